@@ -0,0 +1,164 @@
+"""
+Build the file system image from data/ before buildfs/uploadfs:
+
+ - html pages get their fragments (%HEADER%, %FOOTER%) and library headers
+   (%VAR_HEADER_...%) inlined, so the web server doesn't process templates
+ - the libraries are bundled into one css and one js file
+ - references to the bundles and the other scripts and stylesheets get the
+   hash of the file's content appended (?v=<hash>), so they can be cached
+   for a long time while the html pages are revalidated on every load
+ - text files are gzipped, the web server sends file.gz with
+   Content-Encoding: gzip when file is requested
+
+The result goes to data_dir (see platformio.ini), data/ stays the source.
+"""
+
+import gzip
+import hashlib
+import os
+import re
+import shutil
+
+Import("env")
+from SCons.Script import COMMAND_LINE_TARGETS
+
+SOURCE_DIR = os.path.join(env.subst("$PROJECT_DIR"), "data")
+OUTPUT_DIR = env.subst("$PROJECT_DATA_DIR")
+
+FS_TARGETS = {"buildfs", "uploadfs", "uploadfsota"}
+
+BUNDLES = {
+    "css/bundle.css": [
+        "css/bootstrap-5.2.3.min.css",
+        "css/fontawesome-6.2.1.min.css",
+        "css/uPlot.min.css",
+    ],
+    "js/vendor.js": [
+        "js/vue.3.2.47.min.js",
+        "js/vue-number-input.min.js",
+        "js/bootstrap.bundle.5.2.3.min.js",
+        "js/uPlot.1.6.24.min.js",
+    ],
+}
+
+# %VAR_HEADER_<name>% placeholders, the bundles are included once in the header
+HEADERS = {
+    "FONTAWESOME": '<link href="/css/bundle.css" rel="stylesheet">',
+    "BOOTSTRAP": "",
+    "BOOTSTRAP_BUNDLE": "",
+    "VUEJS": '<script src="/js/vendor.js"></script>',
+    "VUE_NUMBER_INPUT": "",
+    "UPLOT": "",
+}
+
+GZIP_EXTENSIONS = {".html", ".css", ".js", ".svg", ".json", ".txt"}
+SKIP_DIRS = {"html_fragments"}
+
+PLACEHOLDER = re.compile(r"%([A-Z0-9_]*)%")
+
+# quoted reference to a local script or stylesheet, with or without ?v=...
+ASSET_REFERENCE = re.compile(r"""(['"])/((?:js|css)/[^'"?]+)(\?v=[^'"]*)?\1""")
+
+
+def read(path):
+    with open(path, "rb") as f:
+        return f.read()
+
+
+def write(relpath, content):
+    path = os.path.join(OUTPUT_DIR, relpath)
+    os.makedirs(os.path.dirname(path), exist_ok=True)
+
+    if os.path.splitext(relpath)[1] in GZIP_EXTENSIONS:
+        # mtime=0 keeps the image reproducible
+        with gzip.GzipFile(path + ".gz", "wb", compresslevel=9, mtime=0) as f:
+            f.write(content)
+    else:
+        with open(path, "wb") as f:
+            f.write(content)
+
+
+def content_hash(content):
+    return hashlib.sha1(content).hexdigest()[:8]
+
+
+def add_versions(text, versions, page):
+    """Append the content hash to every reference of a bundle or a file in data/"""
+
+    def replace(match):
+        relpath = match.group(2)
+        source = os.path.join(SOURCE_DIR, relpath)
+
+        if relpath in versions:
+            version = versions[relpath]
+        elif os.path.exists(source):
+            version = content_hash(read(source))
+        else:
+            raise Exception("%s: %s doesn't exist" % (page, relpath))
+
+        return "%s/%s?v=%s%s" % (match.group(1), relpath, version, match.group(1))
+
+    return ASSET_REFERENCE.sub(replace, text)
+
+
+def render(text, headers, page):
+    """Resolve placeholders the way the template processor of the web server did"""
+
+    def replace(match):
+        name = match.group(1)
+
+        if name == "":
+            return "%"
+
+        if name.startswith("VAR_HEADER_"):
+            return headers[name[len("VAR_HEADER_"):]]
+
+        fragment = os.path.join(SOURCE_DIR, "html_fragments", name.lower() + ".html")
+
+        if os.path.exists(fragment):
+            return render(read(fragment).decode("utf-8"), headers, page)
+
+        raise Exception("%s: unknown placeholder %%%s%%" % (page, name))
+
+    return PLACEHOLDER.sub(replace, text)
+
+
+def build_web_assets():
+    if os.path.exists(OUTPUT_DIR):
+        shutil.rmtree(OUTPUT_DIR)
+
+    bundled = set()
+    versions = {}
+
+    for bundle, files in BUNDLES.items():
+        content = b"\n".join(read(os.path.join(SOURCE_DIR, f)) for f in files)
+        versions[bundle] = content_hash(content)
+        bundled.update(files)
+        write(bundle, content)
+
+    for root, dirs, files in os.walk(SOURCE_DIR):
+        dirs[:] = [d for d in dirs if d not in SKIP_DIRS]
+
+        for name in files:
+            relpath = os.path.relpath(os.path.join(root, name), SOURCE_DIR).replace(os.sep, "/")
+
+            if relpath in bundled:
+                continue
+
+            content = read(os.path.join(root, name))
+
+            if relpath.endswith(".html"):
+                content = add_versions(render(content.decode("utf-8"), HEADERS, relpath), versions, relpath).encode("utf-8")
+
+            write(relpath, content)
+
+    total = 0
+
+    for root, dirs, files in os.walk(OUTPUT_DIR):
+        total += sum(os.path.getsize(os.path.join(root, f)) for f in files)
+
+    print("Web assets: %d bytes in %s" % (total, OUTPUT_DIR))
+
+
+if FS_TARGETS & set(COMMAND_LINE_TARGETS):
+    build_web_assets()
@@ -1,20 +1,49 @@
 const appCreatedEvent = new Event('appCreated')
 
+// parameter metadata doesn't change at runtime, it is fetched once, values
+// are only updated if their ETag changed
+let parameterMeta = null
+let parameterValuesETag = null
+
+function fetchParameterMeta() {
+    if (parameterMeta === null) {
+        parameterMeta = fetch("/parameterMeta")
+            .then(response => response.json())
+            .catch(err => {
+                parameterMeta = null
+                throw err
+            })
+    }
+    return parameterMeta
+}
+
 const vueApp = Vue.createApp({
     data() {
         return {
             parameters: [],
             parametersHelpTexts: [],
             isPostingForm: false,
-            showPostSucceeded: false
+            showPostSucceeded: false,
+            autotune: {}
         }
     },
     methods: {
         fetchParameters() {
-            fetch("/parameters")
-                .then(response => response.json())
-                .then(data => {
-                    this.parameters = data.sort((a,b) => a["position"] - b["position"])
+            const headers = parameterValuesETag !== null ? { 'If-None-Match': parameterValuesETag } : {}
+            const values = fetch("/parameterValues", { headers: headers, cache: 'no-store' })
+
+            Promise.all([fetchParameterMeta(), values])
+                .then(([meta, response]) => {
+                    if (response.status == 304) {
+                        return
+                    }
+                    parameterValuesETag = response.headers.get('ETag')
+                    return response.json().then(data => {
+                        this.parameters = meta.map((param, i) => Object.assign({}, param, {
+                            value: data.values[i],
+                            show: data.show[i] == 1
+                        })).sort((a,b) => a["position"] - b["position"])
+                    })
                 })
                 .catch(err => console.log(err.messages))
         },
@@ -56,6 +85,17 @@ const vueApp = Vue.createApp({
                     this.fetchParameters()
                 })
         },
+        fetchAutotune() {
+            fetch("/autotune", { cache: 'no-store' })
+                .then(response => response.json())
+                .then(data => {
+                    this.autotune = data
+                    if (data.state == 'running') {
+                        setTimeout(() => this.fetchAutotune(), 5000)
+                    }
+                })
+                .catch(err => console.log(err.messages))
+        },
         fetchHelpText(paramName) {
             if (!(paramName in this.parametersHelpTexts)) {
                 fetch("/parameterHelp/?param="+paramName)
@@ -80,6 +120,11 @@ const vueApp = Vue.createApp({
     },
     mounted() {
         this.fetchParameters()
+
+        // only the start page shows the autotuning
+        if (document.getElementById('autotune')) {
+            this.fetchAutotune()
+        }
     }
 })
 
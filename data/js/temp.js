@@ -5,8 +5,8 @@ if (document.readyState === 'complete') {
     window.addEventListener('load', getTimeseries)
 }
 
-const maxValues = 600            //max number of data points to keep in memory
-const updateInterval = 1000     //expected ms between updates (from event source with new values)
+const maxValues = 840            //max number of data points to keep in memory (1 h of 15 s values + 10 min of 1 s values)
+const updateInterval = 1000     //ms between live values outside of brews (from the telemetry socket)
 
 var curTempVals = []
 var targetTempVals = []
@@ -20,7 +20,9 @@ var heaterDiv = 'chart-heater'
 let uplotTemp = null;
 let uplotHeater = null;
 
-function addTempData(jsonValue, isSingleValue=false) {
+var timeseriesNext = null        //sequence number following the last history value we got
+
+function addTempData(jsonValue, isSingleValue=false, append=false) {
     // add new value(s) to global data arrays and return in a
     // format that uPlot can use
 
@@ -44,23 +46,24 @@ function addTempData(jsonValue, isSingleValue=false) {
         const curTempKey = "currentTemps"
         const targetTempKey = "targetTemps"
 
-        //set data lists to values from history json
+        //set data lists to values from history, either replacing the
+        //existing lists or appending values we missed while disconnected
         var curTemp = jsonValue[curTempKey]
-        //console.log(curTemp)
-        curTempVals.length = 0  //reset existing list
-        curTempVals.push(...curTemp)
-
         var targetTemp = jsonValue[targetTempKey]
-        //console.log(targetTemp)
-        targetTempVals.length = 0
-        targetTempVals.push(...targetTemp)
-        
-        //create dates for all history values (3 seconds between each value)
-        tempDates.length = 0
-        for (let i=curTempVals.length; i>0; i--) {
-            var date = new Date()
-            date.setSeconds(date.getSeconds()-3*i)
-            tempDates.push(date)
+        var dates = jsonValue["dates"]
+
+        if (!append) {
+            curTempVals.length = 0  //reset existing lists
+            targetTempVals.length = 0
+            tempDates.length = 0
+        }
+
+        for (let i = 0; i < dates.length; i++) {
+            if (tempDates.length > 0 && dates[i] <= tempDates[tempDates.length-1]) continue
+
+            tempDates.push(dates[i])
+            curTempVals.push(curTemp[i])
+            targetTempVals.push(targetTemp[i])
         }
     }
 
@@ -87,7 +90,7 @@ function addTempData(jsonValue, isSingleValue=false) {
     return data
 }
 
-function addHeaterData(jsonValue, isSingleValue=false) {
+function addHeaterData(jsonValue, isSingleValue=false, append=false) {
     if (isSingleValue) {
         const heaterPowerKey = "heaterPower"
 
@@ -100,18 +103,20 @@ function addHeaterData(jsonValue, isSingleValue=false) {
     } else {
         const heaterPowerKey = "heaterPowers"
 
-        //set data lists to values from history json
+        //set data lists to values from history
         var heaterPower = jsonValue[heaterPowerKey]
-        //console.log(heaterPower)
-        heaterPowerVals.length = 0
-        heaterPowerVals.push(...heaterPower)
-        
-        //create dates for all history values (3 seconds between each value)
-        heaterDates.length = 0
-        for (let i=heaterPowerVals.length; i>0; i--) {
-            var date = new Date()
-            date.setSeconds(date.getSeconds()-3*i)
-            heaterDates.push(date)
+        var dates = jsonValue["dates"]
+
+        if (!append) {
+            heaterPowerVals.length = 0
+            heaterDates.length = 0
+        }
+
+        for (let i = 0; i < dates.length; i++) {
+            if (heaterDates.length > 0 && dates[i] <= heaterDates[heaterDates.length-1]) continue
+
+            heaterDates.push(dates[i])
+            heaterPowerVals.push(heaterPower[i])
         }
     }
 
@@ -135,6 +140,19 @@ function addHeaterData(jsonValue, isSingleValue=false) {
     return data
 }
 
+//create dates for history values, the last one is one interval old
+function historyDates(count, interval) {
+    let dates = []
+
+    for (let i = count; i > 0; i--) {
+        var date = new Date()
+        date.setSeconds(date.getSeconds() - interval*i)
+        dates.push(date)
+    }
+
+    return dates
+}
+
 function sliceData(data, start, end) {
     let d = [];
 
@@ -291,13 +309,16 @@ function makeHeaterChart(data) {
 //append single historic values
 function addPlotData(jsonValue) {    
     function addData(data, u) {
-        let isTempZoomed = u.scales.x.min != u.data[0][0] || u.scales.x.max != u.data[0][u.data[0].length-1];        
+        let lastX = u.data[0][u.data[0].length-1]
+        let isTempZoomed = u.scales.x.min != u.data[0][0] || u.scales.x.max != lastX;
         if (isTempZoomed) {
-            let tempXScaleMinMax = [u.scales.x.min, u.scales.x.max]            
+            let tempXScaleMinMax = [u.scales.x.min, u.scales.x.max]
+            //values come faster while brewing, move by the time that passed
+            let shift = data[0][data[0].length-1] - lastX
             //add data but don't autoscale
             u.setData(data, false);
-            // move the zoomed area one value to the right so the window stays the same
-            u.setScale('x', {min: tempXScaleMinMax[0]+1, max: tempXScaleMinMax[1]+1});
+            // move the zoomed area to the right so the window stays the same
+            u.setScale('x', {min: tempXScaleMinMax[0]+shift, max: tempXScaleMinMax[1]+shift});
         } else {
             //add data and autoscale (including new data)
             u.setData(data);
@@ -333,61 +354,172 @@ window.addEventListener("resize", e => {
 });
 
 
-// get initial history data from server
+// decode binary history from /timeseries (see EmbeddedWebserver.h), all
+// values are little endian int16 scaled by the factor in the header
+function parseTimeseries(buffer) {
+    let view = new DataView(buffer)
+
+    if (buffer.byteLength < 16 ||
+        String.fromCharCode(view.getUint8(0), view.getUint8(1), view.getUint8(2), view.getUint8(3)) !== "CCTS" ||
+        view.getUint8(4) !== 2) {
+        return null
+    }
+
+    let channels = view.getUint8(5)
+    let scale = view.getUint16(6, true)
+    let count = view.getUint16(8, true)
+    let interval = view.getUint16(10, true)
+
+    // the server ends the response short if the values were overwritten meanwhile
+    if (buffer.byteLength < 16 + count * channels * 2) {
+        return null
+    }
+
+    let history = {
+        next: view.getUint32(12, true),
+        dates: historyDates(count, interval),
+        currentTemps: new Array(count),
+        targetTemps: new Array(count),
+        heaterPowers: new Array(count),
+    }
+
+    for (let i = 0; i < count; i++) {
+        let offset = 16 + i * channels * 2
+        history.currentTemps[i] = view.getInt16(offset, true) / scale
+        history.targetTemps[i] = view.getInt16(offset + 2, true) / scale
+        history.heaterPowers[i] = view.getInt16(offset + 4, true) / scale
+    }
+
+    return history
+}
+
+function fetchTimeseries(url) {
+    return fetch(url)
+        .then(response => {
+            if (!response.ok) {
+                throw new Error("Timeseries request failed: " + response.status)
+            }
+
+            return response.arrayBuffer()
+        })
+        .then(buffer => {
+            let history = parseTimeseries(buffer)
+
+            if (history === null) {
+                throw new Error("Invalid timeseries data")
+            }
+
+            return history
+        })
+}
+
+// put the older, coarser values in front of the newer ones where they don't overlap
+function mergeTimeseries(older, newer) {
+    let start = newer.dates.length > 0 ? newer.dates[0] : new Date()
+    let n = older.dates.findIndex(date => date >= start)
+
+    if (n < 0) {
+        n = older.dates.length
+    }
+
+    return {
+        next: newer.next,
+        dates: older.dates.slice(0, n).concat(newer.dates),
+        currentTemps: older.currentTemps.slice(0, n).concat(newer.currentTemps),
+        targetTemps: older.targetTemps.slice(0, n).concat(newer.targetTemps),
+        heaterPowers: older.heaterPowers.slice(0, n).concat(newer.heaterPowers),
+    }
+}
+
+// get history data from server, either everything (initial load: the last
+// hour in 15 s resolution and the last 10 min in 1 s resolution) or only the
+// values we missed since the last request (after reconnecting)
 function getTimeseries() {
-    var xhr = new XMLHttpRequest()
-
-    xhr.onload = (e) => {
-        if (xhr.readyState === 4 && xhr.status === 200) {
-            var tempHistory = JSON.parse(xhr.responseText)
-            let tempData = addTempData(tempHistory);
-            let heaterData = addHeaterData(tempHistory);
-            setTimeout(() => {
+    var append = timeseriesNext !== null && uplotTemp !== null && uplotHeater !== null
+    var request
+
+    if (append) {
+        request = fetchTimeseries("/timeseries?since=" + timeseriesNext)
+    } else {
+        request = Promise.all([fetchTimeseries("/timeseries?tier=1"), fetchTimeseries("/timeseries")])
+            .then(([older, newer]) => mergeTimeseries(older, newer))
+    }
+
+    request
+        .then(tempHistory => {
+            timeseriesNext = tempHistory.next
+            let tempData = addTempData(tempHistory, false, append);
+            let heaterData = addHeaterData(tempHistory, false, append);
+
+            if (append) {
+                uplotTemp.setData(tempData)
+                uplotHeater.setData(heaterData)
+            } else {
                 makeTempChart(tempData);
                 makeHeaterChart(heaterData);
-            }, 0);
-        }
+            }
+        })
+        .catch(error => console.log(error))
+}
+
+// decode a binary frame from /ws (see EmbeddedWebserver.h), all values are little endian
+function parseTelemetry(buffer) {
+    let view = new DataView(buffer)
+
+    if (buffer.byteLength < 16 || view.getUint8(0) !== 1) {
+        return null
     }
 
-    xhr.open("GET", "/timeseries", true)
-    xhr.send()
+    return {
+        machineState: view.getUint8(1),
+        timestamp: view.getUint32(2, true),
+        currentTemp: view.getInt16(6, true) / 100,
+        targetTemp: view.getInt16(8, true) / 100,
+        heaterPower: view.getUint16(10, true) / 10,
+        pressure: view.getInt16(12, true) / 100,
+        weight: view.getInt16(14, true) / 10,
+    }
 }
 
-// listen to events to update data from endpoints
-if (!!window.EventSource) {
-    var source = new EventSource('/events')
+// live values, once per second and ten times per second while brewing
+var telemetryDisconnected = false
 
-    source.addEventListener(
-        'open',
-        function (e) {
-            console.log("Event source connected")
-        },
-        false
-    )
-
-    source.addEventListener(
-        'error',
-        function (e) {
-            if (e.target.readyState != EventSource.OPEN) {
-                console.log("Events source disconnected")
-            }
-        },
-        false
-    )
+function connectTelemetry() {
+    var socket = new WebSocket("ws://" + window.location.host + "/ws")
+    socket.binaryType = "arraybuffer"
 
-    source.addEventListener(
-        'new_temps',
-        function (e) {
-            var myObj = JSON.parse(e.data)
-            //console.log("new_temps", e.data)
-            //console.log(myObj)
+    socket.addEventListener('open', function (e) {
+        console.log("Telemetry connected")
+        socket.send("interval=" + updateInterval + " brewInterval=100")
 
-            // add new data to existing for plotting            
-            addPlotData(myObj)
+        // fetch what we missed while we were disconnected
+        if (telemetryDisconnected) {
+            telemetryDisconnected = false
+            getTimeseries()
+        }
+    })
 
-            // update current temp value on index page
-            document.getElementById("varTEMP").innerText = myObj["currentTemp"].toFixed(1)
-        },
-        false
-    )
-}
\ No newline at end of file
+    socket.addEventListener('close', function (e) {
+        console.log("Telemetry disconnected")
+        telemetryDisconnected = true
+        setTimeout(connectTelemetry, 2000)
+    })
+
+    socket.addEventListener('message', function (e) {
+        let values = parseTelemetry(e.data)
+
+        if (values === null) {
+            return
+        }
+
+        // add new data to existing for plotting
+        addPlotData(values)
+
+        // update current temp value on index page
+        document.getElementById("varTEMP").innerText = values.currentTemp.toFixed(1)
+    })
+}
+
+if (!!window.WebSocket) {
+    connectTelemetry()
+}
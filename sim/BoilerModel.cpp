@@ -0,0 +1,71 @@
+/**
+ * @file BoilerModel.cpp
+ *
+ * @brief Lumped thermal model of a single boiler machine
+ *
+ */
+
+#include "BoilerModel.h"
+
+#define WATER_HEAT_CAPACITY 4.186   // J/(g K)
+#define BOILING_POINT 100.0         // °C, steam draw starts above this
+
+/**
+ * @brief Silvia with a 300 ml boiler and a 1000 W heater, the shell heats up
+ *        from 20 °C to the brew setpoint in about 4 min, idle losses at 95 °C
+ *        are about 55 W
+ */
+boiler_params_t boilerDefaults() {
+    boiler_params_t params;
+
+    params.heaterPower = 1000;
+    params.shellCapacity = 700;
+    params.waterCapacity = 300 * WATER_HEAT_CAPACITY;
+    params.shellToWater = 60;
+    params.shellToAmbient = 0.75;
+    params.ambientTemp = 20;
+    params.brewFlow = 2.0;
+    params.steamPower = 600;
+    params.sensorLag = 3.0;
+
+    return params;
+}
+
+BoilerModel::BoilerModel(const boiler_params_t& params) : _params(params) {
+    reset(params.ambientTemp);
+}
+
+void BoilerModel::reset(double temp) {
+    _shellTemp = temp;
+    _waterTemp = temp;
+    _sensorTemp = temp;
+    _heaterEnergy = 0;
+    _brew = false;
+    _steam = false;
+}
+
+/**
+ * @brief Advance the model with explicit Euler steps
+ *
+ * @param dt       - time step in s, well below the smallest time constant (~5 s)
+ * @param heaterOn - fraction of dt the heater was on, 0..1
+ */
+void BoilerModel::step(double dt, double heaterOn) {
+    double heater = _params.heaterPower * heaterOn;
+    double exchange = _params.shellToWater * (_shellTemp - _waterTemp);
+    double loss = _params.shellToAmbient * (_shellTemp - _params.ambientTemp);
+    double draw = 0;
+
+    if (_brew) {
+        draw += _params.brewFlow * WATER_HEAT_CAPACITY * (_waterTemp - _params.ambientTemp);
+    }
+
+    if (_steam && _waterTemp > BOILING_POINT) {
+        draw += _params.steamPower;
+    }
+
+    _shellTemp += dt * (heater - exchange - loss) / _params.shellCapacity;
+    _waterTemp += dt * (exchange - draw) / _params.waterCapacity;
+    _sensorTemp += dt * (_shellTemp - _sensorTemp) / _params.sensorLag;
+    _heaterEnergy += dt * heater;
+}
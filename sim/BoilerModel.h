@@ -0,0 +1,52 @@
+/**
+ * @file BoilerModel.h
+ *
+ * @brief Lumped thermal model of a single boiler machine (Rancilio Silvia
+ *        by default) for the native simulation
+ *
+ */
+
+#pragma once
+
+/**
+ * @brief Model parameters. The heater heats the brass shell, which carries
+ *        the temperature sensor and exchanges heat with the water.
+ */
+struct boiler_params_t {
+    double heaterPower;         // W
+    double shellCapacity;       // J/K, brass and heating element
+    double waterCapacity;       // J/K, boiler water
+    double shellToWater;        // W/K
+    double shellToAmbient;      // W/K, losses of the whole boiler
+    double ambientTemp;         // °C, also the temperature of the inlet water
+    double brewFlow;            // g/s of inlet water replacing the water drawn for a shot
+    double steamPower;          // W drawn from the water at 1 bar while the steam valve is open
+    double sensorLag;           // s, time constant of the sensor and its mounting
+};
+
+boiler_params_t boilerDefaults();
+
+class BoilerModel {
+    public:
+        explicit BoilerModel(const boiler_params_t& params);
+
+        void reset(double temp);
+        void step(double dt, double heaterOn);
+
+        void setBrew(bool on) { _brew = on; }
+        void setSteam(bool on) { _steam = on; }
+
+        double getShellTemp() const { return _shellTemp; }
+        double getWaterTemp() const { return _waterTemp; }
+        double getSensorTemp() const { return _sensorTemp; }
+        double getHeaterEnergy() const { return _heaterEnergy; }
+
+    private:
+        boiler_params_t _params;
+        double _shellTemp;
+        double _waterTemp;
+        double _sensorTemp;
+        double _heaterEnergy;   // J since reset()
+        bool _brew;
+        bool _steam;
+};
@@ -0,0 +1,155 @@
+/**
+ * @file SimMachine.cpp
+ *
+ * @brief Control task of the firmware running against the simulated boiler
+ *
+ * Control.cpp and ISR.cpp are built as they are, the simulated board only
+ * connects them to the boiler model: the sensor reads the lagged shell
+ * temperature, the heater timer interrupt switches the heater pin and the
+ * pump relay starts the water flow. Switches are set through their pins, so
+ * a shot runs through brew() with preinfusion like on the machine.
+ */
+
+#include "SimMachine.h"
+
+#include <Arduino.h>
+#include <driver/timer.h>
+
+#include "ISR.h"
+#include "Storage.h"
+#include "TempHistory.h"
+#include "debugSerial.h"
+#include "defaults.h"
+#include "pinmapping.h"
+#include "simGpio.h"
+
+#define CONTROL_PERIOD 10           // ms, controlTaskPeriod of main.cpp
+#define HISTORY_INTERVAL 1000       // ms, tempHistoryInterval of main.cpp
+
+Scheduler telemetryScheduler("telemetry");
+
+static BoilerModel *boiler = NULL;
+static TempHistory tempHistory;
+static int heaterOnHalfWaves = 0;
+
+/**
+ * @brief Sensor reading the lagged shell temperature of the boiler model
+ */
+class SimTempSensor : public TempSensor {
+    public:
+        int begin() override {
+            poll();
+            return 0;
+        }
+
+        void poll() override {
+            push(boiler->getSensorTemp(), millis());
+        }
+};
+
+static SimTempSensor simTempSensor;
+
+// Hooks of the application, the simulated machine has no network and no standby
+void enterStandbyPowerSave() {}
+void exitStandbyPowerSave() {}
+void triggerMQTTPublish() {}
+
+
+/**
+ * @brief Read the settings and start the control task like setup() does,
+ *      plus the telemetry jobs that touch the stored settings
+ *
+ * @return 0 on success, <0 if the storage couldn't be read
+ */
+int machineSetup(BoilerModel *model) {
+    boiler = model;
+
+    initTimer1();
+
+    if (readSysParamsFromStorage() != 0) {
+        LOG_ERROR("%s(): cannot read settings\n", __func__);
+        return -1;
+    }
+
+    controlSetup(simTempSensor);
+
+    windowStartTime = millis();
+    enableTimer1();
+
+    controlSchedulerSetup();
+
+    telemetryScheduler.addJob("history", []{ tempHistory.add(temperature, setpoint, pidOutput / 10); }, HISTORY_INTERVAL, 4, 500);
+    telemetryScheduler.addJob("storage", []{ storageLoop(); }, 500, 1, 5000);
+
+    return 0;
+}
+
+static void countHeater() {
+    if (simGetPin(PIN_HEATER) == HIGH) heaterOnHalfWaves++;
+}
+
+/**
+ * @brief One control period: run both schedulers, then let the boiler follow
+ *        the heater pin for the half waves of the period
+ */
+void machineStep() {
+    looppid();
+    telemetryScheduler.run();
+
+    const int halfWaves = CONTROL_PERIOD * 1000 / HEATER_STEP_US;
+
+    heaterOnHalfWaves = 0;
+    simTimerRun(CONTROL_PERIOD * 1000, countHeater);
+
+    boiler->setBrew(simGetPin(PIN_PUMP) == relayON);
+    boiler->step(CONTROL_PERIOD / 1000.0, (double)heaterOnHalfWaves / halfWaves);
+    simAdvance(CONTROL_PERIOD * 1000);
+}
+
+void machineBrew(bool on) {
+    simSetPin(PIN_BREWSWITCH, on ? HIGH : LOW);
+}
+
+void machineAutotune(bool on) {
+    autotuneON = on;
+}
+
+void machineSteam(bool on) {
+    simSetPin(PIN_STEAMSWITCH, on ? HIGH : LOW);
+}
+
+void machineSteamValve(bool open) {
+    boiler->setSteam(open);
+}
+
+MachineState machineGetState() {
+    return machineState;
+}
+
+BrewState machineGetBrewState() {
+    return brewcounter;
+}
+
+double machineGetTemperature() {
+    return temperature;
+}
+
+double machineGetSetpoint() {
+    return setpoint;
+}
+
+double machineGetBrewSetpoint() {
+    return brewSetpoint;
+}
+
+double machineGetOutput() {
+    return pidOutput;
+}
+
+const PidAutotune& machineGetAutotune() {
+    return autotune;
+}
+
+const char *machineStateName(MachineState state) {
+    return machinestateEnumToString(state);
+}
@@ -0,0 +1,33 @@
+/**
+ * @file SimMachine.h
+ *
+ * @brief Control task of the firmware running against the simulated boiler
+ *
+ */
+
+#pragma once
+
+#include "BoilerModel.h"
+#include "Control.h"
+#include "PidAutotune.h"
+#include "Scheduler.h"
+
+extern Scheduler telemetryScheduler;
+
+int machineSetup(BoilerModel *boiler);
+void machineStep();
+
+void machineBrew(bool on);
+void machineSteam(bool on);
+void machineSteamValve(bool open);
+void machineAutotune(bool on);
+
+MachineState machineGetState();
+BrewState machineGetBrewState();
+double machineGetTemperature();
+double machineGetSetpoint();
+double machineGetBrewSetpoint();
+double machineGetOutput();
+const PidAutotune& machineGetAutotune();
+
+const char *machineStateName(MachineState state);
@@ -0,0 +1,74 @@
+/**
+ * @file Arduino.h
+ *
+ * @brief Minimal Arduino API for the native build, time comes from the
+ *        simulated clock
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include "simClock.h"
+
+#define PROGMEM
+#define IRAM_ATTR
+#define PGM_P const char *
+#define memcpy_P memcpy
+
+#define HIGH 1
+#define LOW 0
+
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define INPUT_PULLDOWN 0x09
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+inline unsigned long millis() { return (unsigned long)(simMicros() / 1000); }
+inline unsigned long micros() { return (unsigned long)simMicros(); }
+inline void delay(unsigned long ms) { simAdvance((uint64_t)ms * 1000); }
+
+// Pins of the simulated board, see simGpio.h
+void pinMode(uint8_t pin, uint8_t mode);
+int digitalRead(uint8_t pin);
+void digitalWrite(uint8_t pin, uint8_t level);
+
+#ifndef constrain
+    #define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+#endif
+
+using std::min;
+using std::max;
+
+/**
+ * @brief The few String members used by the modules built natively
+ */
+class String {
+    public:
+        String(const char *s = "") : _s(s) {}
+        const char *c_str() const { return _s.c_str(); }
+        unsigned int length() const { return _s.length(); }
+
+    private:
+        std::string _s;
+};
+
+// FreeRTOS, the simulation runs in a single thread
+typedef void *SemaphoreHandle_t;
+typedef void *TaskHandle_t;
+#define portMAX_DELAY 0xFFFFFFFF
+#define pdMS_TO_TICKS(ms) (ms)
+
+inline SemaphoreHandle_t xSemaphoreCreateMutex() { return (SemaphoreHandle_t)1; }
+inline int xSemaphoreTake(SemaphoreHandle_t, uint32_t) { return 1; }
+inline int xSemaphoreGive(SemaphoreHandle_t) { return 1; }
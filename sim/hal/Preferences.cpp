@@ -0,0 +1,101 @@
+/**
+ * @file Preferences.cpp
+ *
+ * @brief In-memory NVS of the native build
+ *
+ */
+
+#include "Preferences.h"
+
+#include <string.h>
+
+static std::map<std::string, std::map<std::string, std::vector<uint8_t> > > namespaces;
+static uint32_t writeCount = 0;
+
+bool Preferences::begin(const char *name, bool readOnly) {
+    if (_ns != NULL) {
+        return false;
+    }
+
+    // like NVS, a read-only open of a namespace that doesn't exist fails
+    if (readOnly && namespaces.find(name) == namespaces.end()) {
+        return false;
+    }
+
+    _ns = &namespaces[name];
+    _readOnly = readOnly;
+
+    return true;
+}
+
+void Preferences::end() {
+    _ns = NULL;
+}
+
+bool Preferences::isKey(const char *key) {
+    return _ns != NULL && _ns->find(key) != _ns->end();
+}
+
+bool Preferences::remove(const char *key) {
+    if (_ns == NULL || _readOnly) {
+        return false;
+    }
+
+    return _ns->erase(key) > 0;
+}
+
+bool Preferences::clear() {
+    if (_ns == NULL || _readOnly) {
+        return false;
+    }
+
+    _ns->clear();
+
+    return true;
+}
+
+size_t Preferences::getBytesLength(const char *key) {
+    if (!isKey(key)) {
+        return 0;
+    }
+
+    return (*_ns)[key].size();
+}
+
+size_t Preferences::getBytes(const char *key, void *buf, size_t maxLen) {
+    size_t len = getBytesLength(key);
+
+    if (len == 0 || buf == NULL || len > maxLen) {
+        return 0;
+    }
+
+    memcpy(buf, (*_ns)[key].data(), len);
+
+    return len;
+}
+
+size_t Preferences::putBytes(const char *key, const void *value, size_t len) {
+    if (_ns == NULL || _readOnly || value == NULL || len == 0) {
+        return 0;
+    }
+
+    const uint8_t *bytes = (const uint8_t *)value;
+    (*_ns)[key].assign(bytes, bytes + len);
+    writeCount++;
+
+    return len;
+}
+
+uint32_t Preferences::getULong(const char *key, uint32_t defaultValue) {
+    uint32_t value;
+
+    return getBytes(key, &value, sizeof(value)) == sizeof(value) ? value : defaultValue;
+}
+
+size_t Preferences::putULong(const char *key, uint32_t value) {
+    return putBytes(key, &value, sizeof(value));
+}
+
+uint32_t Preferences::getWriteCount() {
+    return writeCount;
+}
@@ -0,0 +1,43 @@
+/**
+ * @file Preferences.h
+ *
+ * @brief NVS replacement of the native build, keeps all namespaces in memory
+ *        for the lifetime of the process
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+class Preferences {
+    public:
+        Preferences() : _ns(NULL), _readOnly(false) {}
+
+        bool begin(const char *name, bool readOnly = false);
+        void end();
+
+        bool isKey(const char *key);
+        bool remove(const char *key);
+        bool clear();
+
+        size_t getBytesLength(const char *key);
+        size_t getBytes(const char *key, void *buf, size_t maxLen);
+        size_t putBytes(const char *key, const void *value, size_t len);
+
+        uint32_t getULong(const char *key, uint32_t defaultValue = 0);
+        size_t putULong(const char *key, uint32_t value);
+
+        // number of putBytes() calls of all namespaces, each one is a flash write on the device
+        static uint32_t getWriteCount();
+
+    private:
+        typedef std::map<std::string, std::vector<uint8_t> > nvs_namespace_t;
+
+        nvs_namespace_t *_ns;
+        bool _readOnly;
+};
@@ -0,0 +1,10 @@
+/**
+ * @file WiFiManager.h
+ *
+ * @brief Only needed because debugSerial.h includes it
+ *
+ */
+
+#pragma once
+
+#include <Arduino.h>
@@ -0,0 +1,79 @@
+/**
+ * @file timer.h
+ *
+ * @brief Hardware timers of the native build, the alarms are fired by
+ *        simTimerRun() as the simulated time advances
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_ERR_INVALID_ARG 0x102
+
+#define ESP_INTR_FLAG_IRAM (1 << 10)
+
+typedef enum {
+    TIMER_GROUP_0 = 0,
+    TIMER_GROUP_1 = 1,
+    TIMER_GROUP_MAX,
+} timer_group_t;
+
+typedef enum {
+    TIMER_0 = 0,
+    TIMER_1 = 1,
+    TIMER_MAX,
+} timer_idx_t;
+
+typedef enum {
+    TIMER_COUNT_DOWN = 0,
+    TIMER_COUNT_UP = 1,
+} timer_count_dir_t;
+
+typedef enum {
+    TIMER_PAUSE = 0,
+    TIMER_START = 1,
+} timer_start_t;
+
+typedef enum {
+    TIMER_ALARM_DIS = 0,
+    TIMER_ALARM_EN = 1,
+} timer_alarm_t;
+
+typedef enum {
+    TIMER_INTR_LEVEL = 0,
+} timer_intr_mode_t;
+
+typedef enum {
+    TIMER_AUTORELOAD_DIS = 0,
+    TIMER_AUTORELOAD_EN = 1,
+} timer_autoreload_t;
+
+typedef struct {
+    timer_alarm_t alarm_en;
+    timer_start_t counter_en;
+    timer_intr_mode_t intr_type;
+    timer_count_dir_t counter_dir;
+    timer_autoreload_t auto_reload;
+    uint32_t divider;               // of the 80 MHz APB clock
+} timer_config_t;
+
+typedef bool (*timer_isr_t)(void *);
+
+esp_err_t timer_init(timer_group_t group, timer_idx_t timer, const timer_config_t *config);
+esp_err_t timer_set_counter_value(timer_group_t group, timer_idx_t timer, uint64_t value);
+esp_err_t timer_set_alarm_value(timer_group_t group, timer_idx_t timer, uint64_t value);
+esp_err_t timer_enable_intr(timer_group_t group, timer_idx_t timer);
+esp_err_t timer_isr_callback_add(timer_group_t group, timer_idx_t timer, timer_isr_t isr, void *arg, int flags);
+esp_err_t timer_start(timer_group_t group, timer_idx_t timer);
+esp_err_t timer_pause(timer_group_t group, timer_idx_t timer);
+
+/**
+ * @brief Advance the running timers by us and fire their alarms in order
+ *
+ * @param afterAlarm - called after every alarm interrupt, may be NULL
+ */
+void simTimerRun(uint64_t us, void (*afterAlarm)());
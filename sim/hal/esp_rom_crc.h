@@ -0,0 +1,24 @@
+/**
+ * @file esp_rom_crc.h
+ *
+ * @brief CRC32 as computed by the ESP32 ROM (little endian, same as zlib)
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+inline uint32_t esp_rom_crc32_le(uint32_t crc, uint8_t const *buf, uint32_t len) {
+    crc = ~crc;
+
+    for (uint32_t i = 0; i < len; i++) {
+        crc ^= buf[i];
+
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+
+    return ~crc;
+}
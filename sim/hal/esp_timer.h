@@ -0,0 +1,14 @@
+/**
+ * @file esp_timer.h
+ *
+ * @brief esp_timer_get_time() of the native build. Unlike millis() it runs
+ *        on the host clock, so the scheduler statistics show the real cost
+ *        of the jobs on the host while the simulation time stands still.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+int64_t esp_timer_get_time();
@@ -0,0 +1,14 @@
+/**
+ * @file simClock.h
+ *
+ * @brief Simulated time of the native build, advanced by the simulation
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+uint64_t simMicros();
+void simAdvance(uint64_t us);
+void simReset();
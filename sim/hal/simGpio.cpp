@@ -0,0 +1,51 @@
+/**
+ * @file simGpio.cpp
+ *
+ * @brief Pins and GPIO registers of the native build
+ *
+ */
+
+#include <Arduino.h>
+#include <soc/gpio_struct.h>
+
+#include "simGpio.h"
+
+static int pinLevels[SIM_GPIO_PINS];
+
+gpio_dev_t GPIO = {{0, HIGH}, {0, LOW}, {{32, HIGH}}, {{32, LOW}}};
+
+void simSetPin(uint8_t pin, int level) {
+    if (pin < SIM_GPIO_PINS) {
+        pinLevels[pin] = level;
+    }
+}
+
+int simGetPin(uint8_t pin) {
+    return pin < SIM_GPIO_PINS ? pinLevels[pin] : LOW;
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+    if (mode == INPUT_PULLUP) {
+        simSetPin(pin, HIGH);
+    } else if (mode == INPUT_PULLDOWN) {
+        simSetPin(pin, LOW);
+    }
+}
+
+int digitalRead(uint8_t pin) {
+    return simGetPin(pin);
+}
+
+void digitalWrite(uint8_t pin, uint8_t level) {
+    simSetPin(pin, level);
+}
+
+SimGpioReg& SimGpioReg::operator=(uint32_t mask) {
+    for (int i = 0; i < 32; i++) {
+        if (mask & (1UL << i)) {
+            simSetPin(_base + i, _level);
+        }
+    }
+
+    return *this;
+}
@@ -0,0 +1,23 @@
+/**
+ * @file simGpio.h
+ *
+ * @brief Pins of the native build, the simulation drives the switches and
+ *        follows the relays and the heater through them
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define SIM_GPIO_PINS 40
+
+/**
+ * @brief Set the level of an input pin, e.g. the brew switch
+ */
+void simSetPin(uint8_t pin, int level);
+
+/**
+ * @brief Level of a pin, written by digitalWrite() or the GPIO registers
+ */
+int simGetPin(uint8_t pin);
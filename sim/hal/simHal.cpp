@@ -0,0 +1,101 @@
+/**
+ * @file simHal.cpp
+ *
+ * @brief Clock and logging of the native build
+ *
+ */
+
+#include <Arduino.h>
+#include <esp_timer.h>
+#include <stdarg.h>
+#include <chrono>
+
+#include "debugSerial.h"
+
+static uint64_t simTime = 0;    // us
+static log_level_t logLevel = LOG_LEVEL_WARNING;
+
+uint64_t simMicros() {
+    return simTime;
+}
+
+void simAdvance(uint64_t us) {
+    simTime += us;
+}
+
+void simReset() {
+    simTime = 0;
+}
+
+int64_t esp_timer_get_time() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void logSetup() {}
+
+void logSetLevel(log_level_t level) {
+    logLevel = level;
+}
+
+log_level_t logGetLevel() {
+    return logLevel;
+}
+
+uint32_t logGetDropped() {
+    return 0;
+}
+
+/**
+ * @brief Messages go to stderr with the simulation time, stdout is reserved
+ *        for the results
+ */
+static size_t logWrite(log_level_t level, const char *format, va_list args) {
+    if (level > logLevel) {
+        return 0;
+    }
+
+    fprintf(stderr, "%10.3f ", simTime / 1e6);
+
+    return vfprintf(stderr, format, args);
+}
+
+size_t logPrintf(log_level_t level, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    size_t len = logWrite(level, format, args);
+    va_end(args);
+
+    return len;
+}
+
+size_t debugPrintf(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    size_t len = logWrite(LOG_LEVEL_INFO, format, args);
+    va_end(args);
+
+    return len;
+}
+
+void debugPrint(const char *message) {
+    logPrintf(LOG_LEVEL_INFO, "%s", message);
+}
+
+void debugPrint(const String& message) {
+    debugPrint(message.c_str());
+}
+
+void debugPrintln(const char *message) {
+    logPrintf(LOG_LEVEL_INFO, "%s\n", message);
+}
+
+void debugPrintln(const String& message) {
+    debugPrintln(message.c_str());
+}
+
+void startRemoteSerialServer() {}
+
+void getCurrentTimeString(char *output) {
+    sprintf(output, "%10.3f", simTime / 1e6);
+}
@@ -0,0 +1,148 @@
+/**
+ * @file simTimer.cpp
+ *
+ * @brief Hardware timers of the native build
+ *
+ */
+
+#include <driver/timer.h>
+#include <stddef.h>
+
+struct sim_timer_t {
+    timer_config_t config;
+    uint64_t counter;       // ticks
+    uint64_t alarm;         // ticks
+    uint64_t remainder;     // APB clock cycles not yet counted
+    timer_isr_t isr;
+    void *arg;
+    bool interrupt;
+};
+
+static sim_timer_t timers[TIMER_GROUP_MAX][TIMER_MAX];
+
+static sim_timer_t *getTimer(timer_group_t group, timer_idx_t timer) {
+    if (group < 0 || group >= TIMER_GROUP_MAX || timer < 0 || timer >= TIMER_MAX) {
+        return NULL;
+    }
+
+    return &timers[group][timer];
+}
+
+esp_err_t timer_init(timer_group_t group, timer_idx_t timer, const timer_config_t *config) {
+    sim_timer_t *t = getTimer(group, timer);
+
+    if (t == NULL || config == NULL || config->divider < 2) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    *t = sim_timer_t();
+    t->config = *config;
+
+    return ESP_OK;
+}
+
+esp_err_t timer_set_counter_value(timer_group_t group, timer_idx_t timer, uint64_t value) {
+    sim_timer_t *t = getTimer(group, timer);
+
+    if (t == NULL) return ESP_ERR_INVALID_ARG;
+
+    t->counter = value;
+
+    return ESP_OK;
+}
+
+esp_err_t timer_set_alarm_value(timer_group_t group, timer_idx_t timer, uint64_t value) {
+    sim_timer_t *t = getTimer(group, timer);
+
+    if (t == NULL) return ESP_ERR_INVALID_ARG;
+
+    t->alarm = value;
+
+    return ESP_OK;
+}
+
+esp_err_t timer_enable_intr(timer_group_t group, timer_idx_t timer) {
+    sim_timer_t *t = getTimer(group, timer);
+
+    if (t == NULL) return ESP_ERR_INVALID_ARG;
+
+    t->interrupt = true;
+
+    return ESP_OK;
+}
+
+esp_err_t timer_isr_callback_add(timer_group_t group, timer_idx_t timer, timer_isr_t isr, void *arg, int flags) {
+    sim_timer_t *t = getTimer(group, timer);
+
+    if (t == NULL) return ESP_ERR_INVALID_ARG;
+
+    t->isr = isr;
+    t->arg = arg;
+    (void)flags;
+
+    return ESP_OK;
+}
+
+esp_err_t timer_start(timer_group_t group, timer_idx_t timer) {
+    sim_timer_t *t = getTimer(group, timer);
+
+    if (t == NULL) return ESP_ERR_INVALID_ARG;
+
+    t->config.counter_en = TIMER_START;
+
+    return ESP_OK;
+}
+
+esp_err_t timer_pause(timer_group_t group, timer_idx_t timer) {
+    sim_timer_t *t = getTimer(group, timer);
+
+    if (t == NULL) return ESP_ERR_INVALID_ARG;
+
+    t->config.counter_en = TIMER_PAUSE;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Count up only, that is all the firmware uses
+ */
+void simTimerRun(uint64_t us, void (*afterAlarm)()) {
+    for (int group = 0; group < TIMER_GROUP_MAX; group++) {
+        for (int timer = 0; timer < TIMER_MAX; timer++) {
+            sim_timer_t& t = timers[group][timer];
+
+            if (t.config.counter_en != TIMER_START) continue;
+
+            uint64_t cycles = t.remainder + us * 80;
+            uint64_t ticks = cycles / t.config.divider;
+            t.remainder = cycles % t.config.divider;
+
+            while (t.config.alarm_en == TIMER_ALARM_EN && t.counter + ticks >= t.alarm) {
+                ticks -= t.alarm - t.counter;
+                t.counter = t.alarm;
+
+                if (t.config.auto_reload == TIMER_AUTORELOAD_EN) {
+                    t.counter = 0;
+                } else {
+                    t.config.alarm_en = TIMER_ALARM_DIS;
+                }
+
+                if (t.interrupt && t.isr != NULL) {
+                    t.isr(t.arg);
+                }
+
+                if (afterAlarm != NULL) {
+                    afterAlarm();
+                }
+
+                // the ISR may have paused its own timer
+                if (t.config.counter_en != TIMER_START) {
+                    ticks = 0;
+                    break;
+                }
+            }
+
+            t.counter += ticks;
+        }
+    }
+}
@@ -0,0 +1,37 @@
+/**
+ * @file gpio_struct.h
+ *
+ * @brief GPIO registers of the native build, the set and clear registers
+ *        switch the pins of simGpio.h
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * @brief Write-only set or clear register of 32 pins starting at base
+ */
+class SimGpioReg {
+    public:
+        SimGpioReg(uint8_t base, int level) : _base(base), _level(level) {}
+        SimGpioReg& operator=(uint32_t mask);
+
+    private:
+        uint8_t _base;
+        int _level;
+};
+
+struct SimGpioReg1 {
+    SimGpioReg val;
+};
+
+struct gpio_dev_t {
+    SimGpioReg out_w1ts;
+    SimGpioReg out_w1tc;
+    SimGpioReg1 out1_w1ts;
+    SimGpioReg1 out1_w1tc;
+};
+
+extern gpio_dev_t GPIO;
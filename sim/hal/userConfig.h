@@ -0,0 +1,14 @@
+/**
+ * @file userConfig.h
+ *
+ * @brief The native build uses the sample configuration with a brew switch,
+ *        so shots run through brew() with preinfusion
+ *
+ */
+
+#pragma once
+
+#include "../../src/userConfig_sample.h"
+
+#undef ONLYPID
+#define ONLYPID 0
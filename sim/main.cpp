@@ -0,0 +1,587 @@
+/**
+ * @file main.cpp
+ *
+ * @brief Native simulation: scripted scenarios against the boiler model and
+ *        benchmarks of the control loop
+ *
+ * Usage: pio run -e native && .pio/build/native/program <command> [options]
+ *
+ *   coldstart  heat up from ambient temperature
+ *   shots      warm up, then shots with the brew switch, preinfusion and brew
+ *              time come from the settings. The next shot starts after the
+ *              pause once the temperature is back within the band.
+ *   steam      warm up, switch to steam, open the steam valve once the steam
+ *              setpoint is reached, then cool down to the brew setpoint
+ *   autotune   warm up, then run the PID autotuning and print its result
+ *   bench      cost per control loop stage on the host
+ *
+ * Options set the storage items before the machine starts, like the web
+ * interface would, e.g. --kp 62 --tn 52 --tv 11.5 --imax 55. Run without a
+ * command to get the full list. The exit status is 1 if the machine didn't
+ * reach the temperature a scenario waits for, times of -1 mean it never got
+ * there.
+ */
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <chrono>
+#include <vector>
+
+#include "BoilerModel.h"
+#include "SimMachine.h"
+#include "PeriodicTrigger.h"
+#include "Storage.h"
+#include "debugSerial.h"
+
+#define TRACE_INTERVAL 100      // ms between trace samples
+#define WARMUP_TIME 1200        // s, the machine is heated up this long before shots and steam
+#define SHOT_TIMEOUT 300000     // ms, the brew switch is turned off if brew() didn't finish the shot
+#define READY_TIMEOUT 900       // s, longest wait for the machine to reach a temperature
+#define READY_HOLD 10           // s, the temperature stays within the band this long to count as settled
+
+struct trace_sample_t {
+    unsigned long time;         // ms
+    float temperature;          // sensor
+    float water;
+    float setpoint;
+    float output;
+    uint8_t state;
+};
+
+struct option_t {
+    const char *name;
+    sto_item_id_t item;         // STO_ITEM__LAST_ENUM for options of the simulation
+    double value;
+    bool set;
+    const char *help;
+};
+
+static option_t options[] = {
+    {"setpoint",   STO_ITEM_BREW_SETPOINT,      0, false, "brew setpoint [°C]"},
+    {"steam-setpoint", STO_ITEM_STEAM_SETPOINT, 0, false, "steam setpoint [°C]"},
+    {"kp",         STO_ITEM_PID_KP_REGULAR,     0, false, "Kp, regular phase"},
+    {"tn",         STO_ITEM_PID_TN_REGULAR,     0, false, "Tn [s], regular phase"},
+    {"tv",         STO_ITEM_PID_TV_REGULAR,     0, false, "Tv [s], regular phase"},
+    {"imax",       STO_ITEM_PID_I_MAX_REGULAR,  0, false, "integrator limit, regular phase"},
+    {"ponm",       STO_ITEM_PID_START_PONM,     0, false, "1 = separate PonM PID for the cold start"},
+    {"start-kp",   STO_ITEM_PID_KP_START,       0, false, "Kp, cold start phase (PonM)"},
+    {"start-tn",   STO_ITEM_PID_TN_START,       0, false, "Tn [s], cold start phase (PonM)"},
+    {"bd",         STO_ITEM_USE_BD_PID,         0, false, "1 = separate PID while brewing"},
+    {"bd-kp",      STO_ITEM_PID_KP_BD,          0, false, "Kp, brew phase"},
+    {"bd-tn",      STO_ITEM_PID_TN_BD,          0, false, "Tn [s], brew phase"},
+    {"bd-tv",      STO_ITEM_PID_TV_BD,          0, false, "Tv [s], brew phase"},
+    {"bd-delay",   STO_ITEM_BREW_PID_DELAY,     0, false, "heater off for this many s at the start of a shot"},
+    {"ff-power",   STO_ITEM_BREW_FF_POWER,      0, false, "heater boost while brewing [%]"},
+    {"ff-start",   STO_ITEM_BREW_FF_START,      0, false, "start of the boost after brew start [s]"},
+    {"ff-time",    STO_ITEM_BREW_FF_TIME,       0, false, "duration of the boost [s]"},
+    {"steam-kp",   STO_ITEM_PID_KP_STEAM,       0, false, "Kp, steam phase"},
+    {"brew-time",  STO_ITEM_BREW_TIME,          0, false, "brew time after the preinfusion [s]"},
+    {"preinfusion", STO_ITEM_PRE_INFUSION_TIME, 0, false, "preinfusion [s], 0 = none"},
+    {"preinfusion-pause", STO_ITEM_PRE_INFUSION_PAUSE, 0, false, "pause after the preinfusion [s]"},
+    {"band",       STO_ITEM__LAST_ENUM,      0.5, false, "settled when within +-band [°C] of the setpoint"},
+    {"duration",   STO_ITEM__LAST_ENUM,     1200, false, "coldstart: simulated time [s]"},
+    {"shots",      STO_ITEM__LAST_ENUM,        3, false, "shots: number of shots"},
+    {"pause",      STO_ITEM__LAST_ENUM,       30, false, "shots: brew switch off at least this long between the shots [s]"},
+    {"steam-time", STO_ITEM__LAST_ENUM,       90, false, "steam: steam valve open for this many s"},
+    {"heater",     STO_ITEM__LAST_ENUM,        0, false, "boiler: heater power [W]"},
+    {"lag",        STO_ITEM__LAST_ENUM,        0, false, "boiler: sensor time constant [s]"},
+    {"flow",       STO_ITEM__LAST_ENUM,        0, false, "boiler: water flow while brewing [g/s]"},
+    {"iterations", STO_ITEM__LAST_ENUM,   100000, false, "bench: calls per stage"},
+};
+
+static std::vector<trace_sample_t> trace;
+static FILE *csv = NULL;
+static BoilerModel *boiler = NULL;
+
+
+static option_t *findOption(const char *name) {
+    for (size_t i = 0; i < sizeof(options) / sizeof(options[0]); i++) {
+        if (strcmp(options[i].name, name) == 0) {
+            return &options[i];
+        }
+    }
+
+    return NULL;
+}
+
+static double getOption(const char *name) {
+    return findOption(name)->value;
+}
+
+static void usage() {
+    printf("usage: program coldstart|shots|steam|autotune|bench [--csv file] [--verbose] [--<option> value ...]\n\n");
+
+    for (size_t i = 0; i < sizeof(options) / sizeof(options[0]); i++) {
+        printf("  --%-16s %s\n", options[i].name, options[i].help);
+    }
+}
+
+
+/**
+ * @brief Run the machine for the given time, recording the trace
+ */
+static void run(double seconds) {
+    unsigned long end = millis() + (unsigned long)(seconds * 1000);
+
+    while (millis() < end) {
+        machineStep();
+
+        if (millis() % TRACE_INTERVAL == 0) {
+            trace_sample_t sample;
+            sample.time = millis();
+            sample.temperature = boiler->getSensorTemp();
+            sample.water = boiler->getWaterTemp();
+            sample.setpoint = machineGetSetpoint();
+            sample.output = machineGetOutput();
+            sample.state = machineGetState();
+            trace.push_back(sample);
+
+            if (csv != NULL) {
+                fprintf(csv, "%.1f,%.3f,%.3f,%.1f,%.1f,%s\n", sample.time / 1000.0, sample.temperature, sample.water,
+                        sample.setpoint, sample.output, machineStateName((MachineState)sample.state));
+            }
+        }
+    }
+}
+
+/**
+ * @brief Index of the first trace sample at or after a time
+ */
+static size_t traceIndex(unsigned long time) {
+    size_t i = 0;
+
+    while (i < trace.size() && trace[i].time < time) i++;
+
+    return i;
+}
+
+/**
+ * @brief Time from start until the temperature stays within the band around
+ *        the target up to end
+ *
+ * @return s, <0 if it didn't settle
+ */
+static double settlingTime(unsigned long start, unsigned long end, double target, double band) {
+    size_t first = traceIndex(start);
+    size_t last = traceIndex(end);
+    unsigned long settled = 0;
+    bool inside = false;
+
+    for (size_t i = first; i < last; i++) {
+        bool within = fabs(trace[i].temperature - target) <= band;
+
+        if (within && !inside) settled = trace[i].time;
+        inside = within;
+    }
+
+    if (!inside || last == first) return -1;
+
+    return (settled - start) / 1000.0;
+}
+
+/**
+ * @brief Largest deviation above (sign 1) or below (sign -1) the target
+ */
+static double maxDeviation(unsigned long start, unsigned long end, double target, int sign) {
+    double deviation = 0;
+
+    for (size_t i = traceIndex(start); i < traceIndex(end); i++) {
+        deviation = max(deviation, sign * (trace[i].temperature - target));
+    }
+
+    return deviation;
+}
+
+static double rmsError(unsigned long start, unsigned long end, double target) {
+    double sum = 0;
+    size_t count = 0;
+
+    for (size_t i = traceIndex(start); i < traceIndex(end); i++) {
+        double error = trace[i].temperature - target;
+        sum += error * error;
+        count++;
+    }
+
+    return count > 0 ? sqrt(sum / count) : 0;
+}
+
+/**
+ * @brief Time from start until the temperature first reaches the target
+ *
+ * @return s, <0 if it never did
+ */
+static double riseTime(unsigned long start, unsigned long end, double target) {
+    for (size_t i = traceIndex(start); i < traceIndex(end); i++) {
+        if (trace[i].temperature >= target) return (trace[i].time - start) / 1000.0;
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Run the machine until the temperature has stayed within the band
+ *        around the target for READY_HOLD
+ *
+ * @return s until the temperature entered the band for good, <0 if that
+ *         didn't happen within READY_TIMEOUT
+ */
+static double waitSettled(double target, double band) {
+    unsigned long start = millis();
+    unsigned long inside = 0;
+
+    while (millis() - start < READY_TIMEOUT * 1000UL) {
+        run(0.1);
+
+        if (fabs(boiler->getSensorTemp() - target) > band) {
+            inside = 0;
+        } else if (inside == 0) {
+            inside = millis();
+        } else if (millis() - inside >= READY_HOLD * 1000UL) {
+            return (inside - start) / 1000.0;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Run the machine until the temperature reaches the target
+ *
+ * @return s until then, <0 if it didn't within READY_TIMEOUT
+ */
+static double waitReached(double target) {
+    unsigned long start = millis();
+
+    while (millis() - start < READY_TIMEOUT * 1000UL) {
+        run(0.1);
+
+        if (boiler->getSensorTemp() >= target) {
+            return (millis() - start) / 1000.0;
+        }
+    }
+
+    return -1;
+}
+
+
+static int coldstartScenario() {
+    double setpoint = machineGetBrewSetpoint();
+    double band = getOption("band");
+    unsigned long end = (unsigned long)(getOption("duration") * 1000);
+
+    run(getOption("duration"));
+
+    printf("coldstart %.1f °C -> %.1f °C, band +-%.2f °C\n", trace.front().temperature, setpoint, band);
+    printf("  rise time          %8.1f s\n", riseTime(0, end, setpoint - band));
+    printf("  settling time      %8.1f s\n", settlingTime(0, end, setpoint, band));
+    printf("  overshoot          %8.2f °C\n", maxDeviation(0, end, setpoint, 1));
+    printf("  rms error last 5 min %6.3f °C\n", rmsError(end > 300000 ? end - 300000 : 0, end, setpoint));
+    printf("  heater energy      %8.1f Wh\n", boiler->getHeaterEnergy() / 3600);
+
+    return settlingTime(0, end, setpoint, band) < 0 ? 1 : 0;
+}
+
+static int shotsScenario() {
+    double setpoint = machineGetBrewSetpoint();
+    double band = getOption("band");
+    double pause = getOption("pause");
+    int count = (int)getOption("shots");
+
+    run(WARMUP_TIME);
+
+    printf("%d shots of %.0f s, at least %.0f s apart, band +-%.2f °C\n", count, totalBrewTime / 1000, pause, band);
+    printf("  shot  water[°C]  drop[°C]  overshoot[°C]  recovery[s]  pause[s]\n");
+
+    for (int shot = 1; shot <= count; shot++) {
+        unsigned long start = millis();
+        double water = boiler->getWaterTemp();
+
+        // brew() runs the pump through preinfusion and brew time, then
+        // waits for the switch to be turned off
+        machineBrew(true);
+        run(1);
+
+        while (machineGetBrewState() != kWaitBrewOff && millis() - start < SHOT_TIMEOUT) {
+            run(0.1);
+        }
+
+        machineBrew(false);
+
+        // like the barista, wait for the machine to be back at the setpoint
+        unsigned long stop = millis();
+        run(pause);
+        bool settled = waitSettled(setpoint, band) >= 0;
+        unsigned long ready = millis();
+
+        if (shot == count) {
+            run(600);
+        }
+
+        unsigned long end = millis();
+        double recovery = settled ? settlingTime(stop, end, setpoint, band) : -1;
+
+        printf("  %4d  %9.2f  %8.2f  %13.2f  %11.1f  %8.1f\n", shot, water, maxDeviation(start, end, setpoint, -1),
+               maxDeviation(stop, end, setpoint, 1), recovery, (ready - stop) / 1000.0);
+
+        if (recovery < 0) {
+            printf("shot %d: not back within +-%.2f °C after %d s\n", shot, band, READY_TIMEOUT);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int steamScenario() {
+    double setpoint = machineGetBrewSetpoint();
+    double band = getOption("band");
+    double steamTime = getOption("steam-time");
+
+    run(WARMUP_TIME);
+
+    unsigned long start = millis();
+
+    machineSteam(true);
+    run(1);
+
+    double steamSetpoint = machineGetSetpoint();
+    double heatUp = waitReached(steamSetpoint - band);
+
+    printf("steam for %.0f s at %.1f °C, back to %.1f °C, band +-%.2f °C\n", steamTime, steamSetpoint, setpoint, band);
+    printf("  heat-up time       %8.1f s\n", heatUp);
+
+    if (heatUp < 0) {
+        printf("  max temperature    %8.2f °C\n", setpoint + maxDeviation(start, millis(), setpoint, 1));
+        printf("steam setpoint not reached after %d s\n", READY_TIMEOUT);
+        return 1;
+    }
+
+    unsigned long open = millis();
+    machineSteamValve(true);
+    run(steamTime);
+    machineSteamValve(false);
+    machineSteam(false);
+
+    unsigned long stop = millis();
+    run(1200);
+    unsigned long end = millis();
+    double recovery = settlingTime(stop, end, setpoint, band);
+
+    printf("  max temperature    %8.2f °C\n", setpoint + maxDeviation(start, end, setpoint, 1));
+    printf("  drop while steaming %7.2f °C\n", maxDeviation(open, stop, steamSetpoint, -1));
+    printf("  undershoot         %8.2f °C\n", maxDeviation(stop, end, setpoint, -1));
+    printf("  recovery time      %8.1f s\n", recovery);
+
+    return recovery < 0 ? 1 : 0;
+}
+
+static int autotuneScenario() {
+    run(WARMUP_TIME);
+
+    unsigned long start = millis();
+
+    machineAutotune(true);
+    run(1);
+
+    while (machineGetState() == kAutotune) {
+        run(1);
+    }
+
+    const PidAutotune& result = machineGetAutotune();
+
+    printf("autotune %s after %.0f s, %u cycles\n", PidAutotune::stateToString(result.getState()),
+           (millis() - start) / 1000.0, result.getCycles());
+
+    if (result.getState() != PidAutotune::kDone) {
+        printf("  %s\n", result.getError());
+        return 1;
+    }
+
+    const autotune_model_t& model = result.getModel();
+    const autotune_tunings_t& tunings = result.getTunings();
+
+    printf("  model: gain %.4f °C/promille, time constant %.1f s, dead time %.1f s, holding output %.0f\n",
+           model.gain, model.timeConstant, model.deadTime, model.holdOutput);
+    printf("  --kp %.1f --tn %.1f --tv %.1f --imax %.0f\n", tunings.kp, tunings.tn, tunings.tv, tunings.iMax);
+    printf("  --start-kp %.1f --start-tn %.1f\n", tunings.startKp, tunings.startTn);
+    printf("  --bd-kp %.1f --bd-tv %.1f\n", tunings.bdKp, tunings.bdTv);
+
+    if (tunings.limited != 0) {
+        printf("  at the maximum, not applicable:");
+
+        for (int i = 0; i < kAutotuneParameterCount; i++) {
+            if (tunings.limited & (1 << i)) {
+                printf(" %s", PidAutotune::parameterName((AutotuneParameter)i));
+            }
+        }
+
+        printf("\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief Host time of a function in ns per call, the simulation clock
+ *        advances by one control period per call
+ */
+template <typename F>
+static double measure(long iterations, F function) {
+    auto start = std::chrono::steady_clock::now();
+
+    for (long i = 0; i < iterations; i++) {
+        simAdvance(10000);
+        function();
+    }
+
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    return std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+}
+
+/**
+ * @brief Cost of every job of both schedulers and of complete scheduler
+ *        passes on the host, after a warm-up so all jobs are in their
+ *        regular state. On the ESP32 the numbers are 20-50 times higher,
+ *        they are meant for comparing changes.
+ */
+static int benchScenario() {
+    long iterations = (long)getOption("iterations");
+    uint32_t writes = Preferences::getWriteCount();
+
+    run(WARMUP_TIME);
+    trace.clear();
+
+    printf("stage                   ns/call\n");
+
+    double jobs = 0;
+    Scheduler *schedulers[] = {&controlScheduler, &telemetryScheduler};
+
+    for (Scheduler *scheduler : schedulers) {
+        for (int i = 0; i < scheduler->getJobCount(); i++) {
+            const scheduler_job_t *job = scheduler->getJob(i);
+            unsigned long period = job->trigger.getInterval();
+            double cost = measure(iterations, job->function);
+
+            // periodic jobs run once per period, amortize over the control periods
+            double perPass = period > 10 ? cost * 10 / period : cost;
+            jobs += perPass;
+
+            printf("  %-9s %-12s %8.1f  (%.1f per pass)\n", scheduler->getName(), job->name, cost, perPass);
+        }
+    }
+
+    double pass = measure(iterations, []{ controlScheduler.run(); telemetryScheduler.run(); });
+    printf("  scheduler pass         %8.1f  (%.1f overhead)\n", pass, pass - jobs);
+
+    double value = 0;
+    printf("  storageGet             %8.1f\n", measure(iterations, [&]{ storageGet(STO_ITEM_PID_KP_REGULAR, value); }));
+    printf("  storageSet             %8.1f\n", measure(iterations, [&]{ storageSet(STO_ITEM_PID_KP_REGULAR, value += 0.1); }));
+    printf("  storageSet + Flush     %8.1f\n", measure(iterations / 100, [&]{ storageSet(STO_ITEM_PID_KP_REGULAR, value += 0.1); storageFlush(); }));
+
+    PeriodicTrigger trigger(1000);
+    volatile bool due = false;
+    printf("  PeriodicTrigger        %8.1f\n", measure(iterations, [&]{ due = trigger.check(); }));
+
+    printf("nvs writes              %8lu\n", (unsigned long)(Preferences::getWriteCount() - writes));
+
+    return 0;
+}
+
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        usage();
+        return 1;
+    }
+
+    const char *command = argv[1];
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--verbose") == 0) {
+            logSetLevel(LOG_LEVEL_VERBOSE);
+            continue;
+        }
+
+        if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc) {
+            csv = fopen(argv[++i], "w");
+
+            if (csv == NULL) {
+                fprintf(stderr, "cannot open %s\n", argv[i]);
+                return 1;
+            }
+
+            fprintf(csv, "time,temperature,water,setpoint,output,state\n");
+            continue;
+        }
+
+        option_t *option = strncmp(argv[i], "--", 2) == 0 ? findOption(argv[i] + 2) : NULL;
+
+        if (option == NULL || i + 1 >= argc) {
+            usage();
+            return 1;
+        }
+
+        option->value = atof(argv[++i]);
+        option->set = true;
+    }
+
+    boiler_params_t params = boilerDefaults();
+
+    if (findOption("heater")->set) params.heaterPower = getOption("heater");
+    if (findOption("lag")->set) params.sensorLag = getOption("lag");
+    if (findOption("flow")->set) params.brewFlow = getOption("flow");
+
+    BoilerModel model(params);
+    boiler = &model;
+
+    if (storageSetup() != 0) {
+        fprintf(stderr, "storage setup failed\n");
+        return 1;
+    }
+
+    // the simulated machine is switched on
+    storageSet(STO_ITEM_PID_ON, (uint8_t)1);
+
+    for (size_t i = 0; i < sizeof(options) / sizeof(options[0]); i++) {
+        if (options[i].set && options[i].item != STO_ITEM__LAST_ENUM) {
+            // the PonM and BD switches are uint8_t items
+            if (options[i].item == STO_ITEM_PID_START_PONM || options[i].item == STO_ITEM_USE_BD_PID) {
+                storageSet(options[i].item, (uint8_t)options[i].value);
+            } else {
+                storageSet(options[i].item, options[i].value);
+            }
+        }
+    }
+
+    storageFlush();
+
+    if (machineSetup(boiler) != 0) {
+        return 1;
+    }
+
+    int result;
+
+    if (strcmp(command, "coldstart") == 0) {
+        result = coldstartScenario();
+    } else if (strcmp(command, "shots") == 0) {
+        result = shotsScenario();
+    } else if (strcmp(command, "steam") == 0) {
+        result = steamScenario();
+    } else if (strcmp(command, "autotune") == 0) {
+        result = autotuneScenario();
+    } else if (strcmp(command, "bench") == 0) {
+        result = benchScenario();
+    } else {
+        usage();
+        return 1;
+    }
+
+    if (csv != NULL) {
+        fclose(csv);
+    }
+
+    return result;
+}
@@ -0,0 +1,1506 @@
+/**
+ * @file Control.cpp
+ *
+ * @brief Temperature control of the control task: machine states, PID phases,
+ *        brew and backflush and the system parameters. Built into the
+ *        firmware and into the native simulation, so the hardware is only
+ *        reached through the Arduino pin API, the TempSensor and the heater ISR.
+ */
+
+#include "Control.h"
+
+#include "ISR.h"
+#include "Storage.h"
+#include "debugSerial.h"
+#include "defaults.h"
+#include "pinmapping.h"
+
+MACHINE machine = (enum MACHINE)MACHINEID;
+
+PeriodicTrigger logbrew(500);
+
+MachineState machineState = kInit;
+int machinestatecold = 0;
+unsigned long machinestatecoldmillis = 0;
+MachineState lastmachinestate = kInit;
+int lastmachinestatepid = -1;
+
+int offlineMode = 0;
+const int triggerType = TRIGGERTYPE;
+
+// Backflush values
+const unsigned long fillTime = FILLTIME;
+const unsigned long flushTime = FLUSHTIME;
+int maxflushCycles = MAXFLUSHCYCLES;
+
+// Voltage Sensor
+unsigned long previousMillisVoltagesensorreading = millis();
+const unsigned long intervalVoltagesensor = 200;
+int VoltageSensorON, VoltageSensorOFF;
+
+// QuickMill thermoblock steam-mode (only for BREWDETECTION = 3)
+const int maxBrewDurationForSteamModeQM_ON = 200;   // if brewtime is shorter steam-mode starts
+const int minPVSOffTimedForSteamModeQM_OFF = 1500;  // if PVS-off-time is longer steam-mode ends
+unsigned long timePVStoON = 0;      // time pinvoltagesensor switched to ON
+unsigned long lastTimePVSwasON = 0; // last time pinvoltagesensor was ON
+bool steamQM_active = false;        // steam-mode is active
+bool brewSteamDetectedQM = false;   // brew/steam detected, not sure yet what it is
+bool coolingFlushDetectedQM = false;
+
+// system parameters
+uint8_t wifiCredentialsSaved = 0;
+uint8_t pidON = 0;                 // 1 = control loop in closed loop
+double brewSetpoint = SETPOINT;
+double brewTempOffset = TEMPOFFSET;
+double setpoint = brewSetpoint;
+double steamSetpoint = STEAMSETPOINT;
+uint8_t usePonM = 0;               // 1 = use PonM for cold start PID, 0 = use normal PID for cold start
+double steamKp = STEAMKP;
+double startKp = STARTKP;
+double startTn = STARTTN;
+double aggKp = AGGKP;
+double aggTn = AGGTN;
+double aggTv = AGGTV;
+double aggIMax = AGGIMAX;
+double brewtime = BREW_TIME;                        // brewtime in s
+double preinfusion = PRE_INFUSION_TIME;             // preinfusion time in s
+double preinfusionpause = PRE_INFUSION_PAUSE_TIME;  // preinfusion pause time in s
+double weightSetpoint = SCALE_WEIGHTSETPOINT;
+
+// PID - values for offline brew detection
+uint8_t useBDPID = 0;
+double aggbKp = AGGBKP;
+double aggbTn = AGGBTN;
+double aggbTv = AGGBTV;
+
+#if aggbTn == 0
+    double aggbKi = 0;
+#else
+    double aggbKi = aggbKp / aggbTn;
+#endif
+
+double aggbKd = aggbTv * aggbKp;
+double brewtimesoftware = BREW_SW_TIME;  // use userConfig time until disabling BD PID
+double brewSensitivity = BD_SENSITIVITY;  // use userConfig brew detection sensitivity
+double brewPIDDelay = BREW_PID_DELAY;      // use userConfig brew detection PID delay
+double brewFFPower = BREW_FF_POWER;        // heater boost while brewing (%)
+double brewFFStart = BREW_FF_START;
+double brewFFTime = BREW_FF_TIME;
+double brewFFOutput = 0;                    // current boost added to pidOutput by the heater job (promille)
+
+uint8_t standbyModeOn = 0;
+double standbyModeTime = STANDBY_MODE_TIME;
+
+// system parameter EEPROM storage wrappers (current value as pointer to variable, minimum, maximum, optional storage ID)
+SysPara<uint8_t> sysParaPidOn(&pidON, 0, 1, STO_ITEM_PID_ON);
+SysPara<uint8_t> sysParaUsePonM(&usePonM, 0, 1, STO_ITEM_PID_START_PONM);
+SysPara<double> sysParaPidKpStart(&startKp, PID_KP_START_MIN, PID_KP_START_MAX, STO_ITEM_PID_KP_START);
+SysPara<double> sysParaPidTnStart(&startTn, PID_TN_START_MIN, PID_TN_START_MAX, STO_ITEM_PID_TN_START);
+SysPara<double> sysParaPidKpReg(&aggKp, PID_KP_REGULAR_MIN, PID_KP_REGULAR_MAX, STO_ITEM_PID_KP_REGULAR);
+SysPara<double> sysParaPidTnReg(&aggTn, PID_TN_REGULAR_MIN, PID_TN_REGULAR_MAX, STO_ITEM_PID_TN_REGULAR);
+SysPara<double> sysParaPidTvReg(&aggTv, PID_TV_REGULAR_MIN, PID_TV_REGULAR_MAX, STO_ITEM_PID_TV_REGULAR);
+SysPara<double> sysParaPidIMaxReg(&aggIMax, PID_I_MAX_REGULAR_MIN, PID_I_MAX_REGULAR_MAX, STO_ITEM_PID_I_MAX_REGULAR);
+SysPara<double> sysParaPidKpBd(&aggbKp, PID_KP_BD_MIN, PID_KP_BD_MAX, STO_ITEM_PID_KP_BD);
+SysPara<double> sysParaPidTnBd(&aggbTn, PID_TN_BD_MIN, PID_KP_BD_MAX, STO_ITEM_PID_TN_BD);
+SysPara<double> sysParaPidTvBd(&aggbTv, PID_TV_BD_MIN, PID_TV_BD_MAX, STO_ITEM_PID_TV_BD);
+SysPara<double> sysParaBrewSetpoint(&brewSetpoint, BREW_SETPOINT_MIN, BREW_SETPOINT_MAX, STO_ITEM_BREW_SETPOINT);
+SysPara<double> sysParaTempOffset(&brewTempOffset, BREW_TEMP_OFFSET_MIN, BREW_TEMP_OFFSET_MAX, STO_ITEM_BREW_TEMP_OFFSET);
+SysPara<double> sysParaBrewPIDDelay(&brewPIDDelay, BREW_PID_DELAY_MIN, BREW_PID_DELAY_MAX, STO_ITEM_BREW_PID_DELAY);
+SysPara<uint8_t> sysParaUseBDPID(&useBDPID, 0, 1, STO_ITEM_USE_BD_PID);
+SysPara<double> sysParaBrewTime(&brewtime, BREW_TIME_MIN, BREW_TIME_MAX, STO_ITEM_BREW_TIME);
+SysPara<double> sysParaBrewSwTime(&brewtimesoftware, BREW_SW_TIME_MIN, BREW_SW_TIME_MAX, STO_ITEM_BREW_SW_TIME);
+SysPara<double> sysParaBrewThresh(&brewSensitivity, BD_THRESHOLD_MIN, BD_THRESHOLD_MAX, STO_ITEM_BD_THRESHOLD);
+SysPara<uint8_t> sysParaWifiCredentialsSaved(&wifiCredentialsSaved, WIFI_CREDENTIALS_SAVED_MIN, WIFI_CREDENTIALS_SAVED_MAX, STO_ITEM_WIFI_CREDENTIALS_SAVED);
+SysPara<double> sysParaPreInfTime(&preinfusion, PRE_INFUSION_TIME_MIN, PRE_INFUSION_TIME_MAX, STO_ITEM_PRE_INFUSION_TIME);
+SysPara<double> sysParaPreInfPause(&preinfusionpause, PRE_INFUSION_PAUSE_MIN, PRE_INFUSION_PAUSE_MAX, STO_ITEM_PRE_INFUSION_PAUSE);
+SysPara<double> sysParaPidKpSteam(&steamKp, PID_KP_STEAM_MIN, PID_KP_STEAM_MAX, STO_ITEM_PID_KP_STEAM);
+SysPara<double> sysParaSteamSetpoint(&steamSetpoint, STEAM_SETPOINT_MIN, STEAM_SETPOINT_MAX, STO_ITEM_STEAM_SETPOINT);
+SysPara<double> sysParaWeightSetpoint(&weightSetpoint, WEIGHTSETPOINT_MIN, WEIGHTSETPOINT_MAX, STO_ITEM_WEIGHTSETPOINT);
+SysPara<uint8_t> sysParaStandbyModeOn(&standbyModeOn, 0, 1, STO_ITEM_STANDBY_MODE_ON);
+SysPara<double> sysParaStandbyModeTime(&standbyModeTime, STANDBY_MODE_TIME_MIN, STANDBY_MODE_TIME_MAX, STO_ITEM_STANDBY_MODE_TIME);
+SysPara<double> sysParaBrewFFPower(&brewFFPower, BREW_FF_POWER_MIN, BREW_FF_POWER_MAX, STO_ITEM_BREW_FF_POWER);
+SysPara<double> sysParaBrewFFStart(&brewFFStart, BREW_FF_START_MIN, BREW_FF_START_MAX, STO_ITEM_BREW_FF_START);
+SysPara<double> sysParaBrewFFTime(&brewFFTime, BREW_FF_TIME_MIN, BREW_FF_TIME_MAX, STO_ITEM_BREW_FF_TIME);
+
+// Other variables
+int relayON, relayOFF;           // used for relay trigger type. Do not change!
+boolean coldstart = true;        // true = Rancilio started for first time
+boolean emergencyStop = false;   // Emergency stop if temperature is too high
+double EmergencyStopTemp = 120;  // Temp EmergencyStopTemp
+boolean brewDetected = 0;
+int backflushON = 0;             // 1 = backflush mode active
+int flushCycles = 0;             // number of active flush cycles
+int backflushState = 10;         // counter for state machine
+int autotuneON = 0;              // 1 = start or run the PID autotuning (kAutotune)
+int autotuneApply = 0;           // 1 = write the tunings of the last autotuning, reset by the control task
+PidAutotune autotune;
+
+// Temperature rate for software brew detection
+const uint16_t tempRateWindow = 15;     // samples, 6 s at intervaltempmes*
+SlopeEstimator<tempRateWindow> tempRate;
+double tempRateAverage = 0;             // temperature rate in °C/s * 1000
+double tempChangeRateAverageMin = 0;
+unsigned long timeBrewDetection = 0;
+int isBrewDetected = 0;                 // flag is set if brew was detected
+bool movingAverageInitialized = false;  // flag set when average filter is initialized, also used for sensor check
+
+// Brewing, 1 = Normal Preinfusion , 2 = Scale & Shottimer = 2
+#include "brewscaleini.h"
+
+// Sensor check
+boolean sensorError = false;
+int error = 0;
+int maxErrorCounter = 10;        // depends on intervaltempmes* , define max seconds for invalid data
+
+// PID controller
+const unsigned long intervaltempmestsic = 400;
+const unsigned long intervaltempmesds18b20 = 400;
+int pidMode = 1;    // 1 = Automatic, 0 = Manual
+
+double setpointTemp;
+double previousInput = 0;
+unsigned long temperatureTime = 0;      // millis() when the current temperature was measured
+
+// Variables to hold PID values (Temp input, Heater output)
+double temperature, pidOutput;
+int steamON = 0;
+int steamFirstON = 0;
+
+#if startTn == 0
+    double startKi = 0;
+#else
+    double startKi = startKp / startTn;
+#endif
+
+#if aggTn == 0
+    double aggKi = 0;
+#else
+    double aggKi = aggKp / aggTn;
+#endif
+
+double aggKd = aggTv * aggKp;
+
+PID bPID(&temperature, &pidOutput, &setpoint, aggKp, aggKi, aggKd, 1, DIRECT);
+
+// Standby timer
+unsigned long standbyModeStartTimeMillis = millis();
+unsigned long standbyModeRemainingTimeMillis = standbyModeTime * 60 * 1000;
+unsigned long lastStandbyTimeMillis = standbyModeStartTimeMillis;
+
+// Jobs of the control task, see controlSchedulerSetup()
+Scheduler controlScheduler("control");
+int temperatureJob = -1;
+
+static TempSensor *tempSensor = NULL;
+static SemaphoreHandle_t controlMutex = NULL;   // see controlLock()
+
+// Emergency stop if temp is too high
+void testEmergencyStop() {
+    if (temperature > EmergencyStopTemp && emergencyStop == false) {
+        emergencyStop = true;
+    } else if (temperature < (brewSetpoint+5) && emergencyStop == true) {
+        emergencyStop = false;
+    }
+}
+
+/**
+ * @brief Temperature rate for software brew detection, least squares slope
+ *      over the last tempRateWindow samples, scaled like the former moving
+ *      average of the change rates so brewSensitivity keeps its meaning
+ */
+void updateTemperatureRate() {
+    tempRateAverage = tempRate.add(temperatureTime, temperature) * 1000;
+
+    if (brewDetectionMode == 1 && !movingAverageInitialized) {
+        movingAverageInitialized = true;
+    }
+
+    if (tempRateAverage < tempChangeRateAverageMin) {
+        tempChangeRateAverageMin = tempRateAverage;
+    }
+}
+
+/**
+ * @brief check sensor value.
+ * @return If < 0 or difference between old and new >25, then increase error.
+ *      If error is equal to maxErrorCounter, then set sensorError
+ */
+boolean checkSensor(float tempInput) {
+    boolean sensorOK = false;
+    boolean badCondition = (tempInput < 0 || tempInput > 150 || fabs(tempInput - previousInput) > (5+brewTempOffset));
+
+    if (badCondition && !sensorError) {
+        error++;
+        sensorOK = false;
+
+        LOG_WARNING(
+            "*** WARNING: temperature sensor reading: consec_errors = %i, temp_current = %.1f, temp_prev = %.1f\n",
+            error, tempInput, previousInput);
+    } else if (badCondition == false && sensorOK == false) {
+        error = 0;
+        sensorOK = true;
+    }
+
+    if (error >= maxErrorCounter && !sensorError) {
+        sensorError = true;
+        LOG_ERROR(
+            "*** ERROR: temperature sensor malfunction: temp_current = %.1f\n",
+            tempInput);
+    } else if (error == 0 && sensorError) {
+        sensorError = false;
+    }
+
+    return sensorOK;
+}
+
+/**
+ * @brief Refresh temperature, called by the control scheduler every intervaltempmes* ms.
+ *      Each time checkSensor() is called to verify the value.
+ *      If the value is not valid, new data is not stored.
+ */
+void refreshTemp() {
+    temp_sample_t sample;
+    bool updated = false;
+
+    tempSensor->poll();
+
+    // normally there is at most one, the sensor is polled at its sample rate
+    while (tempSensor->getSample(sample)) {
+        updated = true;
+    }
+
+    if (!updated) {
+        return;
+    }
+
+    previousInput = temperature;
+    temperature = sample.temperature;
+    temperatureTime = sample.time;
+
+    if (machineState != kSteam) {
+        temperature -= brewTempOffset;
+    }
+
+    if (!checkSensor(temperature) && movingAverageInitialized) {
+        temperature = previousInput;
+        return; // if sensor data is not valid, abort function; Sensor must
+                // be read at least one time at system startup
+    }
+
+    if (brewDetectionMode == 1) {
+        updateTemperatureRate();
+    } else if (!movingAverageInitialized) {
+        movingAverageInitialized = true;
+    }
+}
+
+
+#include "brewvoid.h"
+#include "powerswitchvoid.h"
+
+/**
+ * @brief detect if a brew is running
+ */
+void brewDetection() {
+    if (brewDetectionMode == 1 && brewSensitivity == 0) return;  // abort brewdetection if deactivated
+
+    // Brew detection: 1 = software solution, 2 = hardware, 3 = voltage sensor
+    if (brewDetectionMode == 1) {
+        if (isBrewDetected == 1) {
+            timeBrewed = millis() - timeBrewDetection;
+        }
+
+        // deactivate brewtimer after end of brewdetection pid
+        if (millis() - timeBrewDetection > brewtimesoftware * 1000 && isBrewDetected == 1) {
+            isBrewDetected = 0;  // rearm brewDetection
+            timeBrewed = 0;
+        }
+    } else if (brewDetectionMode == 2) {
+        if (millis() - timeBrewDetection > brewtimesoftware * 1000 && isBrewDetected == 1) {
+            isBrewDetected = 0;  // rearm brewDetection
+        }
+    } else if (brewDetectionMode == 3) {
+        // timeBrewed counter
+        if ((digitalRead(PIN_BREWSWITCH) == VoltageSensorON) && brewDetected == 1) {
+            timeBrewed = millis() - startingTime;
+            lastbrewTime = timeBrewed;
+        }
+
+        // OFF: reset brew
+        if ((digitalRead(PIN_BREWSWITCH) == VoltageSensorOFF) && (brewDetected == 1 || coolingFlushDetectedQM == true)) {
+            isBrewDetected = 0;  // rearm brewDetection
+            brewDetected = 0;
+            timePVStoON = timeBrewed;  // for QuickMill
+            timeBrewed = 0;
+            startingTime = 0;
+            coolingFlushDetectedQM = false;
+            debugPrintln("HW Brew - Voltage Sensor - End");
+        }
+    }
+
+    // Activate brew detection
+    if (brewDetectionMode == 1) {  // SW BD
+        // BD PID only +/- 4 °C, no detection if HW was active
+        if (tempRateAverage <= -brewSensitivity && isBrewDetected == 0 && (fabs(temperature - brewSetpoint) < 5)) {
+            debugPrintln("SW Brew detected");
+            timeBrewDetection = millis();
+            isBrewDetected = 1;
+        }
+    } else if (brewDetectionMode == 2) {  // HW BD
+        if (brewcounter > kBrewIdle && brewDetected == 0) {
+            debugPrintln("HW Brew detected");
+            timeBrewDetection = millis();
+            isBrewDetected = 1;
+            brewDetected = 1;
+        }
+    } else if (brewDetectionMode == 3) {  // voltage sensor
+        switch (machine) {
+            case QuickMill:
+                if (!coolingFlushDetectedQM) {
+                    int pvs = digitalRead(PIN_BREWSWITCH);
+
+                    if (pvs == VoltageSensorON && brewDetected == 0 &&
+                        brewSteamDetectedQM == 0 && !steamQM_active) {
+                        timeBrewDetection = millis();
+                        timePVStoON = millis();
+                        isBrewDetected = 1;
+                        brewDetected = 0;
+                        lastbrewTime = 0;
+                        brewSteamDetectedQM = 1;
+                        debugPrintln("Quick Mill: setting brewSteamDetectedQM = 1");
+                        logbrew.reset();
+                    }
+
+                    const unsigned long minBrewDurationForSteamModeQM_ON = 50;
+                    if (brewSteamDetectedQM == 1 && millis()-timePVStoON > minBrewDurationForSteamModeQM_ON) {
+                        if (pvs == VoltageSensorOFF) {
+                            brewSteamDetectedQM = 0;
+
+                            if (millis() - timePVStoON < maxBrewDurationForSteamModeQM_ON) {
+                                debugPrintln("Quick Mill: steam-mode detected");
+                                initSteamQM();
+                            } else {
+                                debugPrintf("*** ERROR: QuickMill: neither brew nor steam\n");
+                            }
+                        } else if (millis() - timePVStoON > maxBrewDurationForSteamModeQM_ON) {
+                            if (temperature < brewSetpoint + 2) {
+                                debugPrintln("Quick Mill: brew-mode detected");
+                                startingTime = timePVStoON;
+                                brewDetected = 1;
+                                brewSteamDetectedQM = 0;
+                            } else {
+                                debugPrintln("Quick Mill: cooling-flush detected");
+                                coolingFlushDetectedQM = true;
+                                brewSteamDetectedQM = 0;
+                            }
+                        }
+                    }
+                }
+                break;
+
+            // no Quickmill:
+            default:
+                previousMillisVoltagesensorreading = millis();
+
+                if (digitalRead(PIN_BREWSWITCH) == VoltageSensorON && brewDetected == 0) {
+                    debugPrintln("HW Brew - Voltage Sensor - Start");
+                    timeBrewDetection = millis();
+                    startingTime = millis();
+                    isBrewDetected = 1;
+                    brewDetected = 1;
+                    lastbrewTime = 0;
+                }
+        }
+    }
+}
+
+
+/**
+ * @brief steamON & Quickmill
+ */
+void checkSteamON() {
+    // check digital GIPO
+    if (digitalRead(PIN_STEAMSWITCH) == HIGH) {
+        steamON = 1;
+    }
+
+    // if activated via web interface then steamFirstON == 1, prevent override
+    if (digitalRead(PIN_STEAMSWITCH) == LOW && steamFirstON == 0) {
+        steamON = 0;
+    }
+
+    // monitor QuickMill thermoblock steam-mode
+    if (machine == QuickMill) {
+        if (steamQM_active == true) {
+            if (checkSteamOffQM() == true) {  // if true: steam-mode can be turned off
+                steamON = 0;
+                steamQM_active = false;
+                lastTimePVSwasON = 0;
+            } else {
+                steamON = 1;
+            }
+        }
+    }
+
+    if (steamON == 1) {
+        setpoint = steamSetpoint;
+    } else if (steamON == 0) {
+        setpoint = brewSetpoint;
+    }
+}
+
+void setEmergencyStopTemp() {
+    if (machineState == kSteam || machineState == kCoolDown) {
+        if (EmergencyStopTemp != 145) EmergencyStopTemp = 145;
+    } else {
+        if (EmergencyStopTemp != 120) EmergencyStopTemp = 120;
+    }
+}
+
+void initSteamQM() {
+    // Initialize monitoring for steam switch off for QuickMill thermoblock
+    lastTimePVSwasON = millis();  // time when pinvoltagesensor changes from ON to OFF
+    steamQM_active = true;
+    timePVStoON = 0;
+    steamON = 1;
+}
+
+boolean checkSteamOffQM() {
+    /* Monitor optocoupler during active steam mode of QuickMill
+     * thermoblock. Once the pinvolagesenor remains OFF for longer than a
+     * pump-pulse time peride the switch is turned off and steam mode finished.
+     */
+    if (digitalRead(PIN_BREWSWITCH) == VoltageSensorON) {
+        lastTimePVSwasON = millis();
+    }
+
+    if ((millis() - lastTimePVSwasON) > minPVSOffTimedForSteamModeQM_OFF) {
+        lastTimePVSwasON = 0;
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Handle the different states of the machine
+ */
+void handleMachineState() {
+    switch (machineState) {
+        case kInit:
+            // Prevent coldstart leave by temperature 222
+            if (temperature < (brewSetpoint - 1) || temperature < 150) {
+                machineState = kColdStart;
+                debugPrintf("%d\n", temperature);
+                debugPrintf("%d\n", machineState);
+
+                // some users have 100 % Output in kInit / KColdstart, reset PID
+                pidMode = 0;
+                bPID.SetMode(pidMode);
+                pidOutput = 0;
+                digitalWrite(PIN_HEATER, LOW);  // Stop heating
+
+                // start PID
+                pidMode = 1;
+                bPID.SetMode(pidMode);
+            }
+
+            if (pidON == 0) {
+                machineState = kPidOffline;
+            }
+
+            if (sensorError) {
+                machineState = kSensorError;
+            }
+            break;
+
+        case kColdStart:
+            /* One high temperature let the state jump to 19.
+            * switch (machinestatecold) prevent it, we wait 10 sec with new state.
+            * during the 10 sec the temperature has to be temperature >= (BrewSetpoint-1),
+            * If not, reset machinestatecold
+            */
+            switch (machinestatecold) {
+                case 0:
+                    if (temperature >= (brewSetpoint - 1) && temperature < 150) {
+                        machinestatecoldmillis = millis();  // get millis for interval calc
+                        machinestatecold = 10;              // new state
+                        debugPrintln(
+                            "temperature >= (BrewSetpoint-1), wait 10 sec before machineState BelowSetpoint");
+                    }
+                    break;
+
+                case 10:
+                    if (temperature < (brewSetpoint - 1)) {
+                        machinestatecold = 0;  //  temperature was only one time above
+                                               //  BrewSetpoint, reset machinestatecold
+                        debugPrintln("Reset timer for machineState BelowSetpoint: temperature < (BrewSetpoint-1)");
+
+                        break;
+                    }
+
+                    // 10 sec temperature above BrewSetpoint, no set new state
+                    if (machinestatecoldmillis + 10 * 1000 < millis()) {
+                        machineState = kBelowSetpoint;
+                        debugPrintln("5 sec temperature >= (BrewSetpoint-1) finished, switch to state BelowSetpoint");
+                    }
+                    break;
+            }
+
+            if ((timeBrewed > 0 && ONLYPID == 1) ||  // timeBrewed with Only PID
+                (ONLYPID == 0 && brewcounter > kBrewIdle && brewcounter <= kBrewFinished))
+            {
+                machineState = kBrew;
+
+                if (standbyModeOn) {
+                    resetStandbyTimer();
+                } 
+            }
+
+            if (steamON == 1) {
+                machineState = kSteam;
+
+                if (standbyModeOn) {
+                    resetStandbyTimer();
+                } 
+            }
+
+            if (backflushON || backflushState > 10) {
+                machineState = kBackflush;
+
+                if (standbyModeOn) {
+                    resetStandbyTimer();
+                } 
+            }
+
+            if (standbyModeOn && standbyModeRemainingTimeMillis == 0) {
+                machineState = kStandby;
+                pidON = 0;
+            }
+
+            if (pidON == 0 && machineState != kStandby) {
+                machineState = kPidOffline;
+            }
+
+            if (sensorError) {
+                machineState = kSensorError;
+            }
+
+            break;
+
+        // Setpoint is below current temperature
+        case kBelowSetpoint:
+            brewDetection();
+
+            if (temperature >= (brewSetpoint)) {
+                machineState = kPidNormal;
+            }
+
+            if (autotuneON) {
+                machineState = kAutotune;
+            }
+
+            if ((timeBrewed > 0 && ONLYPID == 1) ||  // timeBrewed with Only PID
+                (ONLYPID == 0 && brewcounter > kBrewIdle && brewcounter <= kBrewFinished))
+            {
+                machineState = kBrew;
+
+                if (standbyModeOn) {
+                    resetStandbyTimer();
+                } 
+            }
+
+            if (backflushON || backflushState > 10) {
+                machineState = kBackflush;
+
+                if (standbyModeOn) {
+                    resetStandbyTimer();
+                } 
+            }
+
+            if (steamON == 1) {
+                machineState = kSteam;
+
+                if (standbyModeOn) {
+                    resetStandbyTimer();
+                } 
+            }
+
+            if (standbyModeOn && standbyModeRemainingTimeMillis == 0) {
+                machineState = kStandby;
+                pidON = 0;
+            }
+
+            if (pidON == 0 && machineState != kStandby) {
+                machineState = kPidOffline;
+            }
+
+            if (sensorError) {
+                machineState = kSensorError;
+            }
+
+            break;
+
+        case kPidNormal:
+            brewDetection();     // if brew detected, set BD PID values (if enabled)
+
+            if (autotuneON) {
+                machineState = kAutotune;
+            }
+
+            if ((timeBrewed > 0 && ONLYPID == 1) ||  // timeBrewed with Only PID
+                (ONLYPID == 0 && brewcounter > kBrewIdle && brewcounter <= kBrewFinished))
+            {
+                machineState = kBrew;
+            }
+
+            if (steamON == 1) {
+                machineState = kSteam;
+
+                if (standbyModeOn) {
+                    resetStandbyTimer();
+                } 
+            }
+
+            if (backflushON || backflushState > 10) {
+                machineState = kBackflush;
+
+                if (standbyModeOn) {
+                    resetStandbyTimer();
+                } 
+            }
+
+            if (emergencyStop) {
+                machineState = kEmergencyStop;
+            }
+             
+            if (standbyModeOn && standbyModeRemainingTimeMillis == 0) {
+                machineState = kStandby;
+                pidON = 0;
+            }
+
+            if (pidON == 0 && machineState != kStandby) {
+                machineState = kPidOffline;
+            }
+
+            if (sensorError) {
+                machineState = kSensorError;
+            }
+            break;
+
+        case kBrew:
+            brewDetection();
+
+            // Output brew time, temp and tempRateAverage during brew (used for SW BD only)
+            if (BREWDETECTION == 1 && logbrew.check()) {
+                LOG_DEBUG("(tB,T,hra) --> %5.2f %6.2f %8.2f\n",
+                          (double)(millis() - startingTime) / 1000, temperature, tempRateAverage);
+            }
+
+            if ((timeBrewed == 0 && brewDetectionMode == 3 && ONLYPID == 1) || // OnlyPID+: Voltage sensor BD timeBrewed == 0 -> switch is off again
+                ((brewcounter == kBrewIdle || brewcounter == kWaitBrewOff) && ONLYPID == 0)) // Hardware BD
+            {
+                // delay shot timer display for voltage sensor or hw brew toggle switch (brew counter)
+                machineState = kShotTimerAfterBrew;
+                lastbrewTimeMillis = millis();  // for delay
+            } else if (brewDetectionMode == 1 && ONLYPID == 1 && isBrewDetected == 0) {   // SW BD, kBrew was active for set time
+                // when Software brew is finished, direct to PID BD
+                machineState = kBrewDetectionTrailing;
+            }
+
+            if (steamON == 1) {
+                machineState = kSteam;
+            }
+
+            if (emergencyStop) {
+                machineState = kEmergencyStop;
+            }
+
+            if (pidON == 0) {
+                machineState = kPidOffline;
+            }
+
+            if (sensorError) {
+                machineState = kSensorError;
+            }
+            break;
+
+        case kShotTimerAfterBrew:
+            brewDetection();
+
+            if (millis() - lastbrewTimeMillis > BREWSWITCHDELAY) {
+                debugPrintf("Shot time: %4.1f s\n", lastbrewTime / 1000);
+                machineState = kBrewDetectionTrailing;
+                lastbrewTime = 0;
+            }
+
+            if (steamON == 1) {
+                machineState = kSteam;
+            }
+
+            if (backflushON || backflushState > 10) {
+                machineState = kBackflush;
+            }
+
+            if (emergencyStop) {
+                machineState = kEmergencyStop;
+            }
+
+            if (pidON == 0) {
+                machineState = kPidOffline;
+            }
+
+            if (sensorError) {
+                machineState = kSensorError;
+            }
+            break;
+
+        case kBrewDetectionTrailing:
+            brewDetection();
+
+            if (isBrewDetected == 0) {
+                machineState = kPidNormal;
+            }
+
+            if ((timeBrewed > 0 && ONLYPID == 1 && brewDetectionMode == 3) ||  // Allow brew directly after BD only when using OnlyPID AND hardware brew switch detection
+                (ONLYPID == 0 && brewcounter > kBrewIdle && brewcounter <= kBrewFinished))
+            {
+                machineState = kBrew;
+            }
+
+            if (steamON == 1) {
+                machineState = kSteam;
+            }
+
+            if (backflushON || backflushState > 10) {
+                machineState = kBackflush;
+            }
+
+            if (emergencyStop) {
+                machineState = kEmergencyStop;
+            }
+
+            if (pidON == 0) {
+                machineState = kPidOffline;
+            }
+
+            if (sensorError) {
+                machineState = kSensorError;
+            }
+            break;
+
+        case kSteam:
+            if (steamON == 0) {
+                machineState = kCoolDown;
+            }
+
+            if (emergencyStop) {
+                machineState = kEmergencyStop;
+            }
+
+            if (backflushON || backflushState > 10) {
+                machineState = kBackflush;
+            }
+
+            if (pidON == 0) {
+                machineState = kPidOffline;
+            }
+
+            if (sensorError) {
+                machineState = kSensorError;
+            }
+            break;
+
+        case kCoolDown:
+            if (brewDetectionMode == 2 || brewDetectionMode == 3) {
+                /* For quickmill: steam detection only via switch, calling
+                 * brewDetection() detects new steam request
+                 */
+                brewDetection();
+            }
+
+            if (brewDetectionMode == 1 && ONLYPID == 1) {
+                // if machine cooled down to 2°C above setpoint, enabled PID again
+                if (tempRateAverage > 0 && temperature < brewSetpoint + 2) {
+                    machineState = kPidNormal;
+                }
+            }
+
+            if ((brewDetectionMode == 3 || brewDetectionMode == 2) && temperature < brewSetpoint + 2) {
+                machineState = kPidNormal;
+            }
+
+            if (steamON == 1) {
+                machineState = kSteam;
+            }
+
+            if (backflushON || backflushState > 10) {
+                machineState = kBackflush;
+            }
+
+            if (emergencyStop) {
+                machineState = kEmergencyStop;
+            }
+
+            if (pidON == 0) {
+                machineState = kPidOffline;
+            }
+
+            if (sensorError) {
+                machineState = kSensorError;
+            }
+            break;
+
+        case kBackflush:
+            if (backflushON == 0) {
+                machineState = kPidNormal;
+            }
+
+            if (emergencyStop) {
+                machineState = kEmergencyStop;
+            }
+
+            if (pidON == 0) {
+                machineState = kPidOffline;
+            }
+
+            if (sensorError) {
+                machineState = kSensorError;
+            }
+            break;
+
+        case kAutotune:
+            brewDetection();
+
+            if (autotuneON == 0 || autotune.getState() != PidAutotune::kRunning) {
+                autotuneON = 0;
+                machineState = kPidNormal;
+            }
+
+            if ((timeBrewed > 0 && ONLYPID == 1) ||  // timeBrewed with Only PID
+                (ONLYPID == 0 && brewcounter > kBrewIdle && brewcounter <= kBrewFinished))
+            {
+                machineState = kBrew;
+            }
+
+            if (steamON == 1) {
+                machineState = kSteam;
+            }
+
+            if (backflushON || backflushState > 10) {
+                machineState = kBackflush;
+            }
+
+            if (emergencyStop) {
+                machineState = kEmergencyStop;
+            }
+
+            if (pidON == 0) {
+                machineState = kPidOffline;
+            }
+
+            if (sensorError) {
+                machineState = kSensorError;
+            }
+
+            // keep the result of a finished run for applyAutotune()
+            if (machineState != kAutotune) {
+                autotuneON = 0;
+
+                if (autotune.getState() == PidAutotune::kRunning) {
+                    autotune.abort();
+                }
+            }
+            break;
+
+        case kEmergencyStop:
+            if (!emergencyStop) {
+                machineState = kPidNormal;
+            }
+
+            if (pidON == 0) {
+                machineState = kPidOffline;
+            }
+
+            if (sensorError) {
+                machineState = kSensorError;
+            }
+            break;
+
+        case kPidOffline:
+            if (pidON == 1) {
+                if (coldstart) {
+                    machineState = kColdStart;
+                } else if (!coldstart && (temperature > (brewSetpoint - 10))) {  // temperature higher BrewSetpoint-10, normal PID
+                    machineState = kPidNormal;
+                } else if (temperature <= (brewSetpoint - 10)) {
+                    machineState = kColdStart;  // temperature 10C below set point, enter cold start
+                    coldstart = true;
+                }
+            }
+
+            if (sensorError) {
+                machineState = kSensorError;
+            }
+            break;
+        
+        case kStandby:
+            brewDetection();
+            
+            if (pidON || steamON || isBrewDetected) {
+                pidON = 1;
+                resetStandbyTimer();
+
+                if (steamON) {
+                    machineState = kSteam;
+                } else if (isBrewDetected) {
+                    machineState = kBrew;
+                } else {
+                    machineState = kPidNormal;
+                }
+            }
+             
+            if (sensorError) {
+                machineState = kSensorError;
+            }
+            break;
+
+        case kSensorError:
+            machineState = kSensorError;
+            break;
+
+        case kEepromError:
+            machineState = kEepromError;
+            break;
+    }
+
+    if (machineState != lastmachinestate) {
+        if (machineState == kAutotune) {
+            // the relay starts from the current PID output
+            autotune.start(millis(), setpoint, pidOutput, windowSize, windowSize / 1000.0);
+        }
+
+        if (machineState == kStandby) {
+            enterStandbyPowerSave();
+        } else if (lastmachinestate == kStandby) {
+            exitStandbyPowerSave();
+        }
+
+        printMachineState();
+        lastmachinestate = machineState;
+    }
+}
+
+void printMachineState() {
+    debugPrintf("new machineState: %s -> %s\n",
+                machinestateEnumToString(lastmachinestate), machinestateEnumToString(machineState));
+}
+
+char const* machinestateEnumToString(MachineState machineState) {
+    switch (machineState) {
+        case kInit:
+            return "Init";
+        case kColdStart:
+            return "Cold Start";
+        case kBelowSetpoint:
+            return "Set Point Negative";
+        case kPidNormal:
+            return "PID Normal";
+        case kBrew:
+            return "Brew";
+        case kShotTimerAfterBrew:
+            return "Shot Timer After Brew";
+        case kBrewDetectionTrailing:
+            return "Brew Detection Trailing";
+        case kSteam:
+            return "Steam";
+        case kCoolDown:
+            return "Cool Down";
+        case kBackflush:
+            return "Backflush";
+        case kAutotune:
+            return "Autotune";
+        case kEmergencyStop:
+            return "Emergency Stop";
+        case kPidOffline:
+            return "PID Offline";
+        case kStandby:
+            return "Standby Mode";
+        case kSensorError:
+            return "Sensor Error";
+        case kEepromError:
+            return "EEPROM Error";
+    }
+
+    return "Unknown";
+}
+
+
+/**
+ * @brief One cycle of the control task, runs all due control jobs
+ */
+void looppid() {
+    ControlLock lock;
+
+    controlScheduler.run();
+}
+
+void controlLock() {
+    xSemaphoreTake(controlMutex, portMAX_DELAY);
+}
+
+void controlUnlock() {
+    xSemaphoreGive(controlMutex);
+}
+
+
+void computePID() {
+    testEmergencyStop();  // test if temp is too high
+    bPID.Compute();       // the variable pidOutput now has new values from PID (passed to the heater ISR by the heater job)
+}
+
+
+/**
+ * @brief Heater boost while brewing, added on top of the PID output so the heater
+ *      keeps up with the cold water flowing into the boiler instead of waiting
+ *      for the temperature to drop
+ *
+ * @return boost in promille of windowSize, 0 outside of the boost window
+ */
+double brewFeedForward() {
+    if (brewFFPower <= 0 || machineState < kBrew || machineState > kBrewDetectionTrailing) {
+        return 0;
+    }
+
+    if (timeBrewed < brewFFStart * 1000 || timeBrewed >= (brewFFStart + brewFFTime) * 1000) {
+        return 0;
+    }
+
+    return brewFFPower * windowSize / 100;
+}
+
+
+/**
+ * @brief Machine state handling, selects PID mode and tunings for the current state
+ */
+void updateMachineState() {
+    checkSteamON();
+    setEmergencyStopTemp();
+    checkpowerswitch();
+    handleMachineState();
+
+    if (standbyModeOn && machineState != kStandby) {
+        updateStandbyTimer();
+    }
+
+    #if (ONLYPIDSCALE == 1)  // only by shottimer 2, scale
+        shottimerscale();
+    #endif
+
+    // Check if PID should run or not. If not, set to manual and force output to zero
+    if (machineState == kPidOffline || machineState == kSensorError || machineState == kEmergencyStop || machineState == kEepromError || machineState == kStandby || machineState == kAutotune || brewPIDdisabled) {
+        if (pidMode == 1) {
+            // Force PID shutdown
+            pidMode = 0;
+            bPID.SetMode(pidMode);
+            pidOutput = 0;
+            digitalWrite(PIN_HEATER, LOW);  // Stop heating
+        }
+    } else {  // no sensorerror, no pid off or no Emergency Stop
+        if (pidMode == 0) {
+            pidMode = 1;
+            bPID.SetMode(pidMode);
+        }
+    }
+
+    // Set PID if first start of machine detected, and no steamON
+    if ((machineState == kInit || machineState == kColdStart || machineState == kBelowSetpoint)) {
+        if (usePonM) {
+            if (startTn != 0) {
+                startKi = startKp / startTn;
+            } else {
+                startKi = 0;
+            }
+
+            if (lastmachinestatepid != machineState) {
+                debugPrintf("new PID-Values: P=%.1f  I=%.1f  D=%.1f\n", startKp, startKi, 0.0);
+                lastmachinestatepid = machineState;
+            }
+
+            bPID.SetTunings(startKp, startKi, 0, P_ON_M);
+        } else {
+            setNormalPIDTunings();
+        }
+    }
+
+    if (machineState == kPidNormal) {
+        setNormalPIDTunings();
+        coldstart = false;
+    }
+
+    // BD PID
+    if (machineState >= kBrew && machineState <= kBrewDetectionTrailing) {
+        if (brewPIDDelay > 0 && timeBrewed > 0 && timeBrewed < brewPIDDelay*1000) {
+            //disable PID for brewPIDDelay seconds, enable PID again with new tunings after that
+            if (!brewPIDdisabled) {
+                brewPIDdisabled = true;
+                bPID.SetMode(MANUAL);
+                debugPrintf("disabled PID, waiting for %d seconds before enabling PID again\n", brewPIDDelay);
+            }
+        } else {
+            if (brewPIDdisabled) {
+                //enable PID again
+                bPID.SetMode(AUTOMATIC);
+                brewPIDdisabled = false;
+                debugPrintln("Enabled PID again after delay");
+            }
+
+            if (useBDPID) {
+                setBDPIDTunings();
+            } else {
+                setNormalPIDTunings();
+            }
+        }
+    }
+
+    brewFFOutput = brewFeedForward();
+
+    // the relay experiment drives the heater while the PID is off
+    if (machineState == kAutotune) {
+        pidOutput = autotune.update(millis(), temperature);
+    }
+
+    if (autotuneApply) {
+        applyAutotune();
+        autotuneApply = 0;
+    }
+
+    // Steam on
+    if (machineState == kSteam) {
+        if (lastmachinestatepid != machineState) {
+            debugPrintf("new PID-Values: P=%.1f  I=%.1f  D=%.1f\n", 150.0, 0.0, 0.0);
+            lastmachinestatepid = machineState;
+        }
+
+        bPID.SetTunings(steamKp, 0, 0, 1);
+    }
+
+    // chill-mode after steam
+    if (machineState == kCoolDown) {
+        switch (machine) {
+            case QuickMill:
+                aggbKp = 150;
+                aggbKi = 0;
+                aggbKd = 0;
+                break;
+
+            default:
+                // calc ki, kd
+                if (aggbTn != 0) {
+                    aggbKi = aggbKp / aggbTn;
+                } else {
+                    aggbKi = 0;
+                }
+
+                aggbKd = aggbTv * aggbKp;
+        }
+
+        if (lastmachinestatepid != machineState) {
+            debugPrintf("new PID-Values: P=%.1f  I=%.1f  D=%.1f\n", aggbKp, aggbKi, aggbKd);
+            lastmachinestatepid = machineState;
+        }
+
+        bPID.SetTunings(aggbKp, aggbKi, aggbKd, 1);
+    }
+    // sensor error OR Emergency Stop
+}
+
+
+/**
+ * @brief Apply the tunings of the last successful autotuning and write them to storage
+ *
+ * @return 0 = success, < 0 = no tunings or storage failure
+ */
+int applyAutotune() {
+    if (autotune.getState() != PidAutotune::kDone) {
+        LOG_WARNING("%s(): no autotune result\n", __func__);
+        return -1;
+    }
+
+    const autotune_tunings_t& tunings = autotune.getTunings();
+
+    if (tunings.limited != 0) {
+        LOG_WARNING("%s(): autotune result at the parameter limits, not applied\n", __func__);
+        return -2;
+    }
+
+    if (sysParaPidKpReg.set(tunings.kp) != 0) return -1;
+    if (sysParaPidTnReg.set(tunings.tn) != 0) return -1;
+    if (sysParaPidTvReg.set(tunings.tv) != 0) return -1;
+    if (sysParaPidIMaxReg.set(tunings.iMax) != 0) return -1;
+    if (sysParaPidKpStart.set(tunings.startKp) != 0) return -1;
+    if (sysParaPidTnStart.set(tunings.startTn) != 0) return -1;
+    if (sysParaPidKpBd.set(tunings.bdKp) != 0) return -1;
+    if (sysParaPidTvBd.set(tunings.bdTv) != 0) return -1;
+
+    LOG_INFO("Applied autotune result: Kp=%.1f Tn=%.1f Tv=%.1f\n", aggKp, aggTn, aggTv);
+
+    // applied once, a later apply must not overwrite changes made since
+    autotune.abort();
+
+    triggerMQTTPublish();
+
+    return writeSysParamsToStorage();
+}
+
+void setNormalPIDTunings() {
+    // Prevent overwriting of brewdetection values
+    // calc ki, kd
+    if (aggTn != 0) {
+        aggKi = aggKp / aggTn;
+    } else {
+        aggKi = 0;
+    }
+
+    aggKd = aggTv * aggKp;
+
+    bPID.SetIntegratorLimits(0, aggIMax);
+
+    if (lastmachinestatepid != machineState) {
+        debugPrintf("new PID-Values: P=%.1f  I=%.1f  D=%.1f\n", aggKp, aggKi, aggKd);
+        lastmachinestatepid = machineState;
+    }
+
+    bPID.SetTunings(aggKp, aggKi, aggKd, 1);
+}
+
+void setBDPIDTunings() {
+    // calc ki, kd
+    if (aggbTn != 0) {
+        aggbKi = aggbKp / aggbTn;
+    } else {
+        aggbKi = 0;
+    }
+
+    aggbKd = aggbTv * aggbKp;
+
+    if (lastmachinestatepid != machineState) {
+        debugPrintf("new PID-Values: P=%.1f  I=%.1f  D=%.1f\n", aggbKp, aggbKi, aggbKd);
+        lastmachinestatepid = machineState;
+    }
+
+    bPID.SetTunings(aggbKp, aggbKi, aggbKd, 1);
+}
+
+/**
+ * @brief Reads all system parameter values from non-volatile storage
+ *
+ * @return 0 = success, < 0 = failure
+ */
+int readSysParamsFromStorage(void) {
+    if (sysParaPidOn.getStorage() != 0) return -1;
+    if (sysParaUsePonM.getStorage() != 0) return -1;
+    if (sysParaPidKpStart.getStorage() != 0) return -1;
+    if (sysParaPidTnStart.getStorage() != 0) return -1;
+    if (sysParaPidKpReg.getStorage() != 0) return -1;
+    if (sysParaPidTnReg.getStorage() != 0) return -1;
+    if (sysParaPidTvReg.getStorage() != 0) return -1;
+    if (sysParaPidIMaxReg.getStorage() != 0) return -1;
+    if (sysParaBrewSetpoint.getStorage() != 0) return -1;
+    if (sysParaTempOffset.getStorage() != 0) return -1;
+    if (sysParaBrewPIDDelay.getStorage() != 0) return -1;
+    if (sysParaUseBDPID.getStorage() != 0) return -1;
+    if (sysParaPidKpBd.getStorage() != 0) return -1;
+    if (sysParaPidTnBd.getStorage() != 0) return -1;
+    if (sysParaPidTvBd.getStorage() != 0) return -1;
+    if (sysParaBrewTime.getStorage() != 0) return -1;
+    if (sysParaBrewSwTime.getStorage() != 0) return -1;
+    if (sysParaBrewThresh.getStorage() != 0) return -1;
+    if (sysParaPreInfTime.getStorage() != 0) return -1;
+    if (sysParaPreInfPause.getStorage() != 0) return -1;
+    if (sysParaPidKpSteam.getStorage() != 0) return -1;
+    if (sysParaSteamSetpoint.getStorage() != 0) return -1;
+    if (sysParaWeightSetpoint.getStorage() != 0) return -1;
+    if (sysParaWifiCredentialsSaved.getStorage() != 0) return -1;
+    if (sysParaStandbyModeOn.getStorage() != 0) return -1;
+    if (sysParaStandbyModeTime.getStorage() != 0) return -1;
+    if (sysParaBrewFFPower.getStorage() != 0) return -1;
+    if (sysParaBrewFFStart.getStorage() != 0) return -1;
+    if (sysParaBrewFFTime.getStorage() != 0) return -1;
+
+    return 0;
+}
+
+/**
+ * @brief Writes all current system parameter values to non-volatile storage
+ *
+ * @return 0 = success, < 0 = failure
+ */
+int writeSysParamsToStorage(void) {
+    if (sysParaPidOn.setStorage() != 0) return -1;
+    if (sysParaUsePonM.setStorage() != 0) return -1;
+    if (sysParaPidKpStart.setStorage() != 0) return -1;
+    if (sysParaPidTnStart.setStorage() != 0) return -1;
+    if (sysParaPidKpReg.setStorage() != 0) return -1;
+    if (sysParaPidTnReg.setStorage() != 0) return -1;
+    if (sysParaPidTvReg.setStorage() != 0) return -1;
+    if (sysParaPidIMaxReg.setStorage() != 0) return -1;
+    if (sysParaBrewSetpoint.setStorage() != 0) return -1;
+    if (sysParaTempOffset.setStorage() != 0) return -1;
+    if (sysParaBrewPIDDelay.setStorage() != 0) return -1;
+    if (sysParaUseBDPID.setStorage() != 0) return -1;
+    if (sysParaPidKpBd.setStorage() != 0) return -1;
+    if (sysParaPidTnBd.setStorage() != 0) return -1;
+    if (sysParaPidTvBd.setStorage() != 0) return -1;
+    if (sysParaBrewTime.setStorage() != 0) return -1;
+    if (sysParaBrewSwTime.setStorage() != 0) return -1;
+    if (sysParaBrewThresh.setStorage() != 0) return -1;
+    if (sysParaPreInfTime.setStorage() != 0) return -1;
+    if (sysParaPreInfPause.setStorage() != 0) return -1;
+    if (sysParaPidKpSteam.setStorage() != 0) return -1;
+    if (sysParaSteamSetpoint.setStorage() != 0) return -1;
+    if (sysParaWeightSetpoint.setStorage() != 0) return -1;
+    if (sysParaWifiCredentialsSaved.setStorage() != 0) return -1;
+    if (sysParaStandbyModeOn.setStorage() != 0) return -1;
+    if (sysParaStandbyModeTime.setStorage() != 0) return -1;
+    if (sysParaBrewFFPower.setStorage() != 0) return -1;
+    if (sysParaBrewFFStart.setStorage() != 0) return -1;
+    if (sysParaBrewFFTime.setStorage() != 0) return -1;
+
+    return storageCommit();
+}
+
+
+/**
+ * @brief Performs a factory reset.
+ *
+ * @return 0 = success, < 0 = failure
+ */
+int factoryReset(void) {
+    int stoStatus;
+
+    if ((stoStatus = storageFactoryReset()) != 0)
+        return stoStatus;
+
+    return readSysParamsFromStorage();
+}
+
+
+/**
+ * @brief Update the remaining standby time from the time elapsed since the last reset
+ */
+void updateStandbyTimer(void) {
+    unsigned long currentTime = millis();
+    unsigned long standbyModeTimeMillis = standbyModeTime * 60 * 1000;
+    unsigned long elapsedTime = currentTime - standbyModeStartTimeMillis;
+
+    if (elapsedTime >= standbyModeTimeMillis) {
+        standbyModeRemainingTimeMillis = 0;
+        return;
+    }
+
+    standbyModeRemainingTimeMillis = standbyModeTimeMillis - elapsedTime;
+
+    if (currentTime - lastStandbyTimeMillis >= 60000) {
+        lastStandbyTimeMillis = currentTime;
+        debugPrintf("Standby time remaining: %lu minutes\n", (standbyModeRemainingTimeMillis + 59999) / 60000);
+    }
+}
+
+void resetStandbyTimer(void) {
+    standbyModeRemainingTimeMillis = standbyModeTime * 60 * 1000;
+    standbyModeStartTimeMillis = millis();
+    lastStandbyTimeMillis = standbyModeStartTimeMillis;
+
+    debugPrintf("Resetting standby timer to %i minutes\n",  (int)standbyModeTime);
+}
+
+
+/**
+ * @brief Relay levels, pins, PID and the first temperature reading, called
+ *      by setup() before any control job runs
+ *
+ * @param sensor - temperature sensor, polled by refreshTemp()
+ */
+void controlSetup(TempSensor &sensor) {
+    tempSensor = &sensor;
+    controlMutex = xSemaphoreCreateMutex();
+
+    // Define trigger type
+    if (triggerType) {
+        relayON = HIGH;
+        relayOFF = LOW;
+    } else {
+        relayON = LOW;
+        relayOFF = HIGH;
+    }
+
+    if (VOLTAGESENSORTYPE) {
+        VoltageSensorON = HIGH;
+        VoltageSensorOFF = LOW;
+    } else {
+        VoltageSensorON = LOW;
+        VoltageSensorOFF = HIGH;
+    }
+
+    // Initialize Pins
+    pinMode(PIN_VALVE, OUTPUT);
+    pinMode(PIN_PUMP, OUTPUT);
+    pinMode(PIN_HEATER, OUTPUT);
+    pinMode(PIN_STEAMSWITCH, INPUT);
+    digitalWrite(PIN_VALVE, relayOFF);
+    digitalWrite(PIN_PUMP, relayOFF);
+    digitalWrite(PIN_HEATER, LOW);
+
+    // IF POWERSWITCH is connected
+    if (POWERSWITCHTYPE > 0) {
+        pinMode(PIN_POWERSWITCH, INPUT);
+    }
+
+    // IF Voltage sensor selected
+    if (BREWDETECTION == 3) {
+        pinMode(PIN_BREWSWITCH, PINMODEVOLTAGESENSOR);
+    }
+    else {
+        pinMode(PIN_BREWSWITCH, INPUT_PULLDOWN);
+    }
+
+    if (TEMP_LED) {
+        pinMode(PIN_STATUSLED, OUTPUT);
+    }
+
+    pinMode(PIN_STEAMSWITCH, INPUT_PULLDOWN);
+
+    // Initialize PID controller
+    bPID.SetSampleTime(windowSize);
+    bPID.SetOutputLimits(0, windowSize);
+    bPID.SetIntegratorLimits(0, AGGIMAX);
+    bPID.SetSmoothingFactor(EMA_FACTOR);
+    bPID.SetMode(AUTOMATIC);
+
+    // first reading, waits for the conversion of the DS18B20
+    temp_sample_t sample;
+
+    tempSensor->begin();
+
+    if (tempSensor->getSample(sample)) {
+        temperature = sample.temperature;
+        temperatureTime = sample.time;
+    }
+
+    temperature -= brewTempOffset;
+}
+
+
+/**
+ * @brief Register the temperature control jobs with the control scheduler,
+ *      the application adds its own jobs (scale, shot recorder, outputs) around
+ *      them by priority: sensor -> PID -> brew -> state machine -> heater
+ */
+void controlSchedulerSetup() {
+    temperatureJob = controlScheduler.addJob("temperature", refreshTemp, (TEMPSENSOR == 1) ? intervaltempmesds18b20 : intervaltempmestsic, 10, 100);
+    controlScheduler.addJob("pid", computePID, 0, 9, 20);
+    controlScheduler.addJob("brew", brew, 0, 7, 20);
+    controlScheduler.addJob("machine", updateMachineState, 0, 6, 20);
+    controlScheduler.addJob("heater", []{ heaterSetOutput(pidOutput + brewFFOutput); }, 0, 2, 20);
+}
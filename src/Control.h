@@ -0,0 +1,202 @@
+/**
+ * @file Control.h
+ *
+ * @brief Temperature control of the control task: machine states, PID phases,
+ *        brew and backflush and the system parameters
+ *
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include "PID_v1.h"
+#include "userConfig.h"
+#include "Filters.h"
+#include "PeriodicTrigger.h"
+#include "PidAutotune.h"
+#include "Scheduler.h"
+#include "SysPara.h"
+#include "TempSensor.h"
+
+enum MachineState {
+    kInit = 0,
+    kColdStart = 10,
+    kBelowSetpoint = 19,
+    kPidNormal = 20,
+    kBrew = 30,
+    kShotTimerAfterBrew = 31,
+    kBrewDetectionTrailing = 35,
+    kSteam = 40,
+    kCoolDown = 45,
+    kBackflush = 50,
+    kAutotune = 60,
+    kEmergencyStop = 80,
+    kPidOffline = 90,
+    kStandby = 95,
+    kSensorError = 100,
+    kEepromError = 110,
+};
+
+enum BrewState {
+    kBrewIdle = 10,
+    kPreinfusion = 20,
+    kWaitPreinfusion = 21,
+    kPreinfusionPause = 30,
+    kWaitPreinfusionPause = 31,
+    kBrewRunning = 40,
+    kWaitBrew = 41,
+    kBrewFinished = 42,
+    kWaitBrewOff = 43
+};
+
+// Definitions below must be changed in the userConfig.h file
+const int OnlyPID = ONLYPID;
+const int brewDetectionMode = BREWDETECTION;
+
+extern MACHINE machine;
+extern int offlineMode;
+
+// Machine state
+extern MachineState machineState;
+extern MachineState lastmachinestate;
+
+// System parameters
+extern uint8_t pidON;
+extern uint8_t wifiCredentialsSaved;
+extern double brewSetpoint;
+extern double brewTempOffset;
+extern double setpoint;
+extern double steamSetpoint;
+extern uint8_t usePonM;
+extern double steamKp;
+extern double startKp;
+extern double startTn;
+extern double aggKp;
+extern double aggTn;
+extern double aggTv;
+extern double aggIMax;
+extern double brewtime;
+extern double preinfusion;
+extern double preinfusionpause;
+extern double weightSetpoint;
+extern uint8_t useBDPID;
+extern double aggbKp;
+extern double aggbTn;
+extern double aggbTv;
+extern double brewtimesoftware;
+extern double brewSensitivity;
+extern double brewPIDDelay;
+extern double brewFFPower;
+extern double brewFFStart;
+extern double brewFFTime;
+extern double brewFFOutput;
+extern uint8_t standbyModeOn;
+extern double standbyModeTime;
+
+extern SysPara<uint8_t> sysParaWifiCredentialsSaved;
+
+// Control state
+extern int relayON, relayOFF;
+extern int VoltageSensorON, VoltageSensorOFF;
+extern unsigned long previousMillisVoltagesensorreading;
+extern boolean coldstart;
+extern boolean emergencyStop;
+extern boolean brewDetected;
+extern int isBrewDetected;
+extern unsigned long timeBrewDetection;
+extern int backflushON;
+extern int flushCycles;
+extern int backflushState;
+extern int maxflushCycles;
+extern int autotuneON;
+extern int autotuneApply;
+extern PidAutotune autotune;
+extern boolean sensorError;
+extern int pidMode;
+extern double temperature;
+extern double pidOutput;
+extern int steamON;
+extern int steamFirstON;
+extern PID bPID;
+
+// Brew
+extern BrewState brewcounter;
+extern int brewswitch;
+extern unsigned long startingTime;
+extern double totalBrewTime;
+extern double timeBrewed;
+extern double lastbrewTime;
+
+#if (ONLYPIDSCALE == 1 || BREWMODE == 2)
+    #define SCALE_FLOW_WINDOW 10                        // conversions, 1 s at 10 SPS
+
+    extern float weight;
+    extern float weightPreBrew;
+    extern float weightBrew;
+    extern float weightFlow;
+    extern unsigned long weightTime;
+    extern bool scaleFailure;
+    extern SlopeEstimator<SCALE_FLOW_WINDOW> scaleFlow;
+#endif
+
+// Standby
+extern unsigned long standbyModeRemainingTimeMillis;
+
+extern Scheduler controlScheduler;
+extern int temperatureJob;      // slowed down in standby by the application
+
+void controlSetup(TempSensor &sensor);
+void controlSchedulerSetup();
+void looppid();
+
+/**
+ * @brief Lock of the control parameters. Other tasks change setpoints, PID
+ *        parameters and times only while they hold it, the control task
+ *        holds it while its jobs run. A double isn't written in one
+ *        instruction, and a change of several parameters is applied at once.
+ *        Not recursive, so control jobs must not take it.
+ */
+void controlLock();
+void controlUnlock();
+
+/**
+ * @brief Holds the control lock while it exists
+ */
+class ControlLock {
+    public:
+        ControlLock() { controlLock(); }
+        ~ControlLock() { controlUnlock(); }
+
+        ControlLock(const ControlLock&) = delete;
+        ControlLock& operator=(const ControlLock&) = delete;
+};
+
+void refreshTemp();
+void computePID();
+void brew();
+void updateMachineState();
+double brewFeedForward();
+
+void testEmergencyStop();
+void brewDetection();
+void checkSteamON();
+void setEmergencyStopTemp();
+void initSteamQM();
+boolean checkSteamOffQM();
+void handleMachineState();
+void printMachineState();
+char const* machinestateEnumToString(MachineState machineState);
+void setNormalPIDTunings();
+void setBDPIDTunings();
+int applyAutotune();
+void updateStandbyTimer(void);
+void resetStandbyTimer(void);
+
+// Implemented by the application, called by the control jobs
+void enterStandbyPowerSave();
+void exitStandbyPowerSave();
+void triggerMQTTPublish();
+
+#if (ONLYPIDSCALE == 1)
+    void shottimerscale();
+#endif
@@ -37,7 +37,7 @@ void displayMessage(String text1, String text2, String text3, String text4, Stri
     u8g2.print(text5);
     u8g2.setCursor(0, 50);
     u8g2.print(text6);
-    u8g2.sendBuffer();
+    displayUpdate();
 }
 #endif
 
@@ -64,7 +64,7 @@ void displayLogo(String displaymessagetext, String displaymessagetext2) {
             break;
     }
 
-    u8g2.sendBuffer();
+    displayUpdate();
 }
 
 #if 0 //not used a.t.m.
@@ -94,7 +94,7 @@ void displayEmergencyStop(void)
         u8g2.print(langstring_emergencyStop[1]);
     }
 
-    u8g2.sendBuffer();
+    displayUpdate();
 }
 #endif
 
@@ -115,7 +115,7 @@ void displayShottimer(void) {
         u8g2.setCursor(5, 70);
         u8g2.print(timeBrewed / 1000, 1);
         u8g2.setFont(u8g2_font_profont11_tf);
-        u8g2.sendBuffer();
+        displayUpdate();
 
     }
     if (SHOTTIMER == 1 && millis() >= brewTime_last_Millis && // directly after creating brewTime_last_mills (happens when turning off the brew switch, case 43 in the code) should be started
@@ -128,6 +128,6 @@ void displayShottimer(void) {
         u8g2.setCursor(5, 70);
         u8g2.print((brewTime_last_Millis - startingTime) / 1000, 1);
         u8g2.setFont(u8g2_font_profont11_tf);
-        u8g2.sendBuffer();
+        displayUpdate();
     }
 }
@@ -160,6 +160,6 @@ void printScreen()
             u8g2.print(langstring_offlinemode);
         }
 
-        u8g2.sendBuffer();
+        displayUpdate();
     }
 }
@@ -64,6 +64,6 @@ void printScreen() {
             u8g2.print("O");
         }
 
-        u8g2.sendBuffer();
+        displayUpdate();
     }
 }
@@ -140,7 +140,7 @@ void printScreen() {
                 u8g2.print("Offline");
             }
 
-            u8g2.sendBuffer();
+            displayUpdate();
         }
     }
 }
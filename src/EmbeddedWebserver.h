@@ -20,47 +20,59 @@
 #include "LittleFS.h"
 #include <functional>
 
+#include "Parameters.h"
+#include "TempHistory.h"
+#include "ShotRecorder.h"
 
-enum EditableKind {
-    kInteger,
-    kUInt8,
-    kDouble,
-    kDoubletime,
-    kCString
-};
-
-struct editable_t {
-    String displayName;
-    boolean hasHelpText;
-    String helpText;
-    EditableKind type;
-    int section;                   // parameter section number
-    int position;
-    std::function<bool()> show;    // method that determines if we show this parameter (in the web interface)
-    int minValue;
-    int maxValue;
-    void *ptr;                     // TODO: there must be a tidier way to do this? could we use c++ templates?
-};
 
 AsyncWebServer server(80);
-AsyncEventSource events("/events");
+AsyncWebSocket telemetrySocket("/ws");
 
 double curTemp = 0.0;
 double tTemp = 0.0;
 double hPower = 0.0;
 
-#define HISTORY_LENGTH 600    //30 mins of values (20 vals/min * 60 min) = 600 (7,2kb)
+TempHistory tempHistory;
+
+// binary /timeseries format, all values little endian:
+// header:  "CCTS", uint8 version, uint8 channels, uint16 scale, uint16 count,
+//          uint16 interval in s, uint32 sequence number following the last record
+// records: count * channels int16 values (value * scale), in chronological order,
+//          channels are temperature, setpoint, heater power and for tiers > 0
+//          also the minimum and maximum temperature
+#define TIMESERIES_VERSION 2
+#define TIMESERIES_HEADER_SIZE 16
+#define TIMESERIES_MAX_CHANNELS 5
+
+// binary telemetry frames on /ws, all values little endian:
+// uint8 version, uint8 machine state, uint32 millis, int16 temperature (0.01 °C),
+// int16 brew setpoint (0.01 °C), uint16 heater power (0.1 %), int16 pressure (0.01 bar),
+// int16 weight (0.1 g)
+// clients choose their rate with a text message, see parseTelemetrySettings()
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_FRAME_SIZE 16
+#define TELEMETRY_PERIOD 100        // ms, fastest rate a client can ask for
+#define TELEMETRY_MAX_CLIENTS 4
+
+struct telemetry_client_t {
+    uint32_t id;                    // websocket client id, 0 = free slot
+    uint16_t interval;              // ms between frames
+    uint16_t brewInterval;          // ms between frames while brewing
+    unsigned long lastSent;
+    uint32_t dropped;               // frames skipped because the client was too slow
+};
 
-static float tempHistory[3][HISTORY_LENGTH] = {0};
-int historyCurrentIndex = 0;
-int historyValueCount = 0;
+telemetry_client_t telemetryClients[TELEMETRY_MAX_CLIENTS] = {};
+unsigned long lastTelemetryCleanup = 0;
 
 void serverSetup();
 void setEepromWriteFcn(int (*fcnPtr)(void));
 
 // editable vars are specified in main.cpp
-#define EDITABLE_VARS_LEN 29
-extern std::map<String, editable_t> editableVars;
+#define EDITABLE_VARS_LEN 34
+extern const editable_t editableVars[EDITABLE_VARS_LEN];
+
+extern ShotRecorder shotRecorder;
 
 
 // EEPROM
@@ -87,12 +99,6 @@ String getTempString() {
     return jsonTemps;
 }
 
-// proper modulo function (% is remainder, so will return negatives)
-int mod(int a, int b) {
-    int r = a % b;
-    return r < 0 ? r + b : r;
-}
-
 // rounds a number to 2 decimal places
 // example: round(3.14159) -> 3.14
 // (less characters when serialized to json)
@@ -100,142 +106,473 @@ double round2(double value) {
    return (int)(value * 100 + 0.5) / 100.0;
 }
 
-String getValue(String varName) {
-    try {
-        editable_t e = editableVars.at(varName);
-        switch (e.type) {
-            case kDouble:
-                return String(*(double *)e.ptr);
-            case kDoubletime:
-                return String(*(double *)e.ptr);
+void paramToJson(const editable_t &e, DynamicJsonDocument &doc) {
+    JsonObject paramObj = doc.createNestedObject();
+    paramObj["type"] = e.var.type;
+    paramObj["name"] = e.name;
+    paramObj["displayName"] = e.displayName;
+    paramObj["section"] = e.section;
+    paramObj["position"] = e.position;
+    paramObj["hasHelpText"] = e.helpText != NULL;
+    paramObj["show"] = e.show();
+
+    // set parameter value
+    if (e.var.type == kInteger) {
+        paramObj["value"] = *e.var.intPtr;
+    } else if (e.var.type == kUInt8) {
+        paramObj["value"] = *e.var.uint8Ptr;
+    } else if (e.var.type == kDouble || e.var.type == kDoubletime) {
+        paramObj["value"] = round2(*e.var.doublePtr);
+    } else if (e.var.type == kCString) {
+        paramObj["value"] = e.var.cString;
+    }
+
+    paramObj["min"] = e.minValue;
+    paramObj["max"] = e.maxValue;
+}
+
+// The parameter metadata is the same until the firmware changes, it is
+// serialized on the first request and served from this buffer afterwards.
+// Values are sent separately by /parameterValues.
+char *parameterMeta = NULL;
+size_t parameterMetaLength = 0;
+char parameterMetaETag[12];
+
+#define PARAMETER_VALUES_SIZE 1024
+
+uint32_t fnv1a(const char *data, size_t length) {
+    uint32_t hash = 2166136261UL;
+
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (uint8_t)data[i]) * 16777619UL;
+    }
+
+    return hash;
+}
+
+/**
+ * @brief Serialize the metadata of all parameters (everything but value and
+ *        show) into parameterMeta, in the order of editableVars
+ *
+ * @return 0 on success, <0 if out of memory
+ */
+int buildParameterMeta() {
+    DynamicJsonDocument doc(JSON_ARRAY_SIZE(EDITABLE_VARS_LEN) + JSON_OBJECT_SIZE(8) * EDITABLE_VARS_LEN);
+
+    for (const editable_t& e : editableVars) {
+        JsonObject paramObj = doc.createNestedObject();
+        paramObj["type"] = e.var.type;
+        paramObj["name"] = e.name;
+        paramObj["displayName"] = e.displayName;
+        paramObj["section"] = e.section;
+        paramObj["position"] = e.position;
+        paramObj["hasHelpText"] = e.helpText != NULL;
+        paramObj["min"] = e.minValue;
+        paramObj["max"] = e.maxValue;
+    }
+
+    if (doc.overflowed()) {
+        return -1;
+    }
+
+    size_t length = measureJson(doc);
+    char *json = (char *)malloc(length + 1);
+
+    if (json == NULL) {
+        return -2;
+    }
+
+    serializeJson(doc, json, length + 1);
+
+    snprintf(parameterMetaETag, sizeof(parameterMetaETag), "\"%08lx\"", (unsigned long)fnv1a(json, length));
+    parameterMetaLength = length;
+    parameterMeta = json;
+
+    return 0;
+}
+
+/**
+ * @brief Format the current values and visibility of all parameters, in the
+ *        order of editableVars: {"values":[...],"show":[0|1,...]}
+ *
+ * @return length of the JSON, 0 if it didn't fit
+ */
+size_t formatParameterValues(char *buffer, size_t size) {
+    size_t len = 0;
+    int n = snprintf(buffer, size, "{\"values\":[");
+
+    for (size_t i = 0; i < EDITABLE_VARS_LEN && n >= 0 && len + n < size; i++) {
+        const editable_t& e = editableVars[i];
+        const char *separator = i > 0 ? "," : "";
+
+        len += n;
+
+        switch (e.var.type) {
             case kInteger:
-                return String(*(int *)e.ptr);
+                n = snprintf(buffer + len, size - len, "%s%d", separator, *e.var.intPtr);
+                break;
             case kUInt8:
-                return String(*(uint8_t *)e.ptr);
+                n = snprintf(buffer + len, size - len, "%s%u", separator, (unsigned int)*e.var.uint8Ptr);
+                break;
+            case kDouble:
+            case kDoubletime:
+                n = snprintf(buffer + len, size - len, "%s%g", separator, round2(*e.var.doublePtr));
+                break;
             case kCString:
-                return String((char *)e.ptr);
             default:
-                return F("Unknown type");
+                // only used for literals without quotes or backslashes
+                n = snprintf(buffer + len, size - len, "%s\"%s\"", separator, e.var.cString);
                 break;
         }
-    } catch (const std::out_of_range &exc) {
-        return "(unknown variable " + varName + ")";
     }
+
+    for (size_t i = 0; i < EDITABLE_VARS_LEN && n >= 0 && len + n < size; i++) {
+        len += n;
+        n = snprintf(buffer + len, size - len, "%s%d", i > 0 ? "," : "],\"show\":[", editableVars[i].show() ? 1 : 0);
+    }
+
+    if (n < 0 || len + n + 2 >= size) {
+        return 0;
+    }
+
+    len += n;
+    buffer[len++] = ']';
+    buffer[len++] = '}';
+    buffer[len] = '\0';
+
+    return len;
 }
 
-void paramToJson(String name, editable_t &e, DynamicJsonDocument &doc) {
-    JsonObject paramObj = doc.createNestedObject();
-    paramObj["type"] = e.type;
-    paramObj["name"] = name;
-    paramObj["displayName"] = e.displayName;
-    paramObj["section"] = e.section;
-    paramObj["position"] = e.position;
-    paramObj["hasHelpText"] = e.hasHelpText;
-    paramObj["show"] = e.show();
+/**
+ * @brief Answer 304 if the client already has the current version
+ *
+ * @return true if the request was answered
+ */
+bool sendNotModified(AsyncWebServerRequest *request, const char *etag) {
+    if (request->hasHeader("If-None-Match") && request->header("If-None-Match") == etag) {
+        AsyncWebServerResponse *response = request->beginResponse(304);
+        response->addHeader("ETag", etag);
+        request->send(response);
+        return true;
+    }
 
-    // set parameter value
-    if (e.type == kInteger) {
-        paramObj["value"] = *(int *)e.ptr;
-    } else if (e.type == kUInt8) {
-        paramObj["value"] = *(uint8_t *)e.ptr;
-    } else if (e.type == kDouble || e.type == kDoubletime) {
-        paramObj["value"] = round2(*(double *)e.ptr);
-    } else if (e.type == kCString) {
-        paramObj["value"] = (char *)e.ptr;
+    return false;
+}
+
+typedef void (*histogram_writer_t)(AsyncResponseStream *response, const char *metric, const String &labels, const Histogram &histogram);
+
+void writeHistogramSummary(AsyncResponseStream *response, const char *metric, const String &labels, const Histogram &histogram) {
+    const float quantiles[] = {0.5, 0.9, 0.99};
+
+    for (float q : quantiles) {
+        response->printf("%s{%s,quantile=\"%.2f\"} %lu\n", metric, labels.c_str(), q, (unsigned long)histogram.getPercentile(q));
     }
 
-    paramObj["min"] = e.minValue;
-    paramObj["max"] = e.maxValue;
+    response->printf("%s_sum{%s} %llu\n", metric, labels.c_str(), (unsigned long long)histogram.getSum());
+    response->printf("%s_count{%s} %lu\n", metric, labels.c_str(), (unsigned long)histogram.getCount());
+}
+
+void writeHistogramMin(AsyncResponseStream *response, const char *metric, const String &labels, const Histogram &histogram) {
+    response->printf("%s{%s} %lu\n", metric, labels.c_str(), (unsigned long)histogram.getMin());
 }
 
-// Use libraries for the webinterface from the internet (0) or from the local filesystem (1). 0 has slightly faster load times
-#define NOINTERNET 1
+void writeHistogramAvg(AsyncResponseStream *response, const char *metric, const String &labels, const Histogram &histogram) {
+    response->printf("%s{%s} %lu\n", metric, labels.c_str(), (unsigned long)histogram.getAvg());
+}
 
-//hash strings at compile time to use in switch statement
-//(from https://stackoverflow.com/questions/2111667/compile-time-string-hashing)
-constexpr unsigned int str2int(const char* str, int h = 0) {
-    return !str[h] ? 5381 : (str2int(str, h+1) * 33) ^ str[h];
+void writeHistogramMax(AsyncResponseStream *response, const char *metric, const String &labels, const Histogram &histogram) {
+    response->printf("%s{%s} %lu\n", metric, labels.c_str(), (unsigned long)histogram.getMax());
 }
 
-String getHeader(String varName) {
-    //TODO: actually put the references libs on local file system again (only when using ESP32 which has more flash mem,
-    //but also make sure web server can handle this many concurrent requests (might crash)
-    switch (str2int(varName.c_str())) {
-        case (str2int("FONTAWESOME")):
-            #if NOINTERNET == 1
-                return F("<link href=\"/css/fontawesome-6.2.1.min.css\" rel=\"stylesheet\">");
-            #else
-                return F("<link rel=\"stylesheet\" href=\"https://cdnjs.cloudflare.com/ajax/libs/font-awesome/6.2.1/css/all.min.css\">");
-            #endif
-        case (str2int("BOOTSTRAP")):
-            #if NOINTERNET == 1
-                return F("<link href=\"/css/bootstrap-5.2.3.min.css\" rel=\"stylesheet\">");
-            #else
-                return F("<link href=\"https://cdn.jsdelivr.net/npm/bootstrap@5.2.3/dist/css/bootstrap.min.css\" rel=\"stylesheet\" integrity=\"sha384-1BmE4kWBq78iYhFldvKuhfTAU6auU8tT94WrHftjDbrCEXSU1oBoqyl2QvZ6jIW3\" crossorigin=\"anonymous\">");
-            #endif
-        case (str2int("BOOTSTRAP_BUNDLE")):
-            #if NOINTERNET == 1
-                return F("<script src=\"/js/bootstrap.bundle.5.2.3.min.js\"></script>");
-            #else
-                return F("<script src=\"https://cdn.jsdelivr.net/npm/bootstrap@5.2.3/dist/js/bootstrap.bundle.min.js\" integrity=\"sha384-kenU1KFdBIe4zVF0s0G1M5b4hcpxyD9F7jL+jjXkk+Q2h455rYXK/7HAuoJl+0I4\" crossorigin=\"anonymous\"></script>");
-            #endif
-        case (str2int("VUEJS")):
-            #if NOINTERNET == 1
-                return F("<script src=\"/js/vue.3.2.47.min.js\"></script>");
-            #else
-                return F("<script src=\"https://cdn.jsdelivr.net/npm/vue@3.2.47/dist/vue.global.prod.min.js\"></script>");
-            #endif
-        case (str2int("VUE_NUMBER_INPUT")):
-            #if NOINTERNET == 1
-                return F("<script src=\"/js/vue-number-input.min.js\"></script>");
-            #else
-                return F("<script src=\"https://unpkg.com/@chenfengyuan/vue-number-input@2.0.1/dist/vue-number-input.min.js\"></script>");
-            #endif
-        case (str2int("UPLOT")):
-            #if NOINTERNET == 1
-                return F("<script src=\"/js/uPlot.1.6.24.min.js\"></script><link rel=\"stylesheet\" href=\"/css/uPlot.min.css\">");
-            #else
-                return F("<script src=\"https://cdn.jsdelivr.net/npm/uplot@1.6.24/dist/uPlot.iife.min.js\"></script><link rel=\"stylesheet\" href=\"https://cdn.jsdelivr.net/npm/uplot@1.6.24/dist/uPlot.min.css\">");
-            #endif
+/**
+ * @brief Write one metric family for the runtime of all scheduler passes (jobs = false)
+ *        or all scheduler jobs (jobs = true)
+ */
+void writeRuntimeFamily(AsyncResponseStream *response, bool jobs, const char *metric, const char *type, const char *help, histogram_writer_t writer) {
+    const Scheduler *schedulers[] = {&controlScheduler, &telemetryScheduler};
+
+    response->printf("# HELP %s %s\n", metric, help);
+    response->printf("# TYPE %s %s\n", metric, type);
+
+    for (const Scheduler *scheduler : schedulers) {
+        String taskLabel = String("task=\"") + scheduler->getName() + "\"";
+
+        if (!jobs) {
+            writer(response, metric, taskLabel, scheduler->getPassRuntime());
+            continue;
+        }
+
+        for (int i = 0; i < scheduler->getJobCount(); i++) {
+            const scheduler_job_t *job = scheduler->getJob(i);
+            writer(response, metric, taskLabel + ",job=\"" + job->name + "\"", job->runtime);
+        }
     }
-    return "";
 }
 
-String staticProcessor(const String& var) {
-    skipHeaterISR = true;
+/**
+ * @brief Timing statistics of the control and telemetry loop in Prometheus text format
+ */
+void writeMetrics(AsyncResponseStream *response) {
+    const Scheduler *schedulers[] = {&controlScheduler, &telemetryScheduler};
+
+    response->print("# HELP clevercoffee_uptime_seconds Time since boot\n");
+    response->print("# TYPE clevercoffee_uptime_seconds gauge\n");
+    response->printf("clevercoffee_uptime_seconds %lu\n", millis() / 1000);
+
+    response->print("# HELP clevercoffee_boot_phase_ms Time since boot when a boot phase was finished\n");
+    response->print("# TYPE clevercoffee_boot_phase_ms gauge\n");
 
-    //try replacing var for variables in editableVars
-    if (var.startsWith("VAR_SHOW_")) {
-        return getValue(var.substring(9)); // cut off "VAR_SHOW_"
-    } else if (var.startsWith("VAR_HEADER_")) {
-        return getHeader(var.substring(11)); // cut off "VAR_HEADER_"
+    for (int i = 0; i < kBootPhaseCount; i++) {
+        if (bootPhaseTime[i] != 0) {
+            response->printf("clevercoffee_boot_phase_ms{phase=\"%s\"} %lu\n", bootPhaseNames[i], bootPhaseTime[i]);
+        }
     }
 
-    //var didn't start with above names, try opening var as fragment file and use contents if it exists
-    //TODO: this seems to consume too much heap in some cases, probably better to remove fragment loading and only use one SPA in the long term (or only support ESP32 which has more RAM)
-    String varLower(var);
-    varLower.toLowerCase();
+    writeRuntimeFamily(response, false, "clevercoffee_loop_runtime_us", "summary", "Runtime of one complete scheduler pass", writeHistogramSummary);
+    writeRuntimeFamily(response, false, "clevercoffee_loop_runtime_min_us", "gauge", "Min runtime of one scheduler pass", writeHistogramMin);
+    writeRuntimeFamily(response, false, "clevercoffee_loop_runtime_avg_us", "gauge", "Average runtime of one scheduler pass", writeHistogramAvg);
+    writeRuntimeFamily(response, false, "clevercoffee_loop_runtime_max_us", "gauge", "Max runtime of one scheduler pass", writeHistogramMax);
 
-    File file = LittleFS.open("/html_fragments/" + varLower + ".html", "r");
+    writeRuntimeFamily(response, true, "clevercoffee_job_runtime_us", "summary", "Runtime of a single scheduler job", writeHistogramSummary);
+    writeRuntimeFamily(response, true, "clevercoffee_job_runtime_min_us", "gauge", "Min runtime of a scheduler job", writeHistogramMin);
+    writeRuntimeFamily(response, true, "clevercoffee_job_runtime_avg_us", "gauge", "Average runtime of a scheduler job", writeHistogramAvg);
+    writeRuntimeFamily(response, true, "clevercoffee_job_runtime_max_us", "gauge", "Max runtime of a scheduler job", writeHistogramMax);
 
-    if (file) {
-        if (file.size()*2 < ESP.getFreeHeap()) {
-            String ret = file.readString();
-            file.close();
-            return ret;
+    response->print("# HELP clevercoffee_job_lateness_max_ms Max delay between due time and start of a job\n");
+    response->print("# TYPE clevercoffee_job_lateness_max_ms gauge\n");
+
+    for (const Scheduler *scheduler : schedulers) {
+        for (int i = 0; i < scheduler->getJobCount(); i++) {
+            const scheduler_job_t *job = scheduler->getJob(i);
+            response->printf("clevercoffee_job_lateness_max_ms{task=\"%s\",job=\"%s\"} %lu\n", scheduler->getName(), job->name, job->maxLateness);
+        }
+    }
+
+    response->print("# HELP clevercoffee_job_deadline_misses_total Number of job runs that finished after their deadline\n");
+    response->print("# TYPE clevercoffee_job_deadline_misses_total counter\n");
+
+    for (const Scheduler *scheduler : schedulers) {
+        for (int i = 0; i < scheduler->getJobCount(); i++) {
+            const scheduler_job_t *job = scheduler->getJob(i);
+            response->printf("clevercoffee_job_deadline_misses_total{task=\"%s\",job=\"%s\"} %lu\n", scheduler->getName(), job->name, job->deadlineMisses);
+        }
+    }
+}
+
+struct timeseries_request_t {
+    uint8_t tier;       // history tier to send
+    uint8_t channels;   // values per record
+    uint32_t next;      // sequence number following the last record
+    uint16_t count;     // number of records to send
+};
+
+// write a value little endian, independent of the host byte order
+static void putUInt16(uint8_t *dest, uint16_t value) {
+    dest[0] = value & 0xFF;
+    dest[1] = value >> 8;
+}
+
+static void putUInt32(uint8_t *dest, uint32_t value) {
+    putUInt16(dest, value & 0xFFFF);
+    putUInt16(dest + 2, value >> 16);
+}
+
+static int16_t toFixedPoint(double value, double scale) {
+    double scaled = value * scale;
+
+    if (scaled >= INT16_MAX) return INT16_MAX;
+    if (scaled <= INT16_MIN) return INT16_MIN;
+
+    return (int16_t)lround(scaled);
+}
+
+/**
+ * @brief Response filler for /timeseries, streams the header and the records
+ *        straight out of tempHistory without an intermediate buffer
+ *
+ * @param ts - snapshot of the history taken when the request came in
+ * @param buffer - chunk buffer to fill
+ * @param maxLen - size of buffer
+ * @param index - number of bytes already sent
+ *
+ * @return number of bytes written, 0 when done
+ */
+size_t fillTimeseries(const timeseries_request_t& ts, uint8_t *buffer, size_t maxLen, size_t index) {
+    const size_t recordSize = ts.channels * 2;
+    size_t written = 0;
+
+    while (written < maxLen) {
+        size_t pos = index + written;
+        uint8_t unit[TIMESERIES_HEADER_SIZE];
+        size_t unitStart;
+        size_t unitLen;
+
+        if (pos < TIMESERIES_HEADER_SIZE) {
+            memcpy(unit, "CCTS", 4);
+            unit[4] = TIMESERIES_VERSION;
+            unit[5] = ts.channels;
+            putUInt16(unit + 6, HISTORY_SCALE);
+            putUInt16(unit + 8, ts.count);
+            putUInt16(unit + 10, tempHistory.getInterval(ts.tier));
+            putUInt32(unit + 12, ts.next);
+            unitStart = 0;
+            unitLen = TIMESERIES_HEADER_SIZE;
         } else {
-            debugPrintf("Can't open file %s, not enough memory available\n", file.name());
+            size_t record = (pos - TIMESERIES_HEADER_SIZE) / recordSize;
+
+            if (record >= ts.count) break;
+
+            // each tier keeps one slot spare, so the oldest record only gets
+            // overwritten if the response takes longer than a whole interval,
+            // end the response short then, the client drops it
+            history_record_t r;
+
+            if (!tempHistory.getRecord(ts.tier, ts.next - ts.count + record, r)) {
+                break;
+            }
+
+            int16_t values[TIMESERIES_MAX_CHANNELS] = {r.temp, r.setpoint, r.heater, r.tempMin, r.tempMax};
+
+            for (int c = 0; c < ts.channels; c++) {
+                putUInt16(unit + 2 * c, (uint16_t)values[c]);
+            }
+
+            unitStart = TIMESERIES_HEADER_SIZE + record * recordSize;
+            unitLen = recordSize;
+        }
+
+        size_t offset = pos - unitStart;
+        size_t n = min(unitLen - offset, maxLen - written);
+
+        memcpy(buffer + written, unit + offset, n);
+        written += n;
+    }
+
+    return written;
+}
+
+/**
+ * @brief Build the telemetry frame sent on /ws from controlState
+ */
+void formatTelemetryFrame(uint8_t *frame) {
+    frame[0] = TELEMETRY_VERSION;
+    frame[1] = (uint8_t)controlState.machineState;
+    putUInt32(frame + 2, (uint32_t)controlState.timestamp);
+    putUInt16(frame + 6, (uint16_t)toFixedPoint(controlState.temperature, 100));
+    putUInt16(frame + 8, (uint16_t)toFixedPoint(controlState.brewSetpoint, 100));
+    putUInt16(frame + 10, (uint16_t)constrain(lround(controlState.pidOutput), 0L, 1000L));
+    putUInt16(frame + 12, (uint16_t)toFixedPoint(controlState.pressure, 100));
+    putUInt16(frame + 14, (uint16_t)toFixedPoint(controlState.weight, 10));
+}
+
+/**
+ * @brief Send the telemetry frame to every client whose interval elapsed,
+ *        called by the telemetry scheduler every TELEMETRY_PERIOD ms. A frame
+ *        is only handed to a client if its connection can take it right away,
+ *        otherwise it is dropped, so slow clients never pile up heap.
+ */
+void sendTelemetry() {
+    HeapScope heapScope(kHeapWeb);
+    uint8_t frame[TELEMETRY_FRAME_SIZE];
+    bool formatted = false;
+    bool brewing = controlState.machineState == kBrew;
+    unsigned long now = millis();
+
+    for (telemetry_client_t& tc : telemetryClients) {
+        if (tc.id == 0 || now - tc.lastSent < (brewing ? tc.brewInterval : tc.interval)) {
+            continue;
+        }
+
+        AsyncWebSocketClient *client = telemetrySocket.client(tc.id);
+
+        if (client == NULL || client->status() != WS_CONNECTED) {
+            continue;
+        }
+
+        tc.lastSent = now;
+
+        // 2 bytes of websocket header for short binary frames
+        if (client->queueIsFull() || client->client()->space() < TELEMETRY_FRAME_SIZE + 2) {
+            tc.dropped++;
+            continue;
+        }
+
+        if (!formatted) {
+            formatTelemetryFrame(frame);
+            formatted = true;
+        }
+
+        client->binary(frame, TELEMETRY_FRAME_SIZE);
+    }
+
+    if (now - lastTelemetryCleanup >= 1000) {
+        lastTelemetryCleanup = now;
+        telemetrySocket.cleanupClients(TELEMETRY_MAX_CLIENTS);
+    }
+}
+
+/**
+ * @brief Handle a settings message of a telemetry client, e.g.
+ *        "interval=1000 brewInterval=100", intervals in ms
+ */
+void parseTelemetrySettings(telemetry_client_t& tc, char *message) {
+    for (char *token = strtok(message, " &,"); token != NULL; token = strtok(NULL, " &,")) {
+        unsigned int value;
+        uint16_t *target = NULL;
+
+        if (sscanf(token, "interval=%u", &value) == 1) {
+            target = &tc.interval;
+        } else if (sscanf(token, "brewInterval=%u", &value) == 1) {
+            target = &tc.brewInterval;
+        }
+
+        if (target != NULL) {
+            *target = (uint16_t)constrain(value, (unsigned int)TELEMETRY_PERIOD, 60000U);
         }
-    } else {
-        debugPrintf("Fragment %s not found\n", varLower.c_str());
     }
+}
+
+void onTelemetryEvent(AsyncWebSocket *, AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len) {
+    if (type == WS_EVT_CONNECT) {
+        for (telemetry_client_t& tc : telemetryClients) {
+            if (tc.id == 0) {
+                tc = {client->id(), 1000, 1000, 0, 0};
+                return;
+            }
+        }
+
+        client->close();
+    } else if (type == WS_EVT_DISCONNECT) {
+        for (telemetry_client_t& tc : telemetryClients) {
+            if (tc.id == client->id()) {
+                if (tc.dropped > 0) {
+                    debugPrintf("Telemetry client %lu disconnected, %lu frames dropped\n", (unsigned long)tc.id, (unsigned long)tc.dropped);
+                }
+
+                tc.id = 0;
+            }
+        }
+    } else if (type == WS_EVT_DATA) {
+        AwsFrameInfo *info = (AwsFrameInfo *)arg;
+
+        // settings are short text messages in a single frame
+        if (!info->final || info->index != 0 || info->len != len || info->opcode != WS_TEXT || len >= 64) {
+            return;
+        }
 
-    skipHeaterISR = false;
+        char message[64];
+        memcpy(message, data, len);
+        message[len] = '\0';
 
-    //didn't find a value for the var, replace var with empty string
-    return String();
+        for (telemetry_client_t& tc : telemetryClients) {
+            if (tc.id == client->id()) {
+                parseTelemetrySettings(tc, message);
+            }
+        }
+    }
 }
 
+
 void serverSetup() {
     // set up dynamic routes (endpoints)
 
@@ -267,11 +604,74 @@ void serverSetup() {
         request->redirect("/");
     });
 
-    server.on("/parameters", HTTP_GET | HTTP_POST, [](AsyncWebServerRequest *request) {
-        // stop writing to heater in ISR method (digitalWrite) as it causes
-        // crashes when called at the same time as flash is read or written
-        skipHeaterISR = true;
+    server.on("/toggleAutotune", HTTP_POST, [](AsyncWebServerRequest *request) {
+        int on = flipUintValue(autotuneON);
+
+        setAutotune(on);
+        debugPrintf("Toggle autotune: %i \n", on);
 
+        request->redirect("/");
+    });
+
+    // the control task applies the result, see updateMachineState()
+    server.on("/applyAutotune", HTTP_POST, [](AsyncWebServerRequest *request) {
+        autotuneApply = 1;
+
+        request->redirect("/");
+    });
+
+    // state of the autotuning, model and suggested tunings once it is done
+    server.on("/autotune", HTTP_GET, [](AsyncWebServerRequest *request) {
+        HeapScope heapScope(kHeapWeb);
+        PidAutotune::State autotuneState;
+        uint8_t cycles;
+        const char *error;
+        autotune_model_t model;
+        autotune_tunings_t tunings;
+
+        // the control task changes the autotuning while its jobs run
+        {
+            ControlLock lock;
+
+            autotuneState = autotune.getState();
+            cycles = autotune.getCycles();
+            error = autotune.getError();
+            model = autotune.getModel();
+            tunings = autotune.getTunings();
+        }
+
+        AsyncResponseStream *response = request->beginResponseStream("application/json");
+
+        response->printf("{\"state\":\"%s\",\"cycles\":%u", PidAutotune::stateToString(autotuneState), cycles);
+
+        if (autotuneState == PidAutotune::kFailed) {
+            response->printf(",\"error\":\"%s\"", error);
+        } else if (autotuneState == PidAutotune::kDone) {
+            response->printf(",\"model\":{\"gain\":%.4f,\"timeConstant\":%.1f,\"deadTime\":%.1f,\"holdOutput\":%.0f}",
+                             model.gain, model.timeConstant, model.deadTime, model.holdOutput);
+            response->printf(",\"tunings\":{\"PID_KP\":%.1f,\"PID_TN\":%.1f,\"PID_TV\":%.1f,\"PID_I_MAX\":%.0f,"
+                             "\"START_KP\":%.1f,\"START_TN\":%.1f,\"PID_BD_KP\":%.1f,\"PID_BD_TV\":%.1f}",
+                             tunings.kp, tunings.tn, tunings.tv, tunings.iMax, tunings.startKp, tunings.startTn,
+                             tunings.bdKp, tunings.bdTv);
+
+            // parameters cut to their range, the result can't be applied then
+            response->print(",\"limited\":[");
+
+            for (int i = 0, n = 0; i < kAutotuneParameterCount; i++) {
+                if (tunings.limited & (1 << i)) {
+                    response->printf("%s\"%s\"", n++ > 0 ? "," : "", PidAutotune::parameterName((AutotuneParameter)i));
+                }
+            }
+
+            response->print(']');
+        }
+
+        response->print('}');
+        request->send(response);
+    });
+
+    server.on("/parameters", HTTP_GET | HTTP_POST, [](AsyncWebServerRequest *request) {
+        HeapScope heapScope(kHeapWeb);
         // Determine the size of the document to allocate based on the number
         // of parameters
         // GET = either
@@ -293,30 +693,33 @@ void serverSetup() {
             // returns values from WebRequestMethod enum -> 2 == HTTP_POST
             // update all given params and match var name in editableVars
 
-            for (int i = 0; i < requestParams; i++) {
-                AsyncWebParameter* p = request->getParam(i);
-                String varName;
-                if (p->name().startsWith("var")) {
-                    varName = p->name().substring(3);
-                } else {
-                    varName = p->name();
-                }
+            int writeResult = 0;
+
+            {
+                // the control task gets all new values at once
+                ControlLock lock;
 
-                try {
-                    editable_t e = editableVars.at(varName);
-                    if (e.type == kInteger) {
-                        int newVal = atoi(p->value().c_str());
-                        *(int *)e.ptr = newVal;
-                    } else if (e.type == kUInt8) {
-                        *(uint8_t *)e.ptr =
-                            (uint8_t)atoi(p->value().c_str());
-                    } else if (e.type == kDouble || e.type == kDoubletime) {
-                        float newVal = atof(p->value().c_str());
-                        *(double *)e.ptr = newVal;
+                for (int i = 0; i < requestParams; i++) {
+                    AsyncWebParameter* p = request->getParam(i);
+                    String varName;
+                    if (p->name().startsWith("var")) {
+                        varName = p->name().substring(3);
+                    } else {
+                        varName = p->name();
                     }
-                    paramToJson(varName, e, doc);
-                } catch (const std::out_of_range &exc) {
-                    continue;
+
+                    const editable_t *e = findByName(editableVars, varName.c_str());
+
+                    if (e == NULL) {
+                        continue;
+                    }
+
+                    setEditableString(*e, p->value().c_str());
+                    paramToJson(*e, doc);
+                }
+
+                if (writeToEeprom) {
+                    writeResult = writeToEeprom();
                 }
             }
 
@@ -326,34 +729,33 @@ void serverSetup() {
 
             // Write to EEPROM
             if (writeToEeprom) {
-                if (writeToEeprom() == 0) {
+                if (writeResult == 0) {
                     debugPrintln("successfully wrote EEPROM");
                 } else {
                     debugPrintln("EEPROM write failed");
                 }
             }
 
-            // Write the new values to MQTT
-            writeSysParamsToMQTT(true); // Continue on error
+            // Write the new values to MQTT, done by the telemetry task
+            triggerMQTTPublish();
+            wakeControlTask();
 
         } else if (request->method() == 1) {  // WebRequestMethod enum -> HTTP_GET
             // get parameter id from first parameter, e.g. /parameters?param=PID_ON
             int paramCount = request->params();
             String paramId = paramCount > 0 ? request->getParam(0)->value() : "";
 
-            std::map<String, editable_t>::iterator it;
-            if (!paramId.isEmpty()) {
-                it = editableVars.find(paramId);
-            } else {
-                it = editableVars.begin();
-            }
+            ControlLock lock;
 
-            for (; it != editableVars.end(); it++) {
-                editable_t e = it->second;
-                paramToJson(it->first, e, doc);
+            if (!paramId.isEmpty()) {
+                const editable_t *e = findByName(editableVars, paramId.c_str());
 
-                if (!paramId.isEmpty()) {
-                    break;
+                if (e != NULL) {
+                    paramToJson(*e, doc);
+                }
+            } else {
+                for (const editable_t& e : editableVars) {
+                    paramToJson(e, doc);
                 }
             }
         }
@@ -361,7 +763,6 @@ void serverSetup() {
             request->send(404, "application/json",
                             F("{ \"code\": 404, \"message\": "
                             "\"Parameter not found\"}"));
-            skipHeaterISR = false;
             return;
         }
 
@@ -370,7 +771,60 @@ void serverSetup() {
         request->send(200, "application/json", paramsJson);
     });
 
+    // metadata of all parameters, static until the firmware changes
+    server.on("/parameterMeta", HTTP_GET, [](AsyncWebServerRequest *request) {
+        HeapScope heapScope(kHeapWeb);
+        if (parameterMeta == NULL && buildParameterMeta() != 0) {
+            request->send(500, "text/plain", "out of memory");
+            return;
+        }
+
+        if (sendNotModified(request, parameterMetaETag)) {
+            return;
+        }
+
+        AsyncWebServerResponse *response = request->beginResponse_P(200, "application/json",
+                                                                    (const uint8_t *)parameterMeta, parameterMetaLength);
+        response->addHeader("ETag", parameterMetaETag);
+        response->addHeader("Cache-Control", "no-cache");
+        request->send(response);
+    });
+
+    // values of all parameters in the order of /parameterMeta, the ETag
+    // changes with any value so clients can poll cheaply
+    server.on("/parameterValues", HTTP_GET, [](AsyncWebServerRequest *request) {
+        HeapScope heapScope(kHeapWeb);
+        char *values = (char *)malloc(PARAMETER_VALUES_SIZE);
+
+        if (values == NULL) {
+            request->send(500, "text/plain", "out of memory");
+            return;
+        }
+
+        size_t length;
+
+        {
+            ControlLock lock;
+            length = formatParameterValues(values, PARAMETER_VALUES_SIZE);
+        }
+        char etag[12];
+
+        snprintf(etag, sizeof(etag), "\"%08lx\"", (unsigned long)fnv1a(values, length));
+
+        if (length == 0) {
+            request->send(500, "text/plain", "values don't fit");
+        } else if (!sendNotModified(request, etag)) {
+            AsyncWebServerResponse *response = request->beginResponse(200, "application/json", values);
+            response->addHeader("ETag", etag);
+            response->addHeader("Cache-Control", "no-cache");
+            request->send(response);
+        }
+
+        free(values);
+    });
+
     server.on("/parameterHelp", HTTP_GET, [](AsyncWebServerRequest *request) {
+        HeapScope heapScope(kHeapWeb);
         DynamicJsonDocument doc(1024);
 
         AsyncWebParameter* p = request->getParam(0);
@@ -380,111 +834,177 @@ void serverSetup() {
         }
         const String& varValue = p->value();
 
-        skipHeaterISR = true;
+        const editable_t *e = findByName(editableVars, varValue.c_str());
 
-        try {
-            editable_t e = editableVars.at(varValue);
-            doc["name"] = varValue;
-            doc["helpText"] = e.helpText;
-        } catch (const std::out_of_range &exc) {
+        if (e == NULL) {
             request->send(404, "application/json", "parameter not found");
-            skipHeaterISR = false;
             return;
         }
 
+        doc["name"] = e->name;
+        doc["helpText"] = e->helpText != NULL ? e->helpText : "";
+
         String helpJson;
         serializeJson(doc, helpJson);
         request->send(200, "application/json", helpJson);
-
-        skipHeaterISR = false;
     });
 
     server.on("/temperatures", HTTP_GET, [](AsyncWebServerRequest *request) {
+        HeapScope heapScope(kHeapWeb);
         String json = getTempString();
         request->send(200, "application/json", json);
     });
 
-    // TODO: could send values also chunked and without json (but needs three
-    // endpoints then?)
-    // https://stackoverflow.com/questions/61559745/espasyncwebserver-serve-large-array-from-ram
+    // ?tier=<0..2> selects the resolution (see TempHistory), ?since=<sequence>
+    // only returns values stored after the given sequence number, the client
+    // passes the sequence number of its last response
     server.on("/timeseries", HTTP_GET, [](AsyncWebServerRequest *request) {
+        HeapScope heapScope(kHeapWeb);
+        timeseries_request_t ts;
+        ts.tier = 0;
+
+        if (request->hasParam("tier")) {
+            long tier = request->getParam("tier")->value().toInt();
+
+            if (tier < 0 || tier >= TempHistory::numTiers) {
+                request->send(400, "text/plain", "invalid tier");
+                return;
+            }
+
+            ts.tier = tier;
+        }
+
+        ts.channels = ts.tier == 0 ? 3 : TIMESERIES_MAX_CHANNELS;
+        ts.next = tempHistory.getNext(ts.tier);
+
+        uint32_t first = ts.next - tempHistory.getCount(ts.tier);
+
+        if (request->hasParam("since")) {
+            uint32_t since = strtoul(request->getParam("since")->value().c_str(), NULL, 10);
+
+            // a sequence number from the future means we rebooted, send everything
+            if (since > first && since <= ts.next) {
+                first = since;
+            }
+        }
+
+        ts.count = ts.next - first;
+
+        AsyncWebServerResponse *response = request->beginChunkedResponse("application/octet-stream",
+            [ts](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+                return fillTimeseries(ts, buffer, maxLen, index);
+            });
+
+        response->addHeader("Cache-Control", "no-store");
+        request->send(response);
+    });
+
+    // list of the recorded shots, ?id=<id> returns the binary shot file (see ShotRecorder.h)
+    server.on("/shots", HTTP_GET, [](AsyncWebServerRequest *request) {
+        HeapScope heapScope(kHeapWeb);
+        if (request->hasParam("id")) {
+            String path = ShotRecorder::getPath(strtoul(request->getParam("id")->value().c_str(), NULL, 10));
+
+            if (!LittleFS.exists(path)) {
+                request->send(404, "application/json",
+                                F("{ \"code\": 404, \"message\": "
+                                "\"Shot not found\"}"));
+                return;
+            }
+
+            request->send(LittleFS, path, "application/octet-stream");
+            return;
+        }
+
         AsyncResponseStream *response = request->beginResponseStream("application/json");
+        bool first = true;
 
-        // set capacity of json doc for history structure
-        DynamicJsonDocument doc(JSON_ARRAY_SIZE(2) + JSON_OBJECT_SIZE(3) + JSON_OBJECT_SIZE(HISTORY_LENGTH) * 3);
+        response->print('[');
 
-        // for each value in mem history array, add json array element
-        JsonArray currentTemps = doc.createNestedArray("currentTemps");
-        JsonArray targetTemps = doc.createNestedArray("targetTemps");
-        JsonArray heaterPowers = doc.createNestedArray("heaterPowers");
+        for (uint32_t id = shotRecorder.getFirstId(); id < shotRecorder.getNextId(); id++) {
+            File file = LittleFS.open(ShotRecorder::getPath(id), "r");
 
-        // go through history values backwards starting from currentIndex and
-        // wrap around beginning to include valueCount many values
-        for (int i = mod(historyCurrentIndex - historyValueCount, HISTORY_LENGTH);
-            i != mod(historyCurrentIndex, HISTORY_LENGTH);
-            i = mod(i + 1, HISTORY_LENGTH))
-        {
-            currentTemps.add(round2(tempHistory[0][i]));
-            targetTemps.add(round2(tempHistory[1][i]));
-            heaterPowers.add(round2(tempHistory[2][i]));
+            if (!file) continue;
+
+            shot_header_t header;
+            size_t len = file.read((uint8_t *)&header, sizeof(header));
+            file.close();
+
+            if (len != sizeof(header) || memcmp(header.magic, "CCSH", 4) != 0) continue;
+
+            response->printf("%s{\"id\":%lu,\"startTime\":%lu,\"duration\":%lu,\"samples\":%u,\"setpoint\":%.2f,\"weight\":%.1f}",
+                            first ? "" : ",", (unsigned long)header.id, (unsigned long)header.startTime,
+                            (unsigned long)header.duration, header.count, header.setpoint / 100.0, header.weight / 10.0);
+            first = false;
         }
 
-        serializeJson(doc, *response);
+        response->print(']');
         request->send(response);
     });
 
-    server.onNotFound([](AsyncWebServerRequest *request) {
-        request->send(404, "text/plain", "Not found");
+    server.on("/metrics", HTTP_GET, [](AsyncWebServerRequest *request) {
+        HeapScope heapScope(kHeapWeb);
+        AsyncResponseStream *response = request->beginResponseStream("text/plain; version=0.0.4");
+        writeMetrics(response);
+        request->send(response);
     });
 
-    // set up event handler for temperature messages
-    events.onConnect([](AsyncEventSourceClient *client) {
-        if (client->lastId()) {
-            debugPrintf("Reconnected, last message ID was: %u\n", client->lastId());
+    // heap usage and allocations per subsystem, see HeapProfiler.h
+    server.on("/diagnostics", HTTP_GET, [](AsyncWebServerRequest *request) {
+        HeapScope heapScope(kHeapWeb);
+        const heap_stats_t& heap = heapGetStats();
+
+        AsyncResponseStream *response = request->beginResponseStream("application/json");
+
+        response->printf("{\"uptime\":%lu,\"heap\":{\"size\":%lu,\"free\":%lu,\"largestFreeBlock\":%lu,\"minFree\":%lu,"
+                         "\"fragmentation\":%u,\"sampleTime\":%lu},\"allocations\":{",
+                         millis() / 1000, (unsigned long)heap.size, (unsigned long)heap.freeHeap,
+                         (unsigned long)heap.largestFreeBlock, (unsigned long)heap.minFreeHeap, heap.fragmentation, heap.time);
+
+        for (int i = 0; i < kHeapTagCount; i++) {
+            heap_tag_stats_t stats;
+            heapGetTagStats((HeapTag)i, stats);
+
+            response->printf("%s\"%s\":{\"count\":%lu,\"bytes\":%lu,\"failures\":%lu}", i > 0 ? "," : "",
+                             heapTagToString((HeapTag)i), (unsigned long)stats.allocations,
+                             (unsigned long)stats.bytes, (unsigned long)stats.failures);
         }
 
-        client->send("hello", NULL, millis(), 10000);
+        response->print("}}");
+        request->send(response);
+    });
+
+    server.onNotFound([](AsyncWebServerRequest *request) {
+        request->send(404, "text/plain", "Not found");
     });
 
-    server.addHandler(&events);
+    // live values for the website, see sendTelemetry()
+    telemetrySocket.onEvent(onTelemetryEvent);
+    server.addHandler(&telemetrySocket);
 
     // serve static files
     LittleFS.begin();
-    server.serveStatic("/css", LittleFS, "/css/", "max-age=604800");  // cache for one week
-    server.serveStatic("/js", LittleFS, "/js/", "max-age=604800");
+    // the pages reference scripts and stylesheets with the hash of their content
+    // (see build_web_assets.py), a new file system image changes their URLs
+    server.serveStatic("/css", LittleFS, "/css/", "max-age=31536000, immutable");
+    server.serveStatic("/js", LittleFS, "/js/", "max-age=31536000, immutable");
     server.serveStatic("/img", LittleFS, "/img/", "max-age=604800");  // cache for one week
     server.serveStatic("/webfonts", LittleFS, "/webfonts/", "max-age=604800");
-    server.serveStatic("/", LittleFS, "/html/", "max-age=604800").setDefaultFile("index.html").setTemplateProcessor(staticProcessor);
+    // pages are prepared by build_web_assets.py, everything but images and fonts is stored as .gz
+    // and sent with Content-Encoding: gzip. Pages are revalidated on every load, so they pick
+    // up new script versions right after a file system update.
+    server.serveStatic("/", LittleFS, "/html/", "no-cache").setDefaultFile("index.html");
 
     server.begin();
 
     debugPrintln(("Server started at " + WiFi.localIP().toString()).c_str());
 }
 
-//skip counter so we don't keep a value every second
-int skippedValues = 0;
-#define SECONDS_TO_SKIP 2
-
-void sendTempEvent(double currentTemp, double targetTemp, double heaterPower) {
+void addTempHistory(double currentTemp, double targetTemp, double heaterPower) {
     curTemp = currentTemp;
     tTemp = targetTemp;
     hPower = heaterPower;
 
-    // save all values in memory to show history
-    if (skippedValues > 0 && skippedValues % SECONDS_TO_SKIP == 0) {
-        // use array and int value for start index (round robin)
-        // one record (3 float values == 12 bytes) every three seconds, for half
-        // an hour -> 7.2kB of static memory
-        tempHistory[0][historyCurrentIndex] = (float)currentTemp;
-        tempHistory[1][historyCurrentIndex] = (float)targetTemp;
-        tempHistory[2][historyCurrentIndex] = (float)heaterPower;
-        historyCurrentIndex = (historyCurrentIndex + 1) % HISTORY_LENGTH;
-        historyValueCount = min(HISTORY_LENGTH - 1, historyValueCount + 1);
-        skippedValues = 0;
-    } else {
-        skippedValues++;
-    }
-
-    events.send("ping", NULL, millis());
-    events.send(getTempString().c_str(), "new_temps", millis());
+    // save all values in memory to show history, called once per second
+    tempHistory.add(currentTemp, targetTemp, heaterPower);
 }
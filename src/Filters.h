@@ -0,0 +1,264 @@
+/**
+ * @file Filters.h
+ *
+ * @brief Allocation-free sensor filters with constant cost per sample
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Fixed size ring of the last N values, index 0 is the oldest
+ */
+template <typename T, uint16_t N>
+class RingBuffer {
+    public:
+        RingBuffer() : _next(0), _count(0) {}
+
+        /**
+         * @brief Append a value, the oldest one is overwritten when the ring is full
+         *
+         * @return true if a value was overwritten, it is returned in evicted
+         */
+        bool push(const T& value, T& evicted) {
+            bool full = _count == N;
+
+            if (full) {
+                evicted = _values[_next];
+            } else {
+                _count++;
+            }
+
+            _values[_next] = value;
+            _next = (_next + 1) % N;
+
+            return full;
+        }
+
+        void reset() {
+            _next = 0;
+            _count = 0;
+        }
+
+        uint16_t size() const { return _count; }
+        bool full() const { return _count == N; }
+
+        const T& operator[](uint16_t i) const { return _values[(_next + N - _count + i) % N]; }
+        const T& newest() const { return _values[(_next + N - 1) % N]; }
+
+    private:
+        T _values[N];
+        uint16_t _next;
+        uint16_t _count;
+};
+
+/**
+ * @brief Average of the last N values using a running sum
+ */
+template <typename T, uint16_t N>
+class MovingAverage {
+    public:
+        MovingAverage() : _sum(0) {}
+
+        T add(T value) {
+            T evicted;
+
+            if (_ring.push(value, evicted)) {
+                _sum -= evicted;
+            }
+
+            _sum += value;
+
+            return get();
+        }
+
+        void reset() {
+            _ring.reset();
+            _sum = 0;
+        }
+
+        T get() const { return _ring.size() > 0 ? _sum / _ring.size() : 0; }
+        bool full() const { return _ring.full(); }
+
+    private:
+        RingBuffer<T, N> _ring;
+        T _sum;
+};
+
+/**
+ * @brief Least squares slope of the last N (time, value) samples in value/s.
+ *        Times are taken relative to the oldest sample, so the sums keep their
+ *        precision however long the machine runs. The sums are updated on every
+ *        sample and recomputed from the ring once per N samples, which keeps
+ *        rounding errors from adding up.
+ */
+template <uint16_t N>
+class SlopeEstimator {
+    public:
+        SlopeEstimator() { reset(); }
+
+        /**
+         * @param time  - millis() of the sample, samples must come in order
+         * @param value - measured value
+         *
+         * @return slope in value/s, 0 until there are two samples
+         */
+        double add(unsigned long time, double value) {
+            sample_t evicted;
+            sample_t sample = {time, value};
+
+            if (_ring.size() == 0) {
+                _base = time;
+            }
+
+            if (_ring.push(sample, evicted)) {
+                double x = seconds(evicted.time);
+                _sumX -= x;
+                _sumXX -= x * x;
+                _sumY -= evicted.value;
+                _sumXY -= x * evicted.value;
+            }
+
+            if (++_pushed >= N) {
+                recompute();
+            } else {
+                double x = seconds(time);
+                _sumX += x;
+                _sumXX += x * x;
+                _sumY += value;
+                _sumXY += x * value;
+            }
+
+            return get();
+        }
+
+        void reset() {
+            _ring.reset();
+            _base = 0;
+            _pushed = 0;
+            _sumX = _sumXX = _sumY = _sumXY = 0;
+        }
+
+        double get() const {
+            double n = _ring.size();
+            double denominator = n * _sumXX - _sumX * _sumX;
+
+            if (n < 2 || denominator <= 0) {
+                return 0;
+            }
+
+            return (n * _sumXY - _sumX * _sumY) / denominator;
+        }
+
+        bool full() const { return _ring.full(); }
+
+    private:
+        struct sample_t {
+            unsigned long time;
+            double value;
+        };
+
+        double seconds(unsigned long time) const { return (long)(time - _base) / 1000.0; }
+
+        void recompute() {
+            _base = _ring[0].time;
+            _pushed = 0;
+            _sumX = _sumXX = _sumY = _sumXY = 0;
+
+            for (uint16_t i = 0; i < _ring.size(); i++) {
+                double x = seconds(_ring[i].time);
+                _sumX += x;
+                _sumXX += x * x;
+                _sumY += _ring[i].value;
+                _sumXY += x * _ring[i].value;
+            }
+        }
+
+        RingBuffer<sample_t, N> _ring;
+        unsigned long _base;    // time of x = 0
+        uint16_t _pushed;       // samples since the last recompute()
+        double _sumX;
+        double _sumXX;
+        double _sumY;
+        double _sumXY;
+};
+
+/**
+ * @brief Exponential moving average, the first sample initializes the output
+ */
+template <typename T>
+class EmaFilter {
+    public:
+        /**
+         * @param alpha - weight of a new sample, 0..1, higher is faster
+         */
+        explicit EmaFilter(T alpha) : _alpha(alpha), _value(0), _initialized(false) {}
+
+        T add(T value) {
+            if (!_initialized) {
+                _value = value;
+                _initialized = true;
+            } else {
+                _value += _alpha * (value - _value);
+            }
+
+            return _value;
+        }
+
+        void reset() { _initialized = false; }
+        T get() const { return _value; }
+
+    private:
+        T _alpha;
+        T _value;
+        bool _initialized;
+};
+
+/**
+ * @brief Median of the last N values, removes single spikes. Meant for small
+ *        windows, the sorted copy costs O(N) per sample.
+ */
+template <typename T, uint16_t N>
+class MedianFilter {
+    public:
+        static_assert(N % 2 == 1, "MedianFilter needs an odd window");
+
+        MedianFilter() : _count(0) {}
+
+        T add(T value) {
+            T evicted;
+            uint16_t i;
+
+            if (_ring.push(value, evicted)) {
+                // remove the evicted value from the sorted window
+                for (i = 0; i < _count && _sorted[i] != evicted; i++) {}
+                for (; i + 1 < _count; i++) _sorted[i] = _sorted[i + 1];
+                _count--;
+            }
+
+            // insert the new one
+            for (i = _count; i > 0 && _sorted[i - 1] > value; i--) {
+                _sorted[i] = _sorted[i - 1];
+            }
+
+            _sorted[i] = value;
+            _count++;
+
+            return get();
+        }
+
+        void reset() {
+            _ring.reset();
+            _count = 0;
+        }
+
+        T get() const { return _count > 0 ? _sorted[_count / 2] : 0; }
+
+    private:
+        RingBuffer<T, N> _ring;
+        T _sorted[N];
+        uint16_t _count;
+};
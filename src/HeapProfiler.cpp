@@ -0,0 +1,171 @@
+/**
+ * @file HeapProfiler.cpp
+ *
+ * @brief Allocation counters per subsystem and heap fragmentation
+ *
+ *        malloc(), calloc() and realloc() are wrapped by the linker
+ *        (-Wl,--wrap in platformio.ini), so the calls of the Arduino core and
+ *        the libraries are counted as well, e.g. String and ArduinoJson. Direct
+ *        heap_caps_malloc() calls of ESP-IDF (WiFi, lwIP buffers) aren't.
+ */
+
+#include "HeapProfiler.h"
+
+#include <Arduino.h>
+#include <esp_attr.h>
+#include <esp_heap_caps.h>
+
+#include "debugSerial.h"
+
+struct heap_log_entry_t {
+    uint32_t size;
+    uint32_t caller;        // address of the malloc() call
+    HeapTag tag;
+    const char *task;
+};
+
+static __thread HeapTag heapTag = kHeapOther;
+
+static heap_tag_stats_t tagStats[kHeapTagCount];
+static heap_stats_t heapStats;
+
+#if HEAP_PROFILER_LOG_SIZE > 0
+    static portMUX_TYPE heapLogMux = portMUX_INITIALIZER_UNLOCKED;
+    static heap_log_entry_t heapLog[HEAP_PROFILER_LOG_ENTRIES];
+    static uint8_t heapLogCount = 0;
+    static uint32_t heapLogDropped = 0;
+#endif
+
+static const char *tagNames[kHeapTagCount] = {"other", "control", "web", "mqtt", "influxdb", "display", "storage"};
+
+
+/**
+ * @brief Count one allocation, called from the wrappers with the address they
+ *        were called from. Must not allocate itself.
+ */
+static inline void IRAM_ATTR heapCount(const void *ptr, size_t size, void *caller) {
+    // thread locals are only set up for tasks, global constructors run earlier
+    HeapTag tag = xTaskGetSchedulerState() == taskSCHEDULER_NOT_STARTED ? kHeapOther : heapTag;
+    heap_tag_stats_t& stats = tagStats[tag];
+
+    __atomic_add_fetch(&stats.allocations, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats.bytes, size, __ATOMIC_RELAXED);
+
+    if (ptr == NULL && size > 0) {
+        __atomic_add_fetch(&stats.failures, 1, __ATOMIC_RELAXED);
+    }
+
+    #if HEAP_PROFILER_LOG_SIZE > 0
+        if (size < HEAP_PROFILER_LOG_SIZE || xTaskGetSchedulerState() == taskSCHEDULER_NOT_STARTED) {
+            return;
+        }
+
+        // the top bits of a return address hold the register window increment
+        uint32_t address = ((uintptr_t)caller & 0x3FFFFFFF) | 0x40000000;
+
+        portENTER_CRITICAL(&heapLogMux);
+
+        if (heapLogCount < HEAP_PROFILER_LOG_ENTRIES) {
+            heap_log_entry_t& entry = heapLog[heapLogCount++];
+
+            entry.size = size;
+            entry.caller = address - 3;     // the call instruction before the return address
+            entry.tag = tag;
+            entry.task = pcTaskGetName(NULL);
+        } else {
+            heapLogDropped++;
+        }
+
+        portEXIT_CRITICAL(&heapLogMux);
+    #else
+        (void)caller;
+    #endif
+}
+
+extern "C" {
+    void *__real_malloc(size_t size);
+    void *__real_calloc(size_t count, size_t size);
+    void *__real_realloc(void *ptr, size_t size);
+
+    void *IRAM_ATTR __wrap_malloc(size_t size) {
+        void *ptr = __real_malloc(size);
+        heapCount(ptr, size, __builtin_return_address(0));
+
+        return ptr;
+    }
+
+    void *IRAM_ATTR __wrap_calloc(size_t count, size_t size) {
+        void *ptr = __real_calloc(count, size);
+        heapCount(ptr, count * size, __builtin_return_address(0));
+
+        return ptr;
+    }
+
+    void *IRAM_ATTR __wrap_realloc(void *ptr, size_t size) {
+        void *result = __real_realloc(ptr, size);
+
+        // realloc(ptr, 0) frees, it isn't an allocation
+        if (size > 0) {
+            heapCount(result, size, __builtin_return_address(0));
+        }
+
+        return result;
+    }
+}
+
+
+HeapScope::HeapScope(HeapTag tag) {
+    _previous = heapTag;
+    heapTag = tag;
+}
+
+HeapScope::~HeapScope() {
+    heapTag = _previous;
+}
+
+void heapProfilerSample() {
+    heapStats.size = heap_caps_get_total_size(MALLOC_CAP_8BIT);
+    heapStats.freeHeap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    heapStats.largestFreeBlock = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    heapStats.minFreeHeap = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+    heapStats.fragmentation = heapStats.freeHeap > 0 ? 100 - (uint64_t)heapStats.largestFreeBlock * 100 / heapStats.freeHeap : 0;
+    heapStats.time = millis();
+
+    #if HEAP_PROFILER_LOG_SIZE > 0
+        heap_log_entry_t entries[HEAP_PROFILER_LOG_ENTRIES];
+        uint8_t count;
+        uint32_t dropped;
+
+        // copy first, logging allocates
+        portENTER_CRITICAL(&heapLogMux);
+        count = heapLogCount;
+        dropped = heapLogDropped;
+        memcpy(entries, heapLog, count * sizeof(heap_log_entry_t));
+        heapLogCount = 0;
+        heapLogDropped = 0;
+        portEXIT_CRITICAL(&heapLogMux);
+
+        for (uint8_t i = 0; i < count; i++) {
+            LOG_INFO("Heap: %lu bytes by 0x%08lx in task %s (%s)\n", (unsigned long)entries[i].size,
+                     (unsigned long)entries[i].caller, entries[i].task, tagNames[entries[i].tag]);
+        }
+
+        if (dropped > 0) {
+            LOG_INFO("Heap: %lu more large allocations not logged\n", (unsigned long)dropped);
+        }
+    #endif
+}
+
+const heap_stats_t& heapGetStats() {
+    return heapStats;
+}
+
+void heapGetTagStats(HeapTag tag, heap_tag_stats_t& stats) {
+    stats.allocations = __atomic_load_n(&tagStats[tag].allocations, __ATOMIC_RELAXED);
+    stats.bytes = __atomic_load_n(&tagStats[tag].bytes, __ATOMIC_RELAXED);
+    stats.failures = __atomic_load_n(&tagStats[tag].failures, __ATOMIC_RELAXED);
+}
+
+const char *heapTagToString(HeapTag tag) {
+    return tag < kHeapTagCount ? tagNames[tag] : "unknown";
+}
@@ -0,0 +1,85 @@
+/**
+ * @file HeapProfiler.h
+ *
+ * @brief Allocation counters per subsystem and heap fragmentation
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "userConfig.h"
+
+// Not defined in older userConfig files
+#ifndef HEAP_PROFILER_LOG_SIZE
+    #define HEAP_PROFILER_LOG_SIZE 0        // log allocations of at least this many bytes, 0 = off
+#endif
+
+#define HEAP_SAMPLE_PERIOD 10000            // ms between two heapProfilerSample() calls
+#define HEAP_PROFILER_LOG_ENTRIES 16        // large allocations queued until the next heapProfilerSample()
+
+/**
+ * @brief Subsystem an allocation is counted for, set with HeapScope
+ */
+enum HeapTag : uint8_t {
+    kHeapOther,
+    kHeapControl,
+    kHeapWeb,
+    kHeapMqtt,
+    kHeapInflux,
+    kHeapDisplay,
+    kHeapStorage,
+    kHeapTagCount
+};
+
+// counters since boot, they wrap around, so only differences are meaningful
+struct heap_tag_stats_t {
+    uint32_t allocations;   // malloc(), calloc() and realloc() calls
+    uint32_t bytes;         // bytes requested by these calls
+    uint32_t failures;      // calls that returned NULL
+};
+
+struct heap_stats_t {
+    uint32_t size;              // total size of the 8 bit capable heap
+    uint32_t freeHeap;
+    uint32_t largestFreeBlock;
+    uint32_t minFreeHeap;       // lowest free heap since boot
+    uint8_t fragmentation;      // 100 - largest free block in % of the free heap
+    unsigned long time;         // millis() of the sample, 0 = not sampled yet
+};
+
+/**
+ * @brief Counts all allocations of the current task for a subsystem while it
+ *        exists. Scopes nest, the innermost one counts. Only for tasks, not
+ *        for ISRs or global constructors.
+ */
+class HeapScope {
+    public:
+        explicit HeapScope(HeapTag tag);
+        ~HeapScope();
+
+    private:
+        HeapTag _previous;
+};
+
+/**
+ * @brief Sample free heap, largest free block and the minimum free heap and
+ *        log the large allocations queued since the last call. Called
+ *        periodically by the telemetry task.
+ */
+void heapProfilerSample();
+
+/**
+ * @brief Last sample of heapProfilerSample(), the fields are updated one by
+ *        one so a reader in another task can see two different samples
+ */
+const heap_stats_t& heapGetStats();
+
+/**
+ * @brief Allocation counters of a subsystem
+ */
+void heapGetTagStats(HeapTag tag, heap_tag_stats_t& stats);
+
+const char *heapTagToString(HeapTag tag);
@@ -0,0 +1,113 @@
+/**
+ * @file Histogram.cpp
+ *
+ * @brief Fixed-size log-linear histogram for timing measurements
+ *
+ */
+
+#include "Histogram.h"
+
+#include <string.h>
+
+Histogram::Histogram() {
+    reset();
+}
+
+void Histogram::reset() {
+    memset(_buckets, 0, sizeof(_buckets));
+    _count = 0;
+    _min = 0;
+    _max = 0;
+    _sum = 0;
+}
+
+/**
+ * @brief Bucket of a value: values 0..3 have their own bucket, above that
+ *        every power of two is split into four linear sub-buckets
+ */
+int Histogram::bucketIndex(uint32_t value) {
+    if (value < (uint32_t)subBuckets) {
+        return value;
+    }
+
+    int exponent = 31 - __builtin_clz(value);   // >= 2
+
+    if (exponent >= maxExponent) {
+        return numBuckets - 1;
+    }
+
+    int sub = (value >> (exponent - 2)) & (subBuckets - 1);
+
+    return subBuckets + (exponent - 2) * subBuckets + sub;
+}
+
+/**
+ * @brief Largest value counted in a bucket
+ */
+uint32_t Histogram::bucketUpperBound(int index) {
+    if (index < subBuckets) {
+        return index;
+    }
+
+    int exponent = (index - subBuckets) / subBuckets + 2;
+    int sub = (index - subBuckets) % subBuckets;
+
+    return ((uint32_t)(subBuckets + sub + 1) << (exponent - 2)) - 1;
+}
+
+void Histogram::add(uint32_t value) {
+    _buckets[bucketIndex(value)]++;
+
+    if (_count == 0 || value < _min) _min = value;
+    if (value > _max) _max = value;
+
+    _count++;
+    _sum += value;
+}
+
+uint32_t Histogram::getCount() const {
+    return _count;
+}
+
+uint32_t Histogram::getMin() const {
+    return _min;
+}
+
+uint32_t Histogram::getMax() const {
+    return _max;
+}
+
+uint32_t Histogram::getAvg() const {
+    return _count > 0 ? (uint32_t)(_sum / _count) : 0;
+}
+
+uint64_t Histogram::getSum() const {
+    return _sum;
+}
+
+/**
+ * @brief Estimate a percentile from the buckets
+ *
+ * @param percentile - 0.0 .. 1.0, e.g. 0.99
+ *
+ * @return upper bound of the bucket containing the percentile, limited to the max value
+ */
+uint32_t Histogram::getPercentile(float percentile) const {
+    if (_count == 0) return 0;
+
+    uint32_t rank = (uint32_t)(percentile * _count + 0.5f);
+    uint32_t seen = 0;
+
+    if (rank < 1) rank = 1;
+
+    for (int i = 0; i < numBuckets; i++) {
+        seen += _buckets[i];
+
+        if (seen >= rank) {
+            uint32_t bound = bucketUpperBound(i);
+            return bound < _max ? bound : _max;
+        }
+    }
+
+    return _max;
+}
@@ -0,0 +1,44 @@
+/**
+ * @file Histogram.h
+ *
+ * @brief Fixed-size log-linear histogram for timing measurements
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * @brief Histogram with four buckets per power of two, values from 0 to ~4 s
+ *        in us. Adding a value is O(1) and does not allocate, percentiles have
+ *        a resolution of about 25%. Larger values are counted in the last bucket.
+ */
+class Histogram {
+    public:
+        Histogram();
+
+        void add(uint32_t value);
+        void reset();
+
+        uint32_t getCount() const;
+        uint32_t getMin() const;
+        uint32_t getMax() const;
+        uint32_t getAvg() const;
+        uint64_t getSum() const;
+        uint32_t getPercentile(float percentile) const;
+
+    private:
+        static const int subBuckets = 4;     // buckets per power of two
+        static const int maxExponent = 22;   // 2^22 us = ~4.2 s
+        static const int numBuckets = subBuckets + (maxExponent - 1) * subBuckets;
+
+        uint32_t _buckets[numBuckets];
+        uint32_t _count;
+        uint32_t _min;
+        uint32_t _max;
+        uint64_t _sum;
+
+        static int bucketIndex(uint32_t value);
+        static uint32_t bucketUpperBound(int index);
+};
@@ -1,58 +1,219 @@
 /**
  * @file ISR.cpp
  *
- * @brief TODO
+ * @brief Heater output modulation, runs once per mains half wave
  *
  */
 
 #include <Arduino.h>
+#include <driver/timer.h>
+#include <soc/gpio_struct.h>
 #include "ISR.h"
 #include "pinmapping.h"
 
-unsigned int isrCounter = 0;  // counter for ISR
+// The timer interrupt is registered with ESP_INTR_FLAG_IRAM, it keeps running
+// while the flash cache is disabled (LittleFS reads, EEPROM commits, OTA writes).
+// Everything it touches must therefore live in IRAM or DRAM: no digitalWrite(),
+// no flash-resident helpers and no const data in flash.
+#define HEATER_TIMER_GROUP TIMER_GROUP_0
+#define HEATER_TIMER TIMER_0
+
+unsigned int isrCounter = 0;  // ms counter running from 0 to 999, used for blinking on the display
 unsigned long windowStartTime;
-unsigned int windowSize = 1000;
-bool skipHeaterISR = false;
+unsigned int windowSize = 1000;  // PID sample time in ms and PID output range (promille)
 
+volatile uint32_t heaterDuty = 0;   // heater output 0..windowSize, set from the control task
+heater_modulation_t heaterModulation = {0, 0};    // advanced by the ISR only
+uint32_t isrCounterMicros = 0;
+volatile bool heaterTimerEnabled = false;
 
-void IRAM_ATTR onTimer(){
-    timerAlarmWrite(timer, 10000, true);
+#if HEATER_ZEROCROSS == 1
+    static uint64_t heaterLastStep = 0;   // timer count of the last heater step
+#endif
 
-    if (pidOutput <= isrCounter) {
-        digitalWrite(PIN_HEATER, LOW);
-    } else {
-        digitalWrite(PIN_HEATER, HIGH);
+
+/**
+ * @brief Switch the heater pin with a direct GPIO register write
+ */
+static inline void IRAM_ATTR heaterWrite(bool on) {
+    #if PIN_HEATER < 32
+        if (on) {
+            GPIO.out_w1ts = (1UL << PIN_HEATER);
+        } else {
+            GPIO.out_w1tc = (1UL << PIN_HEATER);
+        }
+    #else
+        if (on) {
+            GPIO.out1_w1ts.val = (1UL << (PIN_HEATER - 32));
+        } else {
+            GPIO.out1_w1tc.val = (1UL << (PIN_HEATER - 32));
+        }
+    #endif
+}
+
+
+/**
+ * @brief Decide if the heater is on for the next mains half wave
+ *      HEATER_MODULATION 0: one on-block at the beginning of every HEATER_WINDOW
+ *      HEATER_MODULATION 1: first order sigma-delta, on half waves are spread
+ *                           evenly, so the window length doesn't matter
+ *
+ * @param state - modulation state, advanced by one half wave
+ * @param duty - heater output 0..windowSize
+ * @param windowSize - full scale of duty
+ *
+ * @return true if the heater is on during this half wave
+ */
+bool IRAM_ATTR heaterModulationStep(heater_modulation_t& state, uint32_t duty, uint32_t windowSize) {
+    bool heaterOn;
+
+    #if HEATER_MODULATION == 1
+        state.accumulator += duty;
+
+        if (state.accumulator >= windowSize) {
+            state.accumulator -= windowSize;
+            heaterOn = true;
+        } else {
+            heaterOn = false;
+        }
+    #else
+        heaterOn = state.step * windowSize < duty * HEATER_WINDOW_STEPS;
+    #endif
+
+    if (++state.step >= HEATER_WINDOW_STEPS) {
+        state.step = 0;
     }
 
-    isrCounter += 10; // += 10 because one tick = 10ms
+    return heaterOn;
+}
+
+
+/**
+ * @brief Switch the heater for the next mains half wave and advance the display counter
+ */
+static inline void IRAM_ATTR heaterStep() {
+    heaterWrite(heaterModulationStep(heaterModulation, heaterDuty, windowSize));
+
+    isrCounterMicros += HEATER_STEP_US;
 
-    //set PID output as relais commands
-    if (isrCounter >= windowSize) {
-        isrCounter = 0;
+    if (isrCounterMicros >= 1000000) {
+        isrCounterMicros -= 1000000;
     }
+
+    isrCounter = isrCounterMicros / 1000;
 }
 
 
 /**
- * @brief Initialize hardware timers
+ * @brief Timer ISR, switches the heater for every mains half wave
+ *      HEATER_ZEROCROSS 0: the timer runs free, a zero-cross SSR delays
+ *                          every switch to the next zero crossing
+ *      HEATER_ZEROCROSS 1: only fires if a zero crossing was missed, e.g.
+ *                          while the flash cache is disabled
+ */
+static bool IRAM_ATTR onTimer(void *) {
+    #if HEATER_ZEROCROSS == 1
+        uint64_t now = timer_group_get_counter_value_in_isr(HEATER_TIMER_GROUP, HEATER_TIMER);
+
+        // a zero crossing stepped just before the alarm
+        if (now - heaterLastStep >= HEATER_STEP_US / 2) {
+            heaterStep();
+            heaterLastStep = now;
+        }
+
+        timer_group_set_alarm_value_in_isr(HEATER_TIMER_GROUP, HEATER_TIMER, heaterLastStep + HEATER_STEP_US);
+    #else
+        heaterStep();
+    #endif
+
+    return false;  // no higher priority task woken
+}
+
+
+#if HEATER_ZEROCROSS == 1
+    /**
+     * @brief Zero-cross ISR, steps the heater at the beginning of every half
+     *        wave and moves the timer alarm behind the next crossing
+     */
+    static void IRAM_ATTR onZeroCross() {
+        if (!heaterTimerEnabled) {
+            return;
+        }
+
+        uint64_t now = timer_group_get_counter_value_in_isr(HEATER_TIMER_GROUP, HEATER_TIMER);
+
+        // detector glitches and a crossing right after a timer step
+        if (now - heaterLastStep < HEATER_STEP_US / 2) {
+            return;
+        }
+
+        heaterStep();
+        heaterLastStep = now;
+
+        timer_group_set_alarm_value_in_isr(HEATER_TIMER_GROUP, HEATER_TIMER, now + HEATER_STEP_US + HEATER_STEP_US / 4);
+    }
+#endif
+
+
+/**
+ * @brief Set heater output for the modulation ISR
+ *
+ * @param output - heater output 0..windowSize (PID output)
+ */
+void heaterSetOutput(double output) {
+    if (output <= 0) {
+        heaterDuty = 0;
+    } else if (output >= windowSize) {
+        heaterDuty = windowSize;
+    } else {
+        heaterDuty = (uint32_t)(output + 0.5);
+    }
+}
+
+
+/**
+ * @brief Initialize the heater timer, the heater pin must already be an output
  */
 void initTimer1(void) {
-        timer = timerBegin(0, 80, true); //m
-        timerAttachInterrupt(timer, &onTimer, true);//m
-        timerAlarmWrite(timer, 10000, true);//m
+    timer_config_t config = {};
+    config.divider = 80;                    // 1 MHz timer clock
+    config.counter_dir = TIMER_COUNT_UP;
+    config.counter_en = TIMER_PAUSE;
+    config.alarm_en = TIMER_ALARM_EN;
+    #if HEATER_ZEROCROSS == 1
+        config.auto_reload = TIMER_AUTORELOAD_DIS;  // the ISRs move the alarm
+    #else
+        config.auto_reload = TIMER_AUTORELOAD_EN;
+    #endif
+
+    timer_init(HEATER_TIMER_GROUP, HEATER_TIMER, &config);
+    timer_set_counter_value(HEATER_TIMER_GROUP, HEATER_TIMER, 0);
+    timer_set_alarm_value(HEATER_TIMER_GROUP, HEATER_TIMER, HEATER_STEP_US);  // one mains half wave
+    timer_enable_intr(HEATER_TIMER_GROUP, HEATER_TIMER);
+    timer_isr_callback_add(HEATER_TIMER_GROUP, HEATER_TIMER, onTimer, NULL, ESP_INTR_FLAG_IRAM);
+
+    #if HEATER_ZEROCROSS == 1
+        // The GPIO interrupt isn't IRAM safe, the timer steps while it is held off.
+        // Both interrupts are allocated on this core, so they don't run concurrently.
+        pinMode(PIN_ZC, INPUT);
+        attachInterrupt(digitalPinToInterrupt(PIN_ZC), onZeroCross, RISING);
+    #endif
 }
 
 
 void enableTimer1(void) {
-    timerAlarmEnable(timer);
+    timer_start(HEATER_TIMER_GROUP, HEATER_TIMER);
+    heaterTimerEnabled = true;
 }
 
 
 void disableTimer1(void) {
-    timerAlarmDisable(timer);
+    timer_pause(HEATER_TIMER_GROUP, HEATER_TIMER);
+    heaterTimerEnabled = false;
+    heaterWrite(false);
 }
 
 
 bool isTimer1Enabled(void) {
-    return timerAlarmEnabled(timer);
+    return heaterTimerEnabled;
 }
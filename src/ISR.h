@@ -7,15 +7,50 @@
 
 #pragma once
 
+#include <stdint.h>
+#include "userConfig.h"
+
+// Heater modulation, not defined in older userConfig files
+#ifndef MAINS_FREQUENCY
+    #define MAINS_FREQUENCY 50
+#endif
+
+#ifndef HEATER_MODULATION
+    #define HEATER_MODULATION 0
+#endif
+
+#ifndef HEATER_ZEROCROSS
+    #define HEATER_ZEROCROSS 0
+#endif
+
+#ifndef HEATER_WINDOW
+    #define HEATER_WINDOW 1000
+#endif
+
+// One heater step is one mains half wave, zero-cross SSRs can't switch faster anyway
+#define HEATER_STEP_US (1000000 / (2 * MAINS_FREQUENCY))
+#define HEATER_WINDOW_STEPS ((HEATER_WINDOW * 2 * MAINS_FREQUENCY) / 1000)
+
+static_assert(MAINS_FREQUENCY == 50 || MAINS_FREQUENCY == 60, "MAINS_FREQUENCY must be 50 or 60");
+static_assert((HEATER_WINDOW * 2 * MAINS_FREQUENCY) % 1000 == 0, "HEATER_WINDOW must be a multiple of the mains half wave");
+static_assert(HEATER_WINDOW_STEPS > 0, "HEATER_WINDOW too small");
+
+/**
+ * @brief State of the heater modulation, advanced once per mains half wave
+ */
+struct heater_modulation_t {
+    uint32_t step;          // current step within the modulation window
+    uint32_t accumulator;   // sigma-delta accumulator
+};
+
 extern unsigned long windowStartTime;
 extern double pidOutput;
 extern unsigned int isrCounter;
 extern unsigned int windowSize;
-extern bool skipHeaterISR;
-
-extern hw_timer_t *timer;
 
 void initTimer1(void);
 void enableTimer1(void);
 void disableTimer1(void);
 bool isTimer1Enabled(void);
+void heaterSetOutput(double output);
+bool heaterModulationStep(heater_modulation_t& state, uint32_t duty, uint32_t windowSize);
@@ -9,16 +9,58 @@
 
 #include "userConfig.h"
 #include <InfluxDbClient.h>
+#include <time.h>
+
+// Batching, not defined in older userConfig files
+#ifndef INFLUXDB_FLUSH_INTERVAL
+    #define INFLUXDB_FLUSH_INTERVAL 10000
+#endif
+
+#ifndef INFLUXDB_BUFFER_SIZE
+    #define INFLUXDB_BUFFER_SIZE 300
+#endif
+
+#define INFLUXDB_BATCH_SIZE 4096        // bytes of line protocol per write request
+#define INFLUXDB_MAX_BACKOFF 300000     // ms, upper limit of the retry delay after failed writes
+#define INFLUXDB_MIN_VALID_TIME 1577836800  // unix time before this means NTP didn't sync yet
 
 
 // InfluxDB Client
 InfluxDBClient influxClient(INFLUXDB_URL, INFLUXDB_DB_NAME);
-Point influxSensor("machineState");
 const unsigned long intervalInflux = INFLUXDB_INTERVAL;
-unsigned long previousMillisInflux;  // initialisation at the end of init()
-boolean influxdb_healthy = true;
-const int influxdb_retries = INFLUXDB_RETRIES;
-int influxdb_tries = 0;
+
+/**
+ * @brief One point of the machineState measurement, kept in the ring until it
+ *        was written successfully
+ */
+struct influx_sample_t {
+    unsigned long timestamp;    // millis()
+    float temperature;
+    float setpoint;
+    float heaterPower;
+    float kp;
+    float ki;
+    float kd;
+    float brewtime;
+    float preinfusion;
+    float preinfusionpause;
+    uint8_t pidON;
+    uint8_t steamON;
+};
+
+influx_sample_t *influxRing = NULL;     // INFLUXDB_BUFFER_SIZE samples, allocated in influxDbSetup()
+uint32_t influxHead = 0;                // sequence number of the next sample
+uint32_t influxTail = 0;                // sequence number of the oldest unsent sample
+uint32_t influxDropped = 0;             // samples lost because the ring was full
+SemaphoreHandle_t influxMutex = NULL;   // protects ring, head and tail
+
+char *influxBatch = NULL;               // line protocol of one write request
+char influxFieldSuffix[32];             // ,mac="..." field of every point, computed once
+TaskHandle_t influxTaskHandle = NULL;
+unsigned long influxBackoff = INFLUXDB_FLUSH_INTERVAL;
+
+void influxTask(void *params);
+
 
 void influxDbSetup() {
     if (INFLUXDB_AUTH_TYPE == 1) {
@@ -33,56 +75,175 @@ void influxDbSetup() {
         influxClient.setInsecure();
         debugPrintf("InfluxDB setInsecure");
     }
+
+    // we batch and retry ourselves, the client only sends what it gets
+    influxClient.setWriteOptions(WriteOptions().writePrecision(WritePrecision::S).batchSize(1).bufferSize(2).retryInterval(0));
+
+    // timestamps of buffered samples need the real time
+    configTime(0, 0, "pool.ntp.org", "time.nist.gov");
+
+    byte mac[6];
+    WiFi.macAddress(mac);
+    snprintf(influxFieldSuffix, sizeof(influxFieldSuffix), ",mac=\"%u%u%u%u%u%u\"",
+             mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+
+    influxRing = (influx_sample_t *)calloc(INFLUXDB_BUFFER_SIZE, sizeof(influx_sample_t));
+    influxBatch = (char *)malloc(INFLUXDB_BATCH_SIZE);
+    influxMutex = xSemaphoreCreateMutex();
+
+    if (influxRing == NULL || influxBatch == NULL || influxMutex == NULL) {
+        debugPrintln("InfluxDB: not enough memory for the sample buffer, InfluxDB disabled");
+        free(influxRing);
+        free(influxBatch);
+        influxRing = NULL;
+        influxBatch = NULL;
+        return;
+    }
+
+    xTaskCreatePinnedToCore(influxTask, "influx", 8192, NULL, 1, &influxTaskHandle, 0);
+}
+
+
+/**
+ * @brief Add the current control state to the sample ring, called by the
+ *        telemetry scheduler every intervalInflux ms. Samples are taken while
+ *        offline as well, the oldest are dropped when the ring is full.
+ */
+void addInfluxSample() {
+    if (influxRing == NULL) {
+        return;
+    }
+
+    influx_sample_t sample;
+    sample.timestamp = millis();
+    sample.temperature = controlState.temperature;
+    sample.setpoint = controlState.setpoint;
+    sample.heaterPower = controlState.pidOutput;
+    sample.kp = controlState.kp;
+    sample.ki = controlState.ki;
+    sample.kd = controlState.kd;
+    sample.brewtime = brewtime;
+    sample.preinfusion = preinfusion;
+    sample.preinfusionpause = preinfusionpause;
+    sample.pidON = controlState.pidON;
+    sample.steamON = controlState.steamON;
+
+    xSemaphoreTake(influxMutex, portMAX_DELAY);
+
+    if (influxHead - influxTail >= INFLUXDB_BUFFER_SIZE) {
+        influxTail++;
+        influxDropped++;
+    }
+
+    influxRing[influxHead % INFLUXDB_BUFFER_SIZE] = sample;
+    influxHead++;
+
+    xSemaphoreGive(influxMutex);
 }
 
 
 /**
- * @brief
+ * @brief Format unsent samples as line protocol into influxBatch
+ *
+ * @param first - receives the sequence number of the first sample in the batch
  *
+ * @return number of samples in the batch
  */
-void sendInflux() {
-    if (influxdb_healthy) {
-        unsigned long currentMillisInflux = millis();
-        if (currentMillisInflux - previousMillisInflux >= intervalInflux) {
-            previousMillisInflux = currentMillisInflux;
-            influxSensor.clearFields();
-            influxSensor.addField("value", temperature);
-            influxSensor.addField("setpoint", setpoint);
-            influxSensor.addField("HeaterPower", pidOutput);
-            influxSensor.addField("Kp", bPID.GetKp());
-            influxSensor.addField("Ki", bPID.GetKi());
-            influxSensor.addField("Kd", bPID.GetKd());
-            influxSensor.addField("pidON", pidON);
-            influxSensor.addField("brewtime", brewtime);
-            influxSensor.addField("preinfusionpause", preinfusionpause);
-            influxSensor.addField("preinfusion", preinfusion);
-            influxSensor.addField("steamON", steamON);
-
-            byte mac[6];
-            WiFi.macAddress(mac);
-            String macaddr0 = number2string(mac[0]);
-            String macaddr1 = number2string(mac[1]);
-            String macaddr2 = number2string(mac[2]);
-            String macaddr3 = number2string(mac[3]);
-            String macaddr4 = number2string(mac[4]);
-            String macaddr5 = number2string(mac[5]);
-            String completemac = macaddr0 + macaddr1 + macaddr2 + macaddr3 + macaddr4 + macaddr5;
-            influxSensor.addField("mac", completemac);
-
-            // Write point
-            if (!influxClient.writePoint(influxSensor)) {
-                debugPrintf("InfluxDB write failed: %s\n", influxClient.getLastErrorMessage().c_str());
-                influxdb_tries++;
-                debugPrintf("InfluxDB retries %i\n", influxdb_tries);
-                if (influxdb_tries >= influxdb_retries) {
-                    influxdb_healthy = false;
-                    debugPrintln("InlfuxDB retries reached therefore we disable InfluxDB");
-                }
-            }
-            else {
-                // Set it back to 0 on successful transmission
-                influxdb_tries = 0;
-            }
+uint32_t formatInfluxBatch(uint32_t &first) {
+    time_t now = time(NULL);
+    unsigned long nowMillis = millis();
+    size_t len = 0;
+    uint32_t count = 0;
+
+    xSemaphoreTake(influxMutex, portMAX_DELAY);
+
+    first = influxTail;
+
+    for (uint32_t seq = influxTail; seq != influxHead; seq++) {
+        const influx_sample_t &s = influxRing[seq % INFLUXDB_BUFFER_SIZE];
+        char timestamp[16] = "";
+
+        // without a synchronized clock the server assigns the time
+        if (now >= INFLUXDB_MIN_VALID_TIME) {
+            snprintf(timestamp, sizeof(timestamp), " %lu", (unsigned long)(now - (nowMillis - s.timestamp) / 1000));
+        }
+
+        int n = snprintf(influxBatch + len, INFLUXDB_BATCH_SIZE - len,
+                         "machineState value=%.2f,setpoint=%.2f,HeaterPower=%.2f,Kp=%.2f,Ki=%.2f,Kd=%.2f,"
+                         "pidON=%ui,brewtime=%.2f,preinfusionpause=%.2f,preinfusion=%.2f,steamON=%ui%s%s\n",
+                         s.temperature, s.setpoint, s.heaterPower, s.kp, s.ki, s.kd,
+                         (unsigned int)s.pidON, s.brewtime, s.preinfusionpause, s.preinfusion, (unsigned int)s.steamON,
+                         influxFieldSuffix, timestamp);
+
+        if (n < 0 || len + n >= INFLUXDB_BATCH_SIZE) {
+            break;  // batch full, the rest goes with the next one
+        }
+
+        len += n;
+        count++;
+    }
+
+    xSemaphoreGive(influxMutex);
+
+    influxBatch[len] = '\0';
+
+    return count;
+}
+
+
+/**
+ * @brief Write all unsent samples in batches
+ *
+ * @return 0 on success or if there was nothing to send, <0 if a write failed
+ */
+int flushInflux() {
+    while (true) {
+        uint32_t first;
+        uint32_t count = formatInfluxBatch(first);
+
+        if (count == 0) {
+            return 0;
+        }
+
+        if (!influxClient.writeRecord(influxBatch)) {
+            debugPrintf("InfluxDB write failed: %s\n", influxClient.getLastErrorMessage().c_str());
+            return -1;
+        }
+
+        // samples may have been dropped in the meantime, never move the tail back
+        xSemaphoreTake(influxMutex, portMAX_DELAY);
+
+        if ((int32_t)(first + count - influxTail) > 0) {
+            influxTail = first + count;
+        }
+
+        xSemaphoreGive(influxMutex);
+    }
+}
+
+
+/**
+ * @brief Background task writing the sample ring to InfluxDB every
+ *        INFLUXDB_FLUSH_INTERVAL ms. Failed writes are retried with an
+ *        exponential backoff up to INFLUXDB_MAX_BACKOFF, samples stay in the
+ *        ring until then.
+ */
+void influxTask(void *) {
+    HeapScope heapScope(kHeapInflux);
+
+    while (true) {
+        vTaskDelay(pdMS_TO_TICKS(influxBackoff));
+
+        if (!isNetworkOnline()) {
+            continue;
+        }
+
+        if (flushInflux() == 0) {
+            influxBackoff = INFLUXDB_FLUSH_INTERVAL;
+        } else {
+            influxBackoff = min(influxBackoff * 2, (unsigned long)INFLUXDB_MAX_BACKOFF);
+            debugPrintf("InfluxDB: retrying in %lu s, %lu samples buffered, %lu dropped\n",
+                        influxBackoff / 1000, (unsigned long)(influxHead - influxTail), (unsigned long)influxDropped);
         }
     }
 }
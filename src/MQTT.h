@@ -10,13 +10,20 @@
 #include "userConfig.h"
 #include <os.h>
 #include <Arduino.h>
-#include <PubSubClient.h>
+#include <AsyncMqttClient.h>
+#include <atomic>
+#include <vector>
 
-unsigned long previousMillisMQTT;   // initialisation at the end of init()
-const unsigned long intervalMQTT = 5000;
+const unsigned long intervalMQTT = 1000;   // interval of writeSysParamsToMQTT() in the telemetry scheduler, only changed values are sent
+const unsigned long intervalMQTTFullRefresh = 300000;  // all values are republished this often and after (re)connecting
 
-WiFiClient net;
-PubSubClient mqtt(net);
+#define MQTT_OUTBOUND_QUEUE_LENGTH 64     // messages waiting for the TCP send buffer
+#define MQTT_TOPIC_SIZE 128
+#define MQTT_PAYLOAD_SIZE 32              // parameter and sensor values, discovery messages don't go through the queue
+#define MQTT_INBOUND_QUEUE_LENGTH 8
+#define MQTT_CONNECT_TIMEOUT 10000        // ms
+
+AsyncMqttClient mqtt;
 
 const char *mqtt_server_ip = MQTT_SERVER_IP;
 const int mqtt_server_port = MQTT_SERVER_PORT;
@@ -30,21 +37,79 @@ char topic_set[256];
 unsigned long lastMQTTConnectionAttempt = millis();
 unsigned int MQTTReCnctCount = 0;
 
-extern std::map<const char*, std::function<editable_t*()>, cmp_str> mqttVars;
-extern std::map<const char*, std::function<double()>, cmp_str> mqttSensors;
+/**
+ * @brief Connection state, the AsyncTCP callbacks only set the state, all the
+ *      work is done by checkMQTT() in the telemetry task
+ */
+enum MQTTConnectionState {
+    kMQTTDisconnected,
+    kMQTTConnecting,
+    kMQTTConnected,     // waiting for checkMQTT() to subscribe
+    kMQTTSubscribed
+};
+
+std::atomic<MQTTConnectionState> mqttConnectionState(kMQTTDisconnected);
+
+/**
+ * @brief Outbound message, one of the MQTT_OUTBOUND_QUEUE_LENGTH slots of mqttMessagePool
+ */
+struct mqtt_message_t {
+    char topic[MQTT_TOPIC_SIZE];
+    char payload[MQTT_PAYLOAD_SIZE];
+    size_t length;
+    bool retain;
+};
+
+/**
+ * @brief Received message, only short payloads (parameter values) are accepted
+ */
+struct mqtt_inbound_t {
+    char topic[MQTT_TOPIC_SIZE];
+    char payload[MQTT_PAYLOAD_SIZE];
+    unsigned int length;
+};
+
+// every slot is either in mqttFreeMessages or in mqttOutbound
+mqtt_message_t mqttMessagePool[MQTT_OUTBOUND_QUEUE_LENGTH];
+QueueHandle_t mqttFreeMessages = NULL;  // mqtt_message_t *, unused slots of mqttMessagePool
+QueueHandle_t mqttOutbound = NULL;      // mqtt_message_t *, sent by mqttFlushOutbound()
+QueueHandle_t mqttInbound = NULL;       // mqtt_inbound_t, handled by checkMQTT()
 
-struct DiscoveryObject {
-  String discovery_topic;
-  String payload_json;
+/**
+ * @brief Value reported to MQTT, only published again once it changed by more than deadband
+ */
+struct mqtt_sensor_t {
+    std::function<double()> value;
+    double deadband;
 };
 
+// mqttVars (see Parameters.h) is defined in main.cpp before this file is included
+extern std::map<const char*, mqtt_sensor_t, cmp_str> mqttSensors;
+
+/**
+ * @brief Topic of a parameter or sensor with the value it was last published with
+ */
+struct mqtt_publication_t {
+    String topic;                   // full topic, built once in mqttPublicationsSetup()
+    const editable_t *var;          // parameter, NULL for sensors
+    const mqtt_sensor_t *sensor;    // sensor, NULL for parameters
+    bool published;                 // lastValue/lastNumber are valid
+    double lastNumber;
+    char lastValue[24];
+};
+
+std::vector<mqtt_publication_t> mqttPublications;
+String mqttStatusTopic;
+unsigned long lastMQTTFullRefresh = 0;
+bool mqttFullRefreshPending = true;
+
 /**
  * @brief Get the string name corresponding to a MACHINE enum value.
  * 
  * @param machine The MACHINE enum value.
- * @return String The string name of the MACHINE.
+ * @return The string name of the MACHINE.
  */
-String getMachineName(MACHINE machine) {
+const char *getMachineName(MACHINE machine) {
     switch (machine) {
         case RancilioSilvia:
             return "RancilioSilvia";
@@ -60,77 +125,189 @@ String getMachineName(MACHINE machine) {
 }
 
 
+void mqtt_callback(char *topic, byte *data, unsigned int length);
+void sendHASSIODiscoveryMsg();
+void mqttFlushHASSIODiscovery();
+
+
 /**
- * @brief Check if MQTT is connected, if not reconnect. Abort function if offline or brew is running
- *      MQTT is also using maxWifiReconnects!
+ * @brief Queue a message for publishing, never blocks
+ *
+ * @param topic full topic
+ * @param payload message
+ * @param retain retain flag
+ * @return 0 = queued, <0 = not connected, too long or queue full
  */
-void checkMQTT() {
-    if (offlineMode == 1 || brewcounter > kBrewIdle) return;
-
-    if ((millis() - lastMQTTConnectionAttempt >= wifiConnectionDelay) && (MQTTReCnctCount <= maxWifiReconnects)) {
-        if (!mqtt.connected()) {
-            lastMQTTConnectionAttempt = millis();  // Reconnection Timer Function
-            MQTTReCnctCount++;                     // Increment reconnection Counter
-            debugPrintf("Attempting MQTT reconnection: %i\n", MQTTReCnctCount);
-
-            if (mqtt.connect(hostname, mqtt_username, mqtt_password, topic_will, 0, true, "offline")) {
-                mqtt.subscribe(topic_set);
-                debugPrintf("Subscribed to MQTT Topic: %s\n", topic_set);
-            }   // Try to reconnect to the server; connect() is a blocking
-                // function, watch the timeout!
-            else {
-                debugPrintf("Failed to connect to MQTT due to reason: %i\n", mqtt.state());
-            }
-        }
+int mqttEnqueue(const char *topic, const char *payload, bool retain) {
+  if (mqttOutbound == NULL || mqttConnectionState != kMQTTSubscribed) {
+    return -1;
+  }
+
+  size_t payloadLength = strlen(payload);
+
+  if (strlen(topic) >= MQTT_TOPIC_SIZE || payloadLength >= MQTT_PAYLOAD_SIZE) {
+    return -2;
+  }
+
+  mqtt_message_t *msg;
+
+  if (xQueueReceive(mqttFreeMessages, &msg, 0) != pdTRUE) {
+    return -3;
+  }
+
+  strcpy(msg->topic, topic);
+  memcpy(msg->payload, payload, payloadLength + 1);
+  msg->length = payloadLength;
+  msg->retain = retain;
+
+  // can't fail, the queue has a place for every slot
+  xQueueSend(mqttOutbound, &msg, 0);
+
+  return 0;
+}
+
+
+/**
+ * @brief Hand queued messages to the MQTT client as long as the TCP send
+ *      buffer has space, the rest stays queued for the next call
+ */
+void mqttFlushOutbound() {
+  mqtt_message_t *msg;
+
+  while (xQueuePeek(mqttOutbound, &msg, 0) == pdTRUE) {
+    if (mqtt.publish(msg->topic, 0, msg->retain, msg->payload, msg->length) == 0) {
+      break;
     }
+
+    xQueueReceive(mqttOutbound, &msg, 0);
+    xQueueSend(mqttFreeMessages, &msg, 0);
+  }
 }
 
 
 /**
- * @brief Publish Data to MQTT
+ * @brief Drop all queued messages, they are sent again with the full refresh after reconnecting
  */
-bool mqtt_publish(const char *reading, char *payload, boolean retain = false) {
-    char topic[120];
-    snprintf(topic, 120, "%s%s/%s", mqtt_topic_prefix, hostname, reading);
-    return mqtt.publish(topic, payload, retain);
+void mqttClearOutbound() {
+  mqtt_message_t *msg;
+
+  while (xQueueReceive(mqttOutbound, &msg, 0) == pdTRUE) {
+    xQueueSend(mqttFreeMessages, &msg, 0);
+  }
 }
 
 
 /**
- * @brief Publishes a large message to an MQTT topic, splitting it into smaller chunks if necessary.
- *
- * @param topic The MQTT topic to publish the message to.
- * @param largeMessage The large message to be published.
- * @return 0 if the message was successfully published, otherwise an MQTT error code.
+ * @brief Set up the MQTT client, connecting is done by checkMQTT()
  */
-int PublishLargeMessage(const String& topic, const String& largeMessage) {
-  const size_t splitSize = 128; // Maximum Message Size
-  const size_t messageLength = largeMessage.length();
-
-  if (messageLength > splitSize) {
-    size_t count = messageLength / splitSize;
-    mqtt.beginPublish(topic.c_str(), messageLength, true);
-
-    for (size_t i = 0; i < count; i++) {
-      size_t startIndex = i * splitSize;
-      size_t endIndex = startIndex + splitSize;
-      mqtt.print(largeMessage.substring(startIndex, endIndex));
+void mqttSetup() {
+  mqttOutbound = xQueueCreate(MQTT_OUTBOUND_QUEUE_LENGTH, sizeof(mqtt_message_t *));
+  mqttFreeMessages = xQueueCreate(MQTT_OUTBOUND_QUEUE_LENGTH, sizeof(mqtt_message_t *));
+
+  for (mqtt_message_t& slot : mqttMessagePool) {
+    mqtt_message_t *msg = &slot;
+    xQueueSend(mqttFreeMessages, &msg, 0);
+  }
+  mqttInbound = xQueueCreate(MQTT_INBOUND_QUEUE_LENGTH, sizeof(mqtt_inbound_t));
+
+  mqtt.setServer(mqtt_server_ip, mqtt_server_port);
+  mqtt.setCredentials(mqtt_username, mqtt_password);
+  mqtt.setClientId(hostname);
+  mqtt.setWill(topic_will, 0, true, "offline");
+
+  // these run in the AsyncTCP task
+  mqtt.onConnect([](bool) {
+    mqttConnectionState = kMQTTConnected;
+  });
+
+  mqtt.onDisconnect([](AsyncMqttClientDisconnectReason) {
+    mqttConnectionState = kMQTTDisconnected;
+  });
+
+  mqtt.onMessage([](char *topic, char *payload, AsyncMqttClientMessageProperties, size_t len, size_t index, size_t total) {
+    mqtt_inbound_t msg;
+
+    // parameter values are short, anything split into several parts is not for us
+    if (index != 0 || len != total || len >= sizeof(msg.payload) || strlen(topic) >= sizeof(msg.topic)) {
+      return;
     }
 
-    mqtt.print(largeMessage.substring(count * splitSize));
-    int publishResult = mqtt.endPublish();
-    if (publishResult == 0) {
-      debugPrintln("[MQTT] PublishLargeMessage sent failed");
-      return 1;
+    strcpy(msg.topic, topic);
+    memcpy(msg.payload, payload, len);
+    msg.payload[len] = '\0';
+    msg.length = len;
+
+    xQueueSend(mqttInbound, &msg, 0);
+  });
+}
+
+
+/**
+ * @brief MQTT connection state machine, called by the telemetry task on every pass.
+ *      Connects, subscribes after the connection was established, sends queued
+ *      messages and handles received ones. Nothing in here blocks on the broker.
+ *      MQTT is also using maxWifiReconnects!
+ */
+void checkMQTT() {
+    HeapScope heapScope(kHeapMqtt);
+
+    if (offlineMode == 1 || mqttOutbound == NULL) return;
+
+    switch (mqttConnectionState) {
+        case kMQTTDisconnected:
+            if ((millis() - lastMQTTConnectionAttempt >= wifiConnectionDelay) && (MQTTReCnctCount <= maxWifiReconnects)) {
+                lastMQTTConnectionAttempt = millis();  // Reconnection Timer Function
+                MQTTReCnctCount++;                     // Increment reconnection Counter
+                debugPrintf("Attempting MQTT reconnection: %i\n", MQTTReCnctCount);
+
+                mqttClearOutbound();
+                mqttConnectionState = kMQTTConnecting;
+                mqtt.connect();
+            }
+            break;
+
+        case kMQTTConnecting:
+            if (millis() - lastMQTTConnectionAttempt >= MQTT_CONNECT_TIMEOUT) {
+                debugPrintln("Failed to connect to MQTT: timeout");
+                mqtt.disconnect(true);
+                mqttConnectionState = kMQTTDisconnected;
+            }
+            break;
+
+        case kMQTTConnected:
+            mqtt.subscribe(topic_set, 0);
+            debugPrintf("Subscribed to MQTT Topic: %s\n", topic_set);
+            MQTTReCnctCount = 0;
+            mqttConnectionState = kMQTTSubscribed;
+
+            #if MQTT_HASSIO_SUPPORT == 1
+                // Home Assistant announces restarts here, it needs the discovery messages again then
+                mqtt.subscribe(MQTT_HASSIO_DISCOVERY_PREFIX "/status", 0);
+                sendHASSIODiscoveryMsg();
+            #endif
+
+            // the broker may have lost our retained values, send everything again
+            mqttFullRefreshPending = true;
+            triggerMQTTPublish();
+            break;
+
+        case kMQTTSubscribed:
+            break;
     }
-    else {
-      return 0;
+
+    mqttFlushOutbound();
+
+    #if MQTT_HASSIO_SUPPORT == 1
+        if (mqttConnectionState == kMQTTSubscribed) {
+            mqttFlushHASSIODiscovery();
+        }
+    #endif
+
+    mqtt_inbound_t msg;
+
+    while (xQueueReceive(mqttInbound, &msg, 0) == pdTRUE) {
+        mqtt_callback(msg.topic, (byte *)msg.payload, msg.length);
     }
-  } 
-  else {
-    boolean publishResult = mqtt.publish(topic.c_str(), largeMessage.c_str());
-    return publishResult ? 0 : -1; // Return 0 for success, -1 for failure
-  }
 }
 
 
@@ -141,35 +318,38 @@ int PublishLargeMessage(const String& topic, const String& largeMessage) {
  * @param value MQTT value
  */
 void assignMQTTParam(char *param, double value) {
-    try
+    const mqtt_var_t *mqttVar = findByName(mqttVars, param);
+    const editable_t *var = mqttVar != NULL && mqttVar->enabled ? findByName(editableVars, mqttVar->param) : NULL;
+
+    if (var == NULL) {
+        debugPrintf("%s is not a valid MQTT parameter.\n", param);
+        return;
+    }
+
+    if (var->var.type == kCString) {
+        debugPrintf("%s is not a recognized type for this MQTT parameter.\n", param);
+        return;
+    }
+
     {
-        editable_t *var = mqttVars.at(param)();
-        if (value >= var->minValue && value <= var->maxValue) {
-            switch (var->type) {
-                case kDouble:
-                    *(double *)var->ptr = value;
-                    mqtt_publish(param, number2string(value), true);
-                    break;
-                case kUInt8:
-                    *(uint8_t *)var->ptr = value;
-                    if (strcasecmp(param, "steamON") == 0) {
-                        steamFirstON = value;
-                    }
-                    mqtt_publish(param, number2string(value), true);
-                    writeSysParamsToStorage();
-                    break;
-                default:
-                    debugPrintf("%s is not a recognized type for this MQTT parameter.\n", var->type);
-                    break;
-            }
-        }
-        else {
+        ControlLock lock;
+
+        if (setEditableNumber(*var, value) != 0) {
             debugPrintf("Value out of range for MQTT parameter %s\n", param);
+            return;
+        }
+
+        if (var->var.type != kDouble) {
+            if (strcasecmp(param, "steamON") == 0) {
+                steamFirstON = value;
+            }
+
+            writeSysParamsToStorage();
         }
     }
-    catch(const std::out_of_range& e) {
-        debugPrintf("%s is not a valid MQTT parameter.\n", param);
-    }
+
+    wakeControlTask();
+    triggerMQTTPublish();
 }
 
 
@@ -177,9 +357,10 @@ void assignMQTTParam(char *param, double value) {
  * @brief MQTT Callback Function: set Parameters through MQTT
  */
 void mqtt_callback(char *topic, byte *data, unsigned int length) {
+    HeapScope heapScope(kHeapMqtt);
+
     char topic_str[256];
-    os_memcpy(topic_str, topic, sizeof(topic_str));
-    topic_str[255] = '\0';
+    strlcpy(topic_str, topic, sizeof(topic_str));
     char data_str[length + 1];
     os_memcpy(data_str, data, length);
     data_str[length] = '\0';
@@ -188,6 +369,19 @@ void mqtt_callback(char *topic, byte *data, unsigned int length) {
     char cmd[64];
     double data_double;
 
+    #if MQTT_HASSIO_SUPPORT == 1
+        // Home Assistant birth message
+        if (strcmp(topic_str, MQTT_HASSIO_DISCOVERY_PREFIX "/status") == 0) {
+            if (strcmp(data_str, "online") == 0) {
+                debugPrintln("Home Assistant is online, sending discovery messages");
+                sendHASSIODiscoveryMsg();
+                mqttFullRefreshPending = true;
+                triggerMQTTPublish();
+            }
+            return;
+        }
+    #endif
+
     snprintf(topic_pattern, sizeof(topic_pattern), "%s%s/%%[^\\/]/%%[^\\/]", mqtt_topic_prefix, hostname);
 
     if ((sscanf(topic_str, topic_pattern, &configVar, &cmd) != 2) || (strcmp(cmd, "set") != 0)) {
@@ -203,298 +397,296 @@ void mqtt_callback(char *topic, byte *data, unsigned int length) {
 
 
 /**
- * @brief Send all current system parameter values to MQTT
+ * @brief Build the publication table with the full topic of every parameter
+ *      and sensor, must be called once after mqttSensors are set up
+ */
+void mqttPublicationsSetup() {
+  mqttPublications.clear();
+  mqttPublications.reserve(sizeof(mqttVars) / sizeof(mqttVars[0]) + mqttSensors.size());
+
+  for (const mqtt_var_t& mqttVar : mqttVars) {
+    const editable_t *var = findByName(editableVars, mqttVar.param);
+
+    if (!mqttVar.enabled || var == NULL) {
+      continue;
+    }
+
+    mqtt_publication_t pub = {};
+    pub.topic = String(mqtt_topic_prefix) + hostname + "/" + mqttVar.name;
+    pub.var = var;
+    mqttPublications.push_back(pub);
+  }
+
+  for (const auto& pair : mqttSensors) {
+    mqtt_publication_t pub = {};
+    pub.topic = String(mqtt_topic_prefix) + hostname + "/" + pair.first;
+    pub.sensor = &pair.second;
+    mqttPublications.push_back(pub);
+  }
+
+  mqttStatusTopic = String(mqtt_topic_prefix) + hostname + "/status";
+  mqttFullRefreshPending = true;
+}
+
+
+/**
+ * @brief Format the current value of a publication the way it is published
+ *
+ * @param pub publication
+ * @param number receives the numeric value (for the deadband)
+ * @return formatted value (static buffer of number2string())
+ */
+const char *formatMQTTValue(const mqtt_publication_t& pub, double& number) {
+  if (pub.sensor != NULL) {
+    number = pub.sensor->value();
+    return number2string(number);
+  }
+
+  const editable_t *e = pub.var;
+
+  switch (e->var.type) {
+    case kDouble:
+    case kDoubletime:
+      controlLock();
+      number = *e->var.doublePtr;
+      controlUnlock();
+      return number2string(number);
+    case kInteger:
+      number = *e->var.intPtr;
+      return number2string(*e->var.intPtr);
+    case kUInt8:
+      number = *e->var.uint8Ptr;
+      return number2string(*e->var.uint8Ptr);
+    case kCString:
+    default:
+      number = 0;
+      return e->var.cString;
+  }
+}
+
+
+/**
+ * @brief Send changed system parameters and sensor values to MQTT, called by the
+ *      telemetry scheduler every intervalMQTT ms and after parameters were changed.
+ *      All values are published retained, parameters whenever their value changes,
+ *      sensors once they moved by more than their deadband. Everything is sent again
+ *      every intervalMQTTFullRefresh ms and after reconnecting.
  *
  * @param continueOnError Flag to specify whether to continue publishing messages in case of an error (default: true)
- * @return 0 = success, MQTT error code = failure
+ * @return 0 = success, <0 = a message couldn't be queued (see mqttEnqueue())
  */
 int writeSysParamsToMQTT(bool continueOnError = true) {
-  unsigned long currentMillisMQTT = millis();
-  if ((currentMillisMQTT - previousMillisMQTT >= intervalMQTT) && MQTT == 1) {
-    previousMillisMQTT = currentMillisMQTT;
+  HeapScope heapScope(kHeapMqtt);
 
-    if (mqtt.connected()) {
-      mqtt_publish("status", (char *)"online");
+  if (mqttConnectionState != kMQTTSubscribed || MQTT != 1) {
+    return 0;
+  }
 
-      int errorState = 0; // MQTT error state
+  bool fullRefresh = mqttFullRefreshPending || (millis() - lastMQTTFullRefresh >= intervalMQTTFullRefresh);
+  int errorState = 0; // MQTT error state
 
-      for (const auto& pair : mqttVars) {
-        editable_t *e = pair.second();
+  if (fullRefresh) {
+    errorState = mqttEnqueue(mqttStatusTopic.c_str(), "online", true);
+  }
 
-        switch (e->type) {
-          case kDouble:
-            if (!mqtt_publish(pair.first, number2string(*(double *)e->ptr), true))
-              errorState = mqtt.state();
-            break;
-          case kDoubletime:
-            if (!mqtt_publish(pair.first, number2string(*(double *)e->ptr), true))
-              errorState = mqtt.state();
-            break;
-          case kInteger:
-            if (!mqtt_publish(pair.first, number2string(*(int *)e->ptr), true))
-              errorState = mqtt.state();
-            break;
-          case kUInt8:
-            if (!mqtt_publish(pair.first, number2string(*(uint8_t *)e->ptr), true))
-              errorState = mqtt.state();
-            break;
-          case kCString:
-            if (!mqtt_publish(pair.first, number2string(*(char *)e->ptr), true))
-              errorState = mqtt.state();
-            break;
-        }
+  for (mqtt_publication_t& pub : mqttPublications) {
+    double number;
+    const char *value = formatMQTTValue(pub, number);
 
-        if (errorState != 0 && !continueOnError) {
-          // An error occurred and continueOnError is false, return the error state
-          return errorState;
-        }
+    if (!fullRefresh && pub.published) {
+      if (pub.sensor != NULL) {
+        if (fabs(number - pub.lastNumber) <= pub.sensor->deadband) continue;
+      } else if (strcmp(value, pub.lastValue) == 0) {
+        continue;
       }
+    }
 
-      for (const auto& pair : mqttSensors) {
-        if (!mqtt_publish(pair.first, number2string(pair.second())))
-          errorState = mqtt.state();
+    // all state topics are retained, so subscribers (e.g. Home Assistant)
+    // get the current values right away after they or we restarted
+    int result = mqttEnqueue(pub.topic.c_str(), value, true);
 
-        if (errorState != 0 && !continueOnError) {
-          // An error occurred and continueOnError is false, return the error state
-          return errorState;
-        }
+    if (result == 0) {
+      pub.published = true;
+      pub.lastNumber = number;
+      strlcpy(pub.lastValue, value, sizeof(pub.lastValue));
+    } else {
+      errorState = result;
+
+      if (!continueOnError) {
+        // An error occurred and continueOnError is false, return the error state
+        return errorState;
       }
     }
   }
 
-  return 0; // Success
+  // retry the full refresh on the next call if anything failed
+  if (fullRefresh && errorState == 0) {
+    mqttFullRefreshPending = false;
+    lastMQTTFullRefresh = millis();
+  }
+
+  return errorState;
 }
 
 
+enum HassioComponent {
+    kHassioNumber,
+    kHassioSensor,
+    kHassioSwitch
+};
+
 /**
- * @brief Generate a switch device for Home Assistant MQTT discovery
- *
- * This function generates a switch device configuration for Home Assistant MQTT discovery. It creates a `DiscoveryObject` containing the necessary information for Home Assistant to discover and control the switch device.
- *
- * @param name The name of the switch (used in MQTT topics)
- * @param displayName The display name of the switch (shown in Home Assistant)
- * @param payload_on The payload value to turn the switch on (default: "1")
- * @param payload_off The payload value to turn the switch off (default: "0")
- * @return A `DiscoveryObject` containing the switch device configuration
+ * @brief Entity announced to Home Assistant, the state topic is <prefix><hostname>/<name>
  */
-DiscoveryObject GenerateSwitchDevice(String name, String displayName, String payload_on = "1", String payload_off = "0") {
-  String mqtt_topic = String(mqtt_topic_prefix) + String(hostname);
-  DiscoveryObject switch_device;
-  String unique_id = "clevercoffee-" + String(hostname);
-  String SwitchDiscoveryTopic = String(MQTT_HASSIO_DISCOVERY_PREFIX) + "/switch/";
-
-  String switch_command_topic = mqtt_topic + "/"+ name +"/set";
-  String switch_state_topic = mqtt_topic + "/"+ name;
-
-  switch_device.discovery_topic = SwitchDiscoveryTopic + unique_id + "-"+ name +"" +"/config";
-  
-  DynamicJsonDocument DeviceMapDoc(1024);
-  char DeviceMapBuffer[256];
-  DeviceMapDoc["identifiers"] = String(hostname);
-  DeviceMapDoc["manufacturer"] = "CleverCoffee";
-  DeviceMapDoc["model"] = getMachineName(machine);
-  DeviceMapDoc["name"] = String(hostname);
-  
-  DynamicJsonDocument switchConfigDoc(512);
-  switchConfigDoc["name"] = displayName;
-  switchConfigDoc["command_topic"] = switch_command_topic;
-  switchConfigDoc["state_topic"] = switch_state_topic;
-  switchConfigDoc["unique_id"] = unique_id + "-"+name;
-  switchConfigDoc["payload_on"] = payload_on;
-  switchConfigDoc["payload_off"] = payload_off;
-  switchConfigDoc["payload_available"] = "online";
-  switchConfigDoc["payload_not_available"] = "offline";
-  switchConfigDoc["availability_topic"] = mqtt_topic+"/status";
-
-  JsonObject switchDeviceField = switchConfigDoc.createNestedObject("device");
-  for (JsonPair keyValue : DeviceMapDoc.as<JsonObject>()) {
-    switchDeviceField[keyValue.key()] = keyValue.value();
-  }
+struct hassio_entity_t {
+    HassioComponent component;
+    const char *name;           // used in MQTT topics
+    const char *displayName;    // shown in Home Assistant
+    const char *unit;           // number and sensor
+    const char *deviceClass;    // sensor
+    int minValue;               // number
+    int maxValue;               // number
+    float step;                 // number
+};
+
+const char *const hassioComponentNames[] = {"number", "sensor", "switch"};
+
+const hassio_entity_t hassioEntities[] = {
+    // Number Devices
+    {kHassioNumber, "brewSetpoint", "Brew setpoint", "°C", NULL, BREW_SETPOINT_MIN, BREW_SETPOINT_MAX, 0.1},
+    {kHassioNumber, "steamSetpoint", "Steam setpoint", "°C", NULL, STEAM_SETPOINT_MIN, STEAM_SETPOINT_MAX, 0.1},
+    {kHassioNumber, "brewTempOffset", "Brew Temp. Offset", "°C", NULL, BREW_TEMP_OFFSET_MIN, BREW_TEMP_OFFSET_MAX, 0.1},
+    {kHassioNumber, "brewPidDelay", "Brew Pid Delay", "", NULL, BREW_PID_DELAY_MIN, BREW_PID_DELAY_MAX, 0.1},
+    {kHassioNumber, "brewFFPower", "Brew Heater Boost", "%", NULL, BREW_FF_POWER_MIN, BREW_FF_POWER_MAX, 1},
+    {kHassioNumber, "brewFFStart", "Brew Heater Boost Start", "s", NULL, BREW_FF_START_MIN, BREW_FF_START_MAX, 0.1},
+    {kHassioNumber, "brewFFTime", "Brew Heater Boost Time", "s", NULL, BREW_FF_TIME_MIN, BREW_FF_TIME_MAX, 0.1},
+    {kHassioNumber, "startKp", "Start kP", "", NULL, PID_KP_START_MIN, PID_KP_START_MAX, 0.1},
+    {kHassioNumber, "startTn", "Start Tn", "", NULL, PID_TN_START_MIN, PID_TN_START_MAX, 0.1},
+    {kHassioNumber, "steamKp", "Start Kp", "", NULL, PID_KP_STEAM_MIN, PID_KP_STEAM_MAX, 0.1},
+    {kHassioNumber, "aggKp", "aggKp", "", NULL, PID_KP_REGULAR_MIN, PID_KP_REGULAR_MAX, 0.1},
+    {kHassioNumber, "aggTn", "aggTn", "", NULL, PID_TN_REGULAR_MIN, PID_TN_REGULAR_MAX, 0.1},
+    {kHassioNumber, "aggTv", "aggTv", "", NULL, PID_TV_REGULAR_MIN, PID_TV_REGULAR_MAX, 0.1},
+    {kHassioNumber, "aggIMax", "aggIMax", "", NULL, PID_I_MAX_REGULAR_MIN, PID_I_MAX_REGULAR_MAX, 0.1},
+    {kHassioNumber, "brewtime", "Brew time", "s", NULL, BREW_TIME_MIN, BREW_TIME_MAX, 0.1},
+    // Sensor Devices
+    {kHassioSensor, "temperature", "Boiler Temperature", "°C", "temperature", 0, 0, 0},
+    {kHassioSensor, "heaterPower", "Heater Power", "ms", "power_factor", 0, 0, 0},
+#if PRESSURESENSOR == 1
+    {kHassioSensor, "pressure", "Pressure", "bar", "pressure", 0, 0, 0},
+#endif
+    // Switch Devices
+    {kHassioSwitch, "pidON", "Use PID", NULL, NULL, 0, 0, 0},
+    {kHassioSwitch, "steamON", "Steam", NULL, NULL, 0, 0, 0},
+    {kHassioSwitch, "backflushON", "Backflush", NULL, NULL, 0, 0, 0},
+    {kHassioSwitch, "startUsePonM", "Use PonM", NULL, NULL, 0, 0, 0}
+};
 
-  String switchConfigDocBuffer;
-  serializeJson(switchConfigDoc, switchConfigDocBuffer);
+#define HASSIO_ENTITY_COUNT (sizeof(hassioEntities) / sizeof(hassioEntities[0]))
 
+size_t hassioNextEntity = HASSIO_ENTITY_COUNT;  // discovery message to publish next, all sent
 
-  switch_device.payload_json = switchConfigDocBuffer;
-  return switch_device;
-}
+// scratch space for one discovery message, reused for every entity
+char hassioTopic[160];
+char hassioStateTopic[128];
+char hassioCommandTopic[128];
+char hassioAvailabilityTopic[128];
+char hassioUniqueId[96];
+char hassioStep[8];
+char hassioPayload[768];
+StaticJsonDocument<768> hassioDoc;
 
 
 /**
- * @brief Generate a sensor device for Home Assistant MQTT discovery
- *
- * This function generates a sensor device configuration for Home Assistant MQTT discovery. It creates a `DiscoveryObject` containing the necessary information for Home Assistant to discover and monitor the sensor device.
+ * @brief Serialize the discovery message of an entity into hassioTopic and hassioPayload
  *
- * @param name The name of the sensor (used in MQTT topics)
- * @param displayName The display name of the sensor (shown in Home Assistant)
- * @param unit_of_measurement The unit of measurement for the sensor data (default: "°C")
- * @return A `DiscoveryObject` containing the sensor device configuration
+ * @param entity entity to announce
+ * @return length of the payload, 0 if it didn't fit
  */
-DiscoveryObject GenerateSensorDevice(String name, String displayName, String unit_of_measurement = "°C", String device_class = "temperature") {
-  String mqtt_topic = String(mqtt_topic_prefix) + String(hostname);
-  DiscoveryObject sensor_device;
-  String unique_id = "clevercoffee-" + String(hostname);
-  String SensorDiscoveryTopic = String(MQTT_HASSIO_DISCOVERY_PREFIX) + "/sensor/";
-
-  String sensor_state_topic = mqtt_topic + "/"+ name;
-  sensor_device.discovery_topic = SensorDiscoveryTopic + unique_id + "-"+ name +"" +"/config";
-  
-  DynamicJsonDocument DeviceMapDoc(1024);
-  char DeviceMapBuffer[256];
-  DeviceMapDoc["identifiers"] = String(hostname);
-  DeviceMapDoc["manufacturer"] = "CleverCoffee";
-  DeviceMapDoc["model"] = getMachineName(machine);
-  DeviceMapDoc["name"] = String(hostname);
-  
-  DynamicJsonDocument sensorConfigDoc(512);
-  sensorConfigDoc["name"] = displayName;
-  sensorConfigDoc["state_topic"] = sensor_state_topic;
-  sensorConfigDoc["unique_id"] = unique_id + "-"+name;
-  sensorConfigDoc["unit_of_measurement"] = unit_of_measurement;
-  sensorConfigDoc["device_class"] = device_class;
-  sensorConfigDoc["payload_available"] = "online";
-  sensorConfigDoc["payload_not_available"] = "offline";
-  sensorConfigDoc["availability_topic"] = mqtt_topic+"/status";
-
-  JsonObject sensorDeviceField = sensorConfigDoc.createNestedObject("device");
-  for (JsonPair keyValue : DeviceMapDoc.as<JsonObject>()) {
-    sensorDeviceField[keyValue.key()] = keyValue.value();
+size_t formatHASSIODiscoveryMsg(const hassio_entity_t& entity) {
+  const char *device = hassioComponentNames[entity.component];
+
+  snprintf(hassioUniqueId, sizeof(hassioUniqueId), "clevercoffee-%s-%s", hostname, entity.name);
+  snprintf(hassioTopic, sizeof(hassioTopic), "%s/%s/%s/config", MQTT_HASSIO_DISCOVERY_PREFIX, device, hassioUniqueId);
+  snprintf(hassioStateTopic, sizeof(hassioStateTopic), "%s%s/%s", mqtt_topic_prefix, hostname, entity.name);
+  snprintf(hassioCommandTopic, sizeof(hassioCommandTopic), "%s%s/%s/set", mqtt_topic_prefix, hostname, entity.name);
+  snprintf(hassioAvailabilityTopic, sizeof(hassioAvailabilityTopic), "%s%s/status", mqtt_topic_prefix, hostname);
+
+  // all strings are stored as pointers, the document doesn't copy them
+  hassioDoc.clear();
+  hassioDoc["name"] = entity.displayName;
+  hassioDoc["state_topic"] = (const char *)hassioStateTopic;
+  hassioDoc["unique_id"] = (const char *)hassioUniqueId;
+
+  switch (entity.component) {
+    case kHassioNumber:
+      snprintf(hassioStep, sizeof(hassioStep), "%.2f", entity.step);
+      hassioDoc["command_topic"] = (const char *)hassioCommandTopic;
+      hassioDoc["min"] = entity.minValue;
+      hassioDoc["max"] = entity.maxValue;
+      hassioDoc["step"] = (const char *)hassioStep;
+      hassioDoc["unit_of_measurement"] = entity.unit;
+      hassioDoc["mode"] = "box";
+      break;
+    case kHassioSensor:
+      hassioDoc["unit_of_measurement"] = entity.unit;
+      hassioDoc["device_class"] = entity.deviceClass;
+      break;
+    case kHassioSwitch:
+      hassioDoc["command_topic"] = (const char *)hassioCommandTopic;
+      hassioDoc["payload_on"] = "1";
+      hassioDoc["payload_off"] = "0";
+      break;
   }
 
-  String sensorConfigDocBuffer;
-  serializeJson(sensorConfigDoc, sensorConfigDocBuffer);
+  hassioDoc["payload_available"] = "online";
+  hassioDoc["payload_not_available"] = "offline";
+  hassioDoc["availability_topic"] = (const char *)hassioAvailabilityTopic;
 
+  JsonObject deviceField = hassioDoc.createNestedObject("device");
+  deviceField["identifiers"] = (const char *)hostname;
+  deviceField["manufacturer"] = "CleverCoffee";
+  deviceField["model"] = getMachineName(machine);
+  deviceField["name"] = (const char *)hostname;
+
+  if (hassioDoc.overflowed()) {
+    return 0;
+  }
 
-  sensor_device.payload_json = sensorConfigDocBuffer;
-  return sensor_device;
+  size_t length = serializeJson(hassioDoc, hassioPayload, sizeof(hassioPayload));
+
+  return length < sizeof(hassioPayload) - 1 ? length : 0;
 }
 
 
 /**
- * @brief Generate a number device for Home Assistant MQTT discovery
- *
- * This function generates a number device configuration for Home Assistant MQTT discovery. It creates a `DiscoveryObject` containing the necessary information for Home Assistant to discover and control the number device.
- *
- * @param name The name of the number device (used in MQTT topics)
- * @param displayName The display name of the number device (shown in Home Assistant)
- * @param min_value The minimum value allowed for the number device
- * @param max_value The maximum value allowed for the number device
- * @param steps_value The step value for incrementing/decrementing the number device value
- * @param unit_of_measurement The unit of measurement for the number device (default: "°C")
- * @param ui_mode Control how the number should be displayed in the UI
- * @return A `DiscoveryObject` containing the number device configuration
+ * @brief Send MQTT Homeassistant Discovery Messages, called after connecting
+ *      to the broker and when Home Assistant announces it (re)started. Only
+ *      starts sending, see mqttFlushHASSIODiscovery().
  */
-DiscoveryObject GenerateNumberDevice(String name, String displayName, int min_value, int max_value, float steps_value, String unit_of_measurement = "°C", String ui_mode = "box") {
-  String mqtt_topic = String(mqtt_topic_prefix) + String(hostname);
-  DiscoveryObject number_device;
-  String unique_id = "clevercoffee-" + String(hostname);
-
-  String NumberDiscoveryTopic = String(MQTT_HASSIO_DISCOVERY_PREFIX) + "/number/";
-  number_device.discovery_topic = NumberDiscoveryTopic + unique_id + "-"+ name +"" +"/config";
-
-  DynamicJsonDocument DeviceMapDoc(1024);
-  char DeviceMapBuffer[256];
-  DeviceMapDoc["identifiers"] = String(hostname);
-  DeviceMapDoc["manufacturer"] = "CleverCoffee";
-  DeviceMapDoc["model"] = getMachineName(machine);
-  DeviceMapDoc["name"] = String(hostname);
-
-  DynamicJsonDocument numberConfigDoc(512);
-  numberConfigDoc["name"] = displayName;
-  numberConfigDoc["command_topic"] = mqtt_topic + "/"+ name + "/set";
-  numberConfigDoc["state_topic"] = mqtt_topic + "/"+ name;
-  numberConfigDoc["unique_id"] = unique_id + "-"+name;
-  numberConfigDoc["min"] = min_value;  // Minimum value
-  numberConfigDoc["max"] = max_value;  // Maximum value
-  numberConfigDoc["step"] = String(steps_value,2);  // Steps value
-  numberConfigDoc["unit_of_measurement"] = unit_of_measurement;
-  numberConfigDoc["mode"] = ui_mode;
-  numberConfigDoc["payload_available"] = "online";
-  numberConfigDoc["payload_not_available"] = "offline";
-  numberConfigDoc["availability_topic"] = mqtt_topic+"/status";
-
-  JsonObject numberDeviceField = numberConfigDoc.createNestedObject("device");
-  for (JsonPair keyValue : DeviceMapDoc.as<JsonObject>()) {
-    numberDeviceField[keyValue.key()] = keyValue.value();
-  }
-
-  String numberConfigDocBuffer;
-  serializeJson(numberConfigDoc, numberConfigDocBuffer);
-
-
-  number_device.payload_json = numberConfigDocBuffer;
-  return number_device;
+void sendHASSIODiscoveryMsg() {
+  hassioNextEntity = 0;
 }
 
+
 /**
- * @brief Send MQTT Homeassistant Discovery Messages
- * @return 0 if successful, MQTT connection error code if failed to send messages
+ * @brief Publish the pending discovery messages as long as the TCP send buffer
+ *      has space, called by checkMQTT(). The messages are too big for the
+ *      outbound queue, they are built one after another in a fixed scratch
+ *      buffer and published from there.
  */
-int sendHASSIODiscoveryMsg() {
-// Number Devices
-  DiscoveryObject brewSetpoint = GenerateNumberDevice("brewSetpoint", "Brew setpoint", BREW_SETPOINT_MIN, BREW_SETPOINT_MAX, 0.1, "°C"); 
-  DiscoveryObject steamSetPoint = GenerateNumberDevice("steamSetpoint", "Steam setpoint", STEAM_SETPOINT_MIN, STEAM_SETPOINT_MAX, 0.1, "°C"); 
-  DiscoveryObject brewTempOffset = GenerateNumberDevice("brewTempOffset", "Brew Temp. Offset", BREW_TEMP_OFFSET_MIN, BREW_TEMP_OFFSET_MAX, 0.1, "°C"); 
-  DiscoveryObject brewPidDelay = GenerateNumberDevice("brewPidDelay", "Brew Pid Delay", BREW_PID_DELAY_MIN, BREW_PID_DELAY_MAX, 0.1, ""); 
-  DiscoveryObject startKp = GenerateNumberDevice("startKp", "Start kP", PID_KP_START_MIN, PID_KP_START_MAX, 0.1, ""); 
-  DiscoveryObject startTn = GenerateNumberDevice("startTn", "Start Tn", PID_TN_START_MIN, PID_TN_START_MAX, 0.1, ""); 
-  DiscoveryObject steamKp = GenerateNumberDevice("steamKp", "Start Kp", PID_KP_STEAM_MIN, PID_KP_STEAM_MAX, 0.1, ""); 
-  DiscoveryObject aggKp = GenerateNumberDevice("aggKp", "aggKp", PID_KP_REGULAR_MIN, PID_KP_REGULAR_MAX, 0.1, ""); 
-  DiscoveryObject aggTn = GenerateNumberDevice("aggTn", "aggTn", PID_TN_REGULAR_MIN, PID_TN_REGULAR_MAX, 0.1, ""); 
-  DiscoveryObject aggTv = GenerateNumberDevice("aggTv", "aggTv", PID_TV_REGULAR_MIN, PID_TV_REGULAR_MAX, 0.1, ""); 
-  DiscoveryObject aggIMax = GenerateNumberDevice("aggIMax", "aggIMax", PID_I_MAX_REGULAR_MIN, PID_I_MAX_REGULAR_MAX, 0.1, ""); 
-  DiscoveryObject brewtime = GenerateNumberDevice("brewtime", "Brew time", BREW_TIME_MIN, BREW_TIME_MAX, 0.1, "s"); 
-  // Sensor Devices 
-  DiscoveryObject actual_temperature = GenerateSensorDevice("temperature", "Boiler Temperature"); 
-  DiscoveryObject heaterPower = GenerateSensorDevice("heaterPower", "Heater Power", "ms", "power_factor"); 
-  // Switch Devices 
-  DiscoveryObject pidOn = GenerateSwitchDevice("pidON", "Use PID"); 
-  DiscoveryObject steamON = GenerateSwitchDevice("steamON", "Steam"); 
-  DiscoveryObject backflushON = GenerateSwitchDevice("backflushON", "Backflush"); 
-  DiscoveryObject startUsePonM = GenerateSwitchDevice("startUsePonM", "Use PonM");
-  
-
-// Define an array to store the DiscoveryObject instances
-  DiscoveryObject discoveryObjects[] = {
-    brewSetpoint,
-    steamSetPoint,
-    brewTempOffset,
-    brewPidDelay,
-    startKp,
-    startTn,
-    steamKp,
-    aggKp,
-    aggTn,
-    aggTv,
-    aggIMax,
-    actual_temperature,
-    heaterPower,
-    brewtime,
-    pidOn,
-    steamON,
-    backflushON,
-    startUsePonM
-  };
-
-  const int numDiscoveryObjects = sizeof(discoveryObjects) / sizeof(discoveryObjects[0]);
-
-
-  // Send the Objects to Hassio
-  if (mqtt.connected()) {
-    for (int i = 0; i < numDiscoveryObjects; i++) {
-      const DiscoveryObject& discoveryObj = discoveryObjects[i];
-      int publishResult = PublishLargeMessage(discoveryObj.discovery_topic.c_str(), discoveryObj.payload_json.c_str());
-
-      if (publishResult != 0) {
-        debugPrintf("[MQTT] Failed to publish discovery message. Error code: %d\n", publishResult);
-        return publishResult;
-      }
+void mqttFlushHASSIODiscovery() {
+  HeapScope heapScope(kHeapMqtt);
+
+  while (hassioNextEntity < HASSIO_ENTITY_COUNT) {
+    const hassio_entity_t& entity = hassioEntities[hassioNextEntity];
+    size_t length = formatHASSIODiscoveryMsg(entity);
+
+    if (length == 0) {
+      debugPrintf("[MQTT] Discovery message for %s doesn't fit\n", entity.name);
+    } else if (mqtt.publish(hassioTopic, 0, true, hassioPayload, length) == 0) {
+      break;  // built again on the next call
     }
-    //debugPrintln("[MQTT] Hassio Discover sent");
-    return 0;
-  }
-  else {
-    debugPrintln("[MQTT] Failed to send Hassio Discover, MQTT Client is not connected");
-    return -1;
+
+    hassioNextEntity++;
   }
 }
@@ -0,0 +1,175 @@
+/**
+ * @file Parameters.h
+ *
+ * @brief Compile-time table of the parameters editable in the web interface and via MQTT
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// values are part of the /parameters JSON, keep the order
+enum EditableKind {
+    kInteger,
+    kUInt8,
+    kDouble,
+    kDoubletime,
+    kCString
+};
+
+/**
+ * @brief Pointer to the variable of a parameter, the kind is derived from the
+ *        type of the variable so the two can't get out of sync
+ */
+struct editable_ptr_t {
+    constexpr editable_ptr_t(int *p) : type(kInteger), intPtr(p) {}
+    constexpr editable_ptr_t(uint8_t *p) : type(kUInt8), uint8Ptr(p) {}
+    constexpr editable_ptr_t(double *p) : type(kDouble), doublePtr(p) {}
+    constexpr editable_ptr_t(const char *p) : type(kCString), cString(p) {}
+
+    EditableKind type;
+
+    union {
+        int *intPtr;
+        uint8_t *uint8Ptr;
+        double *doublePtr;
+        const char *cString;
+    };
+};
+
+/**
+ * @brief One editable parameter, all strings are literals in flash
+ */
+struct editable_t {
+    const char *name;           // used in the web interface and the /parameters API
+    const char *displayName;
+    const char *helpText;       // NULL if there is none
+    uint8_t section;            // parameter section number
+    uint8_t position;
+    bool (*show)();             // determines if we show this parameter (in the web interface)
+    int minValue;
+    int maxValue;
+    editable_ptr_t var;
+};
+
+/**
+ * @brief Parameter published to MQTT as <prefix><hostname>/<name>
+ */
+struct mqtt_var_t {
+    const char *name;
+    const char *param;          // name of the editable_t
+    bool enabled;               // depends on the machine configuration
+};
+
+constexpr int constStrcmp(const char *a, const char *b) {
+    return *a != *b ? (*a < *b ? -1 : 1) : (*a == '\0' ? 0 : constStrcmp(a + 1, b + 1));
+}
+
+/**
+ * @brief Check at compile time that a table is sorted by name, which the
+ *        binary search in findByName() relies on
+ */
+template <typename T>
+constexpr bool isSortedByName(const T *table, size_t count) {
+    return count < 2 || (constStrcmp(table[0].name, table[1].name) < 0 && isSortedByName(table + 1, count - 1));
+}
+
+/**
+ * @brief Find an entry in a table sorted by name
+ *
+ * @return entry or NULL if there is none with this name
+ */
+template <typename T, size_t N>
+const T *findByName(const T (&table)[N], const char *name) {
+    size_t low = 0;
+    size_t high = N;
+
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        int cmp = strcmp(name, table[mid].name);
+
+        if (cmp == 0) {
+            return &table[mid];
+        }
+
+        if (cmp < 0) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Current value of a numeric parameter
+ */
+inline double getEditableNumber(const editable_t& e) {
+    switch (e.var.type) {
+        case kInteger:
+            return *e.var.intPtr;
+        case kUInt8:
+            return *e.var.uint8Ptr;
+        case kDouble:
+        case kDoubletime:
+            return *e.var.doublePtr;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * @brief Set a numeric parameter, values out of range are rejected. Tasks
+ *        other than the control task hold the control lock while they call it.
+ *
+ * @return 0 on success, <0 if the value is out of range or the parameter is read-only
+ */
+inline int setEditableNumber(const editable_t& e, double value) {
+    if (value < e.minValue || value > e.maxValue) {
+        return -1;
+    }
+
+    switch (e.var.type) {
+        case kInteger:
+            *e.var.intPtr = (int)value;
+            return 0;
+        case kUInt8:
+            *e.var.uint8Ptr = (uint8_t)value;
+            return 0;
+        case kDouble:
+        case kDoubletime:
+            *e.var.doublePtr = value;
+            return 0;
+        default:
+            return -2;
+    }
+}
+
+/**
+ * @brief Set a parameter from its text representation, as sent by the web
+ *        interface. Tasks other than the control task hold the control lock
+ *        while they call it.
+ *
+ * @return 0 on success, <0 if the parameter is read-only
+ */
+inline int setEditableString(const editable_t& e, const char *value) {
+    switch (e.var.type) {
+        case kInteger:
+            *e.var.intPtr = atoi(value);
+            return 0;
+        case kUInt8:
+            *e.var.uint8Ptr = (uint8_t)atoi(value);
+            return 0;
+        case kDouble:
+        case kDoubletime:
+            *e.var.doublePtr = atof(value);
+            return 0;
+        default:
+            return -2;
+    }
+}
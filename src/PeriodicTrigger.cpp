@@ -1,7 +1,7 @@
 /**
  * @file PeriodicTrigger.cpp
  *
- * @brief TODO
+ * @brief Non-blocking periodic timer based on millis()
  *
  */
 
@@ -23,6 +23,29 @@ bool PeriodicTrigger::check() {
     }
 }
 
+/**
+ * @brief Same condition as check(), but without advancing the trigger
+ */
+bool PeriodicTrigger::isDue() const {
+    return (millis() - m_tref) > m_triggerInterval;
+}
+
+/**
+ * @brief Time in ms the trigger is overdue, 0 if it is not due yet
+ */
+unsigned long PeriodicTrigger::lateness() const {
+    unsigned long elapsed = millis() - m_tref;
+
+    return elapsed > m_triggerInterval ? elapsed - m_triggerInterval : 0;
+}
+
+/**
+ * @brief Make the next check() return true
+ */
+void PeriodicTrigger::expire() {
+    m_tref = millis() - m_triggerInterval - 1;
+}
+
 void PeriodicTrigger::reset() {
     m_tref = millis();
 }
@@ -31,3 +54,7 @@ void PeriodicTrigger::reset(unsigned long ms) {
     m_triggerInterval = ms;
     m_tref = millis();
 }
+
+unsigned long PeriodicTrigger::getInterval() const {
+    return m_triggerInterval;
+}
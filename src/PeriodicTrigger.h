@@ -1,7 +1,7 @@
 /**
  * @file PeriodicTrigger.h
  *
- * @brief TODO
+ * @brief Non-blocking periodic timer based on millis()
  *
  */
 
@@ -9,14 +9,17 @@
 
 class PeriodicTrigger {
  public:
-    PeriodicTrigger(unsigned long millisec);
+    PeriodicTrigger(unsigned long millisec = 0);
 
     bool check();
+    bool isDue() const;
+    unsigned long lateness() const;
+    void expire();
     void reset();
     void reset(unsigned long millisec);
+    unsigned long getInterval() const;
 
  private:
     unsigned long m_triggerInterval;
     unsigned long m_tref;
 };
-
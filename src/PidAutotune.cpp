@@ -0,0 +1,333 @@
+/**
+ * @file PidAutotune.cpp
+ *
+ * @brief Relay autotuning of the boiler PID
+ *
+ */
+
+#include "PidAutotune.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "debugSerial.h"
+#include "defaults.h"
+
+#define AUTOTUNE_MIN_STEP 20        // smallest relay amplitude in promille
+
+
+PidAutotune::PidAutotune() :
+    _state(kIdle),
+    _error(NULL),
+    _setpoint(0),
+    _maxOutput(0),
+    _sampleTime(0),
+    _bias(0),
+    _step(0),
+    _heating(false),
+    _inCycle(false),
+    _cycles(0) {
+    memset(&_model, 0, sizeof(_model));
+    memset(&_tunings, 0, sizeof(_tunings));
+}
+
+/**
+ * @brief Start the experiment, the machine should hold the setpoint already
+ *
+ * @param time       - millis()
+ * @param setpoint   - temperature to oscillate around
+ * @param holdOutput - current PID output, first guess of the holding output
+ * @param maxOutput  - largest heater output (windowSize)
+ * @param sampleTime - PID sample time in s
+ */
+void PidAutotune::start(unsigned long time, double setpoint, double holdOutput, double maxOutput, double sampleTime) {
+    _state = kRunning;
+    _error = NULL;
+    _setpoint = setpoint;
+    _maxOutput = maxOutput;
+    _sampleTime = sampleTime;
+    _bias = fmin(fmax(holdOutput, AUTOTUNE_MIN_STEP), maxOutput / 2);
+    _step = fmin(AUTOTUNE_STEP, _bias);
+    _heating = false;
+    _inCycle = false;
+    _cycles = 0;
+    _startTime = time;
+    _lastTime = time;
+    _max = -INFINITY;
+    _min = INFINITY;
+    _sumPeriod = _sumAmplitude = _sumDeadTime = _sumHold = _sumStep = 0;
+
+    LOG_INFO("Autotune started at %.1f °C, holding output %.0f\n", setpoint, _bias);
+}
+
+/**
+ * @brief Feed a temperature, called every control cycle while running
+ *
+ * @return heater output 0..maxOutput, 0 if the experiment isn't running
+ */
+double PidAutotune::update(unsigned long time, double temperature) {
+    if (_state != kRunning) {
+        return 0;
+    }
+
+    if (fabs(temperature - _setpoint) > AUTOTUNE_MAX_DEVIATION) {
+        fail("temperature out of range");
+        return 0;
+    }
+
+    if (time - _startTime > AUTOTUNE_TIMEOUT) {
+        fail("no stable oscillation");
+        return 0;
+    }
+
+    if (_heating && temperature > _setpoint + AUTOTUNE_HYSTERESIS) {
+        switchRelay(time, false);
+    } else if (!_heating && temperature < _setpoint - AUTOTUNE_HYSTERESIS) {
+        switchRelay(time, true);
+    }
+
+    if (_state != kRunning) {
+        return 0;
+    }
+
+    // the minimum follows the switch to heating, the maximum the switch to cooling
+    if (_heating) {
+        if (temperature < _min) {
+            _min = temperature;
+            _minFirst = _minLast = time;
+        } else if (temperature == _min) {
+            _minLast = time;
+        }
+    } else {
+        if (temperature > _max) {
+            _max = temperature;
+            _maxFirst = _maxLast = time;
+        } else if (temperature == _max) {
+            _maxLast = time;
+        }
+    }
+
+    double output = _heating ? _bias + _step : _bias - _step;
+
+    _outputIntegral += output * (time - _lastTime);
+    _lastTime = time;
+
+    return output;
+}
+
+/**
+ * @brief Stop the experiment, a result from a finished one is discarded
+ */
+void PidAutotune::abort() {
+    if (_state == kRunning) {
+        fail("aborted");
+    } else if (_state != kIdle) {
+        _state = kIdle;
+        _error = NULL;
+    }
+}
+
+const char *PidAutotune::stateToString(State state) {
+    switch (state) {
+        case kIdle:
+            return "idle";
+        case kRunning:
+            return "running";
+        case kDone:
+            return "done";
+        case kFailed:
+            return "failed";
+    }
+
+    return "unknown";
+}
+
+/**
+ * @brief Name of a suggested parameter, the same as in the web interface
+ */
+const char *PidAutotune::parameterName(AutotuneParameter parameter) {
+    switch (parameter) {
+        case kAutotuneKp:
+            return "PID_KP";
+        case kAutotuneTn:
+            return "PID_TN";
+        case kAutotuneTv:
+            return "PID_TV";
+        case kAutotuneIMax:
+            return "PID_I_MAX";
+        case kAutotuneStartKp:
+            return "START_KP";
+        case kAutotuneStartTn:
+            return "START_TN";
+        case kAutotuneBdKp:
+            return "PID_BD_KP";
+        case kAutotuneBdTv:
+            return "PID_BD_TV";
+        case kAutotuneParameterCount:
+            break;
+    }
+
+    return "unknown";
+}
+
+void PidAutotune::switchRelay(unsigned long time, bool heating) {
+    _heating = heating;
+
+    if (!heating) {
+        _switchOff = time;
+        _max = -INFINITY;
+        return;
+    }
+
+    if (_inCycle) {
+        finishCycle(time);
+    }
+
+    _inCycle = true;
+    _cycleStart = time;
+    _min = INFINITY;
+    _outputIntegral = 0;
+    _step = fmin(AUTOTUNE_STEP, fmin(_bias, _maxOutput - _bias));
+}
+
+/**
+ * @brief A cycle from one switch to heating to the next one is complete
+ */
+void PidAutotune::finishCycle(unsigned long time) {
+    double period = (time - _cycleStart) / 1000.0;
+    double heating = (_switchOff - _cycleStart) / 1000.0;
+    double cooling = (time - _switchOff) / 1000.0;
+
+    _cycles++;
+
+    if (_cycles <= AUTOTUNE_SETTLE_CYCLES) {
+        // center the relay on the holding output: more heating than cooling needs more bias
+        _bias += _step * (heating - cooling) / period;
+        _bias = fmin(fmax(_bias, AUTOTUNE_MIN_STEP), _maxOutput - AUTOTUNE_MIN_STEP);
+
+        LOG_DEBUG("Autotune cycle %u: period %.1f s, holding output %.0f\n", _cycles, period, _bias);
+        return;
+    }
+
+    double minTime = ((_minFirst + _minLast) / 2.0 - _cycleStart) / 1000.0;
+    double maxTime = ((_maxFirst + _maxLast) / 2.0 - _switchOff) / 1000.0;
+
+    _sumPeriod += period;
+    _sumAmplitude += (_max - _min) / 2;
+    _sumDeadTime += (minTime + maxTime) / 2;
+    _sumHold += _outputIntegral / (time - _cycleStart);
+    _sumStep += _step;
+
+    LOG_DEBUG("Autotune cycle %u: period %.1f s, amplitude %.2f °C, dead time %.1f s\n",
+              _cycles, period, (_max - _min) / 2, (minTime + maxTime) / 2);
+
+    if (_cycles == AUTOTUNE_SETTLE_CYCLES + AUTOTUNE_CYCLES) {
+        if (identify() == 0) {
+            _state = kDone;
+        }
+    }
+}
+
+/**
+ * @brief Model and tunings from the averaged cycles
+ *
+ *        The relay with hysteresis h oscillates where the process has the gain
+ *        pi * a / (4 * d) and the phase -pi + asin(h / a) (describing function,
+ *        a = amplitude, d = relay amplitude). With the measured dead time this
+ *        gives the time constant and the gain of the model.
+ *
+ *        The tunings are the IMC PID rules for this model with the closed loop
+ *        time constant twice the dead time, the integral time limited like
+ *        in the SIMC rules so disturbances are corrected within a few dead
+ *        times. Half the PID sample time is added to the dead time, this is
+ *        how long the output lags behind on average.
+ *
+ *        The delay to the extrema underestimates the dead time if the sensor
+ *        lags (first order) or the amplitude is close to the hysteresis, the
+ *        temperature then drifts through the hysteresis band for most of the
+ *        cycle. For the tunings the dead time is therefore at least the sensor
+ *        lag and the time the temperature needs to cross the hysteresis.
+ *
+ * @return 0 on success, <0 if the cycles don't fit the model
+ */
+int PidAutotune::identify() {
+    double period = _sumPeriod / AUTOTUNE_CYCLES;
+    double amplitude = _sumAmplitude / AUTOTUNE_CYCLES;
+    double deadTime = _sumDeadTime / AUTOTUNE_CYCLES;
+    double step = _sumStep / AUTOTUNE_CYCLES;
+
+    if (amplitude <= AUTOTUNE_HYSTERESIS * 1.05) {
+        fail("oscillation too small");
+        return -1;
+    }
+
+    double omega = 2 * M_PI / period;
+    double phase = M_PI - asin(AUTOTUNE_HYSTERESIS / amplitude) - omega * deadTime;   // lag of the first order part
+
+    if (phase <= 0.05 || deadTime <= 0) {
+        fail("dead time doesn't fit the period");
+        return -2;
+    }
+
+    phase = fmin(phase, M_PI / 2 - 0.01);   // close to integrating, limits the time constant
+
+    _model.ultimatePeriod = period;
+    _model.ultimateGain = 4 * step / (M_PI * sqrt(amplitude * amplitude - AUTOTUNE_HYSTERESIS * AUTOTUNE_HYSTERESIS));
+    _model.timeConstant = tan(phase) / omega;
+    _model.deadTime = deadTime;
+    _model.gain = sqrt(1 + pow(omega * _model.timeConstant, 2)) / _model.ultimateGain;
+    _model.holdOutput = _sumHold / AUTOTUNE_CYCLES;
+
+    // the temperature crosses the hysteresis band with about the average slope of a half cycle
+    double hysteresisTime = AUTOTUNE_HYSTERESIS * period / (4 * amplitude);
+
+    double k = _model.gain;
+    double t = _model.timeConstant;
+    double l = fmax(_model.deadTime, fmax(hysteresisTime, AUTOTUNE_SENSOR_LAG)) + _sampleTime / 2;
+    double lambda = 2 * l;
+    double kp = (2 * t + l) / (k * (2 * lambda + l));
+    double tn = fmin(t + l / 2, 4 * (lambda + l));
+    double tv = t * l / (2 * t + l);
+
+    _tunings.limited = 0;
+    _tunings.kp = limit(kp, PID_KP_REGULAR_MAX, kAutotuneKp);
+    _tunings.tn = limit(tn, PID_TN_REGULAR_MAX, kAutotuneTn);
+    _tunings.tv = limit(tv, PID_TV_REGULAR_MAX, kAutotuneTv);
+    _tunings.iMax = limit(2 * _model.holdOutput, PID_I_MAX_REGULAR_MAX, kAutotuneIMax);
+
+    // PonM brakes on the measurement, with the same gains it heats up slower but without overshoot
+    _tunings.startKp = limit(kp, PID_KP_START_MAX, kAutotuneStartKp);
+    _tunings.startTn = limit(tn, PID_TN_START_MAX, kAutotuneStartTn);
+
+    // faster while brewing, but not down to lambda = l: the inlet water changes the dynamics
+    lambda = 1.5 * l;
+    _tunings.bdKp = limit((2 * t + l) / (k * (2 * lambda + l)), PID_KP_BD_MAX, kAutotuneBdKp);
+    _tunings.bdTv = limit(tv, PID_TV_BD_MAX, kAutotuneBdTv);
+
+    LOG_INFO("Autotune done: K=%.4f T=%.1f s L=%.1f s (measured %.1f s) -> Kp=%.1f Tn=%.1f Tv=%.1f\n",
+             k, t, l, _model.deadTime, _tunings.kp, _tunings.tn, _tunings.tv);
+
+    return 0;
+}
+
+/**
+ * @brief Cut a suggested parameter to the maximum of its range and flag it
+ */
+double PidAutotune::limit(double value, double max, AutotuneParameter parameter) {
+    if (value <= max) {
+        return value;
+    }
+
+    _tunings.limited |= 1 << parameter;
+
+    LOG_WARNING("Autotune: %s %.1f is above the maximum %.1f\n", parameterName(parameter), value, max);
+
+    return max;
+}
+
+void PidAutotune::fail(const char *error) {
+    _state = kFailed;
+    _error = error;
+
+    LOG_WARNING("Autotune failed: %s\n", error);
+}
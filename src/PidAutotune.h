@@ -0,0 +1,152 @@
+/**
+ * @file PidAutotune.h
+ *
+ * @brief Relay autotuning of the boiler PID
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "userConfig.h"
+
+// Not defined in older userConfig files
+#ifndef AUTOTUNE_STEP
+    #define AUTOTUNE_STEP 150           // relay amplitude around the holding output in promille
+#endif
+
+#ifndef AUTOTUNE_HYSTERESIS
+    #define AUTOTUNE_HYSTERESIS 0.3     // relay switches at setpoint +- hysteresis in °C
+#endif
+
+#ifndef AUTOTUNE_SENSOR_LAG
+    #define AUTOTUNE_SENSOR_LAG 3.0     // time constant of the temperature sensor and its mounting in s
+#endif
+
+#define AUTOTUNE_SETTLE_CYCLES 2        // cycles to center the relay before measuring
+#define AUTOTUNE_CYCLES 3               // measured cycles
+#define AUTOTUNE_MAX_DEVIATION 10       // abort if the temperature leaves setpoint +- this many °C
+#define AUTOTUNE_TIMEOUT (45 * 60 * 1000UL)
+
+/**
+ * @brief First order plus dead time model of the boiler, identified from the
+ *        relay oscillation
+ */
+struct autotune_model_t {
+    double gain;            // °C per promille of heater output
+    double timeConstant;    // s
+    double deadTime;        // s
+    double ultimateGain;    // promille per °C
+    double ultimatePeriod;  // s
+    double holdOutput;      // average output that holds the setpoint, promille
+};
+
+/**
+ * @brief Suggested parameters, bit positions in autotune_tunings_t::limited
+ */
+enum AutotuneParameter {
+    kAutotuneKp,
+    kAutotuneTn,
+    kAutotuneTv,
+    kAutotuneIMax,
+    kAutotuneStartKp,
+    kAutotuneStartTn,
+    kAutotuneBdKp,
+    kAutotuneBdTv,
+    kAutotuneParameterCount
+};
+
+/**
+ * @brief Suggested parameters, same units and ranges as the editable parameters.
+ *        The brew detection PID keeps its Tn, it normally runs without integral part.
+ */
+struct autotune_tunings_t {
+    double kp;
+    double tn;
+    double tv;
+    double iMax;
+    double startKp;
+    double startTn;
+    double bdKp;
+    double bdTv;
+    uint16_t limited;       // bit per AutotuneParameter that was cut to the maximum of its parameter
+};
+
+/**
+ * @brief Runs a relay experiment around the setpoint: the heater switches between
+ *        holdOutput + AUTOTUNE_STEP and holdOutput - AUTOTUNE_STEP whenever the
+ *        temperature crosses setpoint -+ AUTOTUNE_HYSTERESIS. The holding output
+ *        is adjusted until both half cycles take equally long, then the period,
+ *        amplitude and the delay from each switch to the following extremum of
+ *        the temperature give the model and the tunings.
+ *
+ *        Lives in the control task, getModel()/getTunings() are valid once
+ *        getState() returned kDone. Tunings that had to be cut to the range of
+ *        their parameter are flagged, the model doesn't fit the machine then.
+ */
+class PidAutotune {
+    public:
+        enum State : uint8_t {
+            kIdle,
+            kRunning,
+            kDone,
+            kFailed
+        };
+
+        PidAutotune();
+
+        void start(unsigned long time, double setpoint, double holdOutput, double maxOutput, double sampleTime);
+        double update(unsigned long time, double temperature);
+        void abort();
+
+        State getState() const { return _state; }
+        uint8_t getCycles() const { return _cycles; }
+        const char *getError() const { return _error; }
+        const autotune_model_t& getModel() const { return _model; }
+        const autotune_tunings_t& getTunings() const { return _tunings; }
+
+        static const char *stateToString(State state);
+        static const char *parameterName(AutotuneParameter parameter);
+
+    private:
+        void switchRelay(unsigned long time, bool heating);
+        void finishCycle(unsigned long time);
+        int identify();
+        double limit(double value, double max, AutotuneParameter parameter);
+        void fail(const char *error);
+
+        State _state;
+        const char *_error;
+        double _setpoint;
+        double _maxOutput;
+        double _sampleTime;         // PID sample time in s
+        double _bias;               // holding output, adjusted while settling
+        double _step;               // relay amplitude of the current cycle
+        bool _heating;
+        bool _inCycle;              // false until the first switch to heating
+        uint8_t _cycles;            // finished cycles including the settling ones
+
+        unsigned long _startTime;
+        unsigned long _lastTime;
+        unsigned long _cycleStart;  // time of the switch to heating
+        unsigned long _switchOff;   // time of the switch to cooling in this cycle
+
+        // extrema of the current cycle, first and last time they were seen,
+        // a flat top from the sensor resolution is timed by its middle
+        double _max;
+        double _min;
+        unsigned long _maxFirst, _maxLast;
+        unsigned long _minFirst, _minLast;
+        double _outputIntegral;     // promille * ms in the current cycle
+
+        // sums over the measured cycles
+        double _sumPeriod;
+        double _sumAmplitude;
+        double _sumDeadTime;
+        double _sumHold;
+        double _sumStep;
+
+        autotune_model_t _model;
+        autotune_tunings_t _tunings;
+};
@@ -0,0 +1,146 @@
+/**
+ * @file PressureSensor.cpp
+ *
+ * @brief Pressure sensor read by the ADC in continuous (DMA) mode
+ *
+ */
+
+#include "PressureSensor.h"
+
+#include <Arduino.h>
+#include <driver/adc.h>
+#include <esp_adc_cal.h>
+
+#include "ISR.h"
+#include "debugSerial.h"
+
+#define PRESSURE_DECIMATION (PRESSURE_SAMPLE_RATE / MAINS_FREQUENCY)
+#define PRESSURE_FRAME 256          // conversions per DMA frame
+#define PSI_TO_BAR 0.0689476
+
+static esp_adc_cal_characteristics_t adcCharacteristics;
+static uint8_t adcChannel;
+static float pressureScale;         // bar per mV
+
+static portMUX_TYPE pressureMux = portMUX_INITIALIZER_UNLOCKED;
+static float pressure = 0;
+static uint32_t pressureCount = 0;
+
+
+/**
+ * @brief Sum up the conversions of every DMA frame, publish the average
+ *      of each mains period
+ */
+static void pressureTask(void *) {
+    uint8_t frame[PRESSURE_FRAME * sizeof(adc_digi_output_data_t)];
+    uint32_t sum = 0;
+    uint32_t count = 0;
+
+    for (;;) {
+        uint32_t length = 0;
+
+        if (adc_digi_read_bytes(frame, sizeof(frame), &length, ADC_MAX_DELAY) != ESP_OK) {
+            continue;   // ESP_ERR_INVALID_STATE: an overrun dropped samples, keep going
+        }
+
+        for (uint32_t i = 0; i + sizeof(adc_digi_output_data_t) <= length; i += sizeof(adc_digi_output_data_t)) {
+            const adc_digi_output_data_t *result = (const adc_digi_output_data_t *)&frame[i];
+
+            if (result->type1.channel != adcChannel) {
+                continue;
+            }
+
+            sum += result->type1.data;
+
+            if (++count < PRESSURE_DECIMATION) {
+                continue;
+            }
+
+            // the calibration is close to linear, so averaging the raw values first is fine
+            uint32_t millivolts = esp_adc_cal_raw_to_voltage((sum + count / 2) / count, &adcCharacteristics);
+            float value = ((float)millivolts - PRESSURE_OFFSET_MV) * pressureScale;
+
+            portENTER_CRITICAL(&pressureMux);
+            pressure = value;
+            pressureCount++;
+            portEXIT_CRITICAL(&pressureMux);
+
+            sum = 0;
+            count = 0;
+        }
+    }
+}
+
+int pressureSetup(uint8_t pin, float maxPressure) {
+    int8_t channel = digitalPinToAnalogChannel(pin);
+
+    // ADC1 channels are 0..7, ADC2 starts at 10
+    if (channel < 0 || channel > 7) {
+        LOG_ERROR("%s(): pin %u is not an ADC1 pin\n", __func__, pin);
+        return -1;
+    }
+
+    adcChannel = channel;
+    pressureScale = maxPressure * PSI_TO_BAR / (PRESSURE_FULLSCALE_MV - PRESSURE_OFFSET_MV);
+
+    esp_adc_cal_value_t calibration = esp_adc_cal_characterize(ADC_UNIT_1, ADC_ATTEN_DB_11, ADC_WIDTH_BIT_12, 1100, &adcCharacteristics);
+    LOG_INFO("Pressure sensor: ADC calibration from %s\n",
+             calibration == ESP_ADC_CAL_VAL_EFUSE_TP ? "two point eFuse" :
+             calibration == ESP_ADC_CAL_VAL_EFUSE_VREF ? "eFuse Vref" : "default Vref");
+
+    adc_digi_init_config_t initConfig = {};
+    initConfig.max_store_buf_size = 4 * PRESSURE_FRAME * sizeof(adc_digi_output_data_t);
+    initConfig.conv_num_each_intr = PRESSURE_FRAME;
+    initConfig.adc1_chan_mask = BIT(adcChannel);
+    initConfig.adc2_chan_mask = 0;
+
+    if (adc_digi_initialize(&initConfig) != ESP_OK) {
+        LOG_ERROR("%s(): cannot initialize the ADC DMA\n", __func__);
+        return -2;
+    }
+
+    adc_digi_pattern_config_t pattern = {};
+    pattern.atten = ADC_ATTEN_DB_11;
+    pattern.channel = adcChannel;
+    pattern.unit = 0;   // ADC1
+    pattern.bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+
+    adc_digi_configuration_t config = {};
+    config.conv_limit_en = true;    // required on the ESP32
+    config.conv_limit_num = 255;
+    config.pattern_num = 1;
+    config.adc_pattern = &pattern;
+    config.sample_freq_hz = PRESSURE_SAMPLE_RATE;
+    config.conv_mode = ADC_CONV_SINGLE_UNIT_1;
+    config.format = ADC_DIGI_OUTPUT_FORMAT_TYPE1;
+
+    if (adc_digi_controller_configure(&config) != ESP_OK || adc_digi_start() != ESP_OK) {
+        LOG_ERROR("%s(): cannot start the ADC DMA\n", __func__);
+        adc_digi_deinitialize();
+        return -3;
+    }
+
+    if (xTaskCreatePinnedToCore(pressureTask, "pressure", 3072, NULL, 5, NULL, 0) != pdPASS) {
+        adc_digi_stop();
+        adc_digi_deinitialize();
+        return -4;
+    }
+
+    return 0;
+}
+
+float pressureGet() {
+    portENTER_CRITICAL(&pressureMux);
+    float value = pressure;
+    portEXIT_CRITICAL(&pressureMux);
+
+    return value;
+}
+
+uint32_t pressureGetCount() {
+    portENTER_CRITICAL(&pressureMux);
+    uint32_t count = pressureCount;
+    portEXIT_CRITICAL(&pressureMux);
+
+    return count;
+}
@@ -0,0 +1,47 @@
+/**
+ * @file PressureSensor.h
+ *
+ * @brief Pressure sensor read by the ADC in continuous (DMA) mode
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "userConfig.h"
+
+// Sensor output at 0 and at MAXPRESSURE after the divider, older userConfig
+// files only have OFFSET and FULLSCALE in 10 bit ADC counts of 3.3 V
+#ifndef PRESSURE_OFFSET_MV
+    #define PRESSURE_OFFSET_MV (OFFSET * 3300 / 1023)
+#endif
+
+#ifndef PRESSURE_FULLSCALE_MV
+    #define PRESSURE_FULLSCALE_MV (FULLSCALE * 3300 / 1023)
+#endif
+
+#define PRESSURE_SAMPLE_RATE 20000  // Hz, lowest rate of the ADC DMA on the ESP32
+
+/**
+ * @brief Start sampling in the background. Every mains period of samples
+ *        (400 at 50 Hz) is averaged into one value, which cancels the
+ *        pressure ripple of vibration pumps.
+ *
+ * @param pin         - ADC1 pin of the sensor, ADC2 can't be used with WiFi
+ * @param maxPressure - pressure at PRESSURE_FULLSCALE_MV in psi
+ *
+ * @return 0 on success, <0 if the ADC couldn't be set up
+ */
+int pressureSetup(uint8_t pin, float maxPressure);
+
+/**
+ * @brief Latest averaged pressure in bar
+ */
+float pressureGet();
+
+/**
+ * @brief Number of averaged values since the start, stops counting if the
+ *        sampling task stalls
+ */
+uint32_t pressureGetCount();
@@ -0,0 +1,183 @@
+/**
+ * @file Scheduler.cpp
+ *
+ * @brief Cooperative job scheduler with per-job lateness and runtime statistics
+ *
+ */
+
+#include "Scheduler.h"
+
+#include <Arduino.h>
+#include <esp_timer.h>
+#include "debugSerial.h"
+
+Scheduler::Scheduler(const char *name) {
+    _name = name;
+    _jobCount = 0;
+}
+
+/**
+ * @brief Register a job
+ *
+ * @param name     - job name, must stay valid for the lifetime of the scheduler
+ * @param function - function to call when the job is due
+ * @param period   - period in ms, 0 = run on every scheduler pass
+ * @param priority - higher value runs first if several jobs are due at the same time
+ * @param deadline - ms after the due time the job should be finished, used for the statistics
+ *
+ * @return job id >= 0 on success, < 0 if there are no free job slots
+ */
+int Scheduler::addJob(const char *name, job_function_t function, unsigned long period, uint8_t priority, unsigned long deadline) {
+    if (_jobCount >= maxJobs || function == NULL) {
+        debugPrintf("%s(): cannot add job %s to %s\n", __func__, name, _name);
+        return -1;
+    }
+
+    scheduler_job_t &job = _jobs[_jobCount];
+
+    job.name = name;
+    job.function = function;
+    job.trigger.reset(period);
+    job.priority = priority;
+    job.deadline = deadline;
+
+    _jobCount++;
+    resetStats();
+
+    return _jobCount - 1;
+}
+
+/**
+ * @brief Run all jobs which are due. Jobs with higher priority run first,
+ *        jobs with the same priority in order of their absolute deadline.
+ *        On ties the registration order decides, so the order is deterministic.
+ */
+void Scheduler::run() {
+    bool done[maxJobs] = {false};
+    int64_t passStart = esp_timer_get_time();
+
+    for (;;) {
+        int next = -1;
+        long nextSlack = 0;
+
+        for (int i = 0; i < _jobCount; i++) {
+            scheduler_job_t &job = _jobs[i];
+            bool periodic = job.trigger.getInterval() > 0;
+
+            if (done[i] || (periodic && !job.trigger.isDue())) continue;
+
+            // remaining time until the deadline is reached, can be negative
+            long slack = (long)job.deadline - (long)(periodic ? job.trigger.lateness() : 0);
+
+            if (next < 0 || job.priority > _jobs[next].priority ||
+                (job.priority == _jobs[next].priority && slack < nextSlack)) {
+                next = i;
+                nextSlack = slack;
+            }
+        }
+
+        if (next < 0) break;
+
+        done[next] = true;
+        runJob(_jobs[next]);
+    }
+
+    _passRuntime.add((uint32_t)(esp_timer_get_time() - passStart));
+}
+
+void Scheduler::runJob(scheduler_job_t &job) {
+    bool periodic = job.trigger.getInterval() > 0;
+    unsigned long lateness = periodic ? job.trigger.lateness() : 0;
+
+    if (periodic) {
+        job.trigger.check();
+
+        // Skip missed periods instead of running the job several times in a row
+        if (job.trigger.isDue()) {
+            job.trigger.reset();
+        }
+    }
+
+    int64_t start = esp_timer_get_time();
+    job.function();
+    uint32_t runtime = (uint32_t)(esp_timer_get_time() - start);
+
+    job.runs++;
+    job.lastLateness = lateness;
+    job.lastRuntime = runtime;
+    job.runtime.add(runtime);
+
+    if (lateness > job.maxLateness) job.maxLateness = lateness;
+    if (lateness + runtime / 1000 > job.deadline) job.deadlineMisses++;
+}
+
+/**
+ * @brief Make a job due immediately, it runs on the next scheduler pass
+ */
+void Scheduler::trigger(int jobId) {
+    if (jobId < 0 || jobId >= _jobCount) return;
+
+    _jobs[jobId].trigger.expire();
+}
+
+/**
+ * @brief Change the period of a periodic job, the next run is one new period from now.
+ *        Must be called from the task that runs the scheduler.
+ */
+void Scheduler::setPeriod(int jobId, unsigned long period) {
+    if (jobId < 0 || jobId >= _jobCount || period == 0 || _jobs[jobId].trigger.getInterval() == 0) return;
+
+    _jobs[jobId].trigger.reset(period);
+}
+
+void Scheduler::resetStats() {
+    for (int i = 0; i < _jobCount; i++) {
+        scheduler_job_t &job = _jobs[i];
+
+        job.runs = 0;
+        job.deadlineMisses = 0;
+        job.lastLateness = 0;
+        job.maxLateness = 0;
+        job.lastRuntime = 0;
+        job.runtime.reset();
+    }
+
+    _passRuntime.reset();
+}
+
+/**
+ * @brief Print statistics of all jobs
+ */
+void Scheduler::printStats() {
+    debugPrintf("Scheduler %s: job runs misses late_max[ms] run_avg[us] run_p99[us] run_max[us]\n", _name);
+
+    for (int i = 0; i < _jobCount; i++) {
+        const scheduler_job_t &job = _jobs[i];
+
+        debugPrintf("  %-12s %8lu %6lu %6lu %8lu %8lu %8lu\n", job.name, job.runs, job.deadlineMisses, job.maxLateness,
+                    (unsigned long)job.runtime.getAvg(), (unsigned long)job.runtime.getPercentile(0.99),
+                    (unsigned long)job.runtime.getMax());
+    }
+
+    debugPrintf("  %-12s %8lu %6s %6s %8lu %8lu %8lu\n", "(pass)", (unsigned long)_passRuntime.getCount(), "-", "-",
+                (unsigned long)_passRuntime.getAvg(), (unsigned long)_passRuntime.getPercentile(0.99),
+                (unsigned long)_passRuntime.getMax());
+}
+
+int Scheduler::getJobCount() const {
+    return _jobCount;
+}
+
+const scheduler_job_t *Scheduler::getJob(int jobId) const {
+    if (jobId < 0 || jobId >= _jobCount) return NULL;
+
+    return &_jobs[jobId];
+}
+
+const char *Scheduler::getName() const {
+    return _name;
+}
+
+const Histogram &Scheduler::getPassRuntime() const {
+    return _passRuntime;
+}
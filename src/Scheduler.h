@@ -0,0 +1,57 @@
+/**
+ * @file Scheduler.h
+ *
+ * @brief Cooperative job scheduler with per-job lateness and runtime statistics
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "PeriodicTrigger.h"
+#include "Histogram.h"
+
+typedef void (*job_function_t)(void);
+
+//! scheduler job and its statistics
+struct scheduler_job_t {
+    const char *name;               //!< job name used for statistics output
+    job_function_t function;        //!< function to run
+    PeriodicTrigger trigger;        //!< period, 0 = run on every scheduler pass
+    uint8_t priority;               //!< higher value runs first if several jobs are due
+    unsigned long deadline;         //!< ms after the due time the job has to be finished
+
+    unsigned long runs;             //!< number of runs
+    unsigned long deadlineMisses;   //!< number of runs that finished after the deadline
+    unsigned long lastLateness;     //!< ms the last run started after its due time
+    unsigned long maxLateness;      //!< max start lateness in ms
+    unsigned long lastRuntime;      //!< runtime of the last run in us
+    Histogram runtime;              //!< runtime distribution in us
+};
+
+class Scheduler {
+    public:
+        explicit Scheduler(const char *name);
+
+        int addJob(const char *name, job_function_t function, unsigned long period, uint8_t priority, unsigned long deadline);
+        void run();
+        void trigger(int jobId);
+        void setPeriod(int jobId, unsigned long period);
+        void resetStats();
+        void printStats();
+
+        int getJobCount() const;
+        const scheduler_job_t *getJob(int jobId) const;
+        const char *getName() const;
+        const Histogram &getPassRuntime() const;
+
+    private:
+        static const int maxJobs = 16;
+
+        const char *_name;
+        scheduler_job_t _jobs[maxJobs];
+        int _jobCount;
+        Histogram _passRuntime;     // runtime of complete run() passes in us
+
+        void runJob(scheduler_job_t &job);
+};
@@ -0,0 +1,232 @@
+/**
+ * @file ShotRecorder.cpp
+ *
+ * @brief High-rate recording of every shot into files on LittleFS
+ *
+ */
+
+#include "ShotRecorder.h"
+
+#include <LittleFS.h>
+#include <time.h>
+
+#include "debugSerial.h"
+
+#define SHOT_VERSION 1
+
+// unix time before this means the clock was never synchronized
+#define SHOT_MIN_VALID_TIME 1577836800  // 2020-01-01
+
+
+static int16_t toFixedPoint(double value, double scale) {
+    double scaled = value * scale;
+
+    if (scaled >= INT16_MAX) return INT16_MAX;
+    if (scaled <= INT16_MIN) return INT16_MIN;
+
+    return (int16_t)lround(scaled);
+}
+
+ShotRecorder::ShotRecorder() :
+    _state(kIdle),
+    _startMillis(0),
+    _firstId(1),
+    _nextId(1) {
+    memset(&_header, 0, sizeof(_header));
+}
+
+/**
+ * @brief Mount the file system and find the shots stored so far
+ *
+ * @return 0 on success, <0 on failure
+ */
+int ShotRecorder::begin() {
+    if (!LittleFS.begin()) {
+        debugPrintln("Shot recorder: failed to mount file system");
+        return -1;
+    }
+
+    if (!LittleFS.exists(SHOT_DIRECTORY) && !LittleFS.mkdir(SHOT_DIRECTORY)) {
+        debugPrintln("Shot recorder: failed to create " SHOT_DIRECTORY);
+        return -2;
+    }
+
+    File dir = LittleFS.open(SHOT_DIRECTORY);
+    uint32_t minId = UINT32_MAX;
+    uint32_t maxId = 0;
+
+    for (File file = dir.openNextFile(); file; file = dir.openNextFile()) {
+        uint32_t id = strtoul(file.name(), NULL, 10);
+
+        if (id > 0) {
+            minId = min(minId, id);
+            maxId = max(maxId, id);
+        }
+    }
+
+    if (maxId > 0) {
+        _firstId = minId;
+        _nextId = maxId + 1;
+    }
+
+    debugPrintf("Shot recorder: %lu shots stored\n", (unsigned long)(_nextId - _firstId));
+
+    return removeOldShots();
+}
+
+/**
+ * @brief Start recording a shot
+ *
+ * @return true if recording, false if the last shot wasn't written yet
+ */
+bool ShotRecorder::start(double setpoint) {
+    if (_state != kIdle) {
+        return _state == kRecording;
+    }
+
+    _startMillis = millis();
+
+    time_t now = time(NULL);
+
+    memcpy(_header.magic, "CCSH", 4);
+    _header.version = SHOT_VERSION;
+    _header.flags = 0;
+    _header.period = SHOT_SAMPLE_PERIOD;
+    _header.id = _nextId;
+    _header.startTime = now >= SHOT_MIN_VALID_TIME ? (uint32_t)now : 0;
+    _header.duration = 0;
+    _header.setpoint = toFixedPoint(setpoint, 100);
+    _header.weight = 0;
+    _header.count = 0;
+    _header.reserved = 0;
+
+    _state = kRecording;
+
+    return true;
+}
+
+/**
+ * @brief Add a sample to the running shot, samples beyond SHOT_MAX_SAMPLES
+ *        are dropped
+ */
+void ShotRecorder::sample(double temperature, double heater, float pressure, float weight) {
+    if (_state != kRecording) {
+        return;
+    }
+
+    if (_header.count >= SHOT_MAX_SAMPLES) {
+        _header.flags |= 1;
+        return;
+    }
+
+    shot_sample_t& s = _samples[_header.count];
+
+    s.time = (uint16_t)min((millis() - _startMillis) / 10, 0xFFFFUL);
+    s.temperature = toFixedPoint(temperature, 100);
+    s.heater = (uint16_t)constrain(lround(heater), 0L, 1000L);
+    s.pressure = toFixedPoint(pressure, 100);
+    s.weight = toFixedPoint(weight, 10);
+
+    _header.count++;
+}
+
+/**
+ * @brief Finish the running shot, it is written by the next writePending()
+ *
+ * @param weight - final weight of the shot
+ */
+void ShotRecorder::stop(float weight) {
+    if (_state != kRecording) {
+        return;
+    }
+
+    _header.duration = millis() - _startMillis;
+    _header.weight = toFixedPoint(weight, 10);
+
+    _state = kPending;
+}
+
+bool ShotRecorder::isRecording() const {
+    return _state == kRecording;
+}
+
+/**
+ * @brief Write a finished shot to flash and remove the oldest shots
+ *
+ * @return 0 on success or if there was nothing to write, <0 on failure
+ */
+int ShotRecorder::writePending() {
+    if (_state != kPending) {
+        return 0;
+    }
+
+    int returnCode = 0;
+
+    // shots without samples (e.g. aborted immediately) are not worth a file
+    if (_header.count > 0) {
+        String path = getPath(_header.id);
+        File file = LittleFS.open(path, FILE_WRITE);
+
+        if (!file) {
+            debugPrintf("Shot recorder: failed to open %s\n", path.c_str());
+            returnCode = -1;
+        } else {
+            size_t size = sizeof(_header) + _header.count * sizeof(shot_sample_t);
+            size_t written = file.write((const uint8_t *)&_header, sizeof(_header));
+            written += file.write((const uint8_t *)_samples, _header.count * sizeof(shot_sample_t));
+            file.close();
+
+            if (written != size) {
+                debugPrintf("Shot recorder: failed to write %s\n", path.c_str());
+                LittleFS.remove(path);
+                returnCode = -2;
+            } else {
+                debugPrintf("Shot recorder: wrote shot %lu, %u samples\n", (unsigned long)_header.id, _header.count);
+                _nextId = _header.id + 1;
+                returnCode = removeOldShots();
+            }
+        }
+    }
+
+    _state = kIdle;
+
+    return returnCode;
+}
+
+/**
+ * @brief Remove the oldest shots until at most SHOT_RECORDER_COUNT are left
+ */
+int ShotRecorder::removeOldShots() {
+    int returnCode = 0;
+
+    while (_nextId - _firstId > SHOT_RECORDER_COUNT) {
+        String path = getPath(_firstId);
+
+        if (LittleFS.exists(path) && !LittleFS.remove(path)) {
+            debugPrintf("Shot recorder: failed to remove %s\n", path.c_str());
+            returnCode = -3;
+        }
+
+        _firstId++;
+    }
+
+    return returnCode;
+}
+
+/**
+ * @brief Id of the oldest shot that may still be stored
+ */
+uint32_t ShotRecorder::getFirstId() const {
+    return _firstId;
+}
+
+/**
+ * @brief Id the next shot will get
+ */
+uint32_t ShotRecorder::getNextId() const {
+    return _nextId;
+}
+
+String ShotRecorder::getPath(uint32_t id) {
+    return String(SHOT_DIRECTORY "/") + String((unsigned long)id) + ".bin";
+}
@@ -0,0 +1,91 @@
+/**
+ * @file ShotRecorder.h
+ *
+ * @brief High-rate recording of every shot into files on LittleFS
+ *
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <stdint.h>
+#include <atomic>
+
+#include "userConfig.h"
+
+// Not defined in older userConfig files
+#ifndef SHOT_RECORDER_COUNT
+    #define SHOT_RECORDER_COUNT 10
+#endif
+
+#define SHOT_SAMPLE_PERIOD 100      // ms between samples (10 Hz)
+#define SHOT_MAX_SAMPLES 600        // 60 s at 10 Hz, 6 KB of RAM
+#define SHOT_DIRECTORY "/shots"
+
+/**
+ * @brief File header, stored as is (little endian) at the beginning of each
+ *        shot file and followed by count shot_sample_t
+ */
+struct shot_header_t {
+    char magic[4];          // "CCSH"
+    uint8_t version;
+    uint8_t flags;          // bit 0: shot was longer than SHOT_MAX_SAMPLES
+    uint16_t period;        // sample period in ms
+    uint32_t id;
+    uint32_t startTime;     // unix time, 0 if the time wasn't synchronized
+    uint32_t duration;      // ms
+    int16_t setpoint;       // brew setpoint in 0.01 °C
+    int16_t weight;         // final weight of the shot in 0.1 g
+    uint16_t count;         // number of samples
+    uint16_t reserved;
+};
+
+struct shot_sample_t {
+    uint16_t time;          // since the start of the shot in 10 ms
+    int16_t temperature;    // 0.01 °C
+    uint16_t heater;        // PID output, 0..1000
+    int16_t pressure;       // 0.01 bar
+    int16_t weight;         // 0.1 g
+};
+
+/**
+ * @brief Records shots into a preallocated buffer in the control task and
+ *        writes them to flash from the telemetry task, keeping only the last
+ *        SHOT_RECORDER_COUNT shots. While a finished shot waits to be written
+ *        no new shot is recorded.
+ */
+class ShotRecorder {
+    public:
+        ShotRecorder();
+
+        int begin();
+
+        // control task
+        bool start(double setpoint);
+        void sample(double temperature, double heater, float pressure, float weight);
+        void stop(float weight);
+        bool isRecording() const;
+
+        // telemetry task
+        int writePending();
+
+        uint32_t getFirstId() const;
+        uint32_t getNextId() const;
+        static String getPath(uint32_t id);
+
+    private:
+        enum State : uint8_t {
+            kIdle,
+            kRecording,
+            kPending
+        };
+
+        int removeOldShots();
+
+        std::atomic<State> _state;      // hands the buffer over between the tasks
+        unsigned long _startMillis;
+        shot_header_t _header;
+        shot_sample_t _samples[SHOT_MAX_SAMPLES];
+        uint32_t _firstId;
+        uint32_t _nextId;
+};
@@ -0,0 +1,69 @@
+/**
+ * @file Snapshot.h
+ *
+ * @brief Lock-free single writer snapshot for sharing state between tasks
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+
+/**
+ * @brief Sequence-locked copy of a plain data struct
+ *
+ * One task publishes complete copies of T, any number of tasks on any core
+ * can read a consistent copy without taking a lock. A reader that overlaps
+ * with a write simply retries. T must be trivially copyable.
+ */
+template <typename T>
+class Snapshot {
+    public:
+        /**
+         * @brief Publish a new value, must only be called from a single task
+         *
+         * @param value - value to publish
+         */
+        void publish(const T& value) {
+            uint32_t seq = sequence.load(std::memory_order_relaxed);
+
+            sequence.store(seq + 1, std::memory_order_relaxed);  // odd = write in progress
+            std::atomic_thread_fence(std::memory_order_release);
+            data = value;
+            std::atomic_thread_fence(std::memory_order_release);
+            sequence.store(seq + 2, std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Read a consistent copy of the last published value
+         *
+         * @param value - receives the copy, left untouched on failure
+         *
+         * @return true if a consistent copy was read, false if the writer
+         *         kept overlapping (or nothing was published yet)
+         */
+        bool read(T& value) const {
+            for (int tries = 0; tries < maxReadTries; tries++) {
+                uint32_t before = sequence.load(std::memory_order_acquire);
+
+                if (before == 0) return false;  // nothing published yet
+                if (before & 1) continue;       // writer active
+
+                T copy = data;
+                std::atomic_thread_fence(std::memory_order_acquire);
+
+                if (sequence.load(std::memory_order_relaxed) == before) {
+                    value = copy;
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+    private:
+        static const int maxReadTries = 16;
+
+        std::atomic<uint32_t> sequence{0};
+        T data;
+};
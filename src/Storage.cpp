@@ -6,7 +6,8 @@
  */
 
 #include <Arduino.h>
-#include <EEPROM.h>
+#include <Preferences.h>
+#include <esp_rom_crc.h>
 
 #include "debugSerial.h"
 #include "Storage.h"
@@ -14,11 +15,82 @@
 
 #include "ISR.h"
 
-#define STRUCT_MEMBER_SIZE(Type, Member) sizeof(((Type*)0)->Member)
+#define STORAGE_NAMESPACE "clevercoffee"
+#define STORAGE_SETTINGS_KEY "settings"
+#define STORAGE_EEPROM_NAMESPACE "eeprom"   // namespace and key of the former EEPROM emulation blob
+#define STORAGE_VERSION_KEY "version"       // storage version 1 only
+#define STORAGE_ITEM_KEYS_KEY "itemkeys"    // bit mask of the items stored in their own key
+#define STORAGE_VERSION 2
+
+// Changed items are written to their own key ("item<ID>"), the value there
+// replaces the one in the settings blob. Once more than this many items have
+// their own key, all items are written as one blob again and the keys removed.
+#define STORAGE_MAX_ITEM_KEYS 8
+
+// Changes are written once no further change came in for this time (ms),
+// at the latest after STORAGE_COMMIT_MAX_DELAY
+#define STORAGE_COMMIT_DELAY 2000
+#define STORAGE_COMMIT_MAX_DELAY 10000
+
+// storage data structure, RAM copy of all items
+#define STORAGE_NUMBER_MEMBER(id, type, member, def) type member;
+#define STORAGE_STRING_MEMBER(id, member, size, def) char member[size];
+
+typedef struct {
+    STORAGE_ITEMS(STORAGE_NUMBER_MEMBER, STORAGE_STRING_MEMBER)
+} sto_data_t;
+
+// set item defaults
+#define STORAGE_DEFAULT(id, type, member, def) def,
+#define STORAGE_STRING_DEFAULT(id, member, size, def) def,
+
+static const sto_data_t itemDefaults PROGMEM = {
+    STORAGE_ITEMS(STORAGE_DEFAULT, STORAGE_STRING_DEFAULT)
+};
+
+// item address/size/type, indexed by item ID
+enum sto_type_t : uint8_t {
+    STO_TYPE_NUMBER,
+    STO_TYPE_STRING
+};
+
+typedef struct {
+    uint16_t addr;
+    uint8_t size;
+    sto_type_t type;
+} sto_item_t;
+
+#define STORAGE_NUMBER_ITEM(id, type, member, def) {offsetof(sto_data_t, member), sizeof(type), STO_TYPE_NUMBER},
+#define STORAGE_STRING_ITEM(id, member, size, def) {offsetof(sto_data_t, member), size, STO_TYPE_STRING},
 
-// storage data structure
+static const sto_item_t items[STO_ITEM__LAST_ENUM] = {
+    STORAGE_ITEMS(STORAGE_NUMBER_ITEM, STORAGE_STRING_ITEM)
+};
+
+/* Stored settings: header followed by one record per item
+ * (item ID, value size, value), the CRC covers all records.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t version;
+    uint8_t count;          // number of records
+    uint16_t length;        // bytes of records following the header
+    uint32_t crc;
+} sto_header_t;
+
+#define STORAGE_NUMBER_RECORD_SIZE(id, type, member, def) + 2 + sizeof(type)
+#define STORAGE_STRING_RECORD_SIZE(id, member, size, def) + 2 + (size)
+
+static const size_t STORAGE_BLOB_SIZE = sizeof(sto_header_t) STORAGE_ITEMS(STORAGE_NUMBER_RECORD_SIZE, STORAGE_STRING_RECORD_SIZE);
+
+static_assert(STO_ITEM__LAST_ENUM <= 32, "dirtyItems has one bit per item");
+static_assert(STO_ITEM__LAST_ENUM > STORAGE_MAX_ITEM_KEYS, "writing all items must write the settings blob");
+static_assert(STORAGE_BLOB_SIZE - sizeof(sto_header_t) <= UINT16_MAX, "record length doesn't fit the header");
+
+/* Layout of the former EEPROM emulation (storage version 0), only used to
+ * migrate old settings. Any 'freeToUse' areas kept the compatibility to the
+ * origin EEPROM layout.
+ */
 typedef struct __attribute__((packed)) {
-    // Any 'freeToUse' areas ensure the compatibility to origin EEPROM layout and can be used by new value.
     double pidKpRegular;
     uint8_t reserved1[2];
     double pidTnRegular;
@@ -62,229 +134,27 @@ typedef struct __attribute__((packed)) {
     double steamSetpoint;
     uint8_t standbyModeOn;
     double standbyModeTime;
-} sto_data_t;
+} sto_eeprom_t;
 
-// set item defaults
-static const sto_data_t itemDefaults PROGMEM = {
-    AGGKP,                                    // STO_ITEM_PID_KP_REGULAR
-    {0xFF, 0xFF},                             // reserved (maybe for structure version)
-    AGGTN,                                    // STO_ITEM_PID_TN_REGULAR
-    0,                                        // STO_ITEM_PID_ON
-    0xFF,                                     // free to use
-    AGGTV,                                    // STO_ITEM_PID_TV_REGULAR
-    AGGIMAX,                                  // STO_ITEM_PID_I_MAX_REGULAR
-    0xFF,                                     // free to use
-    SETPOINT,                                 // STO_ITEM_BREW_SETPOINT
-    TEMPOFFSET,                               // STO_ITEM_BREW_TEMP_OFFSET
-    0xFF,                                     // free to use
-    BREW_TIME,                                // STO_ITEM_BREW_TIME
-    {0xFF, 0xFF},                             // free to use
-    PRE_INFUSION_TIME,                        // STO_ITEM_PRE_INFUSION_TIME
-    {0xFF, 0xFF},                             // free to use
-    PRE_INFUSION_PAUSE_TIME,                  // STO_ITEM_PRE_INFUSION_PAUSE
-    {   0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
-        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
-        0xFF, 0xFF, 0xFF, 0xFF, 0xFF },       // free to use
-    0,                                        // STO_ITEM_USE_PID_BD
-    AGGBKP,                                   // STO_ITEM_PID_KP_BD
-    {0xFF, 0xFF},                             // free to use
-    AGGBTN,                                   // STO_ITEM_PID_TN_BD
-    {0xFF, 0xFF},                             // free to use
-    AGGBTV,                                   // STO_ITEM_PID_TV_BD
-    {0xFF, 0xFF},                             // free to use
-    BREW_SW_TIME,                             // STO_ITEM_BREW_SW_TIME
-    BREW_PID_DELAY,                           // STO_ITEM_BREW_PID_DELAY
-    0xFF,                                     // free to use
-    BD_SENSITIVITY,                           // STO_ITEM_BD_THRESHOLD
-    WIFI_CREDENTIALS_SAVED,                   // STO_ITEM_WIFI_CREDENTIALS_SAVED
-    0,                                        // STO_ITEM_USE_START_PON_M
-    STARTKP,                                  // STO_ITEM_PID_KP_START
-    {0xFF, 0xFF},                             // free to use
-    0,                                        // STO_ITEM_SOFT_AP_ENABLED_CHECK
-    {0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
-    0xFF, 0xFF, 0xFF, 0xFF},                  // free to use
-    STARTTN,                                  // STO_ITEM_PID_TN_START
-    {0xFF, 0xFF},                             // free to use
-    "",                                       // STO_ITEM_WIFI_SSID
-    "",                                       // STO_ITEM_WIFI_PASSWORD
-    SCALE_WEIGHTSETPOINT,                     // STO_ITEM_WEIGHTSETPOINT
-    STEAMKP,                                  // STO_ITEM_PID_KP_STEAM
-    STEAMSETPOINT,                            // STO_ITEM_STEAM_SETPOINT
-    STANDBY_MODE_ON,                          // STO_ITEM_STANDBY_MODE_ON
-    STANDBY_MODE_TIME                         // STO_ITEM_STANDBY_MODE_TIME 
+#define STORAGE_NUMBER_EEPROM_ADDR(id, type, member, def) offsetof(sto_eeprom_t, member),
+#define STORAGE_STRING_EEPROM_ADDR(id, member, size, def) offsetof(sto_eeprom_t, member),
+
+static const uint16_t eepromAddr[] = {
+    STORAGE_EEPROM_ITEMS(STORAGE_NUMBER_EEPROM_ADDR, STORAGE_STRING_EEPROM_ADDR)
 };
 
-/**
- * @brief Returns the storage address of given item.
- *        Optionally the max. item storage size can be delivered.
- *
- * @param itemId      - storage item ID
- * @param maxItemSize - buffer for max. item storage size (optional, default=no buffer)
- *
- * @return >=0 - item storage address
- *          <0 - error
- */
-static inline int32_t getItemAddr(sto_item_id_t itemId, uint16_t* maxItemSize = NULL) {
-    int32_t addr;
-    uint16_t size;
-
-    switch (itemId) {
-        case STO_ITEM_PID_KP_REGULAR:
-            addr = offsetof(sto_data_t, pidKpRegular);
-            size = STRUCT_MEMBER_SIZE(sto_data_t, pidKpRegular);
-            break;
-
-        case STO_ITEM_PID_TN_REGULAR:
-            addr = offsetof(sto_data_t, pidTnRegular);
-            size = STRUCT_MEMBER_SIZE(sto_data_t, pidTnRegular);
-            break;
-
-        case STO_ITEM_PID_TV_REGULAR:
-            addr = offsetof(sto_data_t, pidTvRegular);
-            size = STRUCT_MEMBER_SIZE(sto_data_t, pidTvRegular);
-            break;
-
-        case STO_ITEM_PID_I_MAX_REGULAR:
-            addr = offsetof(sto_data_t, pidIMaxRegular);
-            size = STRUCT_MEMBER_SIZE(sto_data_t, pidIMaxRegular);
-            break;
-
-        case STO_ITEM_BREW_SETPOINT:
-            addr = offsetof(sto_data_t, brewSetpoint);
-            size = STRUCT_MEMBER_SIZE(sto_data_t, brewSetpoint);
-            break;
-
-        case STO_ITEM_BREW_TEMP_OFFSET:
-            addr = offsetof(sto_data_t, brewTempOffset);
-            size = STRUCT_MEMBER_SIZE(sto_data_t, brewTempOffset);
-            break;
-
-        case STO_ITEM_BREW_TIME:
-            addr = offsetof(sto_data_t, brewTimeMs);
-            size = STRUCT_MEMBER_SIZE(sto_data_t, brewTimeMs);
-            break;
-
-        case STO_ITEM_PRE_INFUSION_TIME:
-            addr = offsetof(sto_data_t, preInfusionTimeMs);
-            size = STRUCT_MEMBER_SIZE(sto_data_t, preInfusionTimeMs);
-            break;
-
-        case STO_ITEM_PRE_INFUSION_PAUSE:
-            addr = offsetof(sto_data_t, preInfusionPauseMs);
-            size = STRUCT_MEMBER_SIZE(sto_data_t, preInfusionPauseMs);
-            break;
-
-        case STO_ITEM_BREW_PID_DELAY:
-            addr = offsetof(sto_data_t, brewPIDDelaySec);
-            size = STRUCT_MEMBER_SIZE(sto_data_t, brewPIDDelaySec);
-            break;
-
-        case STO_ITEM_USE_BD_PID:
-            addr = offsetof(sto_data_t, pidBdOn);
-            size = STRUCT_MEMBER_SIZE(sto_data_t, pidBdOn);
-            break;
-
-        case STO_ITEM_PID_KP_BD:
-            addr = offsetof(sto_data_t, pidKpBd);
-            size = STRUCT_MEMBER_SIZE(sto_data_t, pidKpBd);
-            break;
-
-        case STO_ITEM_PID_TN_BD:
-            addr = offsetof(sto_data_t, pidTnBd);
-            size = STRUCT_MEMBER_SIZE(sto_data_t, pidTnBd);
-            break;
-
-        case STO_ITEM_PID_TV_BD:
-            addr = offsetof(sto_data_t, pidTvBd);
-            size = STRUCT_MEMBER_SIZE(sto_data_t, pidTvBd);
-            break;
-
-        case STO_ITEM_BREW_SW_TIME:
-            addr = offsetof(sto_data_t, brewSwTimeSec);
-            size = STRUCT_MEMBER_SIZE(sto_data_t, brewSwTimeSec);
-            break;
-
-        case STO_ITEM_BD_THRESHOLD:
-            addr = offsetof(sto_data_t, brewDetectionThreshold);
-            size = STRUCT_MEMBER_SIZE(sto_data_t, brewDetectionThreshold);
-            break;
-
-        case STO_ITEM_WIFI_CREDENTIALS_SAVED:
-            addr = offsetof(sto_data_t, wifiCredentialsSaved);
-            size = STRUCT_MEMBER_SIZE(sto_data_t, wifiCredentialsSaved);
-            break;
-
-        case STO_ITEM_PID_START_PONM:
-            addr = offsetof(sto_data_t, useStartPonM);
-            size = STRUCT_MEMBER_SIZE(sto_data_t, useStartPonM);
-            break;
-
-        case STO_ITEM_PID_KP_START:
-            addr = offsetof(sto_data_t, pidKpStart);
-            size = STRUCT_MEMBER_SIZE(sto_data_t, pidKpStart);
-            break;
-
-        case STO_ITEM_PID_TN_START:
-            addr = offsetof(sto_data_t, pidTnStart);
-            size = STRUCT_MEMBER_SIZE(sto_data_t, pidTnStart);
-            break;
-
-        case STO_ITEM_SOFT_AP_ENABLED_CHECK:
-            addr = offsetof(sto_data_t, softApEnabledCheck);
-            size = STRUCT_MEMBER_SIZE(sto_data_t, softApEnabledCheck);
-            break;
-
-        case STO_ITEM_WIFI_SSID:
-            addr = offsetof(sto_data_t, wifiSSID);
-            size = STRUCT_MEMBER_SIZE(sto_data_t, wifiSSID);
-            break;
-
-        case STO_ITEM_WIFI_PASSWORD:
-            addr = offsetof(sto_data_t, wifiPassword);
-            size = STRUCT_MEMBER_SIZE(sto_data_t, wifiPassword);
-            break;
-
-        case STO_ITEM_PID_ON:
-            addr = offsetof(sto_data_t, pidOn);
-            size = STRUCT_MEMBER_SIZE(sto_data_t, pidOn);
-            break;
-
-        case STO_ITEM_PID_KP_STEAM:
-            addr = offsetof(sto_data_t, steamkp);
-            size = STRUCT_MEMBER_SIZE(sto_data_t, steamkp);
-            break;
-
-        case STO_ITEM_WEIGHTSETPOINT:
-            addr = offsetof(sto_data_t, weightSetpoint );
-            size = STRUCT_MEMBER_SIZE(sto_data_t,weightSetpoint);
-            break;
-
-        case STO_ITEM_STEAM_SETPOINT:
-            addr = offsetof(sto_data_t, steamSetpoint);
-            size = STRUCT_MEMBER_SIZE(sto_data_t,steamSetpoint);
-            break;
-
-        case STO_ITEM_STANDBY_MODE_ON:
-            addr = offsetof(sto_data_t, standbyModeOn);
-            size = STRUCT_MEMBER_SIZE(sto_data_t,standbyModeOn);
-            break;
-
-        case STO_ITEM_STANDBY_MODE_TIME:
-            addr = offsetof(sto_data_t, standbyModeTime);
-            size = STRUCT_MEMBER_SIZE(sto_data_t,standbyModeTime);
-            break;
-
-        default:
-            debugPrintf("%s(): invalid item ID %i!\n", __func__, itemId);
-            addr = -1;
-            size = 0;
-            break;
-    }
-
-    if (maxItemSize) *maxItemSize = size;
-
-    return addr;
-}
+static const int STORAGE_EEPROM_ITEM_COUNT = sizeof(eepromAddr) / sizeof(eepromAddr[0]);
+
+static sto_data_t storageData;              // RAM copy of all items, defaults where nothing is stored
+static uint32_t dirtyItems = 0;             // items changed since the last flush
+static bool commitPending = false;
+static unsigned long firstCommitRequest;    // millis() of the first and last storageCommit() since the last flush
+static unsigned long lastCommitRequest;
+static uint32_t itemKeys = 0;               // items stored in their own key, see STORAGE_MAX_ITEM_KEYS
+static bool storageReady = false;
+static SemaphoreHandle_t storageMutex = NULL;   // protects storageData and the commit state
+static SemaphoreHandle_t flushMutex = NULL;     // serializes the NVS writes and protects itemKeys
+static Preferences nvs;
 
 /**
  * @brief Checks if an item storage area is considered as "empty", which means
@@ -328,108 +198,296 @@ static inline bool isString(const void* buf, uint16_t bufSize) {
     return false;
 }
 
-#if 0  // not needed a.t.m.
 /**
- * @brief Sets the default values.
+ * @brief NVS key of an item stored on its own
  */
-static void setDefaults(void) {
-    debugPrintf("%s(): %p <- %p (%u)\n", __func__, EEPROM.getDataPtr(), &itemDefaults, sizeof(itemDefaults));
-    memcpy_P(EEPROM.getDataPtr(), &itemDefaults, sizeof(itemDefaults));
+static inline void getItemKey(char* key, size_t size, int itemId) {
+    snprintf(key, size, "item%u", (unsigned int)itemId);
+}
+
+/**
+ * @brief Checks if a value read from an older storage version is usable
+ */
+static inline bool isValidValue(sto_item_id_t itemId, const void* value) {
+    if (items[itemId].type == STO_TYPE_STRING) {
+        return isString(value, items[itemId].size);
+    }
+
+    return !isEmpty(value, items[itemId].size);
 }
-#endif
 
 /**
- * @brief Setups the module.
+ * @brief Storage version 0: copies the items found in the blob of the former
+ *        EEPROM emulation. The old blob is kept, so older firmware still finds
+ *        its settings.
  *
- * @return  0 - succeed
- *         <0 - failed
+ * @return number of migrated items
  */
-int storageSetup(void) {
+static int migrateEepromBlob(void) {
+    Preferences eeprom;
+    int count = 0;
 
-    if (!EEPROM.begin(sizeof(sto_data_t))) {
-        debugPrintf("%s(): EEPROM initialization failed!\n", __func__);
-        return -1;
+    if (!eeprom.begin(STORAGE_EEPROM_NAMESPACE, true)) {
+        return 0;
     }
 
-    /* It's not necessary here to check if any valid data are stored,
-     * because storageGet() returns a default value in this case.
-     */
+    size_t size = eeprom.isKey(STORAGE_EEPROM_NAMESPACE) ? eeprom.getBytesLength(STORAGE_EEPROM_NAMESPACE) : 0;
 
-    return 0;
+    if (size >= sizeof(sto_eeprom_t)) {
+        uint8_t* blob = (uint8_t*)malloc(size);
+
+        if (blob != NULL && eeprom.getBytes(STORAGE_EEPROM_NAMESPACE, blob, size) == size) {
+            for (int id = 0; id < STORAGE_EEPROM_ITEM_COUNT; id++) {
+                const uint8_t* value = blob + eepromAddr[id];
+
+                if (isValidValue((sto_item_id_t)id, value)) {
+                    memcpy((uint8_t*)&storageData + items[id].addr, value, items[id].size);
+                    count++;
+                }
+            }
+        }
+
+        free(blob);
+    }
+
+    eeprom.end();
+
+    return count;
 }
 
 /**
- * @brief Internal template function to read a number of any type.
+ * @brief Storage version 1: copies the items stored as one NVS key per item
+ *        ("item<ID>") and removes the keys.
  *
- * @param itemId    - storage item ID
- * @param itemValue - buffer for item value
+ * @return number of migrated items
+ */
+static int migrateItemKeys(void) {
+    int count = 0;
+
+    for (int id = 0; id < STO_ITEM__LAST_ENUM; id++) {
+        char key[12];
+        getItemKey(key, sizeof(key), id);
+
+        if (!nvs.isKey(key)) continue;
+
+        if (nvs.getBytesLength(key) == items[id].size) {
+            uint8_t value[items[id].size];
+
+            if (nvs.getBytes(key, value, sizeof(value)) == sizeof(value) && isValidValue((sto_item_id_t)id, value)) {
+                memcpy((uint8_t*)&storageData + items[id].addr, value, sizeof(value));
+                count++;
+            }
+        }
+
+        nvs.remove(key);
+    }
+
+    nvs.remove(STORAGE_VERSION_KEY);
+
+    return count;
+}
+
+/* Migration hooks, migrations[n] converts the data of storage version n to
+ * version n + 1. The ones before version 2 import the old formats into
+ * storageData, later layout changes (e.g. a value changing its unit) convert
+ * the loaded values.
+ */
+static int (*const migrations[STORAGE_VERSION])(void) = {
+    migrateEepromBlob,
+    migrateItemKeys
+};
+
+/**
+ * @brief Reads the items written to their own key since the settings blob was
+ *        written, they are newer than the values in the blob
+ */
+static void loadItemKeys(void) {
+    itemKeys = nvs.isKey(STORAGE_ITEM_KEYS_KEY) ? nvs.getULong(STORAGE_ITEM_KEYS_KEY) : 0;
+
+    for (int id = 0; id < STO_ITEM__LAST_ENUM; id++) {
+        if ((itemKeys & (1UL << id)) == 0) continue;
+
+        char key[12];
+        getItemKey(key, sizeof(key), id);
+
+        uint8_t value[items[id].size];
+
+        if (nvs.getBytesLength(key) == sizeof(value) && nvs.getBytes(key, value, sizeof(value)) == sizeof(value) &&
+            isValidValue((sto_item_id_t)id, value)) {
+            memcpy((uint8_t*)&storageData + items[id].addr, value, sizeof(value));
+        }
+    }
+}
+
+/**
+ * @brief Reads the stored settings into storageData with a single read, plus
+ *        one read per item stored in its own key
+ *
+ * @return >=0 - storage version of the settings, 0 if there are none
+ *          -1 - settings are corrupted
+ *          -2 - settings couldn't be read
+ */
+static int loadSettings(void) {
+    if (!nvs.isKey(STORAGE_SETTINGS_KEY)) {
+        return nvs.isKey(STORAGE_VERSION_KEY) ? 1 : 0;
+    }
+
+    size_t size = nvs.getBytesLength(STORAGE_SETTINGS_KEY);
+
+    if (size < sizeof(sto_header_t)) {
+        return -1;
+    }
+
+    uint8_t* blob = (uint8_t*)malloc(size);
+    int retCode = -1;
+
+    if (blob == NULL || nvs.getBytes(STORAGE_SETTINGS_KEY, blob, size) != size) {
+        retCode = -2;
+    } else {
+        sto_header_t header;
+        memcpy(&header, blob, sizeof(header));
+
+        const uint8_t* record = blob + sizeof(header);
+        const uint8_t* end = record + header.length;
+
+        if (sizeof(header) + header.length == size && esp_rom_crc32_le(0, record, header.length) == header.crc) {
+            for (uint8_t n = 0; n < header.count && record + 2 <= end; n++) {
+                uint8_t id = record[0];
+                uint8_t valueSize = record[1];
+                const uint8_t* value = record + 2;
+
+                if (value + valueSize > end) break;
+
+                // items of newer firmware are skipped, items of the wrong size keep their default
+                if (id < STO_ITEM__LAST_ENUM && valueSize == items[id].size &&
+                    (items[id].type != STO_TYPE_STRING || isString(value, valueSize))) {
+                    memcpy((uint8_t*)&storageData + items[id].addr, value, valueSize);
+                }
+
+                record = value + valueSize;
+            }
+
+            retCode = header.version;
+        }
+    }
+
+    free(blob);
+
+    if (retCode >= STORAGE_VERSION) {
+        loadItemKeys();
+    }
+
+    return retCode;
+}
+
+/**
+ * @brief Setups the module: loads all items, migrating settings of older
+ *        storage versions. Corrupted settings are replaced by the defaults
+ *        and the items stored in their own keys. If the settings can't be
+ *        read, the storage stays unusable until the next boot, so they
+ *        aren't overwritten.
  *
  * @return  0 - succeed
  *         <0 - failed
  */
-template <typename T>
-static inline int getNumber(sto_item_id_t itemId, T& itemValue) {
-    uint16_t maxItemSize;
-    int32_t itemAddr = getItemAddr(itemId, &maxItemSize);
+int storageSetup(void) {
+    memcpy_P(&storageData, &itemDefaults, sizeof(storageData));
 
-    if (itemAddr < 0) {
-        debugPrintf("%s(): invalid item address!\n", __func__);
+    storageMutex = xSemaphoreCreateMutex();
+    flushMutex = xSemaphoreCreateMutex();
+
+    if (storageMutex == NULL || flushMutex == NULL || !nvs.begin(STORAGE_NAMESPACE, false)) {
+        LOG_ERROR("%s(): NVS initialization failed!\n", __func__);
         return -1;
     }
 
-    debugPrintf("%s(): addr=%i size=%u/%u\n", __func__, itemAddr, sizeof(itemValue), maxItemSize);
+    storageReady = true;
+
+    int version = loadSettings();
 
-    if (sizeof(itemValue) != maxItemSize) {
-        debugPrintf("%s(): invalid item size (wrong data type)!\n", __func__);
+    if (version == -2) {
+        // the stored settings may be fine, don't overwrite them with defaults
+        LOG_ERROR("%s(): reading settings failed!\n", __func__);
+        storageReady = false;
         return -2;
     }
 
-    EEPROM.get(itemAddr, itemValue);
+    if (version >= STORAGE_VERSION) {
+        return 0;
+    }
 
-    if (isEmpty(&itemValue, sizeof(itemValue))) { // item storage empty?
-        debugPrintf("%s(): storage empty -> returning default\n", __func__);
+    if (version == -1) {
+        // the items in their own keys are checked one by one, keep them
+        LOG_ERROR("%s(): stored settings are corrupted -> using defaults\n", __func__);
+        loadItemKeys();
+    } else {
+        for (int v = version; v < STORAGE_VERSION; v++) {
+            int count = migrations[v]();
+            LOG_INFO("%s(): migrated %i items of storage version %i\n", __func__, count, v);
+        }
+    }
 
-        memcpy_P(&itemValue, (PGM_P)&itemDefaults + itemAddr, sizeof(itemValue));  // set default value
+    // all items go to a new blob, which replaces a corrupted one and the item keys
+    dirtyItems = (1ULL << STO_ITEM__LAST_ENUM) - 1;
+
+    if (storageFlush() != 0) {
+        LOG_ERROR("%s(): writing settings failed!\n", __func__);
+        return -3;
     }
 
     return 0;
 }
 
 /**
- * @brief Internal template function to set a number of any type.
- *        The value is set in the RAM only and still not written to the
- *        non-volatile memory!
+ * @brief Returns the storage address of given item, after checking the ID
+ *        and the item type
  *
- * @param itemId    - storage item ID
- * @param itemValue - item value to set
- * @param commit    - true=write current data to medium (optional, default=false)
+ * @param itemId - storage item ID
+ * @param type   - expected item type
  *
- * @return  0 - succeed
- *         <0 - failed
+ * @return >=0 - item storage address
+ *          <0 - error
  */
-template <typename T>
-static inline int setNumber(sto_item_id_t itemId, const T& itemValue, bool commit = false) {
-    uint16_t maxItemSize;
-    int32_t itemAddr = getItemAddr(itemId, &maxItemSize);
+static inline int32_t getItemAddr(sto_item_id_t itemId, sto_type_t type) {
+    if (!storageReady) return -4;
 
-    if (itemAddr < 0) {
-        debugPrintf("%s(): invalid item address!\n", __func__);
+    if ((int)itemId < 0 || itemId >= STO_ITEM__LAST_ENUM) {
+        LOG_ERROR("%s(): invalid item ID %i!\n", __func__, (int)itemId);
         return -1;
     }
 
-    debugPrintf("%s(): addr=%i size=%u/%u commit=%u\n", __func__, itemAddr, sizeof(itemValue), maxItemSize, commit);
-
-    if (sizeof(itemValue) != maxItemSize) {
-        debugPrintf("%s(): invalid item size (wrong data type)!\n", __func__);
+    if (items[itemId].type != type) {
+        LOG_ERROR("%s(): invalid item type (item: %i)!\n", __func__, (int)itemId);
         return -2;
     }
 
-    if (isEmpty(&itemValue, sizeof(T))) {
-        debugPrintf("%s(): invalid item value!\n", __func__);
-        return -3;
+    return items[itemId].addr;
+}
+
+/**
+ * @brief Copies an item value to the RAM copy and marks the item as changed.
+ *        Values equal to the stored ones don't cause a write.
+ *
+ * @param itemId    - storage item ID
+ * @param itemAddr  - item storage address
+ * @param itemValue - item value
+ * @param size      - number of bytes to copy
+ * @param commit    - true=schedule writing the changes
+ *
+ * @return  0 - succeed
+ *         <0 - failed
+ */
+static int putItem(sto_item_id_t itemId, int32_t itemAddr, const void* itemValue, size_t size, bool commit) {
+    uint8_t* item = (uint8_t*)&storageData + itemAddr;
+
+    xSemaphoreTake(storageMutex, portMAX_DELAY);
+
+    if (memcmp(item, itemValue, size) != 0) {
+        memcpy(item, itemValue, size);
+        dirtyItems |= 1UL << itemId;
     }
 
-    EEPROM.put(itemAddr, itemValue);
+    xSemaphoreGive(storageMutex);
 
     if (commit) return storageCommit();
 
@@ -437,7 +495,7 @@ static inline int setNumber(sto_item_id_t itemId, const T& itemValue, bool commi
 }
 
 /**
- * @brief Reads the value of a storage item.
+ * @brief Internal template function to read a number of any type.
  *
  * @param itemId    - storage item ID
  * @param itemValue - buffer for item value
@@ -445,134 +503,103 @@ static inline int setNumber(sto_item_id_t itemId, const T& itemValue, bool commi
  * @return  0 - succeed
  *         <0 - failed
  */
-int storageGet(sto_item_id_t itemId, float& itemValue) {
-    int retCode = getNumber(itemId, itemValue);
+template <typename T>
+static inline int getNumber(sto_item_id_t itemId, T& itemValue) {
+    int32_t itemAddr = getItemAddr(itemId, STO_TYPE_NUMBER);
 
-    if (retCode != 0) return retCode;
+    if (itemAddr < 0) return itemAddr;
 
-    debugPrintf("%s(): item=%i value=%.1f\n", __func__, itemId, itemValue);
+    if (sizeof(itemValue) != items[itemId].size) {
+        LOG_ERROR("%s(): invalid item size (wrong data type)!\n", __func__);
+        return -2;
+    }
+
+    xSemaphoreTake(storageMutex, portMAX_DELAY);
+    memcpy(&itemValue, (const uint8_t*)&storageData + itemAddr, sizeof(itemValue));
+    xSemaphoreGive(storageMutex);
 
     return 0;
 }
 
-int storageGet(sto_item_id_t itemId, double& itemValue) {
-    int retCode = getNumber(itemId, itemValue);
+/**
+ * @brief Internal template function to set a number of any type.
+ *        The value is set in the RAM only and still not written to the
+ *        non-volatile memory!
+ *
+ * @param itemId    - storage item ID
+ * @param itemValue - item value to set
+ * @param commit    - true=schedule writing the changes (optional, default=false)
+ *
+ * @return  0 - succeed
+ *         <0 - failed
+ */
+template <typename T>
+static inline int setNumber(sto_item_id_t itemId, const T& itemValue, bool commit = false) {
+    int32_t itemAddr = getItemAddr(itemId, STO_TYPE_NUMBER);
 
-    if (retCode != 0) return retCode;
+    if (itemAddr < 0) return itemAddr;
 
-    debugPrintf("%s(): item=%i value=%.1f\n", __func__, itemId, itemValue);
+    if (sizeof(itemValue) != items[itemId].size) {
+        LOG_ERROR("%s(): invalid item size (wrong data type)!\n", __func__);
+        return -2;
+    }
 
-    return 0;
+    return putItem(itemId, itemAddr, &itemValue, sizeof(itemValue), commit);
 }
 
-int storageGet(sto_item_id_t itemId, int8_t& itemValue) {
-    int retCode = getNumber(itemId, itemValue);
-
-    if (retCode != 0) return retCode;
+/**
+ * @brief Reads the value of a storage item.
+ *
+ * @param itemId    - storage item ID
+ * @param itemValue - buffer for item value
+ *
+ * @return  0 - succeed
+ *         <0 - failed
+ */
+int storageGet(sto_item_id_t itemId, float& itemValue) {
+    return getNumber(itemId, itemValue);
+}
 
-    debugPrintf("%s(): item=%i value=%i\n", __func__, itemId, itemValue);
+int storageGet(sto_item_id_t itemId, double& itemValue) {
+    return getNumber(itemId, itemValue);
+}
 
-    return 0;
+int storageGet(sto_item_id_t itemId, int8_t& itemValue) {
+    return getNumber(itemId, itemValue);
 }
 
 int storageGet(sto_item_id_t itemId, int16_t& itemValue) {
-    int retCode = getNumber(itemId, itemValue);
-
-    if (retCode != 0) return retCode;
-
-    debugPrintf("%s(): item=%i value=%i\n", __func__, itemId, itemValue);
-
-    return 0;
+    return getNumber(itemId, itemValue);
 }
 
 int storageGet(sto_item_id_t itemId, int32_t& itemValue) {
-    int retCode = getNumber(itemId, itemValue);
-
-    if (retCode != 0) return retCode;
-
-    debugPrintf("%s(): item=%i value=%i\n", __func__, itemId, itemValue);
-
-    return 0;
+    return getNumber(itemId, itemValue);
 }
 
 int storageGet(sto_item_id_t itemId, uint8_t& itemValue) {
-    int retCode = getNumber(itemId, itemValue);
-
-    if (retCode != 0) return retCode;
-
-    debugPrintf("%s(): item=%i value=%u\n", __func__, itemId, itemValue);
-
-    return 0;
+    return getNumber(itemId, itemValue);
 }
 
 int storageGet(sto_item_id_t itemId, uint16_t& itemValue) {
-    int retCode = getNumber(itemId, itemValue);
-    if (retCode != 0) return retCode;
-    debugPrintf("%s(): item=%i value=%u\n", __func__, itemId, itemValue);
-
-    return 0;
+    return getNumber(itemId, itemValue);
 }
 
 int storageGet(sto_item_id_t itemId, uint32_t& itemValue) {
-    int retCode = getNumber(itemId, itemValue);
-
-    if (retCode != 0) return retCode;
-
-    debugPrintf("%s(): item=%i value=%u\n", __func__, itemId, itemValue);
-
-    return 0;
+    return getNumber(itemId, itemValue);
 }
 
-#if 0
-/* The ESP32 EEPROM class does not support getConstDataPtr(). The available
- * getDataPtr() always leads to a "dirty" status (= erase/program cycle), even
- * if only read operations will be done!
- * If this function is needed, a temporary read buffer has to be used.
- */
-int storageGet(sto_item_id_t itemId, const char** itemValue) {
-    size_t itemSize;
-    int32_t itemAddr = getItemAddr(itemId);
-
-    if ((itemAddr < 0) || (itemValue == NULL))
-        return -1;
-
-    // instead of copying the string, give back pointer to string in the data structure
-    *itemValue = (const char*)(EEPROM.getConstDataPtr() + itemAddr);
-    itemSize = strlen(*itemValue) + 1;
-
-    if (isEmpty(*itemValue, itemSize)) { // item storage empty?
-        debugPrintf("%s(): storage empty -> returning default\n", __func__);
-        memcpy_P(&itemValue, (const void*)(&itemDefaults+itemAddr), itemSize);      // set default value
-    }
-
-    debugPrintf("%s(): addr=%i size=%u item=%i value=\"%s\"\n", __func__, itemAddr, itemSize, itemId, *itemValue);
-
-    return 0;
-}
-#endif
-
 int storageGet(sto_item_id_t itemId, String& itemValue) {
-    uint16_t maxItemSize;
-    int32_t itemAddr = getItemAddr(itemId, &maxItemSize);
+    int32_t itemAddr = getItemAddr(itemId, STO_TYPE_STRING);
 
-    if (itemAddr < 0) {
-        debugPrintf("%s(): invalid item address!\n", __func__);
-        return -1;
-    }
+    if (itemAddr < 0) return itemAddr;
 
+    char buf[items[itemId].size];
 
-    // The ESP32 EEPROM class does not support getConstDataPtr()!
-    uint8_t buf[maxItemSize];
-    EEPROM.readBytes(itemAddr, buf, maxItemSize);
+    xSemaphoreTake(storageMutex, portMAX_DELAY);
+    memcpy(buf, (const uint8_t*)&storageData + itemAddr, sizeof(buf));
+    xSemaphoreGive(storageMutex);
 
-    if (isString(buf, maxItemSize)) { // exist a null terminator?
-        itemValue = String((const char*)buf);
-    } else {
-        debugPrintf("%s(): storage empty -> returning default\n", __func__);
-        itemValue = String((PGM_P)&itemDefaults + itemAddr);  // set default string
-    }
-
-    debugPrintf("%s(): addr=%i size=%u item=%i value=\"%s\"\n", __func__, itemAddr, itemValue.length() + 1, itemId, itemValue.c_str());
+    itemValue = String(buf);
 
     return 0;
 }
@@ -580,78 +607,66 @@ int storageGet(sto_item_id_t itemId, String& itemValue) {
 /**
  * @brief Sets a value of a storage item.
  *        The value is set in the RAM only! Use 'commit=true' or call
- *        storageCommit() to write the RAM content to the non-volatile memory!
-*
-*  @param itemId    - storage item ID
+ *        storageCommit() to have the changed items written to the
+ *        non-volatile memory!
+ *
+ * @param itemId    - storage item ID
  * @param itemValue - item value to set
- * @param commit    - true=write current RAM content to NV memory (optional, default=false)
+ * @param commit    - true=schedule writing the changes to NV memory (optional, default=false)
  *
  * @return  0 - succeed
  *         <0 - failed
  */
 int storageSet(sto_item_id_t itemId, float itemValue, bool commit) {
-    debugPrintf("%s(): item=%i value=%.1f\n", __func__, itemId, itemValue);
     return setNumber(itemId, itemValue, commit);
 }
 
 int storageSet(sto_item_id_t itemId, double itemValue, bool commit) {
-    debugPrintf("%s(): item=%i value=%.1f\n", __func__, itemId, itemValue);
     return setNumber(itemId, itemValue, commit);
 }
 
 int storageSet(sto_item_id_t itemId, int8_t itemValue, bool commit) {
-    debugPrintf("%s(): item=%i value=%i\n", __func__, itemId, itemValue);
     return setNumber(itemId, itemValue, commit);
 }
 
 int storageSet(sto_item_id_t itemId, int16_t itemValue, bool commit) {
-    debugPrintf("%s(): item=%i value=%i\n", __func__, itemId, itemValue);
     return setNumber(itemId, itemValue, commit);
 }
 
 int storageSet(sto_item_id_t itemId, int32_t itemValue, bool commit) {
-    debugPrintf("%s(): item=%i value=%i\n", __func__, itemId, itemValue);
     return setNumber(itemId, itemValue, commit);
 }
 
 int storageSet(sto_item_id_t itemId, uint8_t itemValue, bool commit) {
-    debugPrintf("%s(): item=%i value=%u\n", __func__, itemId, itemValue);
     return setNumber(itemId, itemValue, commit);
 }
 
 int storageSet(sto_item_id_t itemId, uint16_t itemValue, bool commit) {
-    debugPrintf("%s(): item=%i value=%u\n", __func__, itemId, itemValue);
     return setNumber(itemId, itemValue, commit);
 }
 
 int storageSet(sto_item_id_t itemId, uint32_t itemValue, bool commit) {
-    debugPrintf("%s(): item=%i value=%u\n", __func__, itemId, itemValue);
     return setNumber(itemId, itemValue, commit);
 }
 
 int storageSet(sto_item_id_t itemId, const char* itemValue, bool commit) {
-    uint16_t maxItemSize;
-    size_t valueSize;
-    int32_t itemAddr = getItemAddr(itemId, &maxItemSize);
+    int32_t itemAddr = getItemAddr(itemId, STO_TYPE_STRING);
 
-    if (itemAddr < 0) {
-        debugPrintf("%s(): invalid item address!\n", __func__);
-        return -1;
-    }
+    if (itemAddr < 0) return itemAddr;
 
-    valueSize = strlen(itemValue) + 1;
-    debugPrintf("%s(): item=%i value=\"%s\" addr=%i size=%u/%u\n", __func__, itemId, itemValue, itemAddr, valueSize, maxItemSize);
+    size_t valueSize = strlen(itemValue) + 1;
 
-    if (valueSize > maxItemSize) { // invalid value size?
-        debugPrintf("%s(): string too large!\n", __func__);
+    if (valueSize > items[itemId].size) { // invalid value size?
+        LOG_ERROR("%s(): string too large! (item: %i)\n", __func__, (int)itemId);
         return -2;
     }
 
-    memcpy(EEPROM.getDataPtr() + itemAddr, itemValue, valueSize);  // copy value to data structure in RAM
+    // pad with zeros, the stored record covers the whole item
+    char buf[items[itemId].size];
+    memset(buf, 0, sizeof(buf));
+    memcpy(buf, itemValue, valueSize);
 
-    if (commit) return storageCommit();
-
-    return 0;
+    return putItem(itemId, itemAddr, buf, sizeof(buf), commit);
 }
 
 int storageSet(sto_item_id_t itemId, String& itemValue, bool commit) {
@@ -659,24 +674,190 @@ int storageSet(sto_item_id_t itemId, String& itemValue, bool commit) {
 }
 
 /**
- * @brief Writes all items to the storage medium.
+ * @brief Schedules writing the changed items to the storage medium. Changes
+ *        coming in within STORAGE_COMMIT_DELAY are written together by
+ *        storageLoop(), nothing is written if no value changed.
  *
  * @return  0 - succeed
  *         <0 - failed
  */
 int storageCommit(void) {
-    debugPrintf("%s(): save all data to NV memory\n", __func__);
+    if (!storageReady) return -4;
 
-    //While Flash memory erase/write operations no other code must be executed from
-    //Flash
-    skipHeaterISR = true;
+    xSemaphoreTake(storageMutex, portMAX_DELAY);
 
-    // really write data to storage...
-    int returnCode = EEPROM.commit() ? 0 : -1;
+    if (dirtyItems != 0) {
+        lastCommitRequest = millis();
 
-    skipHeaterISR = false;
+        if (!commitPending) {
+            firstCommitRequest = lastCommitRequest;
+            commitPending = true;
+        }
+    }
+
+    xSemaphoreGive(storageMutex);
 
-    return returnCode;
+    return 0;
+}
+
+/**
+ * @brief Writes all items as one record list and removes the item keys. NVS
+ *        appends changed entries to its pages and spreads the erase cycles
+ *        over the partition.
+ *
+ * @return  0 - succeed
+ *         <0 - failed
+ */
+static int writeSettings(void) {
+    uint8_t blob[STORAGE_BLOB_SIZE];
+    uint8_t* record = blob + sizeof(sto_header_t);
+    sto_header_t header;
+
+    xSemaphoreTake(storageMutex, portMAX_DELAY);
+
+    for (int id = 0; id < STO_ITEM__LAST_ENUM; id++) {
+        record[0] = id;
+        record[1] = items[id].size;
+        memcpy(record + 2, (const uint8_t*)&storageData + items[id].addr, items[id].size);
+        record += 2 + items[id].size;
+    }
+
+    xSemaphoreGive(storageMutex);
+
+    header.version = STORAGE_VERSION;
+    header.count = STO_ITEM__LAST_ENUM;
+    header.length = record - blob - sizeof(header);
+    header.crc = esp_rom_crc32_le(0, blob + sizeof(header), header.length);
+    memcpy(blob, &header, sizeof(header));
+
+    if (nvs.putBytes(STORAGE_SETTINGS_KEY, blob, record - blob) != (size_t)(record - blob)) {
+        return -1;
+    }
+
+    // the blob holds the newest values now, stale item keys are harmless once the mask is gone
+    if (itemKeys != 0) {
+        nvs.remove(STORAGE_ITEM_KEYS_KEY);
+
+        for (int id = 0; id < STO_ITEM__LAST_ENUM; id++) {
+            if ((itemKeys & (1UL << id)) == 0) continue;
+
+            char key[12];
+            getItemKey(key, sizeof(key), id);
+            nvs.remove(key);
+        }
+
+        itemKeys = 0;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Writes the changed items to their own keys, a single changed item is
+ *        a single write. The mask is only written when an item gets its key.
+ *
+ * @return  0 - succeed
+ *         <0 - failed
+ */
+static int writeItemKeys(uint32_t changedItems) {
+    for (int id = 0; id < STO_ITEM__LAST_ENUM; id++) {
+        if ((changedItems & (1UL << id)) == 0) continue;
+
+        char key[12];
+        getItemKey(key, sizeof(key), id);
+
+        uint8_t value[items[id].size];
+
+        xSemaphoreTake(storageMutex, portMAX_DELAY);
+        memcpy(value, (const uint8_t*)&storageData + items[id].addr, sizeof(value));
+        xSemaphoreGive(storageMutex);
+
+        if (nvs.putBytes(key, value, sizeof(value)) != sizeof(value)) {
+            return -1;
+        }
+    }
+
+    // written after the values, a key outside the mask is never read
+    if ((itemKeys | changedItems) != itemKeys) {
+        if (nvs.putULong(STORAGE_ITEM_KEYS_KEY, itemKeys | changedItems) != sizeof(uint32_t)) {
+            return -1;
+        }
+
+        itemKeys |= changedItems;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Writes the changed items, if any item changed. They go to their own
+ *        keys until more than STORAGE_MAX_ITEM_KEYS items have one, then all
+ *        items are written as one record list again.
+ *
+ * @return  0 - succeed
+ *         <0 - failed
+ */
+int storageFlush(void) {
+    if (!storageReady) return -4;
+
+    uint32_t changedItems;
+    int retCode;
+
+    xSemaphoreTake(flushMutex, portMAX_DELAY);
+    xSemaphoreTake(storageMutex, portMAX_DELAY);
+
+    changedItems = dirtyItems;
+    dirtyItems = 0;
+    commitPending = false;
+
+    xSemaphoreGive(storageMutex);
+
+    if (changedItems == 0) {
+        xSemaphoreGive(flushMutex);
+        return 0;
+    }
+
+    // the heater ISR runs from IRAM and keeps working while the flash cache is disabled
+    if (__builtin_popcount(itemKeys | changedItems) > STORAGE_MAX_ITEM_KEYS) {
+        retCode = writeSettings();
+    } else {
+        retCode = writeItemKeys(changedItems);
+    }
+
+    xSemaphoreGive(flushMutex);
+
+    if (retCode != 0) {
+        LOG_ERROR("%s(): writing settings failed!\n", __func__);
+
+        // try again with the next commit
+        xSemaphoreTake(storageMutex, portMAX_DELAY);
+        dirtyItems |= changedItems;
+        xSemaphoreGive(storageMutex);
+
+        return -1;
+    }
+
+    LOG_DEBUG("%s(): saved changed items 0x%08lx to NV memory\n", __func__, (unsigned long)changedItems);
+
+    return 0;
+}
+
+/**
+ * @brief Writes pending changes once they settled, called periodically.
+ *
+ * @return  0 - succeed or nothing to write
+ *         <0 - failed
+ */
+int storageLoop(void) {
+    if (!storageReady || !commitPending) return 0;
+
+    unsigned long now = millis();
+
+    if (now - lastCommitRequest < STORAGE_COMMIT_DELAY && now - firstCommitRequest < STORAGE_COMMIT_MAX_DELAY) {
+        return 0;
+    }
+
+    return storageFlush();
 }
 
 /**
@@ -686,8 +867,15 @@ int storageCommit(void) {
  *         <0 - failed
  */
 int storageFactoryReset(void) {
-    debugPrintf("%s(): reset all values\n", __func__);
-    memset(EEPROM.getDataPtr(), 0xFF, sizeof(sto_data_t));
+    if (!storageReady) return -4;
+
+    LOG_INFO("%s(): reset all values\n", __func__);
+
+    xSemaphoreTake(storageMutex, portMAX_DELAY);
+    memcpy_P(&storageData, &itemDefaults, sizeof(storageData));
+    dirtyItems = (1ULL << STO_ITEM__LAST_ENUM) - 1;
+    xSemaphoreGive(storageMutex);
 
-    return storageCommit();
+    // the defaults are stored, otherwise the old EEPROM blob would be migrated again
+    return storageFlush();
 }
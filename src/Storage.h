@@ -1,7 +1,7 @@
 /**
  * @file Storage.h
  *
- * @brief
+ * @brief Non-volatile storage of the settings
  *
  */
 
@@ -10,46 +10,60 @@
 #include <stdint.h>
 
 
+/* Storage items, X(id, type, member, default) for numbers and
+ * S(id, member, size, default) for strings (size includes the terminator).
+ * The defaults are expanded in Storage.cpp only.
+ *
+ * The ID is stored together with the value: only append new items, never
+ * reorder or reuse them. Items unknown to the firmware are ignored when
+ * loading, missing items get their default value.
+ *
+ * STORAGE_EEPROM_ITEMS are the items of the former EEPROM layout (see
+ * migrateEepromBlob()), newer items are appended to STORAGE_ITEMS.
+ */
+#define STORAGE_EEPROM_ITEMS(X, S) \
+  X(STO_ITEM_PID_ON,                 uint8_t, pidOn,                  0)                        /* PID on/off state */ \
+  X(STO_ITEM_PID_START_PONM,         uint8_t, useStartPonM,           0)                        /* Use PonM for cold start phase (otherwise use normal PID and same params) */ \
+  X(STO_ITEM_PID_KP_START,           double,  pidKpStart,             STARTKP)                  /* PID P part at cold start phase */ \
+  X(STO_ITEM_PID_TN_START,           double,  pidTnStart,             STARTTN)                  /* PID I part at cold start phase */ \
+  X(STO_ITEM_PID_KP_REGULAR,         double,  pidKpRegular,           AGGKP)                    /* PID P part at regular operation */ \
+  X(STO_ITEM_PID_TN_REGULAR,         double,  pidTnRegular,           AGGTN)                    /* PID I part at regular operation */ \
+  X(STO_ITEM_PID_TV_REGULAR,         double,  pidTvRegular,           AGGTV)                    /* PID D part at regular operation */ \
+  X(STO_ITEM_PID_I_MAX_REGULAR,      double,  pidIMaxRegular,         AGGIMAX)                  /* PID Integrator upper limit */ \
+  X(STO_ITEM_PID_KP_BD,              double,  pidKpBd,                AGGBKP)                   /* PID P part at brew detection phase */ \
+  X(STO_ITEM_PID_TN_BD,              double,  pidTnBd,                AGGBTN)                   /* PID I part at brew detection phase */ \
+  X(STO_ITEM_PID_TV_BD,              double,  pidTvBd,                AGGBTV)                   /* PID D part at brew detection phase */ \
+  X(STO_ITEM_BREW_SETPOINT,          double,  brewSetpoint,           SETPOINT)                 /* brew setpoint */ \
+  X(STO_ITEM_BREW_TEMP_OFFSET,       double,  brewTempOffset,         TEMPOFFSET)               /* brew temp offset */ \
+  X(STO_ITEM_USE_BD_PID,             uint8_t, pidBdOn,                0)                        /* use separate PID for brew detection (otherwise continue with regular PID) */ \
+  X(STO_ITEM_BREW_TIME,              double,  brewTimeMs,             BREW_TIME)                /* brew time */ \
+  X(STO_ITEM_BREW_SW_TIME,           double,  brewSwTimeSec,          BREW_SW_TIME)             /* brew software time */ \
+  X(STO_ITEM_BREW_PID_DELAY,         double,  brewPIDDelaySec,        BREW_PID_DELAY)           /* brew PID delay */ \
+  X(STO_ITEM_BD_THRESHOLD,           double,  brewDetectionThreshold, BD_SENSITIVITY)           /* brew detection limit */ \
+  X(STO_ITEM_WIFI_CREDENTIALS_SAVED, uint8_t, wifiCredentialsSaved,   WIFI_CREDENTIALS_SAVED)   /* flag for wifisetup */ \
+  X(STO_ITEM_PRE_INFUSION_TIME,      double,  preInfusionTimeMs,      PRE_INFUSION_TIME)        /* pre-infusion time */ \
+  X(STO_ITEM_PRE_INFUSION_PAUSE,     double,  preInfusionPauseMs,     PRE_INFUSION_PAUSE_TIME)  /* pre-infusion pause */ \
+  X(STO_ITEM_PID_KP_STEAM,           double,  steamkp,                STEAMKP)                  /* PID P part at steam phase */ \
+  X(STO_ITEM_STEAM_SETPOINT,         double,  steamSetpoint,          STEAMSETPOINT)            /* Setpoint for Steam mode */ \
+  X(STO_ITEM_SOFT_AP_ENABLED_CHECK,  uint8_t, softApEnabledCheck,     0)                        /* soft AP enable state */ \
+  S(STO_ITEM_WIFI_SSID,                       wifiSSID,               25 + 1, "")               /* Wifi SSID */ \
+  S(STO_ITEM_WIFI_PASSWORD,                   wifiPassword,           25 + 1, "")               /* Wifi password */ \
+  X(STO_ITEM_WEIGHTSETPOINT,         double,  weightSetpoint,         SCALE_WEIGHTSETPOINT)     /* Brew weight setpoint */ \
+  X(STO_ITEM_STANDBY_MODE_ON,        uint8_t, standbyModeOn,          STANDBY_MODE_ON)          /* Enable standby mode */ \
+  X(STO_ITEM_STANDBY_MODE_TIME,      double,  standbyModeTime,        STANDBY_MODE_TIME)        /* Time until heater is turned off */
+
+#define STORAGE_ITEMS(X, S) \
+  STORAGE_EEPROM_ITEMS(X, S) \
+  X(STO_ITEM_BREW_FF_POWER,          double,  brewFFPower,            BREW_FF_POWER)            /* heater boost while brewing */ \
+  X(STO_ITEM_BREW_FF_START,          double,  brewFFStart,            BREW_FF_START)            /* start of the boost after brew start */ \
+  X(STO_ITEM_BREW_FF_TIME,           double,  brewFFTime,             BREW_FF_TIME)             /* duration of the boost */
+
+#define STORAGE_ITEM_ID(id, ...) id,
+
 // storage items
 typedef enum
 {
-  STO_ITEM_PID_ON,                  // PID on/off state
-  STO_ITEM_PID_START_PONM,          // Use PonM for cold start phase (otherwise use normal PID and same params)
-  STO_ITEM_PID_KP_START,            // PID P part at cold start phase
-  STO_ITEM_PID_TN_START,            // PID I part at cold start phase
-  STO_ITEM_PID_KP_REGULAR,          // PID P part at regular operation
-  STO_ITEM_PID_TN_REGULAR,          // PID I part at regular operation
-  STO_ITEM_PID_TV_REGULAR,          // PID D part at regular operation
-  STO_ITEM_PID_I_MAX_REGULAR,       // PID Integrator upper limit
-  STO_ITEM_PID_KP_BD,               // PID P part at brew detection phase
-  STO_ITEM_PID_TN_BD,               // PID I part at brew detection phase
-  STO_ITEM_PID_TV_BD,               // PID D part at brew detection phase
-  STO_ITEM_BREW_SETPOINT,           // brew setpoint
-  STO_ITEM_BREW_TEMP_OFFSET,        // brew temp offset
-  STO_ITEM_USE_BD_PID,              // use separate PID for brew detection (otherwise continue with regular PID)
-  STO_ITEM_BREW_TIME,               // brew time
-  STO_ITEM_BREW_SW_TIME,            // brew software time
-  STO_ITEM_BREW_PID_DELAY,          // brew PID delay
-  STO_ITEM_BD_THRESHOLD,            // brew detection limit
-  STO_ITEM_WIFI_CREDENTIALS_SAVED,  // flag for wifisetup
-  STO_ITEM_PRE_INFUSION_TIME,       // pre-infusion time
-  STO_ITEM_PRE_INFUSION_PAUSE,      // pre-infusion pause
-  STO_ITEM_PID_KP_STEAM,            // PID P part at steam phase
-  STO_ITEM_STEAM_SETPOINT,          // Setpoint for Steam mode
-  STO_ITEM_SOFT_AP_ENABLED_CHECK,   // soft AP enable state
-  STO_ITEM_WIFI_SSID,               // Wifi SSID
-  STO_ITEM_WIFI_PASSWORD,           // Wifi password
-  STO_ITEM_WEIGHTSETPOINT,          // Brew weight setpoint
-  STO_ITEM_STANDBY_MODE_ON,         // Enable tandby mode
-  STO_ITEM_STANDBY_MODE_TIME,       // Time until heater is turned off
-  STO_ITEM_RESERVED_30,             // reserved
-  STO_ITEM_RESERVED_21,             // reserved
-
-  /* WHEN ADDING NEW ITEMS, THE FOLLOWING HAS TO BE UPDATED:
-   * - storage structure:  sto_data_t
-   * - item default value: itemDefaults
-   * - item address/size:  getItemAddr()
-   */
+  STORAGE_ITEMS(STORAGE_ITEM_ID, STORAGE_ITEM_ID)
 
   STO_ITEM__LAST_ENUM       // must be the last one!
 } sto_item_id_t;
@@ -58,6 +72,8 @@ typedef enum
 // Functions
 int storageSetup(void);
 int storageCommit(void);
+int storageFlush(void);
+int storageLoop(void);
 int storageFactoryReset(void);
 
 int storageGet(sto_item_id_t itemId, float& itemValue);
@@ -68,7 +84,6 @@ int storageGet(sto_item_id_t itemId, int32_t& itemValue);
 int storageGet(sto_item_id_t itemId, uint8_t& itemValue);
 int storageGet(sto_item_id_t itemId, uint16_t& itemValue);
 int storageGet(sto_item_id_t itemId, uint32_t& itemValue);
-int storageGet(sto_item_id_t itemId, const char** itemValue);
 int storageGet(sto_item_id_t itemId, String& itemValue);
 
 int storageSet(sto_item_id_t itemId, float itemValue, bool commit=false);
@@ -40,7 +40,7 @@ class SysPara {
             if (curPtr) {
                 _data.curPtr = curPtr;
             } else {
-                debugPrintf("%s(): empty pointer!\n", __func__);
+                LOG_ERROR("%s(): empty pointer!\n", __func__);
                 _data.curPtr = (T*)&_dummyCur;
             }
             _data.min = min;
@@ -112,7 +112,7 @@ class SysPara {
                 }
                 return stoStatus;
             }
-            debugPrintf("%s(): no storage ID set!\n", __func__);
+            LOG_ERROR("%s(): no storage ID set!\n", __func__);
             return -1;
         }
 
@@ -128,7 +128,7 @@ class SysPara {
                 *_data.curPtr = value;
                 return 0;
             }
-            debugPrintf("%s(): value is outside of range!\n", __func__);
+            LOG_WARNING("%s(): value is outside of range!\n", __func__);
             return -1;
         }
 
@@ -145,11 +145,11 @@ class SysPara {
                 if ((*_data.curPtr >= _data.min) && (*_data.curPtr <= _data.max)) {
                     return storageSet(_stoItemId, *_data.curPtr, commit);
                 } else {
-                    debugPrintf("%s(): value outside of allowed range! (item: %i)\n", __func__, _stoItemId);
+                    LOG_WARNING("%s(): value outside of allowed range! (item: %i)\n", __func__, (int)_stoItemId);
                     return -1;
                 }
             }
-            debugPrintf("%s(): no storage ID set!\n", __func__);
+            LOG_ERROR("%s(): no storage ID set!\n", __func__);
             return -1;
         }
 
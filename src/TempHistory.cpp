@@ -0,0 +1,184 @@
+/**
+ * @file TempHistory.cpp
+ *
+ * @brief Fixed-point multi-resolution history of temperature, setpoint and heater power
+ *
+ */
+
+#include "TempHistory.h"
+
+#include <atomic>
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+
+#define TIER0_LENGTH 600    // 1 s * 600 = 10 min
+#define TIER1_LENGTH 240    // 15 s * 240 = 1 h
+#define TIER2_LENGTH 240    // 120 s * 240 = 8 h
+
+static int16_t tier0Temp[TIER0_LENGTH];
+static int16_t tier0Setpoint[TIER0_LENGTH];
+static uint8_t tier0Heater[TIER0_LENGTH];
+
+static int16_t tier1Temp[TIER1_LENGTH];
+static int16_t tier1TempMin[TIER1_LENGTH];
+static int16_t tier1TempMax[TIER1_LENGTH];
+static int16_t tier1Setpoint[TIER1_LENGTH];
+static uint8_t tier1Heater[TIER1_LENGTH];
+
+static int16_t tier2Temp[TIER2_LENGTH];
+static int16_t tier2TempMin[TIER2_LENGTH];
+static int16_t tier2TempMax[TIER2_LENGTH];
+static int16_t tier2Setpoint[TIER2_LENGTH];
+static uint8_t tier2Heater[TIER2_LENGTH];
+
+static int16_t toFixedPoint(double value, double scale) {
+    double scaled = value * scale;
+
+    if (scaled >= INT16_MAX) return INT16_MAX;
+    if (scaled <= INT16_MIN) return INT16_MIN;
+
+    return (int16_t)lround(scaled);
+}
+
+TempHistory::TempHistory() {
+    _tiers[0] = {tier0Temp, NULL, NULL, tier0Setpoint, tier0Heater, TIER0_LENGTH, 1, 0};
+    _tiers[1] = {tier1Temp, tier1TempMin, tier1TempMax, tier1Setpoint, tier1Heater, TIER1_LENGTH, 15, 0};
+    _tiers[2] = {tier2Temp, tier2TempMin, tier2TempMax, tier2Setpoint, tier2Heater, TIER2_LENGTH, 120, 0};
+
+    memset(_buckets, 0, sizeof(_buckets));
+}
+
+/**
+ * @brief Add a value, must be called once per second from a single task
+ *
+ * @param temp - temperature in °C
+ * @param setpoint - setpoint in °C
+ * @param heater - heater power in %
+ */
+void TempHistory::add(double temp, double setpoint, double heater) {
+    int16_t t = toFixedPoint(temp, HISTORY_SCALE);
+    int16_t s = toFixedPoint(setpoint, HISTORY_SCALE);
+    long h = lround(heater * HISTORY_HEATER_SCALE);
+
+    if (h < 0) h = 0;
+    if (h > 100 * HISTORY_HEATER_SCALE) h = 100 * HISTORY_HEATER_SCALE;
+
+    push(0, t, t, t, s, (uint8_t)h);
+    aggregate(1, t, t, t, s, (uint8_t)h);
+}
+
+/**
+ * @brief Store a value in a tier
+ */
+void TempHistory::push(uint8_t tier, int16_t temp, int16_t tempMin, int16_t tempMax, int16_t setpoint, uint8_t heater) {
+    tier_t& ti = _tiers[tier];
+    uint16_t i = ti.next % ti.capacity;
+
+    // readers check next after copying a value, see getRecord()
+    std::atomic_thread_fence(std::memory_order_release);
+
+    ti.temp[i] = temp;
+    ti.setpoint[i] = setpoint;
+    ti.heater[i] = heater;
+
+    if (ti.tempMin != NULL) {
+        ti.tempMin[i] = tempMin;
+        ti.tempMax[i] = tempMax;
+    }
+
+    std::atomic_thread_fence(std::memory_order_release);
+    ti.next = ti.next + 1;
+}
+
+/**
+ * @brief Add a value of the tier below to the bucket of a tier, stores the
+ *        aggregate when the bucket is full and passes it on to the next tier
+ */
+void TempHistory::aggregate(uint8_t tier, int16_t temp, int16_t tempMin, int16_t tempMax, int16_t setpoint, uint8_t heater) {
+    bucket_t& b = _buckets[tier];
+
+    if (b.count == 0) {
+        b.tempMin = tempMin;
+        b.tempMax = tempMax;
+    } else {
+        if (tempMin < b.tempMin) b.tempMin = tempMin;
+        if (tempMax > b.tempMax) b.tempMax = tempMax;
+    }
+
+    b.tempSum += temp;
+    b.setpointSum += setpoint;
+    b.heaterSum += heater;
+    b.count++;
+
+    if (b.count < _tiers[tier].interval / _tiers[tier - 1].interval) {
+        return;
+    }
+
+    int16_t avgTemp = (int16_t)lround((double)b.tempSum / b.count);
+    int16_t avgSetpoint = (int16_t)lround((double)b.setpointSum / b.count);
+    uint8_t avgHeater = (uint8_t)lround((double)b.heaterSum / b.count);
+    int16_t minTemp = b.tempMin;
+    int16_t maxTemp = b.tempMax;
+
+    memset(&b, 0, sizeof(b));
+    push(tier, avgTemp, minTemp, maxTemp, avgSetpoint, avgHeater);
+
+    if (tier + 1 < numTiers) {
+        aggregate(tier + 1, avgTemp, minTemp, maxTemp, avgSetpoint, avgHeater);
+    }
+}
+
+uint16_t TempHistory::getInterval(uint8_t tier) const {
+    return _tiers[tier].interval;
+}
+
+/**
+ * @brief Number of values available in a tier, at most one less than its length
+ */
+uint16_t TempHistory::getCount(uint8_t tier) const {
+    uint32_t next = _tiers[tier].next;
+    uint32_t available = _tiers[tier].capacity - 1;
+
+    return next < available ? next : available;
+}
+
+/**
+ * @brief Sequence number of the next value of a tier, i.e. the number of values
+ *        stored since boot
+ */
+uint32_t TempHistory::getNext(uint8_t tier) const {
+    return _tiers[tier].next;
+}
+
+/**
+ * @brief Read a value of a tier
+ *
+ * @param tier - tier to read from
+ * @param seq - sequence number of the value
+ * @param record - receives the value
+ *
+ * @return true if the value is still available, false if it was overwritten
+ *         or is being overwritten while it was copied
+ */
+bool TempHistory::getRecord(uint8_t tier, uint32_t seq, history_record_t& record) const {
+    const tier_t& ti = _tiers[tier];
+    uint32_t next = ti.next;
+
+    if (seq >= next || next - seq > (uint32_t)(ti.capacity - 1)) {
+        return false;
+    }
+
+    uint16_t i = seq % ti.capacity;
+
+    record.temp = ti.temp[i];
+    record.setpoint = ti.setpoint[i];
+    record.heater = (int16_t)(ti.heater[i] * (HISTORY_SCALE / HISTORY_HEATER_SCALE));
+    record.tempMin = ti.tempMin != NULL ? ti.tempMin[i] : ti.temp[i];
+    record.tempMax = ti.tempMax != NULL ? ti.tempMax[i] : ti.temp[i];
+
+    // the slot is only written again once next moved a whole ring past seq
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    return ti.next - seq <= (uint32_t)(ti.capacity - 1);
+}
@@ -0,0 +1,79 @@
+/**
+ * @file TempHistory.h
+ *
+ * @brief Fixed-point multi-resolution history of temperature, setpoint and heater power
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define HISTORY_SCALE 100           // fixed point scale of temperatures, 0.01 °C
+#define HISTORY_HEATER_SCALE 2      // fixed point scale of the heater power, 0.5 %
+
+/**
+ * @brief One history value, all channels scaled by HISTORY_SCALE. In tier 0
+ *        tempMin and tempMax are the same as temp.
+ */
+struct history_record_t {
+    int16_t temp;       // average temperature
+    int16_t setpoint;   // average setpoint
+    int16_t heater;     // average heater power in %
+    int16_t tempMin;
+    int16_t tempMax;
+};
+
+/**
+ * @brief Ring buffers with three resolutions, fed with one value per second:
+ *        tier 0: every value for the last 10 min
+ *        tier 1: min/max/avg over 15 s for the last hour
+ *        tier 2: min/max/avg over 2 min for the last 8 hours
+ *        Values are stored as int16 (heater as uint8) in separate arrays,
+ *        about 7.3 KB in total. Each tier counts its values with a sequence
+ *        number, so readers can ask for everything after a known value.
+ *        Single writer, readers on other tasks only see complete values as
+ *        each ring keeps one slot spare and getRecord() checks the sequence
+ *        number again after copying a value.
+ */
+class TempHistory {
+    public:
+        static const uint8_t numTiers = 3;
+
+        TempHistory();
+
+        void add(double temp, double setpoint, double heater);
+
+        uint16_t getInterval(uint8_t tier) const;
+        uint16_t getCount(uint8_t tier) const;
+        uint32_t getNext(uint8_t tier) const;
+        bool getRecord(uint8_t tier, uint32_t seq, history_record_t& record) const;
+
+    private:
+        struct tier_t {
+            int16_t *temp;
+            int16_t *tempMin;       // NULL for tier 0
+            int16_t *tempMax;       // NULL for tier 0
+            int16_t *setpoint;
+            uint8_t *heater;
+            uint16_t capacity;
+            uint16_t interval;      // s per value
+            volatile uint32_t next; // sequence number of the next value
+        };
+
+        // running aggregate of the values going into the next value of a tier
+        struct bucket_t {
+            int32_t tempSum;
+            int32_t setpointSum;
+            int32_t heaterSum;
+            int16_t tempMin;
+            int16_t tempMax;
+            uint16_t count;
+        };
+
+        void push(uint8_t tier, int16_t temp, int16_t tempMin, int16_t tempMax, int16_t setpoint, uint8_t heater);
+        void aggregate(uint8_t tier, int16_t temp, int16_t tempMin, int16_t tempMax, int16_t setpoint, uint8_t heater);
+
+        tier_t _tiers[numTiers];
+        bucket_t _buckets[numTiers];
+};
@@ -0,0 +1,80 @@
+/**
+ * @file TempSensor.h
+ *
+ * @brief Common interface of the temperature sensors, readings are queued
+ *        with the time they were taken
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define TEMP_SAMPLE_QUEUE_SIZE 8
+
+struct temp_sample_t {
+    unsigned long time;     // millis() when the value was measured
+    float temperature;      // °C, sensor specific error values are passed on as is
+};
+
+/**
+ * @brief Base class of the sensor drivers. poll() never waits for the sensor,
+ *        it only queues the readings that are complete. The queue isn't
+ *        locked, poll() and getSample() are called from the control task.
+ */
+class TempSensor {
+    public:
+        virtual ~TempSensor() {}
+
+        /**
+         * @brief Initialize the sensor, may block until the first reading is queued
+         *
+         * @return 0 on success, <0 if the sensor wasn't found
+         */
+        virtual int begin() = 0;
+
+        /**
+         * @brief Collect a finished reading and start the next one if the sensor needs that
+         */
+        virtual void poll() = 0;
+
+        /**
+         * @brief Take the oldest queued reading
+         *
+         * @return true if there was one
+         */
+        bool getSample(temp_sample_t& sample) {
+            if (_tail == _head) {
+                return false;
+            }
+
+            sample = _queue[_tail % TEMP_SAMPLE_QUEUE_SIZE];
+            _tail++;
+
+            return true;
+        }
+
+        // readings lost because nobody took them in time
+        uint32_t getDropped() const { return _dropped; }
+
+    protected:
+        TempSensor() : _head(0), _tail(0), _dropped(0) {}
+
+        void push(float temperature, unsigned long time) {
+            if (_head - _tail >= TEMP_SAMPLE_QUEUE_SIZE) {
+                _tail++;
+                _dropped++;
+            }
+
+            temp_sample_t& sample = _queue[_head % TEMP_SAMPLE_QUEUE_SIZE];
+            sample.time = time;
+            sample.temperature = temperature;
+            _head++;
+        }
+
+    private:
+        temp_sample_t _queue[TEMP_SAMPLE_QUEUE_SIZE];
+        uint32_t _head;
+        uint32_t _tail;
+        uint32_t _dropped;
+};
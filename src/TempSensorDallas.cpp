@@ -0,0 +1,83 @@
+/**
+ * @file TempSensorDallas.cpp
+ *
+ * @brief DS18B20 on a OneWire bus, read without waiting for the conversion
+ *
+ */
+
+#include "TempSensorDallas.h"
+
+#include <Arduino.h>
+#include "debugSerial.h"
+
+TempSensorDallas::TempSensorDallas(uint8_t pin) : _oneWire(pin), _sensors(&_oneWire) {
+    _found = false;
+    _converting = false;
+    _requestTime = 0;
+    _conversionTime = 0;
+}
+
+bool TempSensorDallas::findSensor() {
+    if (!_sensors.getAddress(_address, 0)) {
+        return false;
+    }
+
+    _sensors.setResolution(_address, DALLAS_RESOLUTION);
+    _conversionTime = _sensors.millisToWaitForConversion(DALLAS_RESOLUTION);
+    _found = true;
+
+    return true;
+}
+
+void TempSensorDallas::request() {
+    _sensors.requestTemperaturesByAddress(_address);
+    _requestTime = millis();
+    _converting = true;
+}
+
+/**
+ * @brief Find the sensor and queue a first reading, this one waits for the conversion
+ */
+int TempSensorDallas::begin() {
+    _sensors.begin();
+
+    if (!findSensor()) {
+        LOG_ERROR("%s(): no DS18B20 found\n", __func__);
+        return -1;
+    }
+
+    _sensors.requestTemperaturesByAddress(_address);
+    push(_sensors.getTempC(_address), millis());
+
+    _sensors.setWaitForConversion(false);
+    request();
+
+    return 0;
+}
+
+void TempSensorDallas::poll() {
+    if (!_found) {
+        // not there at boot, retry the lookup and report it as disconnected meanwhile
+        if (!findSensor()) {
+            push(DEVICE_DISCONNECTED_C, millis());
+            return;
+        }
+
+        _sensors.setWaitForConversion(false);
+        request();
+        return;
+    }
+
+    if (!_converting) {
+        request();
+        return;
+    }
+
+    if (millis() - _requestTime < _conversionTime) {
+        return;
+    }
+
+    // reading the scratchpad takes a few ms, the conversion doesn't block anymore
+    push(_sensors.getTempC(_address), _requestTime + _conversionTime);
+    request();
+}
@@ -0,0 +1,41 @@
+/**
+ * @file TempSensorDallas.h
+ *
+ * @brief DS18B20 on a OneWire bus, read without waiting for the conversion
+ *
+ */
+
+#pragma once
+
+#include <OneWire.h>
+#include <DallasTemperature.h>
+
+#include "TempSensor.h"
+
+#define DALLAS_RESOLUTION 10    // bits, 187.5 ms per conversion
+
+/**
+ * @brief Starts a conversion, returns and reads the result once the
+ *        conversion time has passed, then starts the next one. The ROM address
+ *        of the first sensor is looked up once, so no bus search is done per
+ *        reading.
+ */
+class TempSensorDallas : public TempSensor {
+    public:
+        explicit TempSensorDallas(uint8_t pin);
+
+        int begin() override;
+        void poll() override;
+
+    private:
+        bool findSensor();
+        void request();
+
+        OneWire _oneWire;
+        DallasTemperature _sensors;
+        DeviceAddress _address;
+        bool _found;
+        bool _converting;
+        unsigned long _requestTime;
+        unsigned long _conversionTime;
+};
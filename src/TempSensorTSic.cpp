@@ -0,0 +1,23 @@
+/**
+ * @file TempSensorTSic.cpp
+ *
+ * @brief TSic 306 read by the ZACwire library
+ *
+ */
+
+#include "TempSensorTSic.h"
+
+#include <Arduino.h>
+
+TempSensorTSic::TempSensorTSic(uint8_t pin) : _sensor(pin, 306) {
+}
+
+int TempSensorTSic::begin() {
+    poll();
+
+    return 0;
+}
+
+void TempSensorTSic::poll() {
+    push(_sensor.getTemp(), millis());
+}
@@ -0,0 +1,27 @@
+/**
+ * @file TempSensorTSic.h
+ *
+ * @brief TSic 306 read by the ZACwire library
+ *
+ */
+
+#pragma once
+
+#include <ZACwire.h>
+
+#include "TempSensor.h"
+
+/**
+ * @brief The TSic sends a reading every 100 ms on its own, ZACwire decodes it
+ *        in an interrupt, so every poll() queues the latest value
+ */
+class TempSensorTSic : public TempSensor {
+    public:
+        explicit TempSensorTSic(uint8_t pin);
+
+        int begin() override;
+        void poll() override;
+
+    private:
+        ZACwire _sensor;
+};
@@ -7,20 +7,9 @@
 
 #pragma once
 #include <pinmapping.h>
+#include "Control.h"
 
 
-enum BrewState {
-    kBrewIdle = 10,
-    kPreinfusion = 20,
-    kWaitPreinfusion = 21,
-    kPreinfusionPause = 30,
-    kWaitPreinfusionPause = 31,
-    kBrewRunning = 40,
-    kWaitBrew = 41,
-    kBrewFinished = 42,
-    kWaitBrewOff = 43
-};
-
 // Normal Brew
 BrewState brewcounter = kBrewIdle;
 int brewswitch = 0;
@@ -42,14 +31,17 @@ unsigned long previousMillistempanalogreading;      // ms for analogreading
 
 // Shot timer with or without scale
 #if (ONLYPIDSCALE == 1 || BREWMODE == 2)
-    int shottimercounter = 10 ;
-    float calibrationValue = SCALE_CALIBRATION_FACTOR;  // use calibration example to get value
     float weight = 0;                                   // value from HX711
     float weightPreBrew = 0;                            // value of scale before wrew started
     float weightBrew = 0;                               // weight value of brew
-    float scaleDelayValue = 2.5;                        // value in gramm that takes still flows onto the scale after brew is stopped
+    float scaleDelayValue = 2.5;                        // value in gramm that takes still flows onto the scale after brew is stopped, used until the flow is known
+    float weightFlow = 0;                               // g/s, slope of the weight over the last SCALE_FLOW_WINDOW conversions
+    unsigned long weightTime = 0;                       // millis() of the conversion weight comes from
     bool scaleFailure = false;
-    const unsigned long intervalWeight = 200;           // weight scale
-    unsigned long previousMillisScale;                  // initialisation at the end of init()
-    HX711_ADC LoadCell(PIN_HXDAT, PIN_HXCLK);
+    SlopeEstimator<SCALE_FLOW_WINDOW> scaleFlow;
+
+    // Not defined in older userConfig files
+    #ifndef SCALE_DRIP_TIME
+        #define SCALE_DRIP_TIME 1.0
+    #endif
 #endif
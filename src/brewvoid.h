@@ -47,7 +47,7 @@ void checkbrewswitch() {
                 if (brewswitchTrigger == HIGH) {
                     brewswitchTriggermillis = millis();
                     brewswitchTriggerCase = 20;
-                    debugPrintln("brewswitchTriggerCase 10: HIGH");
+                    LOG_DEBUG("brewswitchTriggerCase 10: HIGH\n");
                 }
                 break;
 
@@ -57,12 +57,12 @@ void checkbrewswitch() {
                     // Brew trigger
                     brewswitch = HIGH;
                     brewswitchTriggerCase = 30;
-                    debugPrintln("brewswitchTriggerCase 20: Brew Trigger HIGH");
+                    LOG_DEBUG("brewswitchTriggerCase 20: Brew Trigger HIGH\n");
                 }
 
                 // Button more than one 1sec pushed
                 if (brewswitchTrigger == HIGH && (brewswitchTriggermillis + 1000 <= millis())) {
-                    debugPrintln("brewswitchTriggerCase 20: Manual Trigger - brewing");
+                    LOG_DEBUG("brewswitchTriggerCase 20: Manual Trigger - brewing\n");
                     brewswitchTriggerCase = 31;
                     digitalWrite(PIN_VALVE, relayON);
                     digitalWrite(PIN_PUMP, relayON);
@@ -74,7 +74,7 @@ void checkbrewswitch() {
                     brewswitch = LOW;
                     brewswitchTriggerCase = 40;
                     brewswitchTriggermillis = millis();
-                    debugPrintln("brewswitchTriggerCase 30: Brew Trigger LOW");
+                    LOG_DEBUG("brewswitchTriggerCase 30: Brew Trigger LOW\n");
                 }
                 break;
             case 31:
@@ -82,7 +82,7 @@ void checkbrewswitch() {
                 if (brewswitchTrigger == LOW && brewswitch == LOW) {
                     brewswitchTriggerCase = 40;
                     brewswitchTriggermillis = millis();
-                    debugPrintln("brewswitchTriggerCase 31: Manual Trigger - brewing stop");
+                    LOG_DEBUG("brewswitchTriggerCase 31: Manual Trigger - brewing stop\n");
                     digitalWrite(PIN_VALVE, relayOFF);
                     digitalWrite(PIN_PUMP, relayOFF);
                 }
@@ -92,7 +92,7 @@ void checkbrewswitch() {
                 // wait 5 Sec until next brew, detection
                 if (brewswitchTriggermillis + 5000 <= millis()) {
                     brewswitchTriggerCase = 10;
-                    debugPrintln("brewswitchTriggerCase 40: Brew Trigger Next Loop");
+                    LOG_DEBUG("brewswitchTriggerCase 40: Brew Trigger Next Loop\n");
                 }
                 break;
 
@@ -308,6 +308,19 @@ void brew() {
 
 
 #if (BREWMODE == 2)
+/**
+ * @brief Weight the cup will end up with if the pump stops now: the flow
+ *      goes on for the age of the last conversion and SCALE_DRIP_TIME after
+ *      the stop. Without a flow estimate the fixed scaleDelayValue is used.
+ */
+float predictBrewWeight() {
+    if (weightFlow <= 0 || !scaleFlow.full()) {
+        return weightBrew + scaleDelayValue;
+    }
+
+    return weightBrew + weightFlow * ((millis() - weightTime) / 1000.0 + SCALE_DRIP_TIME);
+}
+
 /**
  * @brief Weight based brew mode
  */
@@ -347,6 +360,8 @@ void brew() {
 
                     coldstart = false;  // force reset coldstart if shot is pulled
                     weightPreBrew = weight;
+                    scaleFlow.reset();  // the flow of this shot only, predictBrewWeight() uses scaleDelayValue until the window is full
+                    weightFlow = 0;
                 } else {
                     backflush();
                 }
@@ -392,8 +407,9 @@ void brew() {
                 break;
 
             case 41:  // waiting time brew
-                if (timeBrewed > totalBrewTime || (weightBrew > (weightSetpoint - scaleDelayValue))) {
+                if (timeBrewed > totalBrewTime || predictBrewWeight() > weightSetpoint) {
                     brewcounter = kBrewFinished;
+                    LOG_DEBUG("Brew by weight: stopped at %.1f g, flow %.1f g/s\n", weightBrew, weightFlow);
                 }
 
                 if (timeBrewed > totalBrewTime) {
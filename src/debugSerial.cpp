@@ -1,22 +1,56 @@
 /**
  * @file debugSerial.cpp
  *
- * @brief TODO
+ * @brief Logging methods using either serial or network port
  *
  */
 
 #include "debugSerial.h"
 
+#include <atomic>
+
+#define LOG_BUFFER_SLOTS 64         // messages, must be a power of two
+#define LOG_MESSAGE_SIZE 120        // longer messages are truncated
+#define LOG_DRAIN_PERIOD 10         // ms between checks of the background task
+
+static_assert((LOG_BUFFER_SLOTS & (LOG_BUFFER_SLOTS - 1)) == 0, "LOG_BUFFER_SLOTS must be a power of two");
+
+/**
+ * @brief One message of the ring buffer. The buffer is a bounded queue with
+ *        many producers and one consumer, each slot carries the sequence
+ *        number of the next write or read. The numbers are stored relative to
+ *        the slot index, so the zero initialized buffer is empty and usable
+ *        before any constructor ran.
+ */
+struct log_slot_t {
+    std::atomic<uint32_t> sequence;
+    time_t time;
+    char message[LOG_MESSAGE_SIZE];
+};
+
+static log_slot_t logBuffer[LOG_BUFFER_SLOTS];
+static std::atomic<uint32_t> logHead(0);        // next write
+static uint32_t logTail = 0;                    // next read, background task only
+static std::atomic<uint32_t> logDropped(0);
+static volatile log_level_t logLevel = (log_level_t)LOG_LEVEL;
+static TaskHandle_t logTaskHandle = NULL;
+static bool remoteSerialStarted = false;
+
 //server for monitor connections
 WiFiServer SerialServer(23);
 WiFiClient RemoteSerial;
 
 void startRemoteSerialServer() {
     SerialServer.begin();
+    remoteSerialStarted = true;
 }
 
-void checkForRemoteSerialClients() {
-    if (SerialServer.hasClient()) {
+/**
+ * @brief Accept a remote serial client, called by the background task which
+ *        is the only one using RemoteSerial
+ */
+static void checkForRemoteSerialClients() {
+    if (remoteSerialStarted && SerialServer.hasClient()) {
         // If we are already connected to another client,
         // then reject the new connection. Otherwise accept
         // the connection.
@@ -31,35 +65,58 @@ void checkForRemoteSerialClients() {
     }
 }
 
+static void formatTime(time_t rawtime, char *output) {
+    struct tm timeinfo;
+    localtime_r(&rawtime, &timeinfo);
+    snprintf(output, 12, "[%02d:%02d:%02d] ", timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec);
+}
+
 void getCurrentTimeString(char *output) {
-    time_t rawtime;
-    struct tm *timeinfo;
-    time(&rawtime);
-    timeinfo = localtime(&rawtime);
-    snprintf(output, 12, "[%02d:%02d:%02d] ", timeinfo->tm_hour, timeinfo->tm_min, timeinfo->tm_sec);
+    formatTime(time(NULL), output);
 }
 
-// Print to remote serial (e.g. using OTA Monitor Task ) if client is connected, otherwise use hardware serial
-void debugPrintln(const char *message) {
-    char time[12];
-    getCurrentTimeString(time);
-    if (RemoteSerial.connected()) {
-        RemoteSerial.print(time);
-        RemoteSerial.println(message);
-    } else {
-        Serial.print(time);
-        Serial.println(message);
+/**
+ * @brief Put a message into the ring buffer, never blocks
+ *
+ * @return length of the queued message, 0 if the buffer was full
+ */
+static size_t logWrite(const char *format, va_list arg) {
+    uint32_t pos = logHead.load(std::memory_order_relaxed);
+    log_slot_t *slot;
+
+    while (true) {
+        uint32_t index = pos & (LOG_BUFFER_SLOTS - 1);
+        slot = &logBuffer[index];
+        int32_t diff = (int32_t)(slot->sequence.load(std::memory_order_acquire) + index - pos);
+
+        if (diff == 0) {
+            if (logHead.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            logDropped++;       // not read yet, buffer full
+            return 0;
+        } else {
+            pos = logHead.load(std::memory_order_relaxed);
+        }
     }
-}
 
-// Print to remote serial (e.g. using OTA Monitor Task ) if client is connected, otherwise use hardware serial
-void debugPrintln(const String& message) {
-    debugPrintln(message.c_str());
+    slot->time = time(NULL);
+    int len = vsnprintf(slot->message, LOG_MESSAGE_SIZE, format, arg);
+
+    if (len >= LOG_MESSAGE_SIZE) {
+        strcpy(slot->message + LOG_MESSAGE_SIZE - 5, "...\n");
+        len = LOG_MESSAGE_SIZE - 1;
+    }
+
+    // hand the slot over to the background task
+    slot->sequence.store(pos + 1 - (pos & (LOG_BUFFER_SLOTS - 1)), std::memory_order_release);
+
+    return len < 0 ? 0 : len;
 }
 
-void debugPrint(const char *message) {
-    char time[12];
-    getCurrentTimeString(time);
+static void logOutput(const char *time, const char *message) {
+    // Print to remote serial (e.g. using OTA Monitor Task ) if client is connected, otherwise use hardware serial
     if (RemoteSerial.connected()) {
         RemoteSerial.print(time);
         RemoteSerial.print(message);
@@ -69,45 +126,113 @@ void debugPrint(const char *message) {
     }
 }
 
-void debugPrint(const String& message) {
-    debugPrint(message.c_str());
+/**
+ * @brief Background task writing the ring buffer to the remote or hardware
+ *        serial, reports dropped messages
+ */
+static void logTask(void *) {
+    uint32_t reportedDropped = 0;
+    char time[12];
+
+    while (true) {
+        checkForRemoteSerialClients();
+
+        while (true) {
+            uint32_t index = logTail & (LOG_BUFFER_SLOTS - 1);
+            log_slot_t *slot = &logBuffer[index];
+
+            if (slot->sequence.load(std::memory_order_acquire) + index != logTail + 1) {
+                break;      // empty or still being written
+            }
+
+            formatTime(slot->time, time);
+            logOutput(time, slot->message);
+
+            slot->sequence.store(logTail + LOG_BUFFER_SLOTS - index, std::memory_order_release);
+            logTail++;
+        }
+
+        uint32_t dropped = logDropped.load();
+
+        if (dropped != reportedDropped) {
+            char message[48];
+            snprintf(message, sizeof(message), "log: %lu messages dropped\n", (unsigned long)(dropped - reportedDropped));
+            getCurrentTimeString(time);
+            logOutput(time, message);
+            reportedDropped = dropped;
+        }
+
+        vTaskDelay(pdMS_TO_TICKS(LOG_DRAIN_PERIOD));
+    }
 }
 
-size_t debugPrintf(const char *format, ...) {
-    //reimplement printf method so that we can take dynamic list of parameters as printf does (we can't simply pass these on to existing printf methods it seems)
+/**
+ * @brief Start the background task, messages logged before are kept in the
+ *        ring buffer until then
+ */
+void logSetup() {
+    if (logTaskHandle == NULL) {
+        xTaskCreatePinnedToCore(logTask, "log", 4096, NULL, 1, &logTaskHandle, 0);
+    }
+}
+
+/**
+ * @brief Set the runtime log level, levels above LOG_LEVEL are compiled out
+ *        and can't be enabled
+ */
+void logSetLevel(log_level_t level) {
+    logLevel = level;
+}
+
+log_level_t logGetLevel() {
+    return logLevel;
+}
+
+/**
+ * @brief Number of messages dropped because the ring buffer was full
+ */
+uint32_t logGetDropped() {
+    return logDropped.load();
+}
+
+size_t logPrintf(log_level_t level, const char *format, ...) {
+    if (level > logLevel) {
+        return 0;
+    }
 
     va_list arg;
     va_start(arg, format);
-    char temp[64];  //allocate a temp buffer
-    char* buffer = temp;
-    size_t len = vsnprintf(temp, sizeof(temp), format, arg);
+    size_t len = logWrite(format, arg);
     va_end(arg);
 
-    //if temp buffer was too short, create new one with enough room (inludes previous bytes)
-    if (len > sizeof(temp) - 1) {
-        buffer = new char[len + 1];
-        if (!buffer) {
-            return 0;
-        }
-        va_start(arg, format);
-        vsnprintf(buffer, len + 1, format, arg);
-        va_end(arg);
-    }
+    return len;
+}
 
-    //get time to prepend to message
-    char time[12];
-    getCurrentTimeString(time);
+void debugPrintln(const char *message) {
+    logPrintf(LOG_LEVEL_INFO, "%s\n", message);
+}
 
-    if (RemoteSerial.connected()) {
-        len = RemoteSerial.print(time);
-        len += RemoteSerial.print(buffer);
-    } else {
-        len = Serial.print(time);
-        len += Serial.print(buffer);
-    }
+void debugPrintln(const String& message) {
+    debugPrintln(message.c_str());
+}
 
-    if (buffer != temp) {
-        delete[] buffer;
+void debugPrint(const char *message) {
+    logPrintf(LOG_LEVEL_INFO, "%s", message);
+}
+
+void debugPrint(const String& message) {
+    debugPrint(message.c_str());
+}
+
+size_t debugPrintf(const char *format, ...) {
+    if (LOG_LEVEL_INFO > logLevel) {
+        return 0;
     }
+
+    va_list arg;
+    va_start(arg, format);
+    size_t len = logWrite(format, arg);
+    va_end(arg);
+
     return len;
 }
@@ -2,6 +2,11 @@
  * @file debugSerial.h
  *
  * @brief Logging methods using either serial or network port
+ *
+ * Messages are put into a ring buffer by the calling task and written to the
+ * remote serial client (if connected) or the hardware serial by a background
+ * task, so a slow client never blocks the caller. Messages are dropped while
+ * the buffer is full.
  */
 
 #pragma once
@@ -11,8 +16,34 @@
 
 #include <WiFiManager.h>
 
+typedef enum {
+    LOG_LEVEL_NONE,
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_WARNING,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_DEBUG,
+    LOG_LEVEL_VERBOSE
+} log_level_t;
+
+// Messages above this level are compiled out, set with -DLOG_LEVEL=... in build_flags
+#ifndef LOG_LEVEL
+    #define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG(level, ...) do { if ((level) <= LOG_LEVEL) logPrintf(level, __VA_ARGS__); } while (0)
+#define LOG_ERROR(...) LOG(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_WARNING(...) LOG(LOG_LEVEL_WARNING, __VA_ARGS__)
+#define LOG_INFO(...) LOG(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_VERBOSE(...) LOG(LOG_LEVEL_VERBOSE, __VA_ARGS__)
+
+void logSetup();
+void logSetLevel(log_level_t level);
+log_level_t logGetLevel();
+uint32_t logGetDropped();
+size_t logPrintf(log_level_t level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
 void startRemoteSerialServer();
-void checkForRemoteSerialClients();
 void debugPrint(const char *message);
 void debugPrint(const String& message);
 void debugPrintln(const char *message);
@@ -43,6 +43,9 @@ int writeSysParamsToStorage(void);
 #define WIFI_CREDENTIALS_SAVED 0   // Flag if wifi setup is done. 0: not set up, 1: credentials set up via wifi manager
 #define STANDBY_MODE_ON 0          // Standby mode off by default
 #define STANDBY_MODE_TIME 30       // Time in minutes until the heater is turned off   
+#define BREW_FF_POWER 0            // heater boost in % added to the PID output while brewing, 0 = off
+#define BREW_FF_START 0            // start of the boost in seconds after brew start
+#define BREW_FF_TIME 20            // duration of the boost in seconds
 
 // Backflush values
 #define FILLTIME 3000              // time in ms the pump is running
@@ -95,4 +98,10 @@ int writeSysParamsToStorage(void);
 #define PID_KP_STEAM_MAX 500
 #define STANDBY_MODE_TIME_MIN 30
 #define STANDBY_MODE_TIME_MAX 120
+#define BREW_FF_POWER_MIN 0
+#define BREW_FF_POWER_MAX 100
+#define BREW_FF_START_MIN 0
+#define BREW_FF_START_MAX 60
+#define BREW_FF_TIME_MIN 0
+#define BREW_FF_TIME_MAX 60
 
@@ -39,7 +39,7 @@ void displayMessage(String text1, String text2, String text3, String text4, Stri
     u8g2.print(text5);
     u8g2.setCursor(0, 50);
     u8g2.print(text6);
-    u8g2.sendBuffer();
+    displayUpdate();
 }
 
 
@@ -73,7 +73,7 @@ void displayLogo(String displaymessagetext, String displaymessagetext2) {
                             startLogoQuickMill_bits);
             break;
     }
-    u8g2.sendBuffer();
+    displayUpdate();
 }
 
 /**
@@ -87,7 +87,7 @@ void displayDistance(int display_distance) {
     u8g2.setFont(u8g2_font_fub20_tf);
     u8g2.printf("%d", display_distance);
     u8g2.print("mm");
-    u8g2.sendBuffer();
+    displayUpdate();
 }
 
 /**
@@ -103,7 +103,7 @@ void displayShottimer(void) {
         u8g2.setCursor(64, 25);
         u8g2.print(timeBrewed / 1000, 1);
         u8g2.setFont(u8g2_font_profont11_tf);
-        u8g2.sendBuffer();
+        displayUpdate();
     }
 
     /* if the totalBrewTime is reached automatically,
@@ -117,7 +117,7 @@ void displayShottimer(void) {
         u8g2.setCursor(64, 25);
         u8g2.print(lastbrewTime / 1000, 1);
         u8g2.setFont(u8g2_font_profont11_tf);
-        u8g2.sendBuffer();
+        displayUpdate();
     }
 
     #if (ONLYPIDSCALE == 1 || BREWMODE == 2)
@@ -134,7 +134,7 @@ void displayShottimer(void) {
             u8g2.print(weightBrew, 0);
             u8g2.print("g");
             u8g2.setFont(u8g2_font_profont11_tf);
-            u8g2.sendBuffer();
+            displayUpdate();
         }
 
         if (((machineState == kShotTimerAfterBrew) && SHOTTIMER == 2)) {
@@ -148,7 +148,7 @@ void displayShottimer(void) {
             u8g2.print(weightBrew, 0);
             u8g2.print(" g");
             u8g2.setFont(u8g2_font_profont11_tf);
-            u8g2.sendBuffer();
+            displayUpdate();
         }
     #endif
 }
@@ -212,7 +212,7 @@ void Displaymachinestate() {
         u8g2.setCursor(92, 30);
         u8g2.setFont(u8g2_font_profont17_tf);
         u8g2.print(temperature, 1);
-        u8g2.sendBuffer();
+        displayUpdate();
     }
 
     // Offline logo
@@ -222,7 +222,7 @@ void Displaymachinestate() {
         u8g2.setCursor(0, 55);
         u8g2.setFont(u8g2_font_profont10_tf);
         u8g2.print("PID is disabled manually");
-        u8g2.sendBuffer();
+        displayUpdate();
     }
 
     if (OFFLINEGLOGO == 1 && machineState == kStandby) {
@@ -231,7 +231,7 @@ void Displaymachinestate() {
         u8g2.setCursor(36, 55);
         u8g2.setFont(u8g2_font_profont10_tf);
         u8g2.print("Standby mode");
-        u8g2.sendBuffer();
+        displayUpdate();
     }
 
     // Steam
@@ -242,7 +242,7 @@ void Displaymachinestate() {
         u8g2.setFont(u8g2_font_profont22_tf);
         u8g2.print(temperature, 0);
         u8g2.setCursor(64, 25);
-        u8g2.sendBuffer();
+        displayUpdate();
     }
 
     // Backflush
@@ -292,7 +292,7 @@ void Displaymachinestate() {
             u8g2.print("PID STOPPED");
         }
 
-        u8g2.sendBuffer();
+        displayUpdate();
     }
 
     if (machineState == kSensorError) {
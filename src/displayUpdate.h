@@ -0,0 +1,60 @@
+/**
+ * @file displayUpdate.h
+ *
+ * @brief Transfer of the frame buffer to the display, limited to the tiles that changed
+ */
+
+#pragma once
+
+#if (OLED_DISPLAY != 0)
+
+#define DISPLAY_FRAME_SIZE (128 * 64 / 8)
+
+uint8_t displaySentFrame[DISPLAY_FRAME_SIZE];   // frame buffer as last sent to the display
+bool displaySentFrameValid = false;
+
+/**
+ * @brief Send the frame buffer to the display. The buffer is compared with the
+ *        frame sent last, per row of tiles (8 pixels high) only the span from
+ *        the first to the last changed tile is transferred and nothing at all
+ *        if the frame didn't change.
+ */
+void displayUpdate() {
+    uint8_t *frame = u8g2.getBufferPtr();
+    uint8_t tileWidth = u8g2.getBufferTileWidth();
+    uint8_t tileHeight = u8g2.getBufferTileHeight();
+    size_t rowSize = tileWidth * 8;
+
+    if (rowSize * tileHeight > sizeof(displaySentFrame)) {
+        u8g2.sendBuffer();
+        return;
+    }
+
+    if (!displaySentFrameValid) {
+        u8g2.sendBuffer();
+        memcpy(displaySentFrame, frame, rowSize * tileHeight);
+        displaySentFrameValid = true;
+        return;
+    }
+
+    for (uint8_t ty = 0; ty < tileHeight; ty++) {
+        uint8_t *row = frame + ty * rowSize;
+        uint8_t *sentRow = displaySentFrame + ty * rowSize;
+        int first = -1;
+        int last = -1;
+
+        for (uint8_t tx = 0; tx < tileWidth; tx++) {
+            if (memcmp(row + tx * 8, sentRow + tx * 8, 8) != 0) {
+                if (first < 0) first = tx;
+                last = tx;
+            }
+        }
+
+        if (first >= 0) {
+            u8g2.updateDisplayArea(first, ty, last - first + 1, 1);
+            memcpy(sentRow + first * 8, row + first * 8, (last - first + 1) * 8);
+        }
+    }
+}
+
+#endif
@@ -17,13 +17,8 @@
 #include <map>
 #include <LittleFS.h>
 
-#if TEMPSENSOR == 1
-    #include <DallasTemperature.h>  // Library for dallas temp sensor
-#endif
-
 #include <WiFiManager.h>
 #include <U8g2lib.h>            // i2c display
-#include <ZACwire.h>            // new TSIC bus library
 #include "PID_v1.h"             // for PID calculation
 
 // Includes
@@ -37,8 +32,6 @@
 #include "defaults.h"
 #include <os.h>
 
-hw_timer_t *timer = NULL;
-
 
 #if OLED_DISPLAY == 3
 #include <SPI.h>
@@ -55,46 +48,31 @@ hw_timer_t *timer = NULL;
     #error Version of userConfig file and main.cpp need to match!
 #endif
 
-MACHINE machine = (enum MACHINE)MACHINEID;
-
 #define HIGH_ACCURACY
 
 #include "PeriodicTrigger.h"
 PeriodicTrigger writeDebugTrigger(5000);  // returns true every 5000 ms
-PeriodicTrigger logbrew(500);
-
-enum MachineState {
-    kInit = 0,
-    kColdStart = 10,
-    kBelowSetpoint = 19,
-    kPidNormal = 20,
-    kBrew = 30,
-    kShotTimerAfterBrew = 31,
-    kBrewDetectionTrailing = 35,
-    kSteam = 40,
-    kCoolDown = 45,
-    kBackflush = 50,
-    kEmergencyStop = 80,
-    kPidOffline = 90,
-    kStandby = 95,
-    kSensorError = 100,
-    kEepromError = 110,
-};
 
-MachineState machineState = kInit;
-int machinestatecold = 0;
-unsigned long machinestatecoldmillis = 0;
-MachineState lastmachinestate = kInit;
-int lastmachinestatepid = -1;
+#include "Snapshot.h"
+#include "Scheduler.h"
+#include "ShotRecorder.h"
+#include "Filters.h"
+#include "PressureSensor.h"
+#include "PidAutotune.h"
+#include "HeapProfiler.h"
+
+#if TEMPSENSOR == 1
+    #include "TempSensorDallas.h"
+#else
+    #include "TempSensorTSic.h"
+#endif
+
+// Machine states, PID phases, brew and system parameters
+#include "Control.h"
 
 // Definitions below must be changed in the userConfig.h file
 int connectmode = CONNECTMODE;
 
-int offlineMode = 0;
-const int OnlyPID = ONLYPID;
-const int TempSensor = TEMPSENSOR;
-const int brewDetectionMode = BREWDETECTION;
-const int triggerType = TRIGGERTYPE;
 const int VoltageSensorType = VOLTAGESENSORTYPE;
 const boolean ota = OTA;
 int BrewMode = BREWMODE;
@@ -103,212 +81,130 @@ int BrewMode = BREWMODE;
 uint8_t oled_i2c = OLED_I2C;
 
 // WiFi
-uint8_t wifiCredentialsSaved = 0;
 WiFiManager wm;
 const unsigned long wifiConnectionDelay = WIFICONNECTIONDELAY;
 const unsigned int maxWifiReconnects = MAXWIFIRECONNECTS;
 const char *hostname = HOSTNAME;
 const char *pass = PASS;
+const unsigned long wifiConnectTimeout = 10000;  // ms a reconnection attempt may take
 unsigned long lastWifiConnectionAttempt = millis();
 unsigned int wifiReconnects = 0;  // actual number of reconnects
+bool wifiConnecting = false;      // a reconnection attempt is running, see checkWifi()
 
 // OTA
 const char *OTAhost = OTAHOST;
 const char *OTApass = OTAPASS;
 
-// Backflush values
-const unsigned long fillTime = FILLTIME;
-const unsigned long flushTime = FLUSHTIME;
-int maxflushCycles = MAXFLUSHCYCLES;
-
-// Voltage Sensor
-unsigned long previousMillisVoltagesensorreading = millis();
-const unsigned long intervalVoltagesensor = 200;
-int VoltageSensorON, VoltageSensorOFF;
-
-// QuickMill thermoblock steam-mode (only for BREWDETECTION = 3)
-const int maxBrewDurationForSteamModeQM_ON = 200;   // if brewtime is shorter steam-mode starts
-const int minPVSOffTimedForSteamModeQM_OFF = 1500;  // if PVS-off-time is longer steam-mode ends
-unsigned long timePVStoON = 0;      // time pinvoltagesensor switched to ON
-unsigned long lastTimePVSwasON = 0; // last time pinvoltagesensor was ON
-bool steamQM_active = false;        // steam-mode is active
-bool brewSteamDetectedQM = false;   // brew/steam detected, not sure yet what it is
-bool coolingFlushDetectedQM = false;
-
 // Pressure sensor
 #if (PRESSURESENSOR == 1)   // Pressure sensor connected
-    int offset = OFFSET;
-    int fullScale = FULLSCALE;
-    int maxPressure = MAXPRESSURE;
     float inputPressure = 0;
-    const unsigned long intervalPressure = 200;
-    unsigned long previousMillisPressure;  // initialisation at the end of init()
+    const unsigned long intervalPressure = 20;  // one averaged value per mains period
 #endif
 
 // Method forward declarations
 void setSteamMode(int steamMode);
 void setPidStatus(int pidStatus);
 void setBackflush(int backflush);
-void setNormalPIDTunings();
-void setBDPIDTunings();
+void setAutotune(int autotune);
 void loopcalibrate();
-void looppid();
+void looptelemetry();
+void startControlTask();
+void startTelemetryTask();
+void networkSetup();
+void schedulerSetup();
+void handleNetwork();
+void updateTempHistory();
+void refreshDisplay();
+bool isNetworkOnline();
+void recordShot();
 void loopLED();
-void printMachineState();
-char const* machinestateEnumToString(MachineState machineState);
-void initSteamQM();
-boolean checkSteamOffQM();
 char *number2string(double in);
 char *number2string(float in);
 char *number2string(int in);
 char *number2string(unsigned int in);
-float filterPressureValue(float input);
 int writeSysParamsToMQTT(bool continueOnError);
-void updateStandbyTimer(void);
-void resetStandbyTimer(void);
-
-
-// system parameters
-uint8_t pidON = 0;                 // 1 = control loop in closed loop
-double brewSetpoint = SETPOINT;
-double brewTempOffset = TEMPOFFSET;
-double setpoint = brewSetpoint;
-double steamSetpoint = STEAMSETPOINT;
-uint8_t usePonM = 0;               // 1 = use PonM for cold start PID, 0 = use normal PID for cold start
-double steamKp = STEAMKP;
-double startKp = STARTKP;
-double startTn = STARTTN;
-double aggKp = AGGKP;
-double aggTn = AGGTN;
-double aggTv = AGGTV;
-double aggIMax = AGGIMAX;
-double brewtime = BREW_TIME;                        // brewtime in s
-double preinfusion = PRE_INFUSION_TIME;             // preinfusion time in s
-double preinfusionpause = PRE_INFUSION_PAUSE_TIME;  // preinfusion pause time in s
-double weightSetpoint = SCALE_WEIGHTSETPOINT;
-
-// PID - values for offline brew detection
-uint8_t useBDPID = 0;
-double aggbKp = AGGBKP;
-double aggbTn = AGGBTN;
-double aggbTv = AGGBTV;
-
-#if aggbTn == 0
-    double aggbKi = 0;
-#else
-    double aggbKi = aggbKp / aggbTn;
-#endif
-
-double aggbKd = aggbTv * aggbKp;
-double brewtimesoftware = BREW_SW_TIME;  // use userConfig time until disabling BD PID
-double brewSensitivity = BD_SENSITIVITY;  // use userConfig brew detection sensitivity
-double brewPIDDelay = BREW_PID_DELAY;      // use userConfig brew detection PID delay
-
-uint8_t standbyModeOn = 0;
-double standbyModeTime = STANDBY_MODE_TIME;
+void updateTelemetryPowerSave();
+void wakeControlTask();
 
-#include "standby.h"
-
-// system parameter EEPROM storage wrappers (current value as pointer to variable, minimum, maximum, optional storage ID)
-SysPara<uint8_t> sysParaPidOn(&pidON, 0, 1, STO_ITEM_PID_ON);
-SysPara<uint8_t> sysParaUsePonM(&usePonM, 0, 1, STO_ITEM_PID_START_PONM);
-SysPara<double> sysParaPidKpStart(&startKp, PID_KP_START_MIN, PID_KP_START_MAX, STO_ITEM_PID_KP_START);
-SysPara<double> sysParaPidTnStart(&startTn, PID_TN_START_MIN, PID_TN_START_MAX, STO_ITEM_PID_TN_START);
-SysPara<double> sysParaPidKpReg(&aggKp, PID_KP_REGULAR_MIN, PID_KP_REGULAR_MAX, STO_ITEM_PID_KP_REGULAR);
-SysPara<double> sysParaPidTnReg(&aggTn, PID_TN_REGULAR_MIN, PID_TN_REGULAR_MAX, STO_ITEM_PID_TN_REGULAR);
-SysPara<double> sysParaPidTvReg(&aggTv, PID_TV_REGULAR_MIN, PID_TV_REGULAR_MAX, STO_ITEM_PID_TV_REGULAR);
-SysPara<double> sysParaPidIMaxReg(&aggIMax, PID_I_MAX_REGULAR_MIN, PID_I_MAX_REGULAR_MAX, STO_ITEM_PID_I_MAX_REGULAR);
-SysPara<double> sysParaPidKpBd(&aggbKp, PID_KP_BD_MIN, PID_KP_BD_MAX, STO_ITEM_PID_KP_BD);
-SysPara<double> sysParaPidTnBd(&aggbTn, PID_TN_BD_MIN, PID_KP_BD_MAX, STO_ITEM_PID_TN_BD);
-SysPara<double> sysParaPidTvBd(&aggbTv, PID_TV_BD_MIN, PID_TV_BD_MAX, STO_ITEM_PID_TV_BD);
-SysPara<double> sysParaBrewSetpoint(&brewSetpoint, BREW_SETPOINT_MIN, BREW_SETPOINT_MAX, STO_ITEM_BREW_SETPOINT);
-SysPara<double> sysParaTempOffset(&brewTempOffset, BREW_TEMP_OFFSET_MIN, BREW_TEMP_OFFSET_MAX, STO_ITEM_BREW_TEMP_OFFSET);
-SysPara<double> sysParaBrewPIDDelay(&brewPIDDelay, BREW_PID_DELAY_MIN, BREW_PID_DELAY_MAX, STO_ITEM_BREW_PID_DELAY);
-SysPara<uint8_t> sysParaUseBDPID(&useBDPID, 0, 1, STO_ITEM_USE_BD_PID);
-SysPara<double> sysParaBrewTime(&brewtime, BREW_TIME_MIN, BREW_TIME_MAX, STO_ITEM_BREW_TIME);
-SysPara<double> sysParaBrewSwTime(&brewtimesoftware, BREW_SW_TIME_MIN, BREW_SW_TIME_MAX, STO_ITEM_BREW_SW_TIME);
-SysPara<double> sysParaBrewThresh(&brewSensitivity, BD_THRESHOLD_MIN, BD_THRESHOLD_MAX, STO_ITEM_BD_THRESHOLD);
-SysPara<uint8_t> sysParaWifiCredentialsSaved(&wifiCredentialsSaved, WIFI_CREDENTIALS_SAVED_MIN, WIFI_CREDENTIALS_SAVED_MAX, STO_ITEM_WIFI_CREDENTIALS_SAVED);
-SysPara<double> sysParaPreInfTime(&preinfusion, PRE_INFUSION_TIME_MIN, PRE_INFUSION_TIME_MAX, STO_ITEM_PRE_INFUSION_TIME);
-SysPara<double> sysParaPreInfPause(&preinfusionpause, PRE_INFUSION_PAUSE_MIN, PRE_INFUSION_PAUSE_MAX, STO_ITEM_PRE_INFUSION_PAUSE);
-SysPara<double> sysParaPidKpSteam(&steamKp, PID_KP_STEAM_MIN, PID_KP_STEAM_MAX, STO_ITEM_PID_KP_STEAM);
-SysPara<double> sysParaSteamSetpoint(&steamSetpoint, STEAM_SETPOINT_MIN, STEAM_SETPOINT_MAX, STO_ITEM_STEAM_SETPOINT);
-SysPara<double> sysParaWeightSetpoint(&weightSetpoint, WEIGHTSETPOINT_MIN, WEIGHTSETPOINT_MAX, STO_ITEM_WEIGHTSETPOINT);
-SysPara<uint8_t> sysParaStandbyModeOn(&standbyModeOn, 0, 1, STO_ITEM_STANDBY_MODE_ON);
-SysPara<double> sysParaStandbyModeTime(&standbyModeTime, STANDBY_MODE_TIME_MIN, STANDBY_MODE_TIME_MAX, STO_ITEM_STANDBY_MODE_TIME);
 
 // Other variables
-int relayON, relayOFF;           // used for relay trigger type. Do not change!
-boolean coldstart = true;        // true = Rancilio started for first time
-boolean emergencyStop = false;   // Emergency stop if temperature is too high
-double EmergencyStopTemp = 120;  // Temp EmergencyStopTemp
-float inX = 0, inY = 0, inOld = 0, inSum = 0; // used for filterPressureValue()
 int signalBars = 0;              // used for getSignalStrength()
-boolean brewDetected = 0;
 boolean setupDone = false;
-int backflushON = 0;             // 1 = backflush mode active
-int flushCycles = 0;             // number of active flush cycles
-int backflushState = 10;         // counter for state machine
-
-// Moving average for software brew detection
-double tempRateAverage = 0;             // average value of temp values
-double tempChangeRateAverageMin = 0;
-unsigned long timeBrewDetection = 0;
-int isBrewDetected = 0;                 // flag is set if brew was detected
-bool movingAverageInitialized = false;  // flag set when average filter is initialized, also used for sensor check
-
-// Brewing, 1 = Normal Preinfusion , 2 = Scale & Shottimer = 2
-#include "brewscaleini.h"
-
-// Sensor check
-boolean sensorError = false;
-int error = 0;
-int maxErrorCounter = 10;        // depends on intervaltempmes* , define max seconds for invalid data
-
-// PID controller
-unsigned long previousMillistemp;    // initialisation at the end of init()
-const unsigned long intervaltempmestsic = 400;
-const unsigned long intervaltempmesds18b20 = 400;
-int pidMode = 1;    // 1 = Automatic, 0 = Manual
-
-double setpointTemp;
-double previousInput = 0;
-
-// Variables to hold PID values (Temp input, Heater output)
-double temperature, pidOutput;
-int steamON = 0;
-int steamFirstON = 0;
-
-#if startTn == 0
-    double startKi = 0;
-#else
-    double startKi = startKp / startTn;
-#endif
-
-#if aggTn == 0
-    double aggKi = 0;
-#else
-    double aggKi = aggKp / aggTn;
-#endif
-
-double aggKd = aggTv * aggKp;
+volatile bool networkReady = false;  // set once networkSetup() is done, the network jobs of the telemetry task wait for it
 
 // Timer - ISR for PID calculation and heat relay output
 #include "ISR.h"
 
-PID bPID(&temperature, &pidOutput, &setpoint, aggKp, aggKi, aggKd, 1, DIRECT);
+// Tasks: control loop pinned to the app core, network and display on the protocol core
+TaskHandle_t controlTaskHandle = NULL;
+TaskHandle_t telemetryTaskHandle = NULL;
+const unsigned long controlTaskPeriod = 10;     // ms, fixed period of the control loop
+const unsigned long telemetryTaskPeriod = 10;   // ms, pause between telemetry loop iterations
+
+// Job scheduler of the telemetry task, controlScheduler is in Control.cpp
+Scheduler telemetryScheduler("telemetry");
+int mqttPublishJob = -1;
+
+// Boot phases in the order they usually finish, the scale is tared in parallel
+// to the network setup. Each phase is written once by the task running it.
+enum BootPhase {
+    kBootSettings,      // storage and parameters loaded
+    kBootControl,       // sensors, PID and heater running
+    kBootScale,         // scale tared
+    kBootWifi,
+    kBootWebserver,
+    kBootMqtt,
+    kBootInflux,
+    kBootDone,          // network set up, setup() finished
+    kBootPhaseCount
+};
+
+const char *bootPhaseNames[kBootPhaseCount] = {"settings", "control", "scale", "wifi", "webserver", "mqtt", "influxdb", "done"};
+unsigned long bootPhaseTime[kBootPhaseCount] = {0};    // ms since boot when the phase was finished, 0 = not (yet)
+
+void bootPhaseDone(BootPhase phase) {
+    bootPhaseTime[phase] = millis();
+    debugPrintf("Boot phase %s finished after %lu ms\n", bootPhaseNames[phase], bootPhaseTime[phase]);
+}
+
+/**
+ * @brief Control state published by the control task once per cycle. Everything
+ *        running in the telemetry task (MQTT, InfluxDB, website) reads this
+ *        instead of the live control variables.
+ */
+struct control_state_t {
+    unsigned long timestamp;
+    double temperature;
+    double setpoint;
+    double brewSetpoint;
+    double pidOutput;
+    double kp;
+    double ki;
+    double kd;
+    double timeBrewed;
+    double lastbrewTime;
+    float weight;
+    float weightBrew;
+    float pressure;
+    MachineState machineState;
+    BrewState brewcounter;
+    uint8_t pidON;
+    int steamON;
+    PidAutotune::State autotuneState;
+};
+
+Snapshot<control_state_t> controlSnapshot;
+control_state_t controlState = {};   // copy owned by the telemetry task
+
+ShotRecorder shotRecorder;
 
-// Dallas temp sensor
+// Temperature sensor, DS18B20 or TSic 306
 #if TEMPSENSOR == 1
-    OneWire oneWire(PINTEMPSENSOR);         // Setup a OneWire instance to communicate with OneWire
-                                            // devices (not just Maxim/Dallas temperature ICs)
-    DallasTemperature sensors(&oneWire);
-    DeviceAddress sensorDeviceAddress;      // arrays to hold device address
+    TempSensorDallas tempSensor(PIN_TEMPSENSOR);
+#else
+    TempSensorTSic tempSensor(PIN_TEMPSENSOR);
 #endif
 
-// TSIC 306 temp sensor
-ZACwire Sensor2(PIN_TEMPSENSOR, 306);    // set pin to receive signal from the TSic 306
-
 
 #include "InfluxDB.h"
 
@@ -324,7 +220,448 @@ enum SectionNames {
     sOtherSection
 };
 
-std::map<String, editable_t> editableVars = {};
+const char sysVersion[] = (STR(FW_VERSION) "." STR(FW_SUBVERSION) "." STR(FW_HOTFIX) " " FW_BRANCH " " AUTO_VERSION);
+
+// visibility of parameters in the web interface
+bool showAlways() { return true; }
+bool showNever() { return false; }
+bool showPonM() { return usePonM; }
+bool showBrewControl() { return ONLYPID == 0; }
+bool showWeightSetpoint() { return ONLYPIDSCALE == 1 || BREWMODE == 2; }
+bool showBrewDetection() { return BREWDETECTION > 0; }
+bool showBDPID() { return BREWDETECTION > 0 && useBDPID; }
+bool showBDTime() { return BREWDETECTION > 0 && (useBDPID || BREWDETECTION == 1); }
+bool showBDSensitivity() { return BREWDETECTION == 1; }
+
+/**
+ * @brief Parameters editable in the web interface, sorted by name for the
+ *      lookup in findByName(). The order on the page is given by position,
+ *      when adding parameters, set EDITABLE_VARS_LEN to max of .position
+ */
+constexpr editable_t editableVars[EDITABLE_VARS_LEN] = {
+    {
+        .name = "AUTOTUNE_APPLY",
+        .displayName = "Apply Autotune",
+        .helpText = NULL,
+        .section = sOtherSection,
+        .position = 34,
+        .show = showNever,
+        .minValue = 0,
+        .maxValue = 1,
+        .var = &autotuneApply
+    },
+    {
+        .name = "AUTOTUNE_ON",
+        .displayName = "Autotune",
+        .helpText = NULL,
+        .section = sOtherSection,
+        .position = 33,
+        .show = showNever,
+        .minValue = 0,
+        .maxValue = 1,
+        .var = &autotuneON
+    },
+    {
+        .name = "BACKFLUSH_ON",
+        .displayName = "Backflush",
+        .helpText = NULL,
+        .section = sOtherSection,
+        .position = 26,
+        .show = showNever,
+        .minValue = 0,
+        .maxValue = 1,
+        .var = &backflushON
+    },
+    {
+        .name = "BREW_PREINFUSION",
+        .displayName = "Preinfusion Time (s)",
+        .helpText = NULL,
+        .section = sTempSection,
+        .position = 16,
+        .show = showBrewControl,
+        .minValue = PRE_INFUSION_TIME_MIN,
+        .maxValue = PRE_INFUSION_TIME_MAX,
+        .var = &preinfusion
+    },
+    {
+        .name = "BREW_PREINFUSIONPAUSE",
+        .displayName = "Preinfusion Pause Time (s)",
+        .helpText = NULL,
+        .section = sTempSection,
+        .position = 15,
+        .show = showBrewControl,
+        .minValue = PRE_INFUSION_PAUSE_MIN,
+        .maxValue = PRE_INFUSION_PAUSE_MAX,
+        .var = &preinfusionpause
+    },
+    {
+        .name = "BREW_SETPOINT",
+        .displayName = "Set point (°C)",
+        .helpText = "The temperature that the PID will attempt to reach and hold",
+        .section = sTempSection,
+        .position = 11,
+        .show = showAlways,
+        .minValue = BREW_SETPOINT_MIN,
+        .maxValue = BREW_SETPOINT_MAX,
+        .var = &brewSetpoint
+    },
+    {
+        .name = "BREW_TEMP_OFFSET",
+        .displayName = "Offset (°C)",
+        .helpText = "Optional offset that is added to the user-visible "
+                    "setpoint. Can be used to compensate sensor offsets and "
+                    "the average temperature loss between boiler and group "
+                    "so that the setpoint represents the approximate brew temperature.",
+        .section = sTempSection,
+        .position = 12,
+        .show = showAlways,
+        .minValue = BREW_TEMP_OFFSET_MIN,
+        .maxValue = BREW_TEMP_OFFSET_MAX,
+        .var = &brewTempOffset
+    },
+    {
+        .name = "BREW_TIME",
+        .displayName = "Brew Time (s)",
+        .helpText = "Stop brew after this time",
+        .section = sTempSection,
+        .position = 14,
+        .show = showBrewControl,
+        .minValue = BREW_TIME_MIN,
+        .maxValue = BREW_TIME_MAX,
+        .var = &brewtime
+    },
+    {
+        .name = "PID_BD_DELAY",
+        .displayName = "Brew PID Delay (s)",
+        .helpText = "Delay time in seconds during which the PID will be "
+                    "disabled once a brew is detected. This prevents too "
+                    "high brew temperatures with boiler machines like Rancilio "
+                    "Silvia. Set to 0 for thermoblock machines.",
+        .section = sBDSection,
+        .position = 18,
+        .show = showAlways,
+        .minValue = BREW_PID_DELAY_MIN,
+        .maxValue = BREW_PID_DELAY_MAX,
+        .var = &brewPIDDelay
+    },
+    {
+        .name = "PID_BD_FF_POWER",
+        .displayName = "Brew Heater Boost (%)",
+        .helpText = "Heater power that is added to the PID output while brewing "
+                    "to make up for the cold water flowing into the boiler, "
+                    "so the temperature recovers sooner after a shot. The boost "
+                    "is also applied during the Brew PID Delay. Set to 0 to disable.",
+        .section = sBDSection,
+        .position = 30,
+        .show = showAlways,
+        .minValue = BREW_FF_POWER_MIN,
+        .maxValue = BREW_FF_POWER_MAX,
+        .var = &brewFFPower
+    },
+    {
+        .name = "PID_BD_FF_START",
+        .displayName = "Brew Heater Boost Start (s)",
+        .helpText = "Time after the start of the brew at which the heater boost is switched on",
+        .section = sBDSection,
+        .position = 31,
+        .show = showAlways,
+        .minValue = BREW_FF_START_MIN,
+        .maxValue = BREW_FF_START_MAX,
+        .var = &brewFFStart
+    },
+    {
+        .name = "PID_BD_FF_TIME",
+        .displayName = "Brew Heater Boost Time (s)",
+        .helpText = "Duration of the heater boost",
+        .section = sBDSection,
+        .position = 32,
+        .show = showAlways,
+        .minValue = BREW_FF_TIME_MIN,
+        .maxValue = BREW_FF_TIME_MAX,
+        .var = &brewFFTime
+    },
+    {
+        .name = "PID_BD_KP",
+        .displayName = "BD Kp",
+        .helpText = "Proportional gain (in Watts/°C) for the PID when brewing has been "
+                    "detected. Use this controller to either increase heating during the "
+                    "brew to counter temperature drop from fresh cold water in the boiler. "
+                    "Some machines, e.g. Rancilio Silvia, actually need to heat less or not "
+                    "at all during the brew because of high temperature stability "
+                    "(<a href='https://www.kaffee-netz.de/threads/"
+                    "installation-eines-temperatursensors-in-silvia-bruehgruppe.111093/"
+                    "#post-1453641' target='_blank'>Details<a>)",
+        .section = sBDSection,
+        .position = 20,
+        .show = showBDPID,
+        .minValue = PID_KP_BD_MIN,
+        .maxValue = PID_KP_BD_MAX,
+        .var = &aggbKp
+    },
+    {
+        .name = "PID_BD_ON",
+        .displayName = "Enable Brew PID",
+        .helpText = "Use separate PID parameters while brew is running",
+        .section = sBDSection,
+        .position = 19,
+        .show = showBrewDetection,
+        .minValue = 0,
+        .maxValue = 1,
+        .var = &useBDPID
+    },
+    {
+        .name = "PID_BD_SENSITIVITY",
+        .displayName = "PID BD Sensitivity",
+        .helpText = "Software brew detection sensitivity that looks at "
+                    "average temperature, <a href='https://manual.rancilio-pid.de/de/customization/"
+                    "brueherkennung.html' target='_blank'>Details</a>. "
+                    "Needs to be &gt;0 also for Hardware switch detection.",
+        .section = sBDSection,
+        .position = 24,
+        .show = showBDSensitivity,
+        .minValue = BD_THRESHOLD_MIN,
+        .maxValue = BD_THRESHOLD_MAX,
+        .var = &brewSensitivity
+    },
+    {
+        .name = "PID_BD_TIME",
+        .displayName = "PID BD Time (s)",
+        .helpText = "Fixed time in seconds for which the BD PID will stay "
+                    "enabled (also after Brew switch is inactive again).",
+        .section = sBDSection,
+        .position = 23,
+        .show = showBDTime,
+        .minValue = BREW_SW_TIME_MIN,
+        .maxValue = BREW_SW_TIME_MAX,
+        .var = &brewtimesoftware
+    },
+    {
+        .name = "PID_BD_TN",
+        .displayName = "BD Tn (=Kp/Ki)",
+        .helpText = "Integral time constant (in seconds) for the PID when "
+                    "brewing has been detected.",
+        .section = sBDSection,
+        .position = 21,
+        .show = showBDPID,
+        .minValue = PID_TN_BD_MIN,
+        .maxValue = PID_TN_BD_MAX,
+        .var = &aggbTn
+    },
+    {
+        .name = "PID_BD_TV",
+        .displayName = "BD Tv (=Kd/Kp)",
+        .helpText = "Differential time constant (in seconds) for the PID "
+                    "when brewing has been detected.",
+        .section = sBDSection,
+        .position = 22,
+        .show = showBDPID,
+        .minValue = PID_TV_BD_MIN,
+        .maxValue = PID_TV_BD_MAX,
+        .var = &aggbTv
+    },
+    {
+        .name = "PID_I_MAX",
+        .displayName = "PID Integrator Max",
+        .helpText = "Internal integrator limit to prevent windup (in Watts). This will allow the integrator to only grow to "
+                    "the specified value. This should be approximally equal to the output needed to hold the temperature after the "
+                    "setpoint has been reached and is depending on machine type and whether the boiler is insulated or not.",
+        .section = sPIDSection,
+        .position = 8,
+        .show = showAlways,
+        .minValue = PID_I_MAX_REGULAR_MIN,
+        .maxValue = PID_I_MAX_REGULAR_MAX,
+        .var = &aggIMax
+    },
+    {
+        .name = "PID_KP",
+        .displayName = "PID Kp",
+        .helpText = "Proportional gain (in Watts/C°) for the main PID controller (in "
+                    "P-Tn-Tv form, <a href='http://testcon.info/EN_BspPID-Regler.html#strukturen' "
+                    "target='_blank'>Details<a>). The higher this value is, the "
+                    "higher is the output of the heater for a given temperature "
+                    "difference. E.g. 5°C difference will result in P*5 Watts of heater output.",
+        .section = sPIDSection,
+        .position = 5,
+        .show = showAlways,
+        .minValue = PID_KP_REGULAR_MIN,
+        .maxValue = PID_KP_REGULAR_MAX,
+        .var = &aggKp
+    },
+    {
+        .name = "PID_ON",
+        .displayName = "Enable PID Controller",
+        .helpText = NULL,
+        .section = sPIDSection,
+        .position = 1,
+        .show = showAlways,
+        .minValue = 0,
+        .maxValue = 1,
+        .var = &pidON
+    },
+    {
+        .name = "PID_TN",
+        .displayName = "PID Tn (=Kp/Ki)",
+        .helpText = "Integral time constant (in seconds) for the main PID controller "
+                    "(in P-Tn-Tv form, <a href='http://testcon.info/EN_BspPID-Regler.html#strukturen' "
+                    "target='_blank'>Details<a>). The larger this value is, the slower the "
+                    "integral part of the PID will increase (or decrease) if the "
+                    "process value remains above (or below) the setpoint in spite of "
+                    "proportional action. The smaller this value, the faster the integral term changes.",
+        .section = sPIDSection,
+        .position = 6,
+        .show = showAlways,
+        .minValue = PID_TN_REGULAR_MIN,
+        .maxValue = PID_TN_REGULAR_MAX,
+        .var = &aggTn
+    },
+    {
+        .name = "PID_TV",
+        .displayName = "PID Tv (=Kd/Kp)",
+        .helpText = "Differential time constant (in seconds) for the main PID controller (in P-Tn-Tv form, <a "
+                    "href='http://testcon.info/EN_BspPID-Regler.html#strukturen' target='_blank'>Details<a>). "
+                    "This value determines how far the PID equation projects the current trend into the future. "
+                    "The higher the value, the greater the dampening. Select it carefully, it can cause oscillations "
+                    "if it is set too high or too low.",
+        .section = sPIDSection,
+        .position = 7,
+        .show = showAlways,
+        .minValue = PID_TV_REGULAR_MIN,
+        .maxValue = PID_TV_REGULAR_MAX,
+        .var = &aggTv
+    },
+    {
+        .name = "SCALE_WEIGHTSETPOINT",
+        .displayName = "Brew weight setpoint (g)",
+        .helpText = "Brew until this weight has been measured.",
+        .section = sTempSection,
+        .position = 17,
+        .show = showWeightSetpoint,
+        .minValue = WEIGHTSETPOINT_MIN,
+        .maxValue = WEIGHTSETPOINT_MAX,
+        .var = &weightSetpoint
+    },
+    {
+        .name = "STANDBY_MODE_ON",
+        .displayName = "Enable Standby Timer",
+        .helpText = "Turn heater off after standby time has elapsed.",
+        .section = sPowerSection,
+        .position = 27,
+        .show = showAlways,
+        .minValue = 0,
+        .maxValue = 1,
+        .var = &standbyModeOn
+    },
+    {
+        .name = "STANDBY_MODE_TIMER",
+        .displayName = "Standby Time",
+        .helpText = "Time in minutes until the heater is turned off. Timer is reset by brew detection.",
+        .section = sPowerSection,
+        .position = 28,
+        .show = showAlways,
+        .minValue = STANDBY_MODE_TIME_MIN,
+        .maxValue = STANDBY_MODE_TIME_MAX,
+        .var = &standbyModeTime
+    },
+    {
+        .name = "START_KP",
+        .displayName = "Start Kp",
+        .helpText = "Proportional gain for cold start controller. This value is not "
+                    "used with the the error as usual but the absolute value of the "
+                    "temperature and counteracts the integral part as the temperature "
+                    "rises. Ideally, both parameters are set so that they balance each "
+                    "other out when the target temperature is reached.",
+        .section = sPIDSection,
+        .position = 3,
+        .show = showPonM,
+        .minValue = PID_KP_START_MIN,
+        .maxValue = PID_KP_START_MAX,
+        .var = &startKp
+    },
+    {
+        .name = "START_TN",
+        .displayName = "Start Tn",
+        .helpText = "Integral gain for cold start controller (PonM mode, <a "
+                    "href='http://brettbeauregard.com/blog/2017/06/"
+                    "introducing-proportional-on-measurement/' target='_blank'>details</a>)",
+        .section = sPIDSection,
+        .position = 4,
+        .show = showPonM,
+        .minValue = PID_TN_START_MIN,
+        .maxValue = PID_TN_START_MAX,
+        .var = &startTn
+    },
+    {
+        .name = "START_USE_PONM",
+        .displayName = "Enable PonM",
+        .helpText = "Use PonM mode (<a href='http://brettbeauregard.com/blog/2017/06/"
+                    "introducing-proportional-on-measurement/' "
+                    "target='_blank'>details</a>) while heating up the machine. "
+                    "Otherwise, just use the same PID values that are used later",
+        .section = sPIDSection,
+        .position = 2,
+        .show = showAlways,
+        .minValue = 0,
+        .maxValue = 1,
+        .var = &usePonM
+    },
+    {
+        .name = "STEAM_KP",
+        .displayName = "Steam Kp",
+        .helpText = "Proportional gain for the steaming mode (I or D are not used)",
+        .section = sPIDSection,
+        .position = 9,
+        .show = showAlways,
+        .minValue = PID_KP_STEAM_MIN,
+        .maxValue = PID_KP_STEAM_MAX,
+        .var = &steamKp
+    },
+    {
+        .name = "STEAM_MODE",
+        .displayName = "Steam Mode",
+        .helpText = NULL,
+        .section = sOtherSection,
+        .position = 25,
+        .show = showNever,
+        .minValue = 0,
+        .maxValue = 1,
+        .var = &steamON
+    },
+    {
+        .name = "STEAM_SETPOINT",
+        .displayName = "Steam Set point (°C)",
+        .helpText = "The temperature that the PID will use for steam mode",
+        .section = sTempSection,
+        .position = 13,
+        .show = showAlways,
+        .minValue = STEAM_SETPOINT_MIN,
+        .maxValue = STEAM_SETPOINT_MAX,
+        .var = &steamSetpoint
+    },
+    {
+        .name = "TEMP",
+        .displayName = "Temperature",
+        .helpText = NULL,
+        .section = sPIDSection,
+        .position = 10,
+        .show = showNever,
+        .minValue = 0,
+        .maxValue = 200,
+        .var = &temperature
+    },
+    {
+        .name = "VERSION",
+        .displayName = "Version",
+        .helpText = NULL,
+        .section = sOtherSection,
+        .position = 29,
+        .show = showNever,
+        .minValue = 0,
+        .maxValue = 1,
+        .var = sysVersion
+    }
+};
+
+static_assert(isSortedByName(editableVars, EDITABLE_VARS_LEN), "editableVars must be sorted by name");
 
 
 struct cmp_str
@@ -335,19 +672,53 @@ struct cmp_str
    }
 };
 
+// Editable values reported to MQTT, sorted by name
+constexpr mqtt_var_t mqttVars[] = {
+    {"aggIMax", "PID_I_MAX", true},
+    {"aggKp", "PID_KP", true},
+    {"aggTn", "PID_TN", true},
+    {"aggTv", "PID_TV", true},
+    {"aggbKp", "PID_BD_KP", BREWDETECTION > 0},
+    {"aggbTn", "PID_BD_TN", BREWDETECTION > 0},
+    {"aggbTv", "PID_BD_TV", BREWDETECTION > 0},
+    {"autotuneApply", "AUTOTUNE_APPLY", true},
+    {"autotuneON", "AUTOTUNE_ON", true},
+    {"backflushON", "BACKFLUSH_ON", true},
+    {"brewFFPower", "PID_BD_FF_POWER", true},
+    {"brewFFStart", "PID_BD_FF_START", true},
+    {"brewFFTime", "PID_BD_FF_TIME", true},
+    {"brewLimit", "PID_BD_SENSITIVITY", BREWDETECTION == 1},
+    {"brewPidDelay", "PID_BD_DELAY", true},
+    {"brewSetpoint", "BREW_SETPOINT", true},
+    {"brewTempOffset", "BREW_TEMP_OFFSET", true},
+    {"brewTimer", "PID_BD_TIME", BREWDETECTION == 1},
+    {"brewtime", "BREW_TIME", ONLYPID == 0},
+    {"pidON", "PID_ON", true},
+    {"pidUseBD", "PID_BD_ON", BREWDETECTION > 0},
+    {"preinfusion", "BREW_PREINFUSION", ONLYPID == 0},
+    {"preinfusionpause", "BREW_PREINFUSIONPAUSE", ONLYPID == 0},
+    {"standbyModeOn", "STANDBY_MODE_ON", true},
+    {"startKp", "START_KP", true},
+    {"startTn", "START_TN", true},
+    {"startUsePonM", "START_USE_PONM", true},
+    {"steamKp", "STEAM_KP", true},
+    {"steamON", "STEAM_MODE", true},
+    {"steamSetpoint", "STEAM_SETPOINT", true},
+    {"weightSetpoint", "SCALE_WEIGHTSETPOINT", ONLYPIDSCALE == 1 || BREWMODE == 2}
+};
+
+static_assert(isSortedByName(mqttVars, sizeof(mqttVars) / sizeof(mqttVars[0])), "mqttVars must be sorted by name");
+
 // MQTT
 #include "MQTT.h"
 
-std::map<const char*, std::function<editable_t*()>, cmp_str> mqttVars = {};
-std::map<const char*, std::function<double()>, cmp_str> mqttSensors = {};
+#ifndef MQTT_LOOP_METRICS
+    #define MQTT_LOOP_METRICS 0     // not defined in older userConfig files
+#endif
 
-unsigned long lastTempEvent = 0;
-unsigned long tempEventInterval = 1000;
+std::map<const char*, mqtt_sensor_t, cmp_str> mqttSensors = {};
 
-#if MQTT_HASSIO_SUPPORT == 1
-static unsigned long lastHomeAssistantDiscoveryExecutionTime = 0;
-const unsigned long HomeAssistantDiscoveryExecutionInterval = 300000;  // 5 minute
-#endif
+const unsigned long tempHistoryInterval = 1000;
 
 bool mqtt_was_connected = false;
 
@@ -392,11 +763,12 @@ void getSignalStrength() {
 #endif
 
 // Update for Display
-unsigned long previousMillisDisplay;  // initialisation at the end of init()
 const unsigned long intervalDisplay = 500;
 
 // Horizontal or vertical display
 #if (OLED_DISPLAY != 0)
+    #include "displayUpdate.h"
+
     #if (DISPLAYTEMPLATE < 20)  // horizontal templates
         #include "display.h"
     #endif
@@ -424,1005 +796,155 @@ const unsigned long intervalDisplay = 500;
     #if (DISPLAYTEMPLATE == 20)
         #include "Displaytemplateupright.h"
     #endif
-#endif
 
+    #define BOOT_MESSAGE_TIME 2000      // ms a boot message is shown instead of the status screen
+
+    // Messages of the boot and the network setup, drawn by the display job so
+    // only the telemetry task uses the display once it runs
+    char bootMessage[2][32];
+    unsigned long bootMessageTime = 0;
+    bool bootMessagePending = false;
+    portMUX_TYPE bootMessageMux = portMUX_INITIALIZER_UNLOCKED;
 
-#if (PRESSURESENSOR == 1)
     /**
-     * Pressure sensor
-     * Verify before installation: meassured analog input value (should be 3,300 V
-     * for 3,3 V supply) and respective ADC value (3,30 V = 1023)
+     * @brief Show a logo screen with two lines for BOOT_MESSAGE_TIME, drawn right
+     *      away as long as the telemetry task doesn't run yet
      */
-    void checkPressure() {
-        float inputPressureFilter = 0;
-        unsigned long currentMillisPressure = millis();
-
-        if (currentMillisPressure - previousMillisPressure >= intervalPressure) {
-            previousMillisPressure = currentMillisPressure;
+    void displayBootMessage(const String& line1, const String& line2) {
+        if (telemetryTaskHandle == NULL) {
+            displayLogo(line1, line2);
+        }
 
-            inputPressure =
-                ((analogRead(PIN_PRESSURESENSOR) - offset) * maxPressure * 0.0689476) /
-                (fullScale - offset);   // pressure conversion and unit
-                                        // conversion [psi] -> [bar]
-            inputPressureFilter = filterPressureValue(inputPressure);
+        portENTER_CRITICAL(&bootMessageMux);
+        strlcpy(bootMessage[0], line1.c_str(), sizeof(bootMessage[0]));
+        strlcpy(bootMessage[1], line2.c_str(), sizeof(bootMessage[1]));
+        bootMessageTime = millis();
+        bootMessagePending = true;
+        portEXIT_CRITICAL(&bootMessageMux);
+    }
 
-            debugPrintf("pressure raw / filtered: %f / %f\n", inputPressure, inputPressureFilter);
+    /**
+     * @brief Called by the display job, draws the last boot message while it is recent
+     *
+     * @return true if the boot message was drawn
+     */
+    bool refreshBootMessage() {
+        char line1[sizeof(bootMessage[0])];
+        char line2[sizeof(bootMessage[1])];
+
+        portENTER_CRITICAL(&bootMessageMux);
+        bool show = bootMessagePending && millis() - bootMessageTime < BOOT_MESSAGE_TIME;
+        bootMessagePending = show;
+        memcpy(line1, bootMessage[0], sizeof(line1));
+        memcpy(line2, bootMessage[1], sizeof(line2));
+        portEXIT_CRITICAL(&bootMessageMux);
+
+        if (show) {
+            displayLogo(line1, line2);
         }
+
+        return show;
     }
 #endif
 
-// Emergency stop if temp is too high
-void testEmergencyStop() {
-    if (temperature > EmergencyStopTemp && emergencyStop == false) {
-        emergencyStop = true;
-    } else if (temperature < (brewSetpoint+5) && emergencyStop == true) {
-        emergencyStop = false;
+
+#if (PRESSURESENSOR == 1)
+    /**
+     * @brief Take the latest pressure, sampled and averaged in the background (see PressureSensor.h)
+     */
+    void checkPressure() {
+        inputPressure = pressureGet();
+
+        LOG_VERBOSE("pressure: %.2f bar\n", inputPressure);
     }
-}
+#endif
+
+
+#include "scalevoid.h"
+#include "standby.h"
 
 /**
- * @brief FIR moving average filter for software brew detection
+ * @brief WiFi reconnection, called by the telemetry task on every pass while
+ *      the connection is lost. Starts a reconnect with the saved credentials
+ *      every wifiConnectionDelay ms and polls WiFi.status() in between, like
+ *      checkMQTT() nothing in here waits for the connection. Aborts if
+ *      offline or a brew is running.
  */
-void calculateTemperatureMovingAverage() {
-    const int numValues = 15;                      // moving average filter length
-    static double tempValues[numValues];           // array of temp values
-    static unsigned long timeValues[numValues];    // array of time values
-    static double tempChangeRates[numValues];
-    static int valueIndex = 1;                     // the index of the current value
-
-    if (brewDetectionMode == 1 && !movingAverageInitialized) {
-        for (int index = 0; index < numValues; index++) {
-            tempValues[index] = temperature;
-            timeValues[index] = 0;
-            tempChangeRates[index] = 0;
+void checkWifi() {
+    if (offlineMode == 1 || brewcounter > kBrewIdle) return;
+
+    // the telemetry task stops calling once WiFi.status() is connected again
+    if (wifiConnecting) {
+        if (millis() - lastWifiConnectionAttempt >= wifiConnectTimeout) {
+            debugPrintln("WiFi reconnection timed out");
+            wifiConnecting = false;
         }
 
-        movingAverageInitialized = true;
+        return;
     }
 
-    timeValues[valueIndex] = millis();
-    tempValues[valueIndex] = temperature;
+    if ((millis() - lastWifiConnectionAttempt >= wifiConnectionDelay) && (wifiReconnects <= maxWifiReconnects)) {
+        lastWifiConnectionAttempt = millis();
+        wifiReconnects++;
+        debugPrintf("Attempting WIFI reconnection: %i\n", wifiReconnects);
 
-    double tempChangeRate = 0;                     // local change rate of temperature
-    if (valueIndex == numValues - 1) {
-        tempChangeRate = (tempValues[numValues - 1] - tempValues[0]) /
-                        (timeValues[numValues - 1] - timeValues[0]) * 10000;
-    } else {
-        tempChangeRate = (tempValues[valueIndex] - tempValues[valueIndex + 1]) /
-                        (timeValues[valueIndex] - timeValues[valueIndex + 1]) * 10000;
+        // returns right away, WiFiManager's autoConnect() would block for up to 30 s
+        WiFi.reconnect();
+        wifiConnecting = true;
     }
-    tempChangeRates[valueIndex] = tempChangeRate;
+}
 
-    double totalTempChangeRateSum = 0;
-    for (int i = 0; i < numValues; i++) {
-        totalTempChangeRateSum += tempChangeRates[i];
-    }
 
-    tempRateAverage = totalTempChangeRateSum / numValues * 100;
+char number2string_double[22];
 
-    if (tempRateAverage < tempChangeRateAverageMin) {
-        tempChangeRateAverageMin = tempRateAverage;
-    }
+char *number2string(double in) {
+    snprintf(number2string_double, sizeof(number2string_double), "%0.2f", in);
 
-    if (valueIndex >= numValues - 1) {
-        // ...wrap around to the beginning:
-        valueIndex = 0;
-    } else {
-        valueIndex++;
-    }
+    return number2string_double;
 }
 
-/**
- * @brief check sensor value.
- * @return If < 0 or difference between old and new >25, then increase error.
- *      If error is equal to maxErrorCounter, then set sensorError
- */
-boolean checkSensor(float tempInput) {
-    boolean sensorOK = false;
-    boolean badCondition = (tempInput < 0 || tempInput > 150 || fabs(tempInput - previousInput) > (5+brewTempOffset));
-
-    if (badCondition && !sensorError) {
-        error++;
-        sensorOK = false;
 
-        debugPrintf(
-            "*** WARNING: temperature sensor reading: consec_errors = %i, temp_current = %.1f, temp_prev = %.1f\n",
-            error, tempInput, previousInput);
-    } else if (badCondition == false && sensorOK == false) {
-        error = 0;
-        sensorOK = true;
-    }
+char number2string_float[22];
 
-    if (error >= maxErrorCounter && !sensorError) {
-        sensorError = true;
-        debugPrintf(
-            "*** ERROR: temperature sensor malfunction: temp_current = %.1f\n",
-            tempInput);
-    } else if (error == 0 && sensorError) {
-        sensorError = false;
-    }
+char *number2string(float in) {
+    snprintf(number2string_float, sizeof(number2string_float), "%0.2f", in);
 
-    return sensorOK;
+    return number2string_float;
 }
 
-/**
- * @brief Refresh temperature.
- *      Each time checkSensor() is called to verify the value.
- *      If the value is not valid, new data is not stored.
- */
-void refreshTemp() {
-    unsigned long currentMillistemp = millis();
-    previousInput = temperature;
 
-    if (TempSensor == 1) {
-        if (currentMillistemp - previousMillistemp >= intervaltempmesds18b20) {
-            previousMillistemp = currentMillistemp;
+char number2string_int[22];
 
-        #if TEMPSENSOR == 1
-            sensors.requestTemperatures();
-            temperature = sensors.getTempCByIndex(0);
-        #endif
+char *number2string(int in) {
+    snprintf(number2string_int, sizeof(number2string_int), "%d", in);
 
-            if (machineState != kSteam) {
-                temperature -= brewTempOffset;
-            }
+    return number2string_int;
+}
 
-            if (!checkSensor(temperature) && movingAverageInitialized) {
-                temperature = previousInput;
-                return; // if sensor data is not valid, abort function; Sensor must
-                        // be read at least one time at system startup
-            }
 
-            if (brewDetectionMode == 1) {
-                calculateTemperatureMovingAverage();
-            } else if (!movingAverageInitialized) {
-                movingAverageInitialized = true;
-            }
-        }
-    }
+char number2string_uint[22];
 
-    if (TempSensor == 2) {
-        if (currentMillistemp - previousMillistemp >= intervaltempmestsic) {
-            previousMillistemp = currentMillistemp;
+char *number2string(unsigned int in) {
+    snprintf(number2string_uint, sizeof(number2string_uint), "%u", in);
 
-            #if TEMPSENSOR == 2
-                temperature = Sensor2.getTemp();
-            #endif
+    return number2string_uint;
+}
 
-            if (machineState != kSteam) {
-                temperature -= brewTempOffset;
-            }
 
-            if (!checkSensor(temperature) && movingAverageInitialized) {
-                temperature = previousInput;
-                return; // if sensor data is not valid, abort function; Sensor must
-                        // be read at least one time at system startup
-            }
+void debugVerboseOutput() {
+    static PeriodicTrigger trigger(10000);
 
-            if (brewDetectionMode == 1) {
-                calculateTemperatureMovingAverage();
-            } else if (!movingAverageInitialized) {
-                movingAverageInitialized = true;
-            }
-        }
+    if (trigger.check()) {
+        debugPrintf(
+            "Tsoll=%5.1f  Tist=%5.1f Machinestate=%2i KP=%4.2f "
+            "KI=%4.2f KD=%4.2f\n",
+            setpoint, temperature, machineState, bPID.GetKp(), bPID.GetKi(), bPID.GetKd());
     }
 }
 
 
-#include "brewvoid.h"
-#include "powerswitchvoid.h"
-#include "scalevoid.h"
-
 /**
- * @brief Switch to offline mode if maxWifiReconnects were exceeded during boot
- */
-void initOfflineMode() {
-    #if OLED_DISPLAY != 0
-        displayMessage("", "", "", "", "Begin Fallback,", "No Wifi");
-    #endif
-
-    debugPrintln("Start offline mode with eeprom values, no wifi :(");
-    offlineMode = 1;
-
-    if (readSysParamsFromStorage() != 0) {
-        #if OLED_DISPLAY != 0
-            displayMessage("", "", "", "", "No eeprom,", "Values");
-        #endif
-
-        debugPrintln(
-            "No working eeprom value, I am sorry, but use default offline value "
-            ":)");
-
-        delay(1000);
-    }
-}
-
-/**
- * @brief Check if Wifi is connected, if not reconnect abort function if offline, or brew is running
- */
-void checkWifi() {
-    if (offlineMode == 1 || brewcounter > kBrewIdle) return;
-
-    /* if coldstart ist still true when checkWifi() is called, then there was no WIFI connection
-     * at boot -> connect or offlinemode
-     */
-    do {
-        if ((millis() - lastWifiConnectionAttempt >= wifiConnectionDelay) && (wifiReconnects <= maxWifiReconnects)) {
-            int statusTemp = WiFi.status();
-
-            if (statusTemp != WL_CONNECTED) {  // check WiFi connection status
-                lastWifiConnectionAttempt = millis();
-                wifiReconnects++;
-                debugPrintf("Attempting WIFI reconnection: %i\n", wifiReconnects);
-
-                if (!setupDone) {
-                    #if OLED_DISPLAY != 0
-                        displayMessage("", "", "", "", langstring_wifirecon, String(wifiReconnects));
-                    #endif
-                }
-
-                wm.disconnect();
-                wm.autoConnect();
-
-                int count = 1;
-
-                while (WiFi.status() != WL_CONNECTED && count <= 20) {
-                    delay(100); // give WIFI some time to connect
-                    count++;    // reconnect counter, maximum waiting time for
-                                // reconnect = 20*100ms
-                }
-            }
-        }
-
-        yield();  // Prevent WDT trigger
-    } while (!setupDone && wifiReconnects < maxWifiReconnects && WiFi.status() != WL_CONNECTED);
-
-
-    if (wifiReconnects >= maxWifiReconnects && !setupDone) {  // no wifi connection after boot, initiate offline mode
-        // (only directly after boot)
-        initOfflineMode();
-    }
-}
-
-
-char number2string_double[22];
-
-char *number2string(double in) {
-    snprintf(number2string_double, sizeof(number2string_double), "%0.2f", in);
-
-    return number2string_double;
-}
-
-
-char number2string_float[22];
-
-char *number2string(float in) {
-    snprintf(number2string_float, sizeof(number2string_float), "%0.2f", in);
-
-    return number2string_float;
-}
-
-
-char number2string_int[22];
-
-char *number2string(int in) {
-    snprintf(number2string_int, sizeof(number2string_int), "%d", in);
-
-    return number2string_int;
-}
-
-
-char number2string_uint[22];
-
-char *number2string(unsigned int in) {
-    snprintf(number2string_uint, sizeof(number2string_uint), "%u", in);
-
-    return number2string_uint;
-}
-
-
-/**
- * @brief detect if a brew is running
- */
-void brewDetection() {
-    if (brewDetectionMode == 1 && brewSensitivity == 0) return;  // abort brewdetection if deactivated
-
-    // Brew detection: 1 = software solution, 2 = hardware, 3 = voltage sensor
-    if (brewDetectionMode == 1) {
-        if (isBrewDetected == 1) {
-            timeBrewed = millis() - timeBrewDetection;
-        }
-
-        // deactivate brewtimer after end of brewdetection pid
-        if (millis() - timeBrewDetection > brewtimesoftware * 1000 && isBrewDetected == 1) {
-            isBrewDetected = 0;  // rearm brewDetection
-            timeBrewed = 0;
-        }
-    } else if (brewDetectionMode == 2) {
-        if (millis() - timeBrewDetection > brewtimesoftware * 1000 && isBrewDetected == 1) {
-            isBrewDetected = 0;  // rearm brewDetection
-        }
-    } else if (brewDetectionMode == 3) {
-        // timeBrewed counter
-        if ((digitalRead(PIN_BREWSWITCH) == VoltageSensorON) && brewDetected == 1) {
-            timeBrewed = millis() - startingTime;
-            lastbrewTime = timeBrewed;
-        }
-
-        // OFF: reset brew
-        if ((digitalRead(PIN_BREWSWITCH) == VoltageSensorOFF) && (brewDetected == 1 || coolingFlushDetectedQM == true)) {
-            isBrewDetected = 0;  // rearm brewDetection
-            brewDetected = 0;
-            timePVStoON = timeBrewed;  // for QuickMill
-            timeBrewed = 0;
-            startingTime = 0;
-            coolingFlushDetectedQM = false;
-            debugPrintln("HW Brew - Voltage Sensor - End");
-        }
-    }
-
-    // Activate brew detection
-    if (brewDetectionMode == 1) {  // SW BD
-        // BD PID only +/- 4 °C, no detection if HW was active
-        if (tempRateAverage <= -brewSensitivity && isBrewDetected == 0 && (fabs(temperature - brewSetpoint) < 5)) {
-            debugPrintln("SW Brew detected");
-            timeBrewDetection = millis();
-            isBrewDetected = 1;
-        }
-    } else if (brewDetectionMode == 2) {  // HW BD
-        if (brewcounter > kBrewIdle && brewDetected == 0) {
-            debugPrintln("HW Brew detected");
-            timeBrewDetection = millis();
-            isBrewDetected = 1;
-            brewDetected = 1;
-        }
-    } else if (brewDetectionMode == 3) {  // voltage sensor
-        switch (machine) {
-            case QuickMill:
-                if (!coolingFlushDetectedQM) {
-                    int pvs = digitalRead(PIN_BREWSWITCH);
-
-                    if (pvs == VoltageSensorON && brewDetected == 0 &&
-                        brewSteamDetectedQM == 0 && !steamQM_active) {
-                        timeBrewDetection = millis();
-                        timePVStoON = millis();
-                        isBrewDetected = 1;
-                        brewDetected = 0;
-                        lastbrewTime = 0;
-                        brewSteamDetectedQM = 1;
-                        debugPrintln("Quick Mill: setting brewSteamDetectedQM = 1");
-                        logbrew.reset();
-                    }
-
-                    const unsigned long minBrewDurationForSteamModeQM_ON = 50;
-                    if (brewSteamDetectedQM == 1 && millis()-timePVStoON > minBrewDurationForSteamModeQM_ON) {
-                        if (pvs == VoltageSensorOFF) {
-                            brewSteamDetectedQM = 0;
-
-                            if (millis() - timePVStoON < maxBrewDurationForSteamModeQM_ON) {
-                                debugPrintln("Quick Mill: steam-mode detected");
-                                initSteamQM();
-                            } else {
-                                debugPrintf("*** ERROR: QuickMill: neither brew nor steam\n");
-                            }
-                        } else if (millis() - timePVStoON > maxBrewDurationForSteamModeQM_ON) {
-                            if (temperature < brewSetpoint + 2) {
-                                debugPrintln("Quick Mill: brew-mode detected");
-                                startingTime = timePVStoON;
-                                brewDetected = 1;
-                                brewSteamDetectedQM = 0;
-                            } else {
-                                debugPrintln("Quick Mill: cooling-flush detected");
-                                coolingFlushDetectedQM = true;
-                                brewSteamDetectedQM = 0;
-                            }
-                        }
-                    }
-                }
-                break;
-
-            // no Quickmill:
-            default:
-                previousMillisVoltagesensorreading = millis();
-
-                if (digitalRead(PIN_BREWSWITCH) == VoltageSensorON && brewDetected == 0) {
-                    debugPrintln("HW Brew - Voltage Sensor - Start");
-                    timeBrewDetection = millis();
-                    startingTime = millis();
-                    isBrewDetected = 1;
-                    brewDetected = 1;
-                    lastbrewTime = 0;
-                }
-        }
-    }
-}
-
-
-/**
- * @brief Filter input value using exponential moving average filter (using fixed coefficients)
- *      After ~28 cycles the input is set to 99,66% if the real input value sum of inX and inY
- *      multiplier must be 1 increase inX multiplier to make the filter faster
- */
-float filterPressureValue(float input) {
-    inX = input * 0.3;
-    inY = inOld * 0.7;
-    inSum = inX + inY;
-    inOld = inSum;
-
-    return inSum;
-}
-
-
-/**
- * @brief steamON & Quickmill
- */
-void checkSteamON() {
-    // check digital GIPO
-    if (digitalRead(PIN_STEAMSWITCH) == HIGH) {
-        steamON = 1;
-    }
-
-    // if activated via web interface then steamFirstON == 1, prevent override
-    if (digitalRead(PIN_STEAMSWITCH) == LOW && steamFirstON == 0) {
-        steamON = 0;
-    }
-
-    // monitor QuickMill thermoblock steam-mode
-    if (machine == QuickMill) {
-        if (steamQM_active == true) {
-            if (checkSteamOffQM() == true) {  // if true: steam-mode can be turned off
-                steamON = 0;
-                steamQM_active = false;
-                lastTimePVSwasON = 0;
-            } else {
-                steamON = 1;
-            }
-        }
-    }
-
-    if (steamON == 1) {
-        setpoint = steamSetpoint;
-    } else if (steamON == 0) {
-        setpoint = brewSetpoint;
-    }
-}
-
-void setEmergencyStopTemp() {
-    if (machineState == kSteam || machineState == kCoolDown) {
-        if (EmergencyStopTemp != 145) EmergencyStopTemp = 145;
-    } else {
-        if (EmergencyStopTemp != 120) EmergencyStopTemp = 120;
-    }
-}
-
-void initSteamQM() {
-    // Initialize monitoring for steam switch off for QuickMill thermoblock
-    lastTimePVSwasON = millis();  // time when pinvoltagesensor changes from ON to OFF
-    steamQM_active = true;
-    timePVStoON = 0;
-    steamON = 1;
-}
-
-boolean checkSteamOffQM() {
-    /* Monitor optocoupler during active steam mode of QuickMill
-     * thermoblock. Once the pinvolagesenor remains OFF for longer than a
-     * pump-pulse time peride the switch is turned off and steam mode finished.
-     */
-    if (digitalRead(PIN_BREWSWITCH) == VoltageSensorON) {
-        lastTimePVSwasON = millis();
-    }
-
-    if ((millis() - lastTimePVSwasON) > minPVSOffTimedForSteamModeQM_OFF) {
-        lastTimePVSwasON = 0;
-        return true;
-    }
-
-    return false;
-}
-
-/**
- * @brief Handle the different states of the machine
- */
-void handleMachineState() {
-    switch (machineState) {
-        case kInit:
-            // Prevent coldstart leave by temperature 222
-            if (temperature < (brewSetpoint - 1) || temperature < 150) {
-                machineState = kColdStart;
-                debugPrintf("%d\n", temperature);
-                debugPrintf("%d\n", machineState);
-
-                // some users have 100 % Output in kInit / KColdstart, reset PID
-                pidMode = 0;
-                bPID.SetMode(pidMode);
-                pidOutput = 0;
-                digitalWrite(PIN_HEATER, LOW);  // Stop heating
-
-                // start PID
-                pidMode = 1;
-                bPID.SetMode(pidMode);
-            }
-
-            if (pidON == 0) {
-                machineState = kPidOffline;
-            }
-
-            if (sensorError) {
-                machineState = kSensorError;
-            }
-            break;
-
-        case kColdStart:
-            /* One high temperature let the state jump to 19.
-            * switch (machinestatecold) prevent it, we wait 10 sec with new state.
-            * during the 10 sec the temperature has to be temperature >= (BrewSetpoint-1),
-            * If not, reset machinestatecold
-            */
-            switch (machinestatecold) {
-                case 0:
-                    if (temperature >= (brewSetpoint - 1) && temperature < 150) {
-                        machinestatecoldmillis = millis();  // get millis for interval calc
-                        machinestatecold = 10;              // new state
-                        debugPrintln(
-                            "temperature >= (BrewSetpoint-1), wait 10 sec before machineState BelowSetpoint");
-                    }
-                    break;
-
-                case 10:
-                    if (temperature < (brewSetpoint - 1)) {
-                        machinestatecold = 0;  //  temperature was only one time above
-                                               //  BrewSetpoint, reset machinestatecold
-                        debugPrintln("Reset timer for machineState BelowSetpoint: temperature < (BrewSetpoint-1)");
-
-                        break;
-                    }
-
-                    // 10 sec temperature above BrewSetpoint, no set new state
-                    if (machinestatecoldmillis + 10 * 1000 < millis()) {
-                        machineState = kBelowSetpoint;
-                        debugPrintln("5 sec temperature >= (BrewSetpoint-1) finished, switch to state BelowSetpoint");
-                    }
-                    break;
-            }
-
-            if ((timeBrewed > 0 && ONLYPID == 1) ||  // timeBrewed with Only PID
-                (ONLYPID == 0 && brewcounter > kBrewIdle && brewcounter <= kBrewFinished))
-            {
-                machineState = kBrew;
-
-                if (standbyModeOn) {
-                    resetStandbyTimer();
-                } 
-            }
-
-            if (steamON == 1) {
-                machineState = kSteam;
-
-                if (standbyModeOn) {
-                    resetStandbyTimer();
-                } 
-            }
-
-            if (backflushON || backflushState > 10) {
-                machineState = kBackflush;
-
-                if (standbyModeOn) {
-                    resetStandbyTimer();
-                } 
-            }
-
-            if (standbyModeOn && standbyModeRemainingTimeMillis == 0) {
-                machineState = kStandby;
-                pidON = 0;
-            }
-
-            if (pidON == 0 && machineState != kStandby) {
-                machineState = kPidOffline;
-            }
-
-            if (sensorError) {
-                machineState = kSensorError;
-            }
-
-            break;
-
-        // Setpoint is below current temperature
-        case kBelowSetpoint:
-            brewDetection();
-
-            if (temperature >= (brewSetpoint)) {
-                machineState = kPidNormal;
-            }
-
-            if ((timeBrewed > 0 && ONLYPID == 1) ||  // timeBrewed with Only PID
-                (ONLYPID == 0 && brewcounter > kBrewIdle && brewcounter <= kBrewFinished))
-            {
-                machineState = kBrew;
-
-                if (standbyModeOn) {
-                    resetStandbyTimer();
-                } 
-            }
-
-            if (backflushON || backflushState > 10) {
-                machineState = kBackflush;
-
-                if (standbyModeOn) {
-                    resetStandbyTimer();
-                } 
-            }
-
-            if (steamON == 1) {
-                machineState = kSteam;
-
-                if (standbyModeOn) {
-                    resetStandbyTimer();
-                } 
-            }
-
-            if (standbyModeOn && standbyModeRemainingTimeMillis == 0) {
-                machineState = kStandby;
-                pidON = 0;
-            }
-
-            if (pidON == 0 && machineState != kStandby) {
-                machineState = kPidOffline;
-            }
-
-            if (sensorError) {
-                machineState = kSensorError;
-            }
-
-            break;
-
-        case kPidNormal:
-            brewDetection();     // if brew detected, set BD PID values (if enabled)
-
-            if ((timeBrewed > 0 && ONLYPID == 1) ||  // timeBrewed with Only PID
-                (ONLYPID == 0 && brewcounter > kBrewIdle && brewcounter <= kBrewFinished))
-            {
-                machineState = kBrew;
-            }
-
-            if (steamON == 1) {
-                machineState = kSteam;
-
-                if (standbyModeOn) {
-                    resetStandbyTimer();
-                } 
-            }
-
-            if (backflushON || backflushState > 10) {
-                machineState = kBackflush;
-
-                if (standbyModeOn) {
-                    resetStandbyTimer();
-                } 
-            }
-
-            if (emergencyStop) {
-                machineState = kEmergencyStop;
-            }
-             
-            if (standbyModeOn && standbyModeRemainingTimeMillis == 0) {
-                machineState = kStandby;
-                pidON = 0;
-            }
-
-            if (pidON == 0 && machineState != kStandby) {
-                machineState = kPidOffline;
-            }
-
-            if (sensorError) {
-                machineState = kSensorError;
-            }
-            break;
-
-        case kBrew:
-            brewDetection();
-
-            // Output brew time, temp and tempRateAverage during brew (used for SW BD only)
-            if (BREWDETECTION == 1 && logbrew.check()) {
-                debugPrintf("(tB,T,hra) --> %5.2f %6.2f %8.2f\n",
-                            (double)(millis() - startingTime) / 1000, temperature, tempRateAverage);
-            }
-
-            if ((timeBrewed == 0 && brewDetectionMode == 3 && ONLYPID == 1) || // OnlyPID+: Voltage sensor BD timeBrewed == 0 -> switch is off again
-                ((brewcounter == kBrewIdle || brewcounter == kWaitBrewOff) && ONLYPID == 0)) // Hardware BD
-            {
-                // delay shot timer display for voltage sensor or hw brew toggle switch (brew counter)
-                machineState = kShotTimerAfterBrew;
-                lastbrewTimeMillis = millis();  // for delay
-            } else if (brewDetectionMode == 1 && ONLYPID == 1 && isBrewDetected == 0) {   // SW BD, kBrew was active for set time
-                // when Software brew is finished, direct to PID BD
-                machineState = kBrewDetectionTrailing;
-            }
-
-            if (steamON == 1) {
-                machineState = kSteam;
-            }
-
-            if (emergencyStop) {
-                machineState = kEmergencyStop;
-            }
-
-            if (pidON == 0) {
-                machineState = kPidOffline;
-            }
-
-            if (sensorError) {
-                machineState = kSensorError;
-            }
-            break;
-
-        case kShotTimerAfterBrew:
-            brewDetection();
-
-            if (millis() - lastbrewTimeMillis > BREWSWITCHDELAY) {
-                debugPrintf("Shot time: %4.1f s\n", lastbrewTime / 1000);
-                machineState = kBrewDetectionTrailing;
-                lastbrewTime = 0;
-            }
-
-            if (steamON == 1) {
-                machineState = kSteam;
-            }
-
-            if (backflushON || backflushState > 10) {
-                machineState = kBackflush;
-            }
-
-            if (emergencyStop) {
-                machineState = kEmergencyStop;
-            }
-
-            if (pidON == 0) {
-                machineState = kPidOffline;
-            }
-
-            if (sensorError) {
-                machineState = kSensorError;
-            }
-            break;
-
-        case kBrewDetectionTrailing:
-            brewDetection();
-
-            if (isBrewDetected == 0) {
-                machineState = kPidNormal;
-            }
-
-            if ((timeBrewed > 0 && ONLYPID == 1 && brewDetectionMode == 3) ||  // Allow brew directly after BD only when using OnlyPID AND hardware brew switch detection
-                (ONLYPID == 0 && brewcounter > kBrewIdle && brewcounter <= kBrewFinished))
-            {
-                machineState = kBrew;
-            }
-
-            if (steamON == 1) {
-                machineState = kSteam;
-            }
-
-            if (backflushON || backflushState > 10) {
-                machineState = kBackflush;
-            }
-
-            if (emergencyStop) {
-                machineState = kEmergencyStop;
-            }
-
-            if (pidON == 0) {
-                machineState = kPidOffline;
-            }
-
-            if (sensorError) {
-                machineState = kSensorError;
-            }
-            break;
-
-        case kSteam:
-            if (steamON == 0) {
-                machineState = kCoolDown;
-            }
-
-            if (emergencyStop) {
-                machineState = kEmergencyStop;
-            }
-
-            if (backflushON || backflushState > 10) {
-                machineState = kBackflush;
-            }
-
-            if (pidON == 0) {
-                machineState = kPidOffline;
-            }
-
-            if (sensorError) {
-                machineState = kSensorError;
-            }
-            break;
-
-        case kCoolDown:
-            if (brewDetectionMode == 2 || brewDetectionMode == 3) {
-                /* For quickmill: steam detection only via switch, calling
-                 * brewDetection() detects new steam request
-                 */
-                brewDetection();
-            }
-
-            if (brewDetectionMode == 1 && ONLYPID == 1) {
-                // if machine cooled down to 2°C above setpoint, enabled PID again
-                if (tempRateAverage > 0 && temperature < brewSetpoint + 2) {
-                    machineState = kPidNormal;
-                }
-            }
-
-            if ((brewDetectionMode == 3 || brewDetectionMode == 2) && temperature < brewSetpoint + 2) {
-                machineState = kPidNormal;
-            }
-
-            if (steamON == 1) {
-                machineState = kSteam;
-            }
-
-            if (backflushON || backflushState > 10) {
-                machineState = kBackflush;
-            }
-
-            if (emergencyStop) {
-                machineState = kEmergencyStop;
-            }
-
-            if (pidON == 0) {
-                machineState = kPidOffline;
-            }
-
-            if (sensorError) {
-                machineState = kSensorError;
-            }
-            break;
-
-        case kBackflush:
-            if (backflushON == 0) {
-                machineState = kPidNormal;
-            }
-
-            if (emergencyStop) {
-                machineState = kEmergencyStop;
-            }
-
-            if (pidON == 0) {
-                machineState = kPidOffline;
-            }
-
-            if (sensorError) {
-                machineState = kSensorError;
-            }
-            break;
-
-        case kEmergencyStop:
-            if (!emergencyStop) {
-                machineState = kPidNormal;
-            }
-
-            if (pidON == 0) {
-                machineState = kPidOffline;
-            }
-
-            if (sensorError) {
-                machineState = kSensorError;
-            }
-            break;
-
-        case kPidOffline:
-            if (pidON == 1) {
-                if (coldstart) {
-                    machineState = kColdStart;
-                } else if (!coldstart && (temperature > (brewSetpoint - 10))) {  // temperature higher BrewSetpoint-10, normal PID
-                    machineState = kPidNormal;
-                } else if (temperature <= (brewSetpoint - 10)) {
-                    machineState = kColdStart;  // temperature 10C below set point, enter cold start
-                    coldstart = true;
-                }
-            }
-
-            if (sensorError) {
-                machineState = kSensorError;
-            }
-            break;
-        
-        case kStandby:
-            brewDetection();
-            
-            if (pidON || steamON || isBrewDetected) {
-                pidON = 1;
-                resetStandbyTimer();
-
-                if (steamON) {
-                    machineState = kSteam;
-                } else if (isBrewDetected) {
-                    machineState = kBrew;
-                } else {
-                    machineState = kPidNormal;
-                }
-            }
-             
-            if (sensorError) {
-                machineState = kSensorError;
-            }
-            break;
-
-        case kSensorError:
-            machineState = kSensorError;
-            break;
-
-        case kEepromError:
-            machineState = kEepromError;
-            break;
-    }
-
-    if (machineState != lastmachinestate) {
-        printMachineState();
-        lastmachinestate = machineState;
-    }
-}
-
-void printMachineState() {
-    debugPrintf("new machineState: %s -> %s\n",
-                machinestateEnumToString(lastmachinestate), machinestateEnumToString(machineState));
-}
-
-char const* machinestateEnumToString(MachineState machineState) {
-    switch (machineState) {
-        case kInit:
-            return "Init";
-        case kColdStart:
-            return "Cold Start";
-        case kBelowSetpoint:
-            return "Set Point Negative";
-        case kPidNormal:
-            return "PID Normal";
-        case kBrew:
-            return "Brew";
-        case kShotTimerAfterBrew:
-            return "Shot Timer After Brew";
-        case kBrewDetectionTrailing:
-            return "Brew Detection Trailing";
-        case kSteam:
-            return "Steam";
-        case kCoolDown:
-            return "Cool Down";
-        case kBackflush:
-            return "Backflush";
-        case kEmergencyStop:
-            return "Emergency Stop";
-        case kPidOffline:
-            return "PID Offline";
-        case kStandby:
-            return "Standby Mode";
-        case kSensorError:
-            return "Sensor Error";
-        case kEepromError:
-            return "EEPROM Error";
-    }
-
-    return "Unknown";
-}
-
-
-void debugVerboseOutput() {
-    static PeriodicTrigger trigger(10000);
-
-    if (trigger.check()) {
-        debugPrintf(
-            "Tsoll=%5.1f  Tist=%5.1f Machinestate=%2i KP=%4.2f "
-            "KI=%4.2f KD=%4.2f\n",
-            setpoint, temperature, machineState, bPID.GetKp(), bPID.GetKi(), bPID.GetKd());
-    }
-}
-
-
-/**
- * @brief Set up internal WiFi hardware
+ * @brief Set up internal WiFi hardware
  */
 void wiFiSetup() {
     wm.setCleanConnect(true);
@@ -1438,7 +960,7 @@ void wiFiSetup() {
         const char hostname[] = (STR(HOSTNAME));
         debugPrintf("Connect to WiFi: %s \n", String(hostname));
         #if OLED_DISPLAY != 0
-            displayLogo("Connect to WiFi: ", HOSTNAME);
+            displayBootMessage("Connect to WiFi: ", HOSTNAME);
         #endif
     }
 
@@ -1447,7 +969,7 @@ void wiFiSetup() {
     if (wm.autoConnect(hostname, pass)) {
         wifiCredentialsSaved = 1;
         sysParaWifiCredentialsSaved.setStorage();
-        storageCommit();
+        storageFlush();
         debugPrintf("WiFi connected - IP = %i.%i.%i.%i\n", WiFi.localIP()[0],
                     WiFi.localIP()[1], WiFi.localIP()[2], WiFi.localIP()[3]);
         byte mac[6];
@@ -1465,715 +987,151 @@ void wiFiSetup() {
         debugPrintln("WiFi connection timed out...");
 
         #if OLED_DISPLAY != 0
-            displayLogo(langstring_nowifi[0], langstring_nowifi[1]);
-        #endif
-
-        wm.disconnect();
-        delay(1000);
-
-        offlineMode = 1;
-    }
-
-    #if OLED_DISPLAY != 0
-        displayLogo(langstring_connectwifi1, wm.getWiFiSSID(true));
-    #endif
-
-    startRemoteSerialServer();
-}
-
-
-/**
- * @brief Set up embedded Website
- */
-void websiteSetup() {
-    setEepromWriteFcn(writeSysParamsToStorage);
-
-    readSysParamsFromStorage();
-
-    /*if (readSysParamsFromStorage() != 0) {
-        #if OLED_DISPLAY != 0
-            displayLogo("3:", "use eeprom values..");
-        #endif
-    } else {
-        #if OLED_DISPLAY != 0
-            displayLogo("3:", "config defaults..");
+            displayBootMessage(langstring_nowifi[0], langstring_nowifi[1]);
         #endif
-    }*/
-
-    serverSetup();
-}
-
-const char sysVersion[] = (STR(FW_VERSION) "." STR(FW_SUBVERSION) "." STR(FW_HOTFIX) " " FW_BRANCH " " AUTO_VERSION);
-
-void setup() {
-    editableVars["PID_ON"] = {
-        .displayName = "Enable PID Controller",
-        .hasHelpText = false,
-        .helpText = "",
-        .type = kUInt8,
-        .section = sPIDSection,
-        .position = 1,
-        .show = [] { return true; },
-        .minValue = 0,
-        .maxValue = 1,
-        .ptr = (void*)&pidON
-    };
-
-    editableVars["START_USE_PONM"] = {
-        .displayName = F("Enable PonM"),
-        .hasHelpText = true,
-        .helpText =
-            F("Use PonM mode (<a href='http://brettbeauregard.com/blog/2017/06/"
-              "introducing-proportional-on-measurement/' "
-              "target='_blank'>details</a>) while heating up the machine. "
-              "Otherwise, just use the same PID values that are used later"),
-        .type = kUInt8,
-        .section = sPIDSection,
-        .position = 2,
-        .show = [] { return true; },
-        .minValue = 0,
-        .maxValue = 1,
-        .ptr = (void*)&usePonM
-    };
-
-    editableVars["START_KP"] = {
-        .displayName = F("Start Kp"),
-        .hasHelpText = true,
-        .helpText = F(
-            "Proportional gain for cold start controller. This value is not "
-            "used with the the error as usual but the absolute value of the "
-            "temperature and counteracts the integral part as the temperature "
-            "rises. Ideally, both parameters are set so that they balance each "
-            "other out when the target temperature is reached."),
-        .type = kDouble,
-        .section = sPIDSection,
-        .position = 3,
-        .show = [] { return true && usePonM; },
-        .minValue = PID_KP_START_MIN,
-        .maxValue = PID_KP_START_MAX,
-        .ptr = (void*)&startKp
-    };
-
-    editableVars["START_TN"] = {
-        .displayName = F("Start Tn"),
-        .hasHelpText = true,
-        .helpText = F("Integral gain for cold start controller (PonM mode, <a "
-                      "href='http://brettbeauregard.com/blog/2017/06/"
-                      "introducing-proportional-on-measurement/' target='_blank'>details</a>)"),
-        .type = kDouble,
-        .section = sPIDSection,
-        .position = 4,
-        .show = [] { return true && usePonM; },
-        .minValue = PID_TN_START_MIN,
-        .maxValue = PID_TN_START_MAX,
-        .ptr = (void*)&startTn
-    };
-
-    editableVars["PID_KP"] = {
-        .displayName = F("PID Kp"),
-        .hasHelpText = true,
-        .helpText =
-            F("Proportional gain (in Watts/C°) for the main PID controller (in "
-              "P-Tn-Tv form, <a href='http://testcon.info/EN_BspPID-Regler.html#strukturen' "
-              "target='_blank'>Details<a>). The higher this value is, the "
-              "higher is the output of the heater for a given temperature "
-              "difference. E.g. 5°C difference will result in P*5 Watts of heater output."),
-        .type = kDouble,
-        .section = sPIDSection,
-        .position = 5,
-        .show = [] { return true; },
-        .minValue = PID_KP_REGULAR_MIN,
-        .maxValue = PID_KP_REGULAR_MAX,
-        .ptr = (void*)&aggKp
-    };
-
-    editableVars["PID_TN"] = {
-        .displayName = F("PID Tn (=Kp/Ki)"),
-        .hasHelpText = true,
-        .helpText =
-            F("Integral time constant (in seconds) for the main PID controller "
-              "(in P-Tn-Tv form, <a href='http://testcon.info/EN_BspPID-Regler.html#strukturen' "
-              "target='_blank'>Details<a>). The larger this value is, the slower the "
-              "integral part of the PID will increase (or decrease) if the "
-              "process value remains above (or below) the setpoint in spite of "
-              "proportional action. The smaller this value, the faster the integral term changes."),
-        .type = kDouble,
-        .section = sPIDSection,
-        .position = 6,
-        .show = [] { return true; },
-        .minValue = PID_TN_REGULAR_MIN,
-        .maxValue = PID_TN_REGULAR_MAX,
-        .ptr = (void*)&aggTn
-    };
-
-    editableVars["PID_TV"] = {
-        .displayName = F("PID Tv (=Kd/Kp)"),
-        .hasHelpText = true,
-        .helpText = F(
-            "Differential time constant (in seconds) for the main PID controller (in P-Tn-Tv form, <a "
-            "href='http://testcon.info/EN_BspPID-Regler.html#strukturen' target='_blank'>Details<a>). "
-            "This value determines how far the PID equation projects the current trend into the future. "
-            "The higher the value, the greater the dampening. Select it carefully, it can cause oscillations "
-            "if it is set too high or too low."),
-        .type = kDouble,
-        .section = sPIDSection,
-        .position = 7,
-        .show = [] { return true; },
-        .minValue = PID_TV_REGULAR_MIN,
-        .maxValue = PID_TV_REGULAR_MAX,
-        .ptr = (void *)&aggTv
-    };
-
-    editableVars["PID_I_MAX"] = {
-        .displayName = F("PID Integrator Max"),
-        .hasHelpText = true,
-        .helpText = F(
-            "Internal integrator limit to prevent windup (in Watts). This will allow the integrator to only grow to "
-            "the specified value. This should be approximally equal to the output needed to hold the temperature after the "
-            "setpoint has been reached and is depending on machine type and whether the boiler is insulated or not."),
-        .type = kDouble,
-        .section = sPIDSection,
-        .position = 8,
-        .show = [] { return true; },
-        .minValue = PID_I_MAX_REGULAR_MIN,
-        .maxValue = PID_I_MAX_REGULAR_MAX,
-        .ptr = (void *)&aggIMax
-    };
-
-    editableVars["STEAM_KP"] = {
-        .displayName = F("Steam Kp"),
-        .hasHelpText = true,
-        .helpText = F("Proportional gain for the steaming mode (I or D are not used)"),
-        .type = kDouble,
-        .section = sPIDSection,
-        .position = 9,
-        .show = [] { return true; },
-        .minValue = PID_KP_STEAM_MIN,
-        .maxValue = PID_KP_STEAM_MAX,
-        .ptr = (void *)&steamKp
-    };
-
-    editableVars["TEMP"] = {
-        .displayName = F("Temperature"),
-        .hasHelpText = false,
-        .helpText = "",
-        .type = kDouble,
-        .section = sPIDSection,
-        .position = 10,
-        .show = [] { return false; },
-        .minValue = 0,
-        .maxValue = 200,
-        .ptr = (void*)&temperature
-    };
-
-    editableVars["BREW_SETPOINT"] = {
-        .displayName = F("Set point (°C)"),
-        .hasHelpText = true,
-        .helpText =
-            F("The temperature that the PID will attempt to reach and hold"),
-        .type = kDouble,
-        .section = sTempSection,
-        .position = 11,
-        .show = [] { return true; },
-        .minValue = BREW_SETPOINT_MIN,
-        .maxValue = BREW_SETPOINT_MAX,
-        .ptr = (void*)&brewSetpoint
-    };
-
-    editableVars["BREW_TEMP_OFFSET"] = {
-        .displayName = F("Offset (°C)"),
-        .hasHelpText = true,
-        .helpText = F("Optional offset that is added to the user-visible "
-                      "setpoint. Can be used to compensate sensor offsets and "
-                      "the average temperature loss between boiler and group "
-                      "so that the setpoint represents the approximate brew temperature."),
-        .type = kDouble,
-        .section = sTempSection,
-        .position = 12,
-        .show = [] { return true; },
-        .minValue = BREW_TEMP_OFFSET_MIN,
-        .maxValue = BREW_TEMP_OFFSET_MAX,
-        .ptr = (void*)&brewTempOffset
-    };
-
-    editableVars["STEAM_SETPOINT"] = {
-        .displayName = F("Steam Set point (°C)"),
-        .hasHelpText = true,
-        .helpText = F("The temperature that the PID will use for steam mode"),
-        .type = kDouble,
-        .section = sTempSection,
-        .position = 13,
-        .show = [] { return true; },
-        .minValue = STEAM_SETPOINT_MIN,
-        .maxValue = STEAM_SETPOINT_MAX,
-        .ptr = (void*)&steamSetpoint
-    };
-
-    editableVars["BREW_TIME"] = {
-        .displayName = F("Brew Time (s)"),
-        .hasHelpText = true,
-        .helpText = F("Stop brew after this time"),
-        .type = kDouble,
-        .section = sTempSection,
-        .position = 14,
-        .show = [] { return true && ONLYPID == 0; },
-        .minValue = BREW_TIME_MIN,
-        .maxValue = BREW_TIME_MAX,
-        .ptr = (void *)&brewtime
-    };
-
-    editableVars["BREW_PREINFUSIONPAUSE"] = {
-        .displayName = F("Preinfusion Pause Time (s)"),
-        .hasHelpText = false,
-        .helpText = "",
-        .type = kDouble,
-        .section = sTempSection,
-        .position = 15,
-        .show = [] { return true && ONLYPID == 0; },
-        .minValue = PRE_INFUSION_PAUSE_MIN,
-        .maxValue = PRE_INFUSION_PAUSE_MAX,
-        .ptr = (void *)&preinfusionpause
-    };
-
-    editableVars["BREW_PREINFUSION"] = {
-        .displayName = F("Preinfusion Time (s)"),
-        .hasHelpText = false,
-        .helpText = "",
-        .type = kDouble,
-        .section = sTempSection,
-        .position = 16,
-        .show = [] { return true && ONLYPID == 0; },
-        .minValue = PRE_INFUSION_TIME_MIN,
-        .maxValue = PRE_INFUSION_TIME_MAX,
-        .ptr = (void *)&preinfusion
-    };
-
-    editableVars["SCALE_WEIGHTSETPOINT"] = {
-        .displayName = F("Brew weight setpoint (g)"),
-        .hasHelpText = true,
-        .helpText = F("Brew until this weight has been measured."),
-        .type = kDouble,
-        .section = sTempSection,
-        .position = 17,
-        .show = [] { return true && (ONLYPIDSCALE == 1 || BREWMODE == 2); },
-        .minValue = WEIGHTSETPOINT_MIN,
-        .maxValue = WEIGHTSETPOINT_MAX,
-        .ptr = (void *)&weightSetpoint
-    };
-
-    editableVars["PID_BD_DELAY"] = {
-        .displayName = F("Brew PID Delay (s)"),
-        .hasHelpText = true,
-        .helpText = F("Delay time in seconds during which the PID will be "
-                      "disabled once a brew is detected. This prevents too "
-                      "high brew temperatures with boiler machines like Rancilio "
-                      "Silvia. Set to 0 for thermoblock machines."),
-        .type = kDouble,
-        .section = sBDSection,
-        .position = 18,
-        .show =
-            [] { return true; },
-        .minValue = BREW_PID_DELAY_MIN,
-        .maxValue = BREW_PID_DELAY_MAX,
-        .ptr = (void *)&brewPIDDelay
-    };
-
-    editableVars["PID_BD_ON"] = {
-        .displayName = F("Enable Brew PID"),
-        .hasHelpText = true,
-        .helpText = F("Use separate PID parameters while brew is running"),
-        .type = kUInt8,
-        .section = sBDSection,
-        .position = 19,
-        .show = [] { return true && BREWDETECTION > 0; },
-        .minValue = 0,
-        .maxValue = 1,
-        .ptr = (void *)&useBDPID
-    };
-
-    editableVars["PID_BD_KP"] = {
-        .displayName = F("BD Kp"),
-        .hasHelpText = true,
-        .helpText = F(
-            "Proportional gain (in Watts/°C) for the PID when brewing has been "
-            "detected. Use this controller to either increase heating during the "
-            "brew to counter temperature drop from fresh cold water in the boiler. "
-            "Some machines, e.g. Rancilio Silvia, actually need to heat less or not "
-            "at all during the brew because of high temperature stability "
-            "(<a href='https://www.kaffee-netz.de/threads/"
-            "installation-eines-temperatursensors-in-silvia-bruehgruppe.111093/"
-            "#post-1453641' target='_blank'>Details<a>)"),
-        .type = kDouble,
-        .section = sBDSection,
-        .position = 20,
-        .show = [] { return true && BREWDETECTION > 0 && useBDPID; },
-        .minValue = PID_KP_BD_MIN,
-        .maxValue = PID_KP_BD_MAX,
-        .ptr = (void *)&aggbKp
-    };
-
-    editableVars["PID_BD_TN"] = {
-        .displayName = F("BD Tn (=Kp/Ki)"),
-        .hasHelpText = true,
-        .helpText = F("Integral time constant (in seconds) for the PID when "
-                      "brewing has been detected."),
-        .type = kDouble,
-        .section = sBDSection,
-        .position = 21,
-        .show = [] { return true && BREWDETECTION > 0 && useBDPID; },
-        .minValue = PID_TN_BD_MIN,
-        .maxValue = PID_TN_BD_MAX,
-        .ptr = (void *)&aggbTn
-    };
-
-    editableVars["PID_BD_TV"] = {
-        .displayName = F("BD Tv (=Kd/Kp)"),
-        .hasHelpText = true,
-        .helpText = F("Differential time constant (in seconds) for the PID "
-                      "when brewing has been detected."),
-        .type = kDouble,
-        .section = sBDSection,
-        .position = 22,
-        .show = [] { return true && BREWDETECTION > 0 && useBDPID; },
-        .minValue = PID_TV_BD_MIN,
-        .maxValue = PID_TV_BD_MAX,
-        .ptr = (void *)&aggbTv
-    };
-
-    editableVars["PID_BD_TIME"] = {
-        .displayName = F("PID BD Time (s)"),
-        .hasHelpText = true,
-        .helpText = F("Fixed time in seconds for which the BD PID will stay "
-                      "enabled (also after Brew switch is inactive again)."),
-        .type = kDouble,
-        .section = sBDSection,
-        .position = 23,
-        .show =
-            [] {
-              return true && BREWDETECTION > 0 &&
-                     (useBDPID || BREWDETECTION == 1);
-            },
-        .minValue = BREW_SW_TIME_MIN,
-        .maxValue = BREW_SW_TIME_MAX,
-        .ptr = (void *)&brewtimesoftware
-    };
-
-    editableVars["PID_BD_SENSITIVITY"] = {
-        .displayName = F("PID BD Sensitivity"),
-        .hasHelpText = true,
-        .helpText = F("Software brew detection sensitivity that looks at "
-                      "average temperature, <a href='https://manual.rancilio-pid.de/de/customization/"
-                      "brueherkennung.html' target='_blank'>Details</a>. "
-                      "Needs to be &gt;0 also for Hardware switch detection."),
-        .type = kDouble,
-        .section = sBDSection,
-        .position = 24,
-        .show = [] { return true && BREWDETECTION == 1; },
-        .minValue = BD_THRESHOLD_MIN,
-        .maxValue = BD_THRESHOLD_MAX,
-        .ptr = (void *)&brewSensitivity
-    };
-
-    editableVars["STEAM_MODE"] = {
-        .displayName = F("Steam Mode"),
-        .hasHelpText = false,
-        .helpText = "",
-        .type = kUInt8,
-        .section = sOtherSection,
-        .position = 25,
-        .show = [] { return false; },
-        .minValue = 0,
-        .maxValue = 1,
-        .ptr = (void *)&steamON
-    };
-
-    editableVars["BACKFLUSH_ON"] = {
-        .displayName = F("Backflush"),
-        .hasHelpText = false,
-        .helpText = "",
-        .type = kUInt8,
-        .section = sOtherSection,
-        .position = 26,
-        .show = [] { return false; },
-        .minValue = 0,
-        .maxValue = 1,
-        .ptr = (void *)&backflushON
-    };
-
-    editableVars["STANDBY_MODE_ON"] = {
-        .displayName = F("Enable Standby Timer"),
-        .hasHelpText = true,
-        .helpText = F("Turn heater off after standby time has elapsed."),
-        .type = kUInt8,
-        .section = sPowerSection,
-        .position = 27,
-        .show = [] { return true; },
-        .minValue = 0,
-        .maxValue = 1,
-        .ptr = (void *)&standbyModeOn
-    };
-
-    editableVars["STANDBY_MODE_TIMER"] = {
-        .displayName = F("Standby Time"),
-        .hasHelpText = true,
-        .helpText = F(
-            "Time in minutes until the heater is turned off. Timer is reset by brew detection."),
-        .type = kDouble,
-        .section = sPowerSection,
-        .position = 28,
-        .show = [] { return true; },
-        .minValue = STANDBY_MODE_TIME_MIN,
-        .maxValue = STANDBY_MODE_TIME_MAX,
-        .ptr = (void *)&standbyModeTime
-    };
-
-    editableVars["VERSION"] = {
-        .displayName = F("Version"),
-        .hasHelpText = false,
-        .helpText = "",
-        .type = kCString,
-        .section = sOtherSection,
-        .position = 29,
-        .show = [] { return false; },
-        .minValue = 0,
-        .maxValue = 1,
-        .ptr = (void *)sysVersion
-    };
-    // when adding parameters, set EDITABLE_VARS_LEN to max of .position
-
-    // Editable values reported to MQTT
-    mqttVars["pidON"] = []{ return &editableVars.at("PID_ON"); };
-    mqttVars["brewSetpoint"] = []{ return &editableVars.at("BREW_SETPOINT"); };
-    mqttVars["brewTempOffset"] = []{ return &editableVars.at("BREW_TEMP_OFFSET"); };
-    mqttVars["steamON"] = []{ return &editableVars.at("STEAM_MODE"); };
-    mqttVars["steamSetpoint"] = []{ return &editableVars.at("STEAM_SETPOINT"); };
-    mqttVars["brewPidDelay"] = []{ return &editableVars.at("PID_BD_DELAY"); };
-    mqttVars["backflushON"] = []{ return &editableVars.at("BACKFLUSH_ON"); };
-    mqttVars["startUsePonM"] = []{ return &editableVars.at("START_USE_PONM"); };
-    mqttVars["startKp"] = []{ return &editableVars.at("START_KP"); };
-    mqttVars["startTn"] = []{ return &editableVars.at("START_TN"); };
-    mqttVars["aggKp"] = []{ return &editableVars.at("PID_KP"); };
-    mqttVars["aggTn"] = []{ return &editableVars.at("PID_TN"); };
-    mqttVars["aggTv"] = []{ return &editableVars.at("PID_TV"); };
-    mqttVars["aggIMax"] = []{ return &editableVars.at("PID_I_MAX"); };
-    mqttVars["steamKp"] = []{ return &editableVars.at("STEAM_KP"); };
-    mqttVars["standbyModeOn"] = []{ return &editableVars.at("STANDBY_MODE_ON"); };
-
-    if (ONLYPID == 0) {
-        mqttVars["brewtime"] = []{ return &editableVars.at("BREW_TIME"); };
-        mqttVars["preinfusionpause"] = []{ return &editableVars.at("BREW_PREINFUSIONPAUSE"); };
-        mqttVars["preinfusion"] = []{ return &editableVars.at("BREW_PREINFUSION"); };
-    }
 
-    if (ONLYPIDSCALE == 1 || BREWMODE == 2) {
-        mqttVars["weightSetpoint"] = []{ return &editableVars.at("SCALE_WEIGHTSETPOINT"); };
+        wm.disconnect();
+        delay(1000);
+
+        offlineMode = 1;
     }
 
-    if (BREWDETECTION > 0) {
-        mqttVars["pidUseBD"] = []{ return &editableVars.at("PID_BD_ON"); };
-        mqttVars["aggbKp"] = []{ return &editableVars.at("PID_BD_KP"); };
-        mqttVars["aggbTn"] = []{ return &editableVars.at("PID_BD_TN"); };
-        mqttVars["aggbTv"] = []{ return &editableVars.at("PID_BD_TV"); };
+    #if OLED_DISPLAY != 0
+        displayBootMessage(langstring_connectwifi1, wm.getWiFiSSID(true));
+    #endif
 
-        if (BREWDETECTION == 1) {
-            mqttVars["brewTimer"] = []{ return &editableVars.at("PID_BD_TIME"); };
-            mqttVars["brewLimit"] = []{ return &editableVars.at("PID_BD_SENSITIVITY"); };
-        }
-    }
-    
-    // Values reported to MQTT
-    mqttSensors["temperature"] = []{ return temperature; };
-    mqttSensors["heaterPower"] = []{ return pidOutput; };
-    mqttSensors["standbyModeTimeRemaining"] = []{ return standbyModeRemainingTimeMillis / 1000; };
-    mqttSensors["currentKp"] = []{ return bPID.GetKp(); };
-    mqttSensors["currentKi"] = []{ return bPID.GetKi(); };
-    mqttSensors["currentKd"] = []{ return bPID.GetKd(); };
+    startRemoteSerialServer();
+}
+
+
+/**
+ * @brief Set up embedded Website
+ */
+void websiteSetup() {
+    setEepromWriteFcn(writeSysParamsToStorage);
+
+    serverSetup();
+}
+
+void setup() {
+    // Values reported to MQTT with the change needed before they are published again
+    mqttSensors["temperature"] = {[]{ return controlState.temperature; }, 0.1};
+    mqttSensors["heaterPower"] = {[]{ return controlState.pidOutput; }, 10};
+    mqttSensors["standbyModeTimeRemaining"] = {[]{ return (double)(standbyModeRemainingTimeMillis / 1000); }, 30};
+    mqttSensors["currentKp"] = {[]{ return controlState.kp; }, 0.01};
+    mqttSensors["currentKi"] = {[]{ return controlState.ki; }, 0.01};
+    mqttSensors["currentKd"] = {[]{ return controlState.kd; }, 0.01};
+    mqttSensors["autotuneState"] = {[]{ return (double)controlState.autotuneState; }, 0.5};
+    mqttSensors["autotuneKp"] = {[]{ return controlState.autotuneState == PidAutotune::kDone ? autotune.getTunings().kp : 0; }, 0.1};
+    mqttSensors["autotuneTn"] = {[]{ return controlState.autotuneState == PidAutotune::kDone ? autotune.getTunings().tn : 0; }, 0.1};
+    mqttSensors["autotuneTv"] = {[]{ return controlState.autotuneState == PidAutotune::kDone ? autotune.getTunings().tv : 0; }, 0.1};
+
+    #if PRESSURESENSOR == 1
+        mqttSensors["pressure"] = {[]{ return (double)controlState.pressure; }, 0.1};
+    #endif
+
+    mqttSensors["freeHeap"] = {[]{ return (double)heapGetStats().freeHeap; }, 1024};
+    mqttSensors["largestFreeBlock"] = {[]{ return (double)heapGetStats().largestFreeBlock; }, 1024};
+    mqttSensors["minFreeHeap"] = {[]{ return (double)heapGetStats().minFreeHeap; }, 1024};
+    mqttSensors["heapFragmentation"] = {[]{ return (double)heapGetStats().fragmentation; }, 5};
+
+    #if MQTT_LOOP_METRICS == 1
+        mqttSensors["controlLoopTimeAvg"] = {[]{ return (double)controlScheduler.getPassRuntime().getAvg(); }, 50};
+        mqttSensors["controlLoopTimeP99"] = {[]{ return (double)controlScheduler.getPassRuntime().getPercentile(0.99); }, 50};
+        mqttSensors["controlLoopTimeMax"] = {[]{ return (double)controlScheduler.getPassRuntime().getMax(); }, 50};
+        mqttSensors["telemetryLoopTimeMax"] = {[]{ return (double)telemetryScheduler.getPassRuntime().getMax(); }, 50};
+    #endif
 
     Serial.begin(115200);
+    logSetup();
 
     initTimer1();
 
     storageSetup();
 
-    // Define trigger type
-    if (triggerType) {
-        relayON = HIGH;
-        relayOFF = LOW;
-    } else {
-        relayON = LOW;
-        relayOFF = HIGH;
-    }
-
-    if (VOLTAGESENSORTYPE) {
-        VoltageSensorON = HIGH;
-        VoltageSensorOFF = LOW;
-    } else {
-        VoltageSensorON = LOW;
-        VoltageSensorOFF = HIGH;
-    }
-
-    // Initialize Pins
-    pinMode(PIN_VALVE, OUTPUT);
-    pinMode(PIN_PUMP, OUTPUT);
-    pinMode(PIN_HEATER, OUTPUT);
-    pinMode(PIN_STEAMSWITCH, INPUT);
-    digitalWrite(PIN_VALVE, relayOFF);
-    digitalWrite(PIN_PUMP, relayOFF);
-    digitalWrite(PIN_HEATER, LOW);
-
-    // IF POWERSWITCH is connected
-    if (POWERSWITCHTYPE > 0) {
-        pinMode(PIN_POWERSWITCH, INPUT);
+    if (readSysParamsFromStorage() != 0) {
+        debugPrintln("No working eeprom value, I am sorry, but use default offline value :)");
     }
 
-    // IF Voltage sensor selected
-    if (BREWDETECTION == 3) {
-        pinMode(PIN_BREWSWITCH, PINMODEVOLTAGESENSOR);
-    }
-    else {
-        pinMode(PIN_BREWSWITCH, INPUT_PULLDOWN);
+    if (connectmode == 0) {
+        wm.disconnect();              // no wm
+        offlineMode = 1;              // offline mode
+        pidON = 1;                    // pid on
     }
 
-    if (TEMP_LED) {
-        pinMode(PIN_STATUSLED, OUTPUT);
-    }
+    bootPhaseDone(kBootSettings);
 
-    pinMode(PIN_STEAMSWITCH, INPUT_PULLDOWN);
+    // relays, switches, PID and the first temperature reading
+    controlSetup(tempSensor);
 
     #if OLED_DISPLAY != 0
         u8g2.setI2CAddress(oled_i2c * 2);
         u8g2.begin();
         u8g2_prepare();
-        displayLogo(String("Version "), String(sysVersion));
-        delay(2000); // caused crash with wifi manager on esp8266, should be ok on esp32
+        displayBootMessage(String("Version "), String(sysVersion));
     #endif
 
-    // Init Scale by BREWMODE 2 or SHOTTIMER 2
+    // Init Scale by BREWMODE 2 or SHOTTIMER 2, the scale task tares in the background
     #if (BREWMODE == 2 || ONLYPIDSCALE == 1)
         initScale();
     #endif
 
-
-    // Fallback offline
-    if (connectmode == 1) {  // WiFi Mode
-        wiFiSetup();
-        websiteSetup();
-
-        // OTA Updates
-        if (ota && WiFi.status() == WL_CONNECTED) {
-            ArduinoOTA.setHostname(OTAhost);  //  Device name for OTA
-            ArduinoOTA.setPassword(OTApass);  //  Password for OTA
-            ArduinoOTA.begin();
-        }
-
-        if (MQTT == 1) {
-            snprintf(topic_will, sizeof(topic_will), "%s%s/%s", mqtt_topic_prefix, hostname, "status");
-            snprintf(topic_set, sizeof(topic_set), "%s%s/+/%s", mqtt_topic_prefix, hostname, "set");
-            mqtt.setServer(mqtt_server_ip, mqtt_server_port);
-            mqtt.setCallback(mqtt_callback);
-            checkMQTT();
-            #if MQTT_HASSIO_SUPPORT == 1
-            // Send Home Assistant MQTT discovery messages
-            sendHASSIODiscoveryMsg();
-            #endif
-        }
-
-        if (INFLUXDB == 1) {
-           influxDbSetup();
+    #if (PRESSURESENSOR == 1)
+        if (pressureSetup(PIN_PRESSURESENSOR, MAXPRESSURE) != 0) {
+            debugPrintln("Pressure sensor: ADC setup failed");
         }
-    } else if (connectmode == 0) {
-        wm.disconnect();              // no wm
-        readSysParamsFromStorage();   // get values from stroage
-        offlineMode = 1;              // offline mode
-        pidON = 1;                    // pid on
-    }
-
-    // Initialize PID controller
-    bPID.SetSampleTime(windowSize);
-    bPID.SetOutputLimits(0, windowSize);
-    bPID.SetIntegratorLimits(0, AGGIMAX);
-    bPID.SetSmoothingFactor(EMA_FACTOR);
-    bPID.SetMode(AUTOMATIC);
-
-    // Dallas temp sensor
-    #if TEMPSENSOR == 1
-        sensors.begin();
-        sensors.getAddress(sensorDeviceAddress, 0);
-        sensors.setResolution(sensorDeviceAddress, 10);
-        sensors.requestTemperatures();
-        temperature = sensors.getTempCByIndex(0);
-    #endif
-
-    // TSic 306 temp sensor
-    #if TEMPSENSOR == 2
-        temperature = Sensor2.getTemp();
     #endif
 
-    temperature -= brewTempOffset;
-
-    // Initialisation MUST be at the very end of the init(), otherwise the
-    // time comparision in loop() will have a big offset
+    // Initialisation MUST be right before the jobs start, otherwise the
+    // time comparisions in the jobs will have a big offset
     unsigned long currentTime = millis();
-    previousMillistemp = currentTime;
     windowStartTime = currentTime;
-    previousMillisDisplay = currentTime;
-    previousMillisMQTT = currentTime;
-    previousMillisInflux = currentTime;
     previousMillisVoltagesensorreading = currentTime;
-    lastMQTTConnectionAttempt = currentTime;
 
-    #if (BREWMODE == 2)
-        previousMillisScale = currentTime;
-    #endif
-    #if (PRESSURESENSOR == 1)
-        previousMillisPressure = currentTime;
-    #endif
+    shotRecorder.begin();
 
-    setupDone = true;
+    schedulerSetup();   // job timers start from here
 
+    // Heat first, the network setup below can take a minute without WiFi
     enableTimer1();
+    startControlTask();
+    bootPhaseDone(kBootControl);
 
     Serial.println("Filesystem overview:");
     Serial.printf("- Bytes total: ld\n", LittleFS.totalBytes());
     Serial.printf("- Bytes used: %ld\n\n", LittleFS.usedBytes());
-}
 
+    // display, history and storage run while WiFi connects, the network jobs wait for networkReady
+    startTelemetryTask();
 
-void loop() {
-    looppid();
-
-    if (TEMP_LED) {
-        loopLED();
+    if (connectmode == 1) {  // WiFi Mode
+        networkSetup();
     }
 
-    checkForRemoteSerialClients();
+    setupDone = true;
+    networkReady = true;
+    bootPhaseDone(kBootDone);
 }
 
 
-void looppid() {
-    // Only do Wifi stuff, if Wifi is connected
-    if (WiFi.status() == WL_CONNECTED && offlineMode == 0) {
-        if (MQTT == 1) {
-            checkMQTT();
-            writeSysParamsToMQTT(true); // Continue on error
-            if (mqtt.connected() == 1) {
-                mqtt.loop();
-                #if MQTT_HASSIO_SUPPORT == 1
-                if (millis() - lastHomeAssistantDiscoveryExecutionTime >= HomeAssistantDiscoveryExecutionInterval) {
-                    sendHASSIODiscoveryMsg();
-                    lastHomeAssistantDiscoveryExecutionTime = millis();
-                }
-                #endif
-                mqtt_was_connected = true;
-            }
-            // Supress debug messages until we have a connection etablished
-            else if(mqtt_was_connected) {
-                debugPrintln("MQTT disconnected\n");
-                mqtt_was_connected = false;
-            }
-        }
+/**
+ * @brief WiFi, website, OTA, MQTT and InfluxDB. Runs at the end of setup() in
+ *      the low priority Arduino loop task while the control and telemetry
+ *      tasks already run, so the machine heats and the display shows the
+ *      temperature while WiFi connects. Nothing of the telemetry task touches
+ *      the network before networkReady is set.
+ */
+void networkSetup() {
+    wiFiSetup();
+    bootPhaseDone(kBootWifi);
 
-        ArduinoOTA.handle();  // For OTA
+    websiteSetup();
+    bootPhaseDone(kBootWebserver);
+
+    // OTA Updates
+    if (ota && WiFi.status() == WL_CONNECTED) {
+        ArduinoOTA.setHostname(OTAhost);  //  Device name for OTA
+        ArduinoOTA.setPassword(OTApass);  //  Password for OTA
 
         // Disable interrupt if OTA is starting, otherwise it will not work
         ArduinoOTA.onStart([]() {
@@ -2186,193 +1144,322 @@ void looppid() {
         // Enable interrupts if OTA is finished
         ArduinoOTA.onEnd([]() { enableTimer1(); });
 
-        wifiReconnects = 0;  // reset wifi reconnects if connected
-    } else {
-        checkWifi();
+        ArduinoOTA.begin();
     }
 
-    refreshTemp();        // update temperature values
-    testEmergencyStop();  // test if temp is too high
-    bPID.Compute();       // the variable pidOutput now has new values from PID (will be written to heater pin in ISR.cpp)
-
-    if ((millis() - lastTempEvent) > tempEventInterval) {
-        //send temperatures to website endpoint
-        sendTempEvent(temperature, brewSetpoint, pidOutput/10);       //pidOutput is promill, so /10 to get percent value
-        lastTempEvent = millis();
-
-        #if VERBOSE
-        if (pidON) {
-            debugPrintf("Current PID mode: %s\n", bPID.GetPonE() ? "PonE" : "PonM");
-
-            //P-Part
-            debugPrintf("Current PID input error: %f\n", bPID.GetInputError());
-            debugPrintf("Current PID P part: %f\n", bPID.GetLastPPart());
-            debugPrintf("Current PID kP: %f\n", bPID.GetKp());
-            //I-Part
-            debugPrintf("Current PID I sum: %f\n", bPID.GetLastIPart());
-            debugPrintf("Current PID kI: %f\n", bPID.GetKi());
-            //D-Part
-            debugPrintf("Current PID diff'd input: %f\n", bPID.GetDeltaInput());
-            debugPrintf("Current PID D part: %f\n", bPID.GetLastDPart());
-            debugPrintf("Current PID kD: %f\n", bPID.GetKd());
-
-            //Combined PID output
-            debugPrintf("Current PID Output: %f\n\n", pidOutput);
-            debugPrintf("Current Machinestate: %s\n\n", machinestateEnumToString(machineState));
-            debugPrintf("timeBrewed %f\n", timeBrewed);
-            debugPrintf("brewtimesoftware %f\n", brewtimesoftware);
-            debugPrintf("isBrewDetected %i\n", isBrewDetected);
-            debugPrintf("brewDetectionMode %i\n", brewDetectionMode);
-        }
-        #endif
+    if (MQTT == 1) {
+        snprintf(topic_will, sizeof(topic_will), "%s%s/%s", mqtt_topic_prefix, hostname, "status");
+        snprintf(topic_set, sizeof(topic_set), "%s%s/+/%s", mqtt_topic_prefix, hostname, "set");
+        lastMQTTConnectionAttempt = millis();
+        mqttSetup();
+        mqttPublicationsSetup();
+        checkMQTT();    // discovery messages are sent once connected
+        bootPhaseDone(kBootMqtt);
     }
 
+    if (INFLUXDB == 1) {
+       influxDbSetup();
+       bootPhaseDone(kBootInflux);
+    }
+}
+
+
+void loop() {
+    // Everything runs in controlTask() and telemetryTask(), the Arduino loop task is not needed anymore
+    vTaskDelete(NULL);
+}
+
+
+/**
+ * @brief Copy the current control state into the snapshot shared with the telemetry task
+ */
+void publishControlState() {
+    control_state_t state;
+
+    state.timestamp = millis();
+    state.temperature = temperature;
+    state.setpoint = setpoint;
+    state.brewSetpoint = brewSetpoint;
+    state.pidOutput = pidOutput;
+    state.kp = bPID.GetKp();
+    state.ki = bPID.GetKi();
+    state.kd = bPID.GetKd();
+    state.timeBrewed = timeBrewed;
+    state.lastbrewTime = lastbrewTime;
+    state.machineState = machineState;
+    state.brewcounter = brewcounter;
+    state.pidON = pidON;
+    state.steamON = steamON;
+    state.autotuneState = autotune.getState();
+
     #if (BREWMODE == 2 || ONLYPIDSCALE == 1)
-        checkWeight();  // Check Weight Scale in the loop
+        state.weight = weight;
+        state.weightBrew = weightBrew;
+    #else
+        state.weight = 0;
+        state.weightBrew = 0;
     #endif
 
     #if (PRESSURESENSOR == 1)
-        checkPressure();
+        state.pressure = inputPressure;
+    #else
+        state.pressure = 0;
     #endif
 
-    brew();
-    checkSteamON();
-    setEmergencyStopTemp();
-    checkpowerswitch();
-    handleMachineState();
+    controlSnapshot.publish(state);
+}
+
+
+/**
+ * @brief High priority control task, runs the control jobs with a fixed period and never touches the network
+ */
+void controlTask(void *) {
+    HeapScope heapScope(kHeapControl);  // nothing in here should allocate
+    TickType_t lastWakeTime = xTaskGetTickCount();
+
+    for (;;) {
+        looppid();
 
-    if (standbyModeOn && machineState != kStandby) {
-        updateStandbyTimer();
+        if (standbyPowerSave) {
+            // switches and commands notify the task, no need to poll fast
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(STANDBY_CONTROL_PERIOD));
+            lastWakeTime = xTaskGetTickCount();
+        } else {
+            vTaskDelayUntil(&lastWakeTime, pdMS_TO_TICKS(controlTaskPeriod));
+        }
     }
+}
 
-    if (INFLUXDB == 1  && offlineMode == 0 ) {
-        sendInflux();
+
+/**
+ * @brief Low priority telemetry task for MQTT, InfluxDB, website events, OTA and display
+ */
+void telemetryTask(void *) {
+    for (;;) {
+        looptelemetry();
+        vTaskDelay(pdMS_TO_TICKS(telemetryPowerSave ? STANDBY_TELEMETRY_PERIOD : telemetryTaskPeriod));
     }
+}
+
+
+/**
+ * @brief Start the control task, called by setup() as soon as sensors and PID are ready
+ */
+void startControlTask() {
+    publishControlState();
+
+    xTaskCreatePinnedToCore(controlTask, "control", 6144, NULL, 10, &controlTaskHandle, 1);
+}
+
+
+/**
+ * @brief Start the telemetry task, called by setup() before the network setup
+ */
+void startTelemetryTask() {
+    controlSnapshot.read(controlState);
+
+    xTaskCreatePinnedToCore(telemetryTask, "telemetry", 10240, NULL, 1, &telemetryTaskHandle, 0);
+}
+
+
+/**
+ * @brief Register the jobs of the control and telemetry scheduler.
+ *      Priorities are only compared within one scheduler. Within the control
+ *      scheduler they keep the order sensor -> PID -> state machine -> outputs.
+ */
+void schedulerSetup() {
+    // Control task: temperature, pid, brew, machine and heater
+    controlSchedulerSetup();
+    slowDownInStandby(controlScheduler, temperatureJob);
 
-    #if (ONLYPIDSCALE == 1)  // only by shottimer 2, scale
-        shottimerscale();
+    #if (BREWMODE == 2 || ONLYPIDSCALE == 1)
+        controlScheduler.addJob("scale", checkWeight, 0, 8, 20);
     #endif
 
-    // Check if PID should run or not. If not, set to manual and force output to zero
-#if OLED_DISPLAY != 0
-    unsigned long currentMillisDisplay = millis();
-    if (currentMillisDisplay - previousMillisDisplay >= 100) {
-        displayShottimer();
-    }
-    if (currentMillisDisplay - previousMillisDisplay >= intervalDisplay) {
-        previousMillisDisplay = currentMillisDisplay;
-    #if DISPLAYTEMPLATE < 20  // not using vertical template
-        Displaymachinestate();
+    #if (PRESSURESENSOR == 1)
+        slowDownInStandby(controlScheduler, controlScheduler.addJob("pressure", checkPressure, intervalPressure, 8, 100));
     #endif
-        printScreen();  // refresh display
-    }
-#endif
 
-    if (machineState == kPidOffline || machineState == kSensorError || machineState == kEmergencyStop || machineState == kEepromError || machineState == kStandby || brewPIDdisabled) {
-        if (pidMode == 1) {
-            // Force PID shutdown
-            pidMode = 0;
-            bPID.SetMode(pidMode);
-            pidOutput = 0;
-            digitalWrite(PIN_HEATER, LOW);  // Stop heating
-        }
-    } else {  // no sensorerror, no pid off or no Emergency Stop
-        if (pidMode == 0) {
-            pidMode = 1;
-            bPID.SetMode(pidMode);
-        }
+    controlScheduler.addJob("shot", recordShot, SHOT_SAMPLE_PERIOD, 5, 50);
+
+    if (TEMP_LED) {
+        controlScheduler.addJob("led", loopLED, 0, 1, 100);
     }
 
-    // Set PID if first start of machine detected, and no steamON
-    if ((machineState == kInit || machineState == kColdStart || machineState == kBelowSetpoint)) {
-        if (usePonM) {
-            if (startTn != 0) {
-                startKi = startKp / startTn;
-            } else {
-                startKi = 0;
-            }
+    controlScheduler.addJob("snapshot", publishControlState, 0, 0, 20);
 
-            if (lastmachinestatepid != machineState) {
-                debugPrintf("new PID-Values: P=%.1f  I=%.1f  D=%.1f\n", startKp, startKi, 0.0);
-                lastmachinestatepid = machineState;
-            }
+    // Telemetry task
+    telemetryScheduler.addJob("network", handleNetwork, 0, 5, 1000);
 
-            bPID.SetTunings(startKp, startKi, 0, P_ON_M);
-        } else {
-            setNormalPIDTunings();
-        }
+    if (MQTT == 1) {
+        mqttPublishJob = telemetryScheduler.addJob("mqtt", []{ if (isNetworkOnline()) writeSysParamsToMQTT(true); }, intervalMQTT, 4, 1000);
+        slowDownInStandby(telemetryScheduler, mqttPublishJob);
     }
 
-    if (machineState == kPidNormal) {
-        setNormalPIDTunings();
-        coldstart = false;
+    telemetryScheduler.addJob("history", updateTempHistory, tempHistoryInterval, 4, 500);
+    slowDownInStandby(telemetryScheduler, telemetryScheduler.addJob("telemetry", []{ if (networkReady) sendTelemetry(); }, TELEMETRY_PERIOD, 4, 100));
+
+    if (INFLUXDB == 1) {
+        slowDownInStandby(telemetryScheduler, telemetryScheduler.addJob("influx", []{ if (networkReady) addInfluxSample(); }, intervalInflux, 2, 100));
     }
 
-    // BD PID
-    if (machineState >= kBrew && machineState <= kBrewDetectionTrailing) {
-        if (brewPIDDelay > 0 && timeBrewed > 0 && timeBrewed < brewPIDDelay*1000) {
-            //disable PID for brewPIDDelay seconds, enable PID again with new tunings after that
-            if (!brewPIDdisabled) {
-                brewPIDdisabled = true;
-                bPID.SetMode(MANUAL);
-                debugPrintf("disabled PID, waiting for %d seconds before enabling PID again\n", brewPIDDelay);
+    #if OLED_DISPLAY != 0
+        slowDownInStandby(telemetryScheduler, telemetryScheduler.addJob("display", refreshDisplay, intervalDisplay, 3, 250));
+        slowDownInStandby(telemetryScheduler, telemetryScheduler.addJob("shottimer", []{ HeapScope heapScope(kHeapDisplay); displayShottimer(); }, 100, 3, 100));
+    #endif
+
+    telemetryScheduler.addJob("shots", []{ HeapScope heapScope(kHeapStorage); shotRecorder.writePending(); }, 500, 1, 5000);
+    telemetryScheduler.addJob("storage", []{ HeapScope heapScope(kHeapStorage); storageLoop(); }, 500, 1, 5000);
+    telemetryScheduler.addJob("heap", heapProfilerSample, HEAP_SAMPLE_PERIOD, 0, 1000);
+
+    #if VERBOSE
+        telemetryScheduler.addJob("stats", []{ controlScheduler.printStats(); telemetryScheduler.printStats(); }, 60000, 0, 60000);
+    #endif
+}
+
+
+/**
+ * @brief Publish all parameters to MQTT on the next pass of the telemetry task
+ *      instead of waiting for the next interval, called e.g. after parameters
+ *      were changed on the website
+ */
+void triggerMQTTPublish() {
+    telemetryScheduler.trigger(mqttPublishJob);
+}
+
+
+/**
+ * @brief True if the network setup is done, WiFi is connected and we are not in offline mode
+ */
+bool isNetworkOnline() {
+    return networkReady && WiFi.status() == WL_CONNECTED && offlineMode == 0;
+}
+
+
+/**
+ * @brief Keep WiFi, MQTT and OTA connections alive
+ */
+void handleNetwork() {
+    // networkSetup() still owns WiFi, MQTT and OTA
+    if (!networkReady) return;
+
+    // Only do Wifi stuff, if Wifi is connected
+    if (isNetworkOnline()) {
+        if (MQTT == 1) {
+            checkMQTT();
+
+            if (mqtt.connected() == 1) {
+                mqtt_was_connected = true;
             }
-        } else {
-            if (brewPIDdisabled) {
-                //enable PID again
-                bPID.SetMode(AUTOMATIC);
-                brewPIDdisabled = false;
-                debugPrintln("Enabled PID again after delay");
+            // Supress debug messages until we have a connection etablished
+            else if(mqtt_was_connected) {
+                debugPrintln("MQTT disconnected\n");
+                mqtt_was_connected = false;
             }
+        }
 
-            if (useBDPID) {
-                setBDPIDTunings();
-            } else {
-                setNormalPIDTunings();
-            }
+        ArduinoOTA.handle();  // For OTA
+
+        wifiReconnects = 0;  // reset wifi reconnects if connected
+
+        if (wifiConnecting) {
+            debugPrintln("WiFi reconnected");
+            wifiConnecting = false;
         }
+    } else {
+        checkWifi();
     }
+}
 
-    // Steam on
-    if (machineState == kSteam) {
-        if (lastmachinestatepid != machineState) {
-            debugPrintf("new PID-Values: P=%.1f  I=%.1f  D=%.1f\n", 150.0, 0.0, 0.0);
-            lastmachinestatepid = machineState;
-        }
 
-        bPID.SetTunings(steamKp, 0, 0, 1);
+/**
+ * @brief Store temperatures in the history for the website
+ */
+void updateTempHistory() {
+    addTempHistory(controlState.temperature, controlState.brewSetpoint, controlState.pidOutput/10);   //pidOutput is promill, so /10 to get percent value
+
+    #if VERBOSE
+    if (pidON) {
+        debugPrintf("Current PID mode: %s\n", bPID.GetPonE() ? "PonE" : "PonM");
+
+        //P-Part
+        debugPrintf("Current PID input error: %f\n", bPID.GetInputError());
+        debugPrintf("Current PID P part: %f\n", bPID.GetLastPPart());
+        debugPrintf("Current PID kP: %f\n", bPID.GetKp());
+        //I-Part
+        debugPrintf("Current PID I sum: %f\n", bPID.GetLastIPart());
+        debugPrintf("Current PID kI: %f\n", bPID.GetKi());
+        //D-Part
+        debugPrintf("Current PID diff'd input: %f\n", bPID.GetDeltaInput());
+        debugPrintf("Current PID D part: %f\n", bPID.GetLastDPart());
+        debugPrintf("Current PID kD: %f\n", bPID.GetKd());
+
+        //Combined PID output
+        debugPrintf("Current PID Output: %f\n\n", controlState.pidOutput);
+        debugPrintf("Current Machinestate: %s\n\n", machinestateEnumToString(controlState.machineState));
+        debugPrintf("timeBrewed %f\n", controlState.timeBrewed);
+        debugPrintf("brewtimesoftware %f\n", brewtimesoftware);
+        debugPrintf("isBrewDetected %i\n", isBrewDetected);
+        debugPrintf("brewDetectionMode %i\n", brewDetectionMode);
     }
+    #endif
+}
 
-    // chill-mode after steam
-    if (machineState == kCoolDown) {
-        switch (machine) {
-            case QuickMill:
-                aggbKp = 150;
-                aggbKi = 0;
-                aggbKd = 0;
-                break;
-
-            default:
-                // calc ki, kd
-                if (aggbTn != 0) {
-                    aggbKi = aggbKp / aggbTn;
-                } else {
-                    aggbKi = 0;
-                }
-
-                aggbKd = aggbTv * aggbKp;
-        }
 
-        if (lastmachinestatepid != machineState) {
-            debugPrintf("new PID-Values: P=%.1f  I=%.1f  D=%.1f\n", aggbKp, aggbKi, aggbKd);
-            lastmachinestatepid = machineState;
-        }
+#if OLED_DISPLAY != 0
+void refreshDisplay() {
+    #if STANDBY_DISPLAY_OFF == 1
+        if (telemetryPowerSave) return;
+    #endif
+
+    HeapScope heapScope(kHeapDisplay);
+
+    if (refreshBootMessage()) return;
+
+    #if DISPLAYTEMPLATE < 20  // not using vertical template
+        Displaymachinestate();
+    #endif
+    printScreen();  // refresh display
+}
+#endif
+
+
+/**
+ * @brief One pass of the telemetry task
+ */
+void looptelemetry() {
+    controlSnapshot.read(controlState);
+    updateTelemetryPowerSave();
+    telemetryScheduler.run();
+}
+
+
+/**
+ * @brief Feed the shot recorder while a shot is running (machine state kBrew),
+ *      the shot is finished as soon as the machine leaves kBrew
+ */
+void recordShot() {
+    float pressure = 0;
+    float shotWeight = 0;
+
+    #if (PRESSURESENSOR == 1)
+        pressure = inputPressure;
+    #endif
 
-        bPID.SetTunings(aggbKp, aggbKi, aggbKd, 1);
+    #if (BREWMODE == 2 || ONLYPIDSCALE == 1)
+        shotWeight = weightBrew;
+    #endif
+
+    if (machineState == kBrew) {
+        if (shotRecorder.start(brewSetpoint)) {
+            shotRecorder.sample(temperature, pidOutput, pressure, shotWeight);
+        }
+    } else if (shotRecorder.isRecording()) {
+        shotRecorder.stop(shotWeight);
     }
-    // sensor error OR Emergency Stop
 }
 
+
 void loopLED() {
     if ((machineState == kPidNormal && (fabs(temperature  - setpoint) < 0.3)) || (temperature > 115 && fabs(temperature - setpoint) < 5)) {
         digitalWrite(PIN_STATUSLED, HIGH);
@@ -2384,147 +1471,39 @@ void loopLED() {
 
 void setBackflush(int backflush) {
     backflushON = backflush;
+    wakeControlTask();
 }
 
-void setSteamMode(int steamMode) {
-    steamON = steamMode;
-
-    if (steamON == 1) {
-        steamFirstON = 1;
-    }
-
-    if (steamON == 0) {
-        steamFirstON = 0;
-    }
-}
-
-void setPidStatus(int pidStatus) {
-    pidON = pidStatus;
-    writeSysParamsToStorage();
+void setAutotune(int autotune) {
+    autotuneON = autotune;
+    wakeControlTask();
 }
 
-void setNormalPIDTunings() {
-    // Prevent overwriting of brewdetection values
-    // calc ki, kd
-    if (aggTn != 0) {
-        aggKi = aggKp / aggTn;
-    } else {
-        aggKi = 0;
-    }
+void setSteamMode(int steamMode) {
+    {
+        ControlLock lock;
 
-    aggKd = aggTv * aggKp;
+        steamON = steamMode;
 
-    bPID.SetIntegratorLimits(0, aggIMax);
+        if (steamON == 1) {
+            steamFirstON = 1;
+        }
 
-    if (lastmachinestatepid != machineState) {
-        debugPrintf("new PID-Values: P=%.1f  I=%.1f  D=%.1f\n", aggKp, aggKi, aggKd);
-        lastmachinestatepid = machineState;
+        if (steamON == 0) {
+            steamFirstON = 0;
+        }
     }
 
-    bPID.SetTunings(aggKp, aggKi, aggKd, 1);
+    wakeControlTask();
 }
 
-void setBDPIDTunings() {
-    // calc ki, kd
-    if (aggbTn != 0) {
-        aggbKi = aggbKp / aggbTn;
-    } else {
-        aggbKi = 0;
-    }
-
-    aggbKd = aggbTv * aggbKp;
+void setPidStatus(int pidStatus) {
+    {
+        ControlLock lock;
 
-    if (lastmachinestatepid != machineState) {
-        debugPrintf("new PID-Values: P=%.1f  I=%.1f  D=%.1f\n", aggbKp, aggbKi, aggbKd);
-        lastmachinestatepid = machineState;
+        pidON = pidStatus;
+        writeSysParamsToStorage();
     }
 
-    bPID.SetTunings(aggbKp, aggbKi, aggbKd, 1);
-}
-
-/**
- * @brief Reads all system parameter values from non-volatile storage
- *
- * @return 0 = success, < 0 = failure
- */
-int readSysParamsFromStorage(void) {
-    if (sysParaPidOn.getStorage() != 0) return -1;
-    if (sysParaUsePonM.getStorage() != 0) return -1;
-    if (sysParaPidKpStart.getStorage() != 0) return -1;
-    if (sysParaPidTnStart.getStorage() != 0) return -1;
-    if (sysParaPidKpReg.getStorage() != 0) return -1;
-    if (sysParaPidTnReg.getStorage() != 0) return -1;
-    if (sysParaPidTvReg.getStorage() != 0) return -1;
-    if (sysParaPidIMaxReg.getStorage() != 0) return -1;
-    if (sysParaBrewSetpoint.getStorage() != 0) return -1;
-    if (sysParaTempOffset.getStorage() != 0) return -1;
-    if (sysParaBrewPIDDelay.getStorage() != 0) return -1;
-    if (sysParaUseBDPID.getStorage() != 0) return -1;
-    if (sysParaPidKpBd.getStorage() != 0) return -1;
-    if (sysParaPidTnBd.getStorage() != 0) return -1;
-    if (sysParaPidTvBd.getStorage() != 0) return -1;
-    if (sysParaBrewTime.getStorage() != 0) return -1;
-    if (sysParaBrewSwTime.getStorage() != 0) return -1;
-    if (sysParaBrewThresh.getStorage() != 0) return -1;
-    if (sysParaPreInfTime.getStorage() != 0) return -1;
-    if (sysParaPreInfPause.getStorage() != 0) return -1;
-    if (sysParaPidKpSteam.getStorage() != 0) return -1;
-    if (sysParaSteamSetpoint.getStorage() != 0) return -1;
-    if (sysParaWeightSetpoint.getStorage() != 0) return -1;
-    if (sysParaWifiCredentialsSaved.getStorage() != 0) return -1;
-    if (sysParaStandbyModeOn.getStorage() != 0) return -1;
-    if (sysParaStandbyModeTime.getStorage() != 0) return -1;
-
-    return 0;
-}
-
-/**
- * @brief Writes all current system parameter values to non-volatile storage
- *
- * @return 0 = success, < 0 = failure
- */
-int writeSysParamsToStorage(void) {
-    if (sysParaPidOn.setStorage() != 0) return -1;
-    if (sysParaUsePonM.setStorage() != 0) return -1;
-    if (sysParaPidKpStart.setStorage() != 0) return -1;
-    if (sysParaPidTnStart.setStorage() != 0) return -1;
-    if (sysParaPidKpReg.setStorage() != 0) return -1;
-    if (sysParaPidTnReg.setStorage() != 0) return -1;
-    if (sysParaPidTvReg.setStorage() != 0) return -1;
-    if (sysParaPidIMaxReg.setStorage() != 0) return -1;
-    if (sysParaBrewSetpoint.setStorage() != 0) return -1;
-    if (sysParaTempOffset.setStorage() != 0) return -1;
-    if (sysParaBrewPIDDelay.setStorage() != 0) return -1;
-    if (sysParaUseBDPID.setStorage() != 0) return -1;
-    if (sysParaPidKpBd.setStorage() != 0) return -1;
-    if (sysParaPidTnBd.setStorage() != 0) return -1;
-    if (sysParaPidTvBd.setStorage() != 0) return -1;
-    if (sysParaBrewTime.setStorage() != 0) return -1;
-    if (sysParaBrewSwTime.setStorage() != 0) return -1;
-    if (sysParaBrewThresh.setStorage() != 0) return -1;
-    if (sysParaPreInfTime.setStorage() != 0) return -1;
-    if (sysParaPreInfPause.setStorage() != 0) return -1;
-    if (sysParaPidKpSteam.setStorage() != 0) return -1;
-    if (sysParaSteamSetpoint.setStorage() != 0) return -1;
-    if (sysParaWeightSetpoint.setStorage() != 0) return -1;
-    if (sysParaWifiCredentialsSaved.setStorage() != 0) return -1;
-    if (sysParaStandbyModeOn.setStorage() != 0) return -1;
-    if (sysParaStandbyModeTime.setStorage() != 0) return -1;
-
-    return storageCommit();
-}
-
-
-/**
- * @brief Performs a factory reset.
- *
- * @return 0 = success, < 0 = failure
- */
-int factoryReset(void) {
-    int stoStatus;
-
-    if ((stoStatus = storageFactoryReset()) != 0)
-        return stoStatus;
-
-    return readSysParamsFromStorage();
+    wakeControlTask();
 }
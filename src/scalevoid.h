@@ -1,69 +1,134 @@
 /**
  * @file scalevoid.h
  *
- * @brief TODO
+ * @brief Brew scale, every HX711 conversion is read by a task woken by the
+ *        data ready edge and queued for the control task with its timestamp
  */
 
 #pragma once
 
 #if (BREWMODE == 2 || ONLYPIDSCALE == 1)
-/**
- * @brief Check measured weight
- */
-void checkWeight() {
-    static boolean newDataReady = 0;
-    unsigned long currentMillisScale = millis();
+int shottimercounter = 10 ;
+float calibrationValue = SCALE_CALIBRATION_FACTOR;  // use calibration example to get value
+HX711_ADC LoadCell(PIN_HXDAT, PIN_HXCLK);
 
-    if (scaleFailure) {   // abort if scale is not working
-        return;
-    }
+#define SCALE_QUEUE_SIZE 16                         // conversions buffered between the scale and the control task
 
-    if (currentMillisScale - previousMillisScale >= intervalWeight) {
-        previousMillisScale = currentMillisScale;
+struct scale_sample_t {
+    unsigned long time;                             // millis() at data ready
+    float weight;
+};
 
-        // check for new data/start next conversion:
-        if (LoadCell.update()) {
-            newDataReady = true;
-        }
+QueueHandle_t scaleQueue = NULL;
+TaskHandle_t scaleTaskHandle = NULL;
+volatile unsigned long scaleReadyTime = 0;          // set by the data ready interrupt
 
-        // get smoothed value from the dataset:
-        if (newDataReady) {
-            weight = LoadCell.getData();
-            newDataReady = 0;
-        }
+/**
+ * @brief HX711 pulls DOUT low when a conversion is ready. Reading the data
+ *      toggles DOUT as well, the task ignores the edges it caused.
+ */
+void IRAM_ATTR scaleDataReady() {
+    BaseType_t woken = pdFALSE;
+
+    scaleReadyTime = millis();
+    vTaskNotifyGiveFromISR(scaleTaskHandle, &woken);
+
+    if (woken) {
+        portYIELD_FROM_ISR();
     }
 }
 
 /**
- * @brief Initialize scale
+ * @brief Tare the scale, runs in the scale task while setup() continues with
+ *      the network. The library busy-waits until the tare is done, so this
+ *      runs at the lowest priority to leave the core to the other tasks.
  */
-void initScale() {
-    LoadCell.begin();
+void scaleStart() {
+    UBaseType_t priority = uxTaskPriorityGet(NULL);
     long stabilizingtime = 2000; // tare preciscion can be improved by adding a few seconds of stabilizing time
     boolean _tare = true; //set this to false if you don't want tare to be performed in the next step
 
-    u8g2.clearBuffer();
-    u8g2.drawStr(0, 2, "Taring scale,");
-    u8g2.drawStr(0, 12, "remove any load!");
-    u8g2.drawStr(0, 22, "....");
-    delay(2000);
-    u8g2.sendBuffer();
+    debugPrintln("Taring scale, remove any load!");
+
+    vTaskPrioritySet(NULL, tskIDLE_PRIORITY + 1);
+    LoadCell.begin();
     LoadCell.start(stabilizingtime, _tare);
+    vTaskPrioritySet(NULL, priority);
 
     if (LoadCell.getTareTimeoutFlag()) {
+        // scale timeout will most likely trigger after OTA update, but will still work after boot
         debugPrintln("Timeout, check MCU>HX711 wiring and pin designations");
-        u8g2.drawStr(0, 32, "failed!");
-        u8g2.drawStr(0, 42, "Scale not working...");    // scale timeout will most likely trigger after OTA update, but will still work after boot
-        delay(5000);
-        u8g2.sendBuffer();
-    }
-    else {
-        u8g2.drawStr(0, 32, "done.");
-        u8g2.sendBuffer();
+    } else {
+        debugPrintln("Taring scale done");
     }
 
     LoadCell.setCalFactor(calibrationValue); // set calibration factor (float)
-    LoadCell.setSamplesInUse(SCALE_SAMPLES);
+
+    // no averaging in the library, the flow regression smooths and a dataset
+    // of one sample adds no latency (the library still drops single outliers)
+    LoadCell.setSamplesInUse(1);
+
+    attachInterrupt(digitalPinToInterrupt(PIN_HXDAT), scaleDataReady, FALLING);
+    bootPhaseDone(kBootScale);
+}
+
+/**
+ * @brief Read every conversion as soon as it is ready, the oldest queued
+ *      conversion is dropped if the control task doesn't keep up
+ */
+void scaleTask(void *) {
+    scaleStart();
+
+    for (;;) {
+        // polls as well in case an edge was missed
+        bool notified = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(200)) > 0;
+        unsigned long readyTime = notified ? scaleReadyTime : millis();
+
+        if (!LoadCell.update()) {
+            continue;
+        }
+
+        scale_sample_t sample = {readyTime, LoadCell.getData()};
+
+        if (xQueueSend(scaleQueue, &sample, 0) != pdTRUE) {
+            scale_sample_t dropped;
+            xQueueReceive(scaleQueue, &dropped, 0);
+            xQueueSend(scaleQueue, &sample, 0);
+        }
+
+        // falling edges of the data bits just read
+        ulTaskNotifyTake(pdTRUE, 0);
+    }
+}
+
+/**
+ * @brief Take the queued conversions, called by the control scheduler on every pass
+ */
+void checkWeight() {
+    scale_sample_t sample;
+
+    if (scaleFailure || scaleQueue == NULL) {   // abort if scale is not working
+        return;
+    }
+
+    while (xQueueReceive(scaleQueue, &sample, 0) == pdTRUE) {
+        weight = sample.weight;
+        weightTime = sample.time;
+        weightFlow = scaleFlow.add(sample.time, sample.weight);
+    }
+}
+
+/**
+ * @brief Initialize scale, the scale task tares it in the background
+ */
+void initScale() {
+    scaleQueue = xQueueCreate(SCALE_QUEUE_SIZE, sizeof(scale_sample_t));
+
+    if (scaleQueue == NULL ||
+        xTaskCreatePinnedToCore(scaleTask, "scale", 4096, NULL, 5, &scaleTaskHandle, 1) != pdPASS) {
+        debugPrintln("Scale: cannot start the scale task");
+        scaleFailure = true;
+    }
 }
 
 /**
@@ -74,6 +139,8 @@ void shottimerscale() {
         case 10:    // waiting step for brew switch turning on
             if (timeBrewed > 0) {
                 weightPreBrew = weight;
+                scaleFlow.reset();      // the flow of this shot only
+                weightFlow = 0;
                 shottimercounter = 20;
             }
 
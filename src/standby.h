@@ -1,42 +1,174 @@
 /**
  * @file standby.h
- * 
+ *
  * @brief Standby mode
 */
 
 #pragma once
 
-unsigned long standbyModeStartTimeMillis = millis();
-unsigned long standbyModeRemainingTimeMillis = standbyModeTime * 60 * 1000;
-unsigned long lastStandbyTimeMillis = standbyModeStartTimeMillis;
+// Not defined in older userConfig files
+#ifndef STANDBY_CPU_FREQUENCY
+    #define STANDBY_CPU_FREQUENCY 80        // MHz, lowest clock WiFi still works with
+#endif
+
+#ifndef STANDBY_DISPLAY_OFF
+    #define STANDBY_DISPLAY_OFF 1           // 1 = display off in standby, 0 = keep showing the standby screen
+#endif
+
+#define STANDBY_CPU_FREQUENCY_NORMAL 240
+#define STANDBY_CONTROL_PERIOD 100      // ms, control task period in standby, switches and commands wake it up earlier
+#define STANDBY_TELEMETRY_PERIOD 50     // ms, pause between telemetry loop iterations in standby
+#define STANDBY_SLOWDOWN 10             // slowed down jobs run this many times less often in standby
+#define STANDBY_MAX_JOBS 8
+
+
+// Power saving in standby: the control task switches the CPU clock, its own job
+// rates and the wake up sources, the telemetry task follows through the control
+// state snapshot with WiFi, display and its job rates.
+
+struct standby_job_t {
+    Scheduler *scheduler;
+    int jobId;
+    unsigned long period;       // normal period in ms
+};
+
+standby_job_t standbyJobs[STANDBY_MAX_JOBS];
+int standbyJobCount = 0;
+
+bool standbyPowerSave = false;      // control task
+bool telemetryPowerSave = false;    // telemetry task
+bool wifiPowerSave = false;         // telemetry task
+wifi_ps_type_t wifiSleepType = WIFI_PS_MIN_MODEM;
 
 /**
- * @brief Decrements the remaining standby time every second, counting down from the configured duration 
+ * @brief Run a periodic job STANDBY_SLOWDOWN times less often in standby
+ *
+ * @return jobId
  */
-void updateStandbyTimer(void) {
-    unsigned long currentTime = millis();
+int slowDownInStandby(Scheduler &scheduler, int jobId) {
+    const scheduler_job_t *job = scheduler.getJob(jobId);
 
-    if ((standbyModeRemainingTimeMillis != 0) && ((currentTime % 1000) == 0) && (currentTime != lastStandbyTimeMillis)) {
-        unsigned long standbyModeTimeMillis = standbyModeTime * 60 * 1000;
-        long elapsedTime = currentTime - standbyModeStartTimeMillis;
-        lastStandbyTimeMillis = currentTime;
+    if (job == NULL || job->trigger.getInterval() == 0 || standbyJobCount >= STANDBY_MAX_JOBS) {
+        return jobId;
+    }
 
-        if (standbyModeTimeMillis > elapsedTime) {
-            standbyModeRemainingTimeMillis = standbyModeTimeMillis - elapsedTime;
+    standbyJobs[standbyJobCount].scheduler = &scheduler;
+    standbyJobs[standbyJobCount].jobId = jobId;
+    standbyJobs[standbyJobCount].period = job->trigger.getInterval();
+    standbyJobCount++;
 
-            if ((currentTime % 60000) == 0) {
-                debugPrintf("Standby time remaining: %i minutes\n", standbyModeRemainingTimeMillis / 60000);
-            }
-        }
-        else {
-            standbyModeRemainingTimeMillis = 0;
+    return jobId;
+}
+
+/**
+ * @brief Switch the slowed down jobs of one scheduler, on wake up they run right away
+ */
+void setStandbyJobPeriods(Scheduler &scheduler, bool standby) {
+    for (int i = 0; i < standbyJobCount; i++) {
+        const standby_job_t &job = standbyJobs[i];
+
+        if (job.scheduler != &scheduler) continue;
+
+        scheduler.setPeriod(job.jobId, standby ? job.period * STANDBY_SLOWDOWN : job.period);
+
+        if (!standby) {
+            scheduler.trigger(job.jobId);
         }
     }
 }
 
-void resetStandbyTimer(void) {
-    standbyModeRemainingTimeMillis = standbyModeTime * 60 * 10000;
-    standbyModeStartTimeMillis = millis();
+/**
+ * @brief Cut the wait of the control task short, used by switches and commands
+ */
+void IRAM_ATTR standbyWakeISR() {
+    BaseType_t woken = pdFALSE;
+
+    vTaskNotifyGiveFromISR(controlTaskHandle, &woken);
+
+    if (woken) {
+        portYIELD_FROM_ISR();
+    }
+}
+
+void wakeControlTask() {
+    if (controlTaskHandle != NULL) {
+        xTaskNotifyGive(controlTaskHandle);
+    }
+}
+
+/**
+ * @brief Called by the control task when the machine enters standby
+ */
+void enterStandbyPowerSave() {
+    if (standbyPowerSave) return;
+
+    standbyPowerSave = true;
+    setCpuFrequencyMhz(STANDBY_CPU_FREQUENCY);
+    setStandbyJobPeriods(controlScheduler, true);
+
+    attachInterrupt(digitalPinToInterrupt(PIN_BREWSWITCH), standbyWakeISR, CHANGE);
+    attachInterrupt(digitalPinToInterrupt(PIN_STEAMSWITCH), standbyWakeISR, CHANGE);
+
+    #if POWERSWITCHTYPE > 0
+        attachInterrupt(digitalPinToInterrupt(PIN_POWERSWITCH), standbyWakeISR, CHANGE);
+    #endif
+
+    debugPrintf("Standby: power saving on, CPU at %lu MHz\n", (unsigned long)getCpuFrequencyMhz());
+}
+
+/**
+ * @brief Called by the control task when the machine leaves standby
+ */
+void exitStandbyPowerSave() {
+    if (!standbyPowerSave) return;
+
+    detachInterrupt(digitalPinToInterrupt(PIN_BREWSWITCH));
+    detachInterrupt(digitalPinToInterrupt(PIN_STEAMSWITCH));
+
+    #if POWERSWITCHTYPE > 0
+        detachInterrupt(digitalPinToInterrupt(PIN_POWERSWITCH));
+    #endif
+
+    setCpuFrequencyMhz(STANDBY_CPU_FREQUENCY_NORMAL);
+    setStandbyJobPeriods(controlScheduler, false);
+    standbyPowerSave = false;
+
+    debugPrintln("Standby: power saving off");
+}
+
+/**
+ * @brief WiFi modem sleep, switched by the telemetry task
+ */
+void setWifiPowerSave(bool on) {
+    if (on == wifiPowerSave) return;
+
+    wifiPowerSave = on;
+
+    if (on) {
+        wifiSleepType = WiFi.getSleep();
+        WiFi.setSleep(WIFI_PS_MAX_MODEM);
+    } else {
+        WiFi.setSleep(wifiSleepType);
+    }
+}
+
+/**
+ * @brief Called by the telemetry task on every pass, follows the machine state
+ *        of the control state snapshot
+ */
+void updateTelemetryPowerSave() {
+    bool standby = controlState.machineState == kStandby;
+
+    // WiFi belongs to networkSetup() until it is done
+    setWifiPowerSave(standby && connectmode == 1 && networkReady);
+
+    if (standby == telemetryPowerSave) return;
 
-    debugPrintf("Resetting standby timer to %i minutes\n",  (int)standbyModeTime);
-}
\ No newline at end of file
+    telemetryPowerSave = standby;
+
+    #if OLED_DISPLAY != 0 && STANDBY_DISPLAY_OFF == 1
+        u8g2.setPowerSave(standby ? 1 : 0);
+    #endif
+
+    setStandbyJobPeriods(telemetryScheduler, standby);
+}
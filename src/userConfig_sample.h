@@ -38,8 +38,10 @@ enum MACHINE {
 #define SHOTTIMER 1                // 0 = deactivated, 1 = activated 2 = with scale
 #define HEATINGLOGO 0              // 0 = deactivated, 1 = Rancilio, 2 = Gaggia
 #define OFFLINEGLOGO 1             // 0 = deactivated, 1 = activated
+#define STANDBY_DISPLAY_OFF 1      // 1 = switch the display off in standby mode, 0 = keep showing the standby screen
 #define BREWSWITCHDELAY 3000       // time in ms that the brew switch will be delayed (shot timer will show that much longer after switching off)
 #define VERBOSE 0                  // 1 = Show verbose output (serial connection), 0 = show less
+#define HEAP_PROFILER_LOG_SIZE 0   // debugging: log allocations of at least this many bytes with the calling address (decode with addr2line), 0 = off
 
 #define LANGUAGE 0                 // LANGUAGE = 0 (DE), LANGUAGE = 1 (EN), LANGUAGE = 2 (ES)
 
@@ -62,19 +64,27 @@ enum MACHINE {
 #define PINMODEVOLTAGESENSOR INPUT // Mode INPUT_PULLUP, INPUT or INPUT_PULLDOWN_16 (Only Pin 16)
 #define PRESSURESENSOR 0           // 1 = pressure sensor connected
 #define TEMP_LED 1                 // Blink status LED when temp is in range
+#define SHOT_RECORDER_COUNT 10     // number of recorded shots (10 Hz temperature, heater, pressure, weight) kept in flash, see /shots
+#define STANDBY_CPU_FREQUENCY 80   // CPU clock in MHz while in standby mode (80, 160 or 240), WiFi needs at least 80
+
+// Heater
+#define MAINS_FREQUENCY 50         // 50 or 60 Hz, the heater is switched once per mains half wave
+#define HEATER_MODULATION 1        // 0 = one on-block per window, 1 = spread on half waves evenly (sigma-delta, recommended for zero-cross SSRs)
+#define HEATER_ZEROCROSS 0         // 0 = free-running half wave timer, needs a zero-cross SSR, 1 = step on the zero-cross detector on PIN_ZC (any SSR)
+#define HEATER_WINDOW 1000         // modulation window in ms for HEATER_MODULATION 0, must be a multiple of the half wave (10 ms @ 50 Hz, 8.33 ms @ 60 Hz)
 
 // Brew Scale
-#define SCALE_SAMPLES 2                     // Load cell sample rate
+#define SCALE_DRIP_TIME 1.0                 // s, coffee still reaching the cup after the pump stopped, brew by weight stops early by flow * SCALE_DRIP_TIME
 #define SCALE_CALIBRATION_FACTOR 3195.83    // Raw data is divided by this value to convert to readable data
 
 /* Pressure sensor
  *
- * measure and verify "offset" value, should be 10% of ADC bit reading @supply volate (3.3V)
- * same goes for "fullScale", should be 90%
+ * measure and verify the sensor voltage at the ADC pin without pressure (offset),
+ * usually 10% of the 3.3 V supply, the full scale value is usually 90%
  */
-#define OFFSET      102            // 10% of ADC input @3.3V supply = 102
-#define FULLSCALE   922            // 90% of ADC input @3.3V supply = 922
-#define MAXPRESSURE 200
+#define PRESSURE_OFFSET_MV    330  // mV at 0 bar
+#define PRESSURE_FULLSCALE_MV 2970 // mV at MAXPRESSURE
+#define MAXPRESSURE 200            // psi
 
 // PlatformIO OTA
 #define OTA true                   // true = OTA activated, false = OTA deactivated
@@ -90,6 +100,7 @@ enum MACHINE {
 #define MQTT_SERVER_PORT 1883                           // Port of the specified MQTT Server
 #define MQTT_HASSIO_SUPPORT 0                           // Enables the Homeassistant Auto Discovery Feature
 #define MQTT_HASSIO_DISCOVERY_PREFIX "homeassistant"    // Homeassistant Auto Discovery Prefix
+#define MQTT_LOOP_METRICS 0                             // 1 = publish control/telemetry loop runtimes (us) as MQTT sensors
 
 // INFLUXDB
 #define INFLUXDB 0                 // 1 = INFLUX enabled, 0 = INFLUX disabled
@@ -101,12 +112,16 @@ enum MACHINE {
 #define INFLUXDB_USER ""
 #define INFLUXDB_PASSWORD ""
 #define INFLUXDB_DB_NAME "coffee"  // InfluxDB bucket name
-#define INFLUXDB_INTERVAL 5000     // Send interval in milliseconds
+#define INFLUXDB_INTERVAL 1000     // Sample interval in milliseconds
+#define INFLUXDB_FLUSH_INTERVAL 10000  // Samples are sent in batches every this many milliseconds
+#define INFLUXDB_BUFFER_SIZE 300   // Samples kept while InfluxDB can't be reached (36 bytes each), the oldest are dropped first
 #define INFLUXDB_TIMEOUT 5000      // InfluxDB httpReadTimeout
-#define INFLUXDB_RETRIES 50         // Amount of retries to etablish an Influxdb Connection before disabling InfluxDB at all
 
 // PID Parameters (not yet in Web interface)
 #define EMA_FACTOR 0.6             // Smoothing of input that is used for Tv (derivative component of PID). Smaller means less smoothing but also less delay, 0 means no filtering
+#define AUTOTUNE_STEP 150          // Autotune: heater output step in promille above and below the holding output
+#define AUTOTUNE_HYSTERESIS 0.3    // Autotune: heater switches at setpoint +- this many °C, keep it above the sensor noise
+#define AUTOTUNE_SENSOR_LAG 3.0    // Autotune: time constant of the temperature sensor in s, the smallest dead time used for the tunings
 
 #define TEMPSENSOR 2               // Temp sensor type: 1 = DS18B20, 2 = TSIC306
 